@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "analytics.h"
+#include "storage.h"
+#include "json.h"
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+void OnlineMean::add(double x) {
+    ++samples;
+    value += (x - value) / (double)std::min(samples, ANALYTICS_WINDOW);
+}
+
+bool ResponseEpisode::rate(double &out) const {
+    double denom = n * stt - st * st;
+    if (n < 2 || denom <= 0) return false;
+    out = (n * sty - st * sy) / denom;
+    return true;
+}
+
+// Add a point to the episode's regression
+static void fit(ResponseEpisode &e, int64_t ts, float temp) {
+    double t = (double)(ts - e.extreme_ts) / 3600.0;
+    ++e.n;
+    e.st += t;
+    e.sy += temp;
+    e.stt += t * t;
+    e.sty += t * temp;
+    e.fit_end = ts;
+}
+
+void RoomResponse::trigger(HeatState state, int64_t ts) {
+    if (state == HeatState::Idle || state == episode_.state) return;
+    HeatState previous = episode_.state;
+    finish();
+    episode_ = ResponseEpisode();
+    episode_.state = state;
+    episode_.previous = previous;
+    episode_.start = ts;
+    if (!std::isnan(last_temp_) && ts - last_ts_ <= ANALYTICS_MAX_READING_AGE) {
+        episode_.start_temp = episode_.extreme = last_temp_;
+        episode_.extreme_ts = ts;
+    }
+}
+
+void RoomResponse::add(int64_t ts, float temp) {
+    if (std::isnan(temp)) return;
+    last_ts_ = ts;
+    last_temp_ = temp;
+    ResponseEpisode &e = episode_;
+    if (e.state == HeatState::Idle || ts < e.start) return;
+    if (ts - e.start > ANALYTICS_MAX_EPISODE_SECONDS) {
+        finish();
+        episode_ = ResponseEpisode();
+        return;
+    }
+    if (e.responded) {
+        fit(e, ts, temp);
+        return;
+    }
+    if (std::isnan(e.start_temp)) {
+        e.start_temp = e.extreme = temp;
+        e.extreme_ts = ts;
+        return;
+    }
+    // +1 while heating: the temperature is expected to rise
+    float sign = e.state == HeatState::Heating ? 1.0f : -1.0f;
+    float moved = sign * (temp - e.extreme);
+    if (moved < 0) {
+        e.extreme = temp;
+        e.extreme_ts = ts;
+    } else if (moved >= ANALYTICS_RESPONSE_DELTA - 1e-4f) {
+        e.responded = true;
+        e.dead_time = ts - e.start;
+        if (e.previous != HeatState::Idle) stats_of(e.previous).overshoot.add(sign * (e.start_temp - e.extreme));
+        fit(e, e.extreme_ts, e.extreme);
+        fit(e, ts, temp);
+    }
+}
+
+void RoomResponse::finish() {
+    ResponseEpisode &e = episode_;
+    if (e.state == HeatState::Idle) return;
+    ResponseStats &s = stats_of(e.state);
+    ++s.episodes;
+    if (!e.responded) return;
+    s.dead_time.add((double)e.dead_time);
+    double rate;
+    bool spans = e.fit_end - e.extreme_ts >= ANALYTICS_MIN_SPAN_SECONDS;
+    if (e.n >= ANALYTICS_MIN_READINGS && spans && e.rate(rate)) s.rate.add(rate);
+}
+
+RoomModel RoomResponse::model() const {
+    RoomModel m;
+    const ResponseStats &heating = stats(HeatState::Heating), &cooling = stats(HeatState::Cooling);
+    // a rate with the wrong sign (e.g. a window left open while heating) is no model
+    if (heating.rate.samples && heating.rate.value > 0) m.heat_rate = heating.rate.value;
+    if (cooling.rate.samples && cooling.rate.value < 0) m.cool_rate = cooling.rate.value;
+    m.heat_overshoot = std::max(0.0, heating.overshoot.value);
+    m.cool_overshoot = std::max(0.0, cooling.overshoot.value);
+    return m;
+}
+
+// ---- per-room analytics, indexed by the handle of the room's sensor ----
+
+struct AnalyticsEntry {
+    std::mutex mutex;
+    RoomResponse response;
+};
+
+static std::vector<std::unique_ptr<AnalyticsEntry>> rooms;
+static std::shared_mutex rooms_mutex;
+
+void analytics_trigger(const std::string &room, const std::string &type, int64_t ts) {
+    HeatState state;
+    if (type == "low") state = HeatState::Heating;
+    else if (type == "high") state = HeatState::Cooling;
+    else return;
+    // registering the id adds no reading, so the room does not show up as a sensor
+    SensorHandle h = sensor_registry.intern(sanitize_id(room));
+    {
+        std::shared_lock<std::shared_mutex> lk(rooms_mutex);
+        if (h < rooms.size() && rooms[h]) {
+            AnalyticsEntry &e = *rooms[h];
+            std::lock_guard<std::mutex> elk(e.mutex);
+            e.response.trigger(state, ts);
+            return;
+        }
+    }
+    // a room's first trigger: start from the sensor's latest reading
+    SensorReading last;
+    bool has_last = sensor_registry.get(h, last);
+    std::unique_lock<std::shared_mutex> lk(rooms_mutex);
+    if (rooms.size() <= h) rooms.resize(h + 1);
+    if (!rooms[h]) {
+        rooms[h] = std::make_unique<AnalyticsEntry>();
+        if (has_last) rooms[h]->response.add(last.timestamp, last.temp);
+    }
+    rooms[h]->response.trigger(state, ts);
+}
+
+void analytics_add(SensorHandle h, const SensorReading &reading) {
+    if (std::isnan(reading.temp)) return;
+    std::shared_lock<std::shared_mutex> lk(rooms_mutex);
+    if (h >= rooms.size() || !rooms[h]) return;
+    AnalyticsEntry &e = *rooms[h];
+    std::lock_guard<std::mutex> elk(e.mutex);
+    e.response.add(reading.timestamp, reading.temp);
+}
+
+bool analytics_model(std::string_view room, RoomModel &out) {
+    SensorHandle h = sensor_registry.find(room);
+    if (h == INVALID_SENSOR) return false;
+    std::shared_lock<std::shared_mutex> lk(rooms_mutex);
+    if (h >= rooms.size() || !rooms[h]) return false;
+    AnalyticsEntry &e = *rooms[h];
+    std::lock_guard<std::mutex> elk(e.mutex);
+    out = e.response.model();
+    return true;
+}
+
+static void write_mean(JsonWriter &w, const char *key, const OnlineMean &m, double scale) {
+    w.key(key);
+    if (m.samples == 0) w.value_null();
+    else w.value_number(std::round(m.value * scale) / scale);
+}
+
+static void write_stats(JsonWriter &w, const ResponseStats &s) {
+    w.begin_object();
+    w.key("episodes");
+    w.value_int((long long)s.episodes);
+    write_mean(w, "rate", s.rate, 100);
+    write_mean(w, "dead_time", s.dead_time, 1);
+    write_mean(w, "overshoot", s.overshoot, 100);
+    w.end_object();
+}
+
+std::string analytics_json(const std::string &room) {
+    std::string id = sanitize_id(room);
+    SensorHandle h = sensor_registry.find(id);
+    if (h == INVALID_SENSOR) return std::string();
+    ResponseStats heating, cooling;
+    ResponseEpisode episode;
+    {
+        std::shared_lock<std::shared_mutex> lk(rooms_mutex);
+        if (h >= rooms.size() || !rooms[h]) return std::string();
+        AnalyticsEntry &e = *rooms[h];
+        std::lock_guard<std::mutex> elk(e.mutex);
+        heating = e.response.stats(HeatState::Heating);
+        cooling = e.response.stats(HeatState::Cooling);
+        episode = e.response.episode();
+    }
+
+    std::string out;
+    JsonWriter w(out);
+    w.begin_object();
+    w.key("room");
+    w.value_string(id);
+    w.key("heating");
+    write_stats(w, heating);
+    w.key("cooling");
+    write_stats(w, cooling);
+    w.key("episode");
+    if (episode.state == HeatState::Idle) {
+        w.value_null();
+    } else {
+        double rate;
+        w.begin_object();
+        w.key("state");
+        w.value_string(heat_state_name(episode.state));
+        w.key("since");
+        w.value_int(episode.start);
+        w.key("dead_time");
+        if (episode.responded) w.value_int(episode.dead_time);
+        else w.value_null();
+        w.key("rate");
+        if (episode.rate(rate)) w.value_number(std::round(rate * 100) / 100);
+        else w.value_null();
+        w.key("readings");
+        w.value_int(episode.n);
+        w.end_object();
+    }
+    w.end_object();
+    return out;
+}
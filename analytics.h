@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef ANALYTICS_H
+#define ANALYTICS_H
+
+#include "sensor_registry.h"
+#include "thermostat.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Heating-rate analytics. Every high or low trigger logged for a room starts an episode
+// (cooling or heating); the room's following readings are folded into it as they
+// arrive, in O(1) each, until the opposite trigger or ANALYTICS_MAX_EPISODE_SECONDS:
+//   - dead time: seconds from the trigger until the temperature has moved
+//     ANALYTICS_RESPONSE_DELTA from its extreme in the expected direction
+//   - overshoot: how far the temperature kept moving the old way after the trigger
+//     (credited to the previous episode's direction)
+//   - rate: least-squares slope in °C/hour of the readings from that extreme on
+// A finished episode updates its direction's estimates: plain means over the first
+// ANALYTICS_WINDOW episodes, then exponentially weighted, so they follow the seasons.
+
+// Temperature change that counts as the room responding (twice the sensor resolution)
+constexpr float ANALYTICS_RESPONSE_DELTA = 0.2f;
+// An episode without an opposite trigger ends after this long
+constexpr int64_t ANALYTICS_MAX_EPISODE_SECONDS = 12 * 3600;
+// A reading older than this at the trigger is not used as the starting temperature
+constexpr int64_t ANALYTICS_MAX_READING_AGE = 1800;
+// Minimum regression span and readings for an episode's rate to count
+constexpr int64_t ANALYTICS_MIN_SPAN_SECONDS = 600;
+constexpr uint32_t ANALYTICS_MIN_READINGS = 3;
+// Episodes averaged before the estimates become exponentially weighted (1/N)
+constexpr uint64_t ANALYTICS_WINDOW = 20;
+
+// Mean of the first ANALYTICS_WINDOW samples, then an exponential moving average
+struct OnlineMean {
+    uint64_t samples = 0;
+    double value = 0;
+    void add(double x);
+};
+
+// Estimates of one direction (heating or cooling)
+struct ResponseStats {
+    uint64_t episodes = 0;  // finished episodes
+    OnlineMean rate;        // °C per hour (negative while cooling)
+    OnlineMean dead_time;   // seconds
+    OnlineMean overshoot;   // °C past the temperature at the trigger that ended it
+};
+
+// The episode in progress
+struct ResponseEpisode {
+    HeatState state = HeatState::Idle;  // Idle: none
+    HeatState previous = HeatState::Idle;
+    int64_t start = 0;                  // trigger time
+    float start_temp = NAN;
+    float extreme = NAN;                // furthest the wrong way so far
+    int64_t extreme_ts = 0;
+    bool responded = false;
+    int64_t dead_time = 0;
+    // regression sums over (hours since extreme_ts, temp), up to the reading at fit_end
+    uint32_t n = 0;
+    double st = 0, sy = 0, stt = 0, sty = 0;
+    int64_t fit_end = 0;
+
+    // Current slope in °C/hour; false with fewer than two readings
+    bool rate(double &out) const;
+};
+
+// Analytics of one room. Not thread-safe.
+class RoomResponse {
+public:
+    // A trigger switched the room to `state` (Heating: low URL, Cooling: high URL) at
+    // `ts`. A repeat of the current state (a re-assert) continues the episode.
+    void trigger(HeatState state, int64_t ts);
+    // A reading of the room's sensor
+    void add(int64_t ts, float temp);
+
+    const ResponseStats &stats(HeatState state) const { return stats_[state == HeatState::Cooling]; }
+    const ResponseEpisode &episode() const { return episode_; }
+    // The learned estimates as a thermostat model (unknown parts left at 0)
+    RoomModel model() const;
+
+private:
+    void finish();
+    ResponseStats &stats_of(HeatState state) { return stats_[state == HeatState::Cooling]; }
+
+    ResponseStats stats_[2];  // heating, cooling
+    ResponseEpisode episode_;
+    int64_t last_ts_ = 0;
+    float last_temp_ = NAN;
+};
+
+// Correlate a logged trigger of `room` ("high" or "low"; other types are ignored)
+void analytics_trigger(const std::string &room, const std::string &type, int64_t ts);
+// Feed a reading of sensor `h` to its room's episode (no-op before the room's first trigger)
+void analytics_add(SensorHandle h, const SensorReading &reading);
+// Learned model of `room` (already sanitized); false if it never had a trigger
+bool analytics_model(std::string_view room, RoomModel &out);
+// JSON for GET /analytics/<room>: {"room":..,"heating":{..},"cooling":{..},"episode":{..}}.
+// Empty if the room never had a trigger.
+std::string analytics_json(const std::string &room);
+
+#endif // ANALYTICS_H
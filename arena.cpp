@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "arena.h"
+#include <algorithm>
+#include <cstring>
+
+Arena::Arena(size_t block_bytes) {
+    blocks_.push_back(Block{std::make_unique<char[]>(block_bytes), block_bytes});
+    enter_block(0);
+}
+
+void Arena::enter_block(size_t index) {
+    block_ = index;
+    base_ = blocks_[index].data.get();
+    size_ = blocks_[index].size;
+    used_ = 0;
+}
+
+// The current block is full: move on to the next kept block that fits, or add one
+// twice the size of the last (at least `n` plus alignment)
+void *Arena::allocate_slow(size_t n, size_t align) {
+    for (size_t i = block_ + 1; i < blocks_.size(); ++i) {
+        if (blocks_[i].size >= n) {
+            enter_block(i);
+            return allocate(n, align);
+        }
+    }
+    size_t size = std::max(blocks_.back().size * 2, n + align);
+    blocks_.push_back(Block{std::make_unique<char[]>(size), size});
+    enter_block(blocks_.size() - 1);
+    return allocate(n, align);
+}
+
+std::string_view Arena::copy(std::string_view s) {
+    char *p = static_cast<char *>(allocate(s.size(), 1));
+    if (!s.empty()) std::memcpy(p, s.data(), s.size());
+    return std::string_view(p, s.size());
+}
+
+void Arena::rewind(Mark m) {
+    block_ = m.block;
+    base_ = blocks_[m.block].data.get();
+    size_ = blocks_[m.block].size;
+    used_ = m.used;
+}
+
+size_t Arena::capacity() const {
+    size_t total = 0;
+    for (const Block &b : blocks_) total += b.size;
+    return total;
+}
+
+Arena &request_arena() {
+    static thread_local Arena arena;
+    return arena;
+}
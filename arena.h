@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Bump allocator for data that lives no longer than one request. An allocation advances
+// an offset in the current block; memory is given back all at once by rewinding to a
+// mark. Blocks are kept when rewound, so once they have grown to fit the largest request
+// seen, requests are served without touching the heap. Not thread-safe: each thread uses
+// its own (request_arena()).
+class Arena {
+public:
+    explicit Arena(size_t block_bytes = 16384);
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    // `align` must be a power of two no larger than alignof(std::max_align_t)
+    void *allocate(size_t n, size_t align = alignof(std::max_align_t)) {
+        size_t off = (used_ + align - 1) & ~(align - 1);
+        if (off <= size_ && n <= size_ - off) {
+            used_ = off + n;
+            return base_ + off;
+        }
+        return allocate_slow(n, align);
+    }
+    // Copy of `s` in the arena
+    std::string_view copy(std::string_view s);
+
+    struct Mark {
+        size_t block;
+        size_t used;
+    };
+    Mark mark() const { return Mark{block_, used_}; }
+    // Release everything allocated since `m` was taken (the blocks are kept)
+    void rewind(Mark m);
+    // Bytes held in blocks
+    size_t capacity() const;
+
+private:
+    void *allocate_slow(size_t n, size_t align);
+    void enter_block(size_t index);
+
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+    std::vector<Block> blocks_;
+    size_t block_ = 0;       // index of the current block
+    char *base_ = nullptr;   // its data
+    size_t size_ = 0;        // its size
+    size_t used_ = 0;        // bytes of it handed out
+};
+
+// Rewinds an arena to where it was when the scope was entered
+class ArenaScope {
+public:
+    explicit ArenaScope(Arena &arena) : arena_(arena), mark_(arena.mark()) {}
+    ~ArenaScope() { arena_.rewind(mark_); }
+    ArenaScope(const ArenaScope &) = delete;
+    ArenaScope &operator=(const ArenaScope &) = delete;
+
+private:
+    Arena &arena_;
+    Arena::Mark mark_;
+};
+
+// Standard allocator over an arena; deallocation is a no-op (the scope frees everything)
+template <typename T>
+struct ArenaAllocator {
+    using value_type = T;
+
+    explicit ArenaAllocator(Arena &a) noexcept : arena(&a) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) noexcept : arena(other.arena) {}
+
+    T *allocate(size_t n) { return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T *, size_t) noexcept {}
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U> &other) const noexcept { return arena == other.arena; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U> &other) const noexcept { return arena != other.arena; }
+
+    Arena *arena;
+};
+
+// Containers for request-lifetime data
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+using ArenaString = std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
+
+// The calling thread's arena for data of the request it is serving
+Arena &request_arena();
+
+#endif // ARENA_H
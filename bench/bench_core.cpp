@@ -0,0 +1,233 @@
+// bench_core.cpp
+// Micro-benchmarks of the request and storage hot paths at synthetic scales of 10 to
+// 100k sensors and rooms: ns/op, heap allocations/op and throughput (items/s).
+// Build and run: make bench (or ./bench/run_bench [--json] [--max-scale <n>])
+
+#include "../http.h"
+#include "../http_parser.h"
+#include "../json.h"
+#include "../storage.h"
+#include "../storage_json.h"
+#include "../history.h"
+#include "../history_store.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+using bench_clock = std::chrono::steady_clock;
+
+// ---- allocation counting: every operator new of the process goes through here ----
+
+static std::atomic<uint64_t> allocations(0);
+
+void *operator new(size_t n) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+void *operator new[](size_t n) { return operator new(n); }
+void *operator new(size_t n, const std::nothrow_t &) noexcept {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(n ? n : 1);
+}
+void *operator new[](size_t n, const std::nothrow_t &t) noexcept { return operator new(n, t); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+
+// ---- harness ----
+
+struct Result {
+    std::string name;
+    size_t scale;          // sensors or rooms (1 for per-request cases)
+    double ns_per_op;
+    double allocs_per_op;
+    double items_per_sec;  // ops/s times the items one op handles
+};
+
+static std::vector<Result> results;
+static volatile size_t sink;  // keeps results observable
+
+// Run `fn` (one op, handling `items` items) for about a quarter of a second
+template <typename Fn>
+static void measure(const char *name, size_t scale, size_t items, Fn fn) {
+    sink = sink + fn();  // warm-up
+    uint64_t iters = 1;
+    double elapsed;
+    uint64_t allocs;
+    while (true) {
+        uint64_t a0 = allocations.load(std::memory_order_relaxed);
+        auto start = bench_clock::now();
+        size_t acc = 0;
+        for (uint64_t i = 0; i < iters; ++i) acc += fn();
+        elapsed = std::chrono::duration<double>(bench_clock::now() - start).count();
+        allocs = allocations.load(std::memory_order_relaxed) - a0;
+        sink = sink + acc;
+        if (elapsed >= 0.25 || iters >= (1u << 26)) break;
+        double grow = elapsed > 0 ? 0.3 / elapsed : 100;
+        iters = (uint64_t)((double)iters * std::min(100.0, std::max(2.0, grow)));
+    }
+    double ns = elapsed * 1e9 / (double)iters;
+    results.push_back({name, scale, ns, (double)allocs / (double)iters, (double)items * 1e9 / ns});
+}
+
+// ---- fixtures ----
+
+static const std::string query = "sensor=living-room&temp=21.5&hum=45.2&batt=3.71";
+static const std::string encoded = "when=avg%28bed-left.temp%2C+bed-right.temp%29+%3C+20+and+window.age+%3C+900";
+static const std::string request =
+    "GET /saveSensorInformation?sensor=living-room&temp=21.5&hum=45.2&batt=3.71 HTTP/1.1\r\n"
+    "Host: 10.0.0.1:8080\r\nUser-Agent: Shelly/1.4.4\r\nAccept: */*\r\n\r\n";
+static const std::string url = "http://relay.local/rpc/Switch.Set?id=0&on=\"true\"&note=tab\there";
+
+static std::string room_name(size_t i) { return "room-" + std::to_string(i); }
+static std::string sensor_name(size_t i) { return "sensor-" + std::to_string(i); }
+
+static void write_settings_file(size_t rooms) {
+    std::string s;
+    JsonWriter w(s);
+    w.begin_object();
+    for (size_t i = 0; i < rooms; ++i) {
+        w.key(room_name(i));
+        w.begin_object();
+        w.key("desired");
+        w.value_number(20.5 + (double)(i % 5) * 0.5);
+        w.key("high");
+        w.value_string("http://relay-" + std::to_string(i) + ".local/rpc/Switch.Set?id=0&on=false");
+        w.key("low");
+        w.value_string("http://relay-" + std::to_string(i) + ".local/rpc/Switch.Set?id=0&on=true");
+        w.key("hysteresis");
+        w.value_number(0.3);
+        w.end_object();
+    }
+    w.end_object();
+    std::ofstream(SETTINGS_JSON_FILE, std::ios::trunc) << s;
+}
+
+// Grow the registry to `sensors` sensors (names are shared between scales)
+static void fill_registry(size_t sensors) {
+    SensorReading r;
+    r.timestamp = 1760000000;
+    for (size_t i = sensor_registry.size(); i < sensors; ++i) {
+        r.temp = 18.0f + (float)(i % 70) * 0.1f;
+        r.hum = 40.0f + (float)(i % 20);
+        r.batt = 3.7f;
+        sensor_registry.update(sensor_registry.intern(sensor_name(i)), r);
+    }
+}
+
+// ---- output ----
+
+static void print_table() {
+    std::printf("%-26s %8s %14s %12s %16s\n", "case", "scale", "ns/op", "allocs/op", "items/s");
+    for (const Result &r : results) {
+        std::printf("%-26s %8zu %14.1f %12.2f %16.0f\n", r.name.c_str(), r.scale, r.ns_per_op, r.allocs_per_op,
+                    r.items_per_sec);
+    }
+}
+
+static void print_json() {
+    std::string out;
+    JsonWriter w(out);
+    w.begin_array();
+    for (const Result &r : results) {
+        w.begin_object();
+        w.key("name");
+        w.value_string(r.name);
+        w.key("scale");
+        w.value_int((long long)r.scale);
+        w.key("ns_per_op");
+        w.value_number(r.ns_per_op);
+        w.key("allocs_per_op");
+        w.value_number(r.allocs_per_op);
+        w.key("items_per_sec");
+        w.value_number(r.items_per_sec);
+        w.end_object();
+    }
+    w.end_array();
+    std::printf("%s\n", out.c_str());
+}
+
+int main(int argc, char **argv) {
+    bool json = false;
+    size_t max_scale = 100000;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (std::strcmp(argv[i], "--max-scale") == 0 && i + 1 < argc) {
+            max_scale = std::strtoul(argv[++i], nullptr, 10);
+        } else {
+            std::fprintf(stderr, "Usage: %s [--json] [--max-scale <n>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // everything the benchmarks write stays in a scratch directory; no WAL, no history
+    fs::path dir = fs::temp_directory_path() / ("shelly_bench_" + std::to_string(::getpid()));
+    fs::create_directories(dir);
+    SETTINGS_JSON_FILE = (dir / "settings.json").string();
+    SENSOR_DATA_JSON_FILE = (dir / "sensor_data.json").string();
+    HISTORY_DIR = "";
+    HISTORY_SAMPLES.store(0);
+
+    // per-request cases
+    measure("parse_query", 1, 1, [] { return parse_query(query).size(); });
+    measure("QueryParams", 1, 1, [] {
+        ArenaScope scope(request_arena());
+        QueryParams params(query, request_arena());
+        return params.find("temp") ? (size_t)1 : 0;
+    });
+    measure("url_decode", 1, 1, [] { return url_decode(encoded).size(); });
+    measure("parse_request_line", 1, 1, [] { return parse_request_line(request).path.size(); });
+    measure("HttpParser::parse", 1, 1, [] {
+        HttpParser p;
+        return p.parse(request) == HttpParser::Result::Complete ? p.request().path.size() : 0;
+    });
+    measure("json_escape", 1, 1, [] { return json_escape(url).size(); });
+    // a reading end to end, from the connection buffer to the queued response
+    std::string out;
+    measure("saveSensorInformation", 1, 1, [&] {
+        HttpParser p;
+        p.parse(request);
+        out.clear();
+        process_request(p.request(), out, true, 5, 100);
+        return out.size();
+    });
+
+    // cases over the settings and the sensors
+    for (size_t scale = 10; scale <= max_scale; scale *= 10) {
+        write_settings_file(scale);
+        std::map<std::string, RoomSettings> rooms;
+        measure("read_settings_map", scale, scale, [&] {
+            read_settings_map(rooms);
+            return rooms.size();
+        });
+
+        fill_registry(scale);
+        measure("all_sensors_json", scale, scale, [] { return all_sensors_json().size(); });
+        std::vector<std::string> ids;
+        for (size_t i = 0; i < 64; ++i) ids.push_back(sensor_name(i * 7919 % scale));
+        size_t next = 0;
+        measure("read_sensor_data", scale, 1, [&] { return read_sensor_data(ids[next++ % ids.size()]).size(); });
+        measure("flush_readings_to_disk", scale, scale, [] {
+            flush_readings_to_disk();
+            return (size_t)1;
+        });
+    }
+
+    fs::remove_all(dir);
+    if (json) print_json();
+    else print_table();
+    return 0;
+}
@@ -0,0 +1,195 @@
+// bench_json.cpp
+// Compares the streaming JSON reader against the previous ad-hoc parsers
+// (substr-based key scanner for sensor_data.json, regex-based settings reader).
+// Build and run: make bench/run_bench_json && ./bench/run_bench_json
+
+#include "../json.h"
+#include "../storage.h"
+#include <chrono>
+#include <cstdio>
+#include <cctype>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <regex>
+#include <string>
+#include <tuple>
+
+using bench_clock = std::chrono::steady_clock;
+
+template <typename Fn>
+static double time_ms(Fn fn, int reps) {
+    auto start = bench_clock::now();
+    for (int i = 0; i < reps; ++i) fn();
+    return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count() / reps;
+}
+
+// ---- previous implementation (copied from storage_json.cpp before the rewrite) ----
+
+static bool legacy_extract_json_value_at(const std::string &s, size_t pos, std::string &out, size_t &new_pos) {
+    while (pos < s.size() && std::isspace((unsigned char)s[pos])) ++pos;
+    if (pos >= s.size()) return false;
+    char c = s[pos];
+    if (c == '{' || c == '[') {
+        char open = c;
+        char close = (c == '{') ? '}' : ']';
+        size_t i = pos;
+        int depth = 0;
+        while (i < s.size()) {
+            char ch = s[i];
+            if (ch == '"') {
+                ++i;
+                while (i < s.size()) {
+                    if (s[i] == '\\') { i += 2; continue; }
+                    if (s[i] == '"') { ++i; break; }
+                    ++i;
+                }
+                continue;
+            } else if (ch == open) {
+                ++depth;
+            } else if (ch == close) {
+                --depth;
+                if (depth == 0) { ++i; break; }
+            }
+            ++i;
+        }
+        if (depth != 0) return false;
+        out = s.substr(pos, i - pos);
+        new_pos = i;
+        return true;
+    }
+    size_t i = pos;
+    while (i < s.size() && s[i] != ',' && s[i] != '}' && s[i] != ']') ++i;
+    if (i == pos) return false;
+    out = s.substr(pos, i - pos);
+    new_pos = i;
+    return true;
+}
+
+static size_t legacy_scan_sensors(const std::string &s) {
+    size_t count = 0;
+    size_t obj_start = s.find('{');
+    if (obj_start == std::string::npos) return 0;
+    size_t pos = obj_start + 1;
+    while (pos < s.size()) {
+        while (pos < s.size() && (std::isspace((unsigned char)s[pos]) || s[pos] == ',')) ++pos;
+        if (pos >= s.size() || s[pos] != '"') break;
+        size_t key_start = pos + 1;
+        size_t i = key_start;
+        while (i < s.size()) {
+            if (s[i] == '\\') { i += 2; continue; }
+            if (s[i] == '"') break;
+            ++i;
+        }
+        if (i >= s.size()) break;
+        std::string key = s.substr(key_start, i - key_start);
+        pos = i + 1;
+        while (pos < s.size() && std::isspace((unsigned char)s[pos])) ++pos;
+        if (pos >= s.size() || s[pos] != ':') break;
+        ++pos;
+        std::string val; size_t val_end;
+        if (!legacy_extract_json_value_at(s, pos, val, val_end)) break;
+        count += !key.empty() && !val.empty();
+        pos = val_end;
+    }
+    return count;
+}
+
+static size_t legacy_read_settings(const std::string &s) {
+    std::map<std::string, std::tuple<std::optional<double>, std::string, std::string>> out;
+    std::regex entry_re(R"RE("([^"]+)"\s*:\s*\{([^}]*)\})RE");
+    for (auto it = std::sregex_iterator(s.begin(), s.end(), entry_re); it != std::sregex_iterator(); ++it) {
+        std::string body = (*it)[2].str();
+        std::optional<double> desired;
+        std::string high, low;
+        std::smatch sub;
+        if (std::regex_search(body, sub, std::regex(R"RE("desired"\s*:\s*(null|[-0-9.+eE]+))RE"))) {
+            if (sub[1].str() != "null") desired = std::stod(sub[1].str());
+        }
+        if (std::regex_search(body, sub, std::regex(R"RE("high"\s*:\s*"([^"]*)")RE"))) high = sub[1].str();
+        if (std::regex_search(body, sub, std::regex(R"RE("low"\s*:\s*"([^"]*)")RE"))) low = sub[1].str();
+        out[(*it)[1].str()] = std::make_tuple(desired, high, low);
+    }
+    return out.size();
+}
+
+// ---- new implementation ----
+
+static size_t stream_scan_sensors(const std::string &s) {
+    size_t count = 0;
+    JsonReader r(s);
+    if (!r.begin_object()) return 0;
+    std::string scratch;
+    std::string_view key, raw;
+    while (r.next_key(key, scratch)) {
+        if (!r.skip_value(&raw)) break;
+        count += !key.empty() && !raw.empty();
+    }
+    return count;
+}
+
+// ---- synthetic inputs ----
+
+static std::string make_sensor_file(int n) {
+    std::string s;
+    JsonWriter w(s);
+    w.begin_object();
+    for (int i = 0; i < n; ++i) {
+        std::string id = "sensor_" + std::to_string(i);
+        w.key(id);
+        w.begin_object();
+        w.key("timestamp"); w.value_string("2026-01-01 12:00:00");
+        w.key("sensor"); w.value_string(id);
+        w.key("temp"); w.value_string("21.5");
+        w.key("hum"); w.value_string("48");
+        w.key("batt"); w.value_string("87");
+        w.end_object();
+    }
+    w.end_object();
+    return s;
+}
+
+static std::string make_settings_file(int n) {
+    std::string s;
+    JsonWriter w(s);
+    w.begin_object();
+    for (int i = 0; i < n; ++i) {
+        w.key("room_" + std::to_string(i));
+        w.begin_object();
+        w.key("desired"); w.value_number(20.5);
+        w.key("high"); w.value_string("http://heater.local/relay/0?turn=off");
+        w.key("low"); w.value_string("http://heater.local/relay/0?turn=on");
+        w.end_object();
+    }
+    w.end_object();
+    return s;
+}
+
+int main() {
+    std::printf("%-28s %8s %12s %12s %8s\n", "case", "entries", "legacy ms", "stream ms", "speedup");
+
+    for (int n : {1000, 10000, 100000}) {
+        std::string s = make_sensor_file(n);
+        int reps = n >= 100000 ? 3 : 20;
+        size_t a = 0, b = 0;
+        double legacy = time_ms([&]{ a = legacy_scan_sensors(s); }, reps);
+        double stream = time_ms([&]{ b = stream_scan_sensors(s); }, reps);
+        if (a != b) std::fprintf(stderr, "mismatch: %zu vs %zu\n", a, b);
+        std::printf("%-28s %8d %12.3f %12.3f %7.1fx\n", "sensor_data.json scan", n, legacy, stream, legacy / stream);
+    }
+
+    SETTINGS_JSON_FILE = "bench_settings.json";
+    for (int n : {100, 1000, 5000}) {
+        std::string s = make_settings_file(n);
+        { std::ofstream(SETTINGS_JSON_FILE, std::ios::trunc) << s; }
+        int reps = n >= 5000 ? 2 : 10;
+        size_t a = 0;
+        std::map<std::string, RoomSettings> m;
+        double legacy = time_ms([&]{ a = legacy_read_settings(s); }, reps);
+        double stream = time_ms([&]{ read_settings_map(m); }, reps);
+        if (a != m.size()) std::fprintf(stderr, "mismatch: %zu vs %zu\n", a, m.size());
+        std::printf("%-28s %8d %12.3f %12.3f %7.1fx\n", "settings.json load", n, legacy, stream, legacy / stream);
+    }
+    std::remove(SETTINGS_JSON_FILE.c_str());
+    return 0;
+}
@@ -0,0 +1,114 @@
+// bench_preheat.cpp
+// Simulates a radiator-heated room reporting through a sparse sensor and compares the
+// reactive hysteresis controller with predictive mode (thermostat_predict fed by the
+// learned RoomResponse): relay switches, and time and degree-minutes outside the band.
+// Build and run: make bench/run_bench_preheat && ./bench/run_bench_preheat
+
+#include "../thermostat.h"
+#include "../analytics.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+
+// Room: heat loss to the outside, radiator power reaching the air through a dead time
+// and a first-order lag (the water and the radiator body warming up or cooling down).
+struct RoomSim {
+    double outside = 5.0;     // °C
+    double loss = 0.15;       // 1/hour
+    double gain = 6.0;        // °C/hour at full radiator output
+    double lag_hours = 0.4;   // radiator time constant
+    int dead_steps;           // valve to radiator delay, in steps
+    double temp = 19.0;
+    double output = 0;        // radiator output, 0..1
+    std::deque<bool> valve;   // commands on their way to the radiator
+
+    explicit RoomSim(int dead) : dead_steps(dead), valve(dead, false) {}
+
+    void step(bool heating, double dt_hours) {
+        valve.push_back(heating);
+        bool on = valve.front();
+        valve.pop_front();
+        output += ((on ? 1.0 : 0.0) - output) * std::min(1.0, dt_hours / lag_hours);
+        temp += (gain * output - loss * (temp - outside)) * dt_hours;
+    }
+};
+
+struct Result {
+    int switches = 0;
+    double minutes_outside = 0;
+    double degree_minutes = 0;
+    double max_over = 0, max_under = 0;
+};
+
+static Result run(bool predictive) {
+    const int64_t step = 10, duration = 14 * 24 * 3600, report_every = 600;
+    const double desired = 21.0;
+    ThermostatParams p;
+    p.hysteresis = 0.3;
+    p.min_dwell_seconds = DEFAULT_MIN_DWELL_SECONDS;
+    p.reassert_seconds = 0;
+    ThermostatState st;
+    RoomResponse response;
+    RoomSim room(30);  // 5 minutes of dead time
+    Result r;
+    HeatState pending = HeatState::Idle, pending_from = HeatState::Idle;
+    int64_t pending_at = 0;
+
+    auto fire = [&](HeatState s, int64_t now) {
+        ++r.switches;
+        response.trigger(s, now);
+    };
+    for (int64_t now = 0; now < duration; now += step) {
+        if (pending != HeatState::Idle && now >= pending_at) {
+            if (st.state == pending_from) {
+                thermostat_force(st, pending, now);
+                fire(pending, now);
+            }
+            pending = HeatState::Idle;
+        }
+        if (now % report_every == 0) {
+            // 0.1 °C resolution, like the Shelly H&T
+            float reading = (float)(std::round(room.temp * 10) / 10);
+            response.add(now, reading);
+            HeatState s = thermostat_step(p, st, desired, reading, now);
+            if (s != HeatState::Idle) fire(s, now);
+            if (predictive) {
+                int64_t when;
+                HeatState next = thermostat_predict(p, st, desired, response.model(), reading, now, when);
+                pending = HeatState::Idle;
+                if (next != HeatState::Idle && when <= now) {
+                    thermostat_force(st, next, now);
+                    fire(next, now);
+                } else if (next != HeatState::Idle) {
+                    pending = next;
+                    pending_from = st.state;
+                    pending_at = when;
+                }
+            }
+        }
+        room.step(st.state == HeatState::Heating, step / 3600.0);
+        // skip the first day: the model is still learning and the room warming up
+        if (now < 24 * 3600) continue;
+        double over = room.temp - (desired + p.hysteresis), under = (desired - p.hysteresis) - room.temp;
+        double out = std::max(over, under);
+        if (out > 0) {
+            r.minutes_outside += step / 60.0;
+            r.degree_minutes += out * step / 60.0;
+        }
+        r.max_over = std::max(r.max_over, over);
+        r.max_under = std::max(r.max_under, under);
+    }
+    return r;
+}
+
+int main() {
+    std::printf("14 simulated days, band 21.0 +- 0.3, readings every 10 min, 5 min dead time\n");
+    std::printf("%-11s %9s %16s %14s %10s %10s\n", "mode", "switches", "min outside", "degree-min", "max over", "max under");
+    for (bool predictive : {false, true}) {
+        Result r = run(predictive);
+        std::printf("%-11s %9d %16.0f %14.1f %10.2f %10.2f\n", predictive ? "predictive" : "reactive", r.switches,
+                    r.minutes_outside, r.degree_minutes, r.max_over, r.max_under);
+    }
+    return 0;
+}
@@ -0,0 +1,590 @@
+// loadgen.cpp
+// Closed-loop load generator: a fleet of simulated Shelly H&T sensors sending readings
+// at a fixed interval, mixed with dashboard polls (/sensors, /triggers) and settings
+// writes. Each room's trigger URLs point at an HTTP stub in this process, so the server
+// runs its trigger dispatcher against a real (local) relay. Reports throughput and
+// p50/p99/p999 latency per request kind.
+// Build and run: make loadgen (or ./bench/loadgen [options] [-- server options])
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+using lg_clock = std::chrono::steady_clock;
+
+// ---- options ----
+
+struct Options {
+    size_t sensors = 1000;
+    size_t buildings = 1;
+    double interval = 60;      // seconds between two readings of one sensor; 0 = as fast as possible
+    double polls = 1;          // dashboard polls per second (alternating /sensors and /triggers)
+    double writes = 0.2;       // settings writes per second
+    size_t connections = 16;
+    double duration = 30;      // seconds
+    std::string server = "./server";
+    std::string target;        // host:port of a running server instead of starting one
+    std::vector<std::string> server_args;
+    bool json = false;
+};
+
+static Options opt;
+
+// ---- minimal blocking HTTP/1.1 client with keep-alive ----
+
+static sockaddr_storage target_addr;
+static socklen_t target_addrlen = 0;
+static std::string target_host;
+
+static bool resolve_target(const std::string &host, const std::string &port) {
+    addrinfo hints{}, *res = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || !res) return false;
+    std::memcpy(&target_addr, res->ai_addr, res->ai_addrlen);
+    target_addrlen = res->ai_addrlen;
+    freeaddrinfo(res);
+    target_host = host + ":" + port;
+    return true;
+}
+
+class Client {
+public:
+    ~Client() { close_conn(); }
+
+    // Send `request` and read the response; returns the status code, 0 on failure.
+    // A reused connection the server closed while idle is reopened and the request resent.
+    int roundtrip(const std::string &request) {
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            bool reused = fd_ >= 0;
+            if (!reused && !open_conn()) return 0;
+            bool got_bytes = false;
+            int status = send_and_read(request, got_bytes);
+            if (status > 0) return status;
+            close_conn();
+            if (!reused || got_bytes) return 0;
+        }
+        return 0;
+    }
+
+private:
+    bool open_conn() {
+        fd_ = ::socket(target_addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd_ < 0) return false;
+        int one = 1;
+        setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        timeval tv{10, 0};
+        setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd_, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        if (::connect(fd_, (const sockaddr *)&target_addr, target_addrlen) != 0) {
+            close_conn();
+            return false;
+        }
+        buf_.clear();
+        return true;
+    }
+
+    void close_conn() {
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = -1;
+    }
+
+    int send_and_read(const std::string &request, bool &got_bytes) {
+        size_t sent = 0;
+        while (sent < request.size()) {
+            ssize_t n = ::send(fd_, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) return 0;
+            sent += (size_t)n;
+        }
+        // headers
+        size_t header_end;
+        while ((header_end = buf_.find("\r\n\r\n")) == std::string::npos) {
+            if (!fill()) return 0;
+            got_bytes = true;
+        }
+        got_bytes = true;
+        int status = 0;
+        if (buf_.compare(0, 9, "HTTP/1.1 ") == 0 || buf_.compare(0, 9, "HTTP/1.0 ") == 0) status = std::atoi(buf_.c_str() + 9);
+        if (status < 100) return 0;
+        std::string headers = buf_.substr(0, header_end);
+        for (char &ch : headers) ch = (char)std::tolower((unsigned char)ch);
+        size_t length = 0;
+        size_t cl = headers.find("\r\ncontent-length:");
+        if (cl != std::string::npos) length = std::strtoul(headers.c_str() + cl + 17, nullptr, 10);
+        bool close_after = headers.find("\r\nconnection: close") != std::string::npos;
+        // body
+        size_t total = header_end + 4 + length;
+        while (buf_.size() < total) {
+            if (!fill()) return 0;
+        }
+        buf_.erase(0, total);
+        if (close_after) close_conn();
+        return status;
+    }
+
+    bool fill() {
+        char tmp[16384];
+        ssize_t n = ::recv(fd_, tmp, sizeof(tmp), 0);
+        if (n <= 0) return false;
+        buf_.append(tmp, (size_t)n);
+        return true;
+    }
+
+    int fd_ = -1;
+    std::string buf_;
+};
+
+static std::string get_request(const std::string &target) {
+    return "GET " + target + " HTTP/1.1\r\nHost: " + target_host + "\r\n\r\n";
+}
+
+static std::string post_request(const std::string &path, const std::string &body) {
+    return "POST " + path + " HTTP/1.1\r\nHost: " + target_host +
+           "\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: " + std::to_string(body.size()) +
+           "\r\n\r\n" + body;
+}
+
+// ---- trigger stub: answers every request with 200 OK ----
+
+static std::atomic<uint64_t> stub_high(0), stub_low(0), stub_other(0);
+
+static void stub_connection(int fd) {
+    std::string buf;
+    char tmp[4096];
+    static const char response[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nContent-Type: text/plain\r\n\r\nOK";
+    while (true) {
+        size_t end;
+        while ((end = buf.find("\r\n\r\n")) == std::string::npos) {
+            ssize_t n = ::recv(fd, tmp, sizeof(tmp), 0);
+            if (n <= 0) {
+                ::close(fd);
+                return;
+            }
+            buf.append(tmp, (size_t)n);
+        }
+        // trigger requests are GETs without a body
+        if (buf.compare(0, 10, "GET /high?") == 0 || buf.compare(0, 10, "GET /high ") == 0) stub_high.fetch_add(1);
+        else if (buf.compare(0, 9, "GET /low?") == 0 || buf.compare(0, 9, "GET /low ") == 0) stub_low.fetch_add(1);
+        else stub_other.fetch_add(1);
+        buf.erase(0, end + 4);
+        if (::send(fd, response, sizeof(response) - 1, MSG_NOSIGNAL) < 0) {
+            ::close(fd);
+            return;
+        }
+    }
+}
+
+// Listen on an ephemeral loopback port; returns the port, 0 on failure
+static int start_stub() {
+    int lfd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (lfd < 0) return 0;
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (::bind(lfd, (sockaddr *)&addr, sizeof(addr)) != 0 || ::listen(lfd, 128) != 0 ||
+        getsockname(lfd, (sockaddr *)&addr, &len) != 0) {
+        ::close(lfd);
+        return 0;
+    }
+    std::thread([lfd] {
+        while (true) {
+            int fd = ::accept4(lfd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                return;
+            }
+            std::thread(stub_connection, fd).detach();
+        }
+    }).detach();
+    return ntohs(addr.sin_port);
+}
+
+// ---- server under test ----
+
+static pid_t server_pid = -1;
+
+// A loopback port that was free a moment ago
+static int free_port() {
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    int port = 0;
+    if (fd >= 0 && ::bind(fd, (sockaddr *)&addr, sizeof(addr)) == 0 && getsockname(fd, (sockaddr *)&addr, &len) == 0)
+        port = ntohs(addr.sin_port);
+    if (fd >= 0) ::close(fd);
+    return port;
+}
+
+// Start the server in `dir` (it keeps its data files in the working directory)
+static bool start_server(const fs::path &dir, int port) {
+    std::string exe = fs::absolute(opt.server).string();
+    std::string log = (dir / "server.log").string();
+    std::vector<std::string> args{exe, std::to_string(port)};
+    args.insert(args.end(), opt.server_args.begin(), opt.server_args.end());
+    server_pid = ::fork();
+    if (server_pid < 0) return false;
+    if (server_pid == 0) {
+        int out = ::open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out >= 0) {
+            ::dup2(out, 1);
+            ::dup2(out, 2);
+        }
+        if (::chdir(dir.c_str()) != 0) _exit(127);
+        std::vector<char *> argv;
+        for (std::string &a : args) argv.push_back(a.data());
+        argv.push_back(nullptr);
+        ::execv(exe.c_str(), argv.data());
+        _exit(127);
+    }
+    return true;
+}
+
+static void stop_server() {
+    if (server_pid <= 0) return;
+    ::kill(server_pid, SIGINT);
+    for (int i = 0; i < 100; ++i) {
+        if (::waitpid(server_pid, nullptr, WNOHANG) == server_pid) {
+            server_pid = -1;
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    ::kill(server_pid, SIGKILL);
+    ::waitpid(server_pid, nullptr, 0);
+    server_pid = -1;
+}
+
+static bool wait_for_server() {
+    for (int i = 0; i < 100; ++i) {
+        if (server_pid > 0 && ::waitpid(server_pid, nullptr, WNOHANG) == server_pid) {
+            server_pid = -1;
+            return false;
+        }
+        Client c;
+        if (c.roundtrip(get_request("/triggersEnabled")) == 200) return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return false;
+}
+
+// ---- fleet ----
+
+static std::vector<std::string> rooms;  // one H&T sensor per room, named after it
+
+static std::string room_name(size_t i) {
+    size_t per_building = (opt.sensors + opt.buildings - 1) / opt.buildings;
+    return "b" + std::to_string(i / per_building + 1) + "-room-" + std::to_string(i % per_building + 1);
+}
+
+// The n-th reading of sensor i: the room swings 1.2 °C either side of 21 °C every
+// 40 readings, with its own phase, so each room crosses its band a few times an hour
+static std::string reading_target(size_t i, uint64_t n) {
+    double phase = (double)(i * 7919 % 1000) / 1000.0;
+    double temp = 21.0 + 1.2 * std::sin(2 * M_PI * ((double)n / 40.0 + phase));
+    double hum = 45.0 + 10.0 * phase;
+    char buf[160];
+    std::snprintf(buf, sizeof(buf), "/saveSensorInformation?id=%s&temp=%.1f&hum=%.0f&batt=%d", rooms[i].c_str(), temp,
+                  hum, 100 - (int)(n % 100));
+    return buf;
+}
+
+// ---- schedule: closed loop, each connection sends its next request once the last is answered ----
+
+enum Kind { Reading, Sensors, Triggers, Settings, KindCount };
+static const char *kind_names[KindCount] = {"reading", "sensors", "triggers", "settings"};
+
+struct Stream {
+    double rate;       // requests per second; 0 = unpaced
+    uint64_t issued;
+};
+
+static std::mutex schedule_mutex;
+static Stream streams[3];  // readings, polls, settings writes
+static lg_clock::time_point run_start, run_end;
+
+struct Op {
+    Kind kind;
+    uint64_t n;                 // index within its stream
+    lg_clock::time_point due;   // when it should be sent (latency is measured from here)
+};
+
+// Next request for a connection: the stream whose next request is due first.
+// Unpaced streams are always due now. False once the run is over.
+static bool next_op(Op &op) {
+    auto now = lg_clock::now();
+    if (now >= run_end) return false;
+    std::lock_guard<std::mutex> lk(schedule_mutex);
+    int best = -1;
+    lg_clock::time_point best_due;
+    for (int s = 0; s < 3; ++s) {
+        if (streams[s].rate < 0) continue;
+        lg_clock::time_point due = now;
+        if (streams[s].rate > 0)
+            due = run_start + std::chrono::duration_cast<lg_clock::duration>(
+                                  std::chrono::duration<double>((double)streams[s].issued / streams[s].rate));
+        if (best < 0 || due < best_due) {
+            best = s;
+            best_due = due;
+        }
+    }
+    if (best < 0 || best_due >= run_end) return false;
+    op.n = streams[best].issued++;
+    op.due = best_due;
+    op.kind = best == 0 ? Reading : best == 1 ? (op.n % 2 ? Triggers : Sensors) : Settings;
+    return true;
+}
+
+struct Stats {
+    std::vector<uint32_t> latency_us[KindCount];
+    uint64_t errors[KindCount] = {};
+};
+
+static void run_connection(Stats &stats) {
+    Client client;
+    Op op;
+    while (next_op(op)) {
+        std::this_thread::sleep_until(op.due);
+        std::string request;
+        switch (op.kind) {
+        case Reading:
+            request = get_request(reading_target(op.n % rooms.size(), op.n / rooms.size()));
+            break;
+        case Sensors:
+            request = get_request("/sensors");
+            break;
+        case Triggers:
+            request = get_request("/triggers?limit=50");
+            break;
+        default: {
+            char body[160];
+            std::snprintf(body, sizeof(body), "room=%s&desired=%.1f", rooms[op.n * 7919 % rooms.size()].c_str(),
+                          20.5 + (double)(op.n % 3) * 0.5);
+            request = post_request("/setDesiredTemperature", body);
+        }
+        }
+        // latency counts from when the request was due, so a server that falls behind is
+        // charged for the time requests waited for a free connection
+        int status = client.roundtrip(request);
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(lg_clock::now() - op.due).count();
+        if (status != 200) stats.errors[op.kind]++;
+        else stats.latency_us[op.kind].push_back((uint32_t)std::min<int64_t>(us, UINT32_MAX));
+    }
+}
+
+// Desired temperature and both trigger URLs for every room, spread over the connections
+static bool configure_rooms(int stub_port) {
+    std::atomic<size_t> next(0), failed(0);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < opt.connections; ++t) {
+        threads.emplace_back([&] {
+            Client client;
+            size_t i;
+            while ((i = next.fetch_add(1)) < rooms.size()) {
+                const std::string &room = rooms[i];
+                std::string stub = "http%3A%2F%2F127.0.0.1%3A" + std::to_string(stub_port);
+                if (client.roundtrip(post_request("/setDesiredTemperature", "room=" + room + "&desired=21")) != 200 ||
+                    client.roundtrip(post_request("/setHighTrigger", "room=" + room + "&url=" + stub + "%2Fhigh%3Froom%3D" + room)) != 200 ||
+                    client.roundtrip(post_request("/setLowTrigger", "room=" + room + "&url=" + stub + "%2Flow%3Froom%3D" + room)) != 200)
+                    failed.fetch_add(1);
+            }
+        });
+    }
+    for (std::thread &t : threads) t.join();
+    return failed.load() == 0;
+}
+
+// ---- report ----
+
+static uint32_t percentile(const std::vector<uint32_t> &sorted, double q) {
+    if (sorted.empty()) return 0;
+    size_t rank = (size_t)std::ceil(q * (double)sorted.size());
+    return sorted[std::min(sorted.size() - 1, rank ? rank - 1 : 0)];
+}
+
+static void report(std::vector<uint32_t> (&latency)[KindCount + 1], const uint64_t (&errors)[KindCount + 1],
+                   double seconds) {
+    uint64_t stub_total = stub_high.load() + stub_low.load() + stub_other.load();
+    const char *names[KindCount + 1] = {kind_names[0], kind_names[1], kind_names[2], kind_names[3], "total"};
+    if (opt.json) {
+        std::string out = "{\"sensors\":" + std::to_string(opt.sensors) + ",\"connections\":" +
+                          std::to_string(opt.connections) + ",\"seconds\":" + std::to_string(seconds) + ",\"requests\":[";
+        for (int k = 0; k <= KindCount; ++k) {
+            const std::vector<uint32_t> &l = latency[k];
+            char buf[320];
+            std::snprintf(buf, sizeof(buf),
+                          "%s{\"kind\":\"%s\",\"count\":%zu,\"errors\":%llu,\"per_sec\":%.1f,\"p50_us\":%u,\"p99_us\":%u,"
+                          "\"p999_us\":%u,\"max_us\":%u}",
+                          k ? "," : "", names[k], l.size(), (unsigned long long)errors[k], (double)l.size() / seconds,
+                          percentile(l, 0.5), percentile(l, 0.99), percentile(l, 0.999), l.empty() ? 0 : l.back());
+            out += buf;
+        }
+        out += "],\"trigger_stub\":{\"high\":" + std::to_string(stub_high.load()) + ",\"low\":" +
+               std::to_string(stub_low.load()) + ",\"other\":" + std::to_string(stub_other.load()) + "}}";
+        std::printf("%s\n", out.c_str());
+        return;
+    }
+    std::printf("%-10s %10s %8s %10s %10s %10s %10s %10s\n", "request", "count", "errors", "req/s", "p50 us", "p99 us",
+                "p999 us", "max us");
+    for (int k = 0; k <= KindCount; ++k) {
+        const std::vector<uint32_t> &l = latency[k];
+        std::printf("%-10s %10zu %8llu %10.1f %10u %10u %10u %10u\n", names[k], l.size(), (unsigned long long)errors[k],
+                    (double)l.size() / seconds, percentile(l, 0.5), percentile(l, 0.99), percentile(l, 0.999),
+                    l.empty() ? 0 : l.back());
+    }
+    std::printf("trigger stub: %llu requests (%llu high, %llu low), %.1f/s\n", (unsigned long long)stub_total,
+                (unsigned long long)stub_high.load(), (unsigned long long)stub_low.load(), (double)stub_total / seconds);
+}
+
+static void usage(const char *argv0) {
+    std::fprintf(stderr,
+                 "Usage: %s [options] [-- server options]\n"
+                 "  --sensors <n>        simulated H&T sensors, one per room (default 1000)\n"
+                 "  --buildings <n>      buildings the rooms are spread over (default 1)\n"
+                 "  --interval <s>       seconds between two readings of a sensor; 0 = as fast as possible (default 60)\n"
+                 "  --polls <n>          dashboard polls per second, alternating /sensors and /triggers (default 1)\n"
+                 "  --writes <n>         settings writes per second (default 0.2)\n"
+                 "  --connections <n>    concurrent client connections (default 16)\n"
+                 "  --duration <s>       length of the run in seconds (default 30)\n"
+                 "  --server <path>      server binary, started in a scratch directory (default ./server)\n"
+                 "  --target <host:port> use a running server instead; its settings are overwritten\n"
+                 "  --json               print the results as JSON\n",
+                 argv0);
+}
+
+static bool parse_number(const char *s, double &out, double min) {
+    char *end;
+    out = std::strtod(s, &end);
+    return end != s && *end == '\0' && out >= min && std::isfinite(out);
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        double v;
+        if (a == "--") {
+            opt.server_args.assign(argv + i + 1, argv + argc);
+            break;
+        } else if (a == "--json") {
+            opt.json = true;
+        } else if ((a == "--server" || a == "--target") && i + 1 < argc) {
+            (a == "--server" ? opt.server : opt.target) = argv[++i];
+        } else if ((a == "--sensors" || a == "--buildings" || a == "--connections") && i + 1 < argc &&
+                   parse_number(argv[i + 1], v, 1) && v <= 10000000) {
+            (a == "--sensors" ? opt.sensors : a == "--buildings" ? opt.buildings : opt.connections) = (size_t)v;
+            ++i;
+        } else if ((a == "--interval" || a == "--polls" || a == "--writes" || a == "--duration") && i + 1 < argc &&
+                   parse_number(argv[i + 1], v, 0)) {
+            (a == "--interval" ? opt.interval : a == "--polls" ? opt.polls : a == "--writes" ? opt.writes : opt.duration) = v;
+            ++i;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (opt.duration <= 0 || opt.buildings > opt.sensors) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int stub_port = start_stub();
+    if (!stub_port) {
+        std::fprintf(stderr, "Cannot start the trigger stub\n");
+        return 2;
+    }
+
+    // the server keeps sensor data, settings, triggers and history in its working directory
+    fs::path dir = fs::temp_directory_path() / ("shelly_loadgen_" + std::to_string(::getpid()));
+    if (opt.target.empty()) {
+        fs::create_directories(dir);
+        int port = free_port();
+        if (!port || !resolve_target("127.0.0.1", std::to_string(port)) || !start_server(dir, port)) {
+            std::fprintf(stderr, "Cannot start %s\n", opt.server.c_str());
+            return 2;
+        }
+    } else {
+        size_t colon = opt.target.rfind(':');
+        if (colon == std::string::npos || !resolve_target(opt.target.substr(0, colon), opt.target.substr(colon + 1))) {
+            std::fprintf(stderr, "Cannot resolve %s\n", opt.target.c_str());
+            return 2;
+        }
+    }
+    if (!wait_for_server()) {
+        std::fprintf(stderr, "Server at %s did not respond\n", target_host.c_str());
+        if (opt.target.empty()) {
+            std::ifstream log(dir / "server.log");
+            std::cerr << log.rdbuf();
+            stop_server();
+            fs::remove_all(dir);
+        }
+        return 2;
+    }
+
+    for (size_t i = 0; i < opt.sensors; ++i) rooms.push_back(room_name(i));
+    if (!configure_rooms(stub_port)) std::fprintf(stderr, "Warning: some rooms could not be configured\n");
+
+    streams[0] = {opt.interval > 0 ? (double)opt.sensors / opt.interval : 0, 0};
+    streams[1] = {opt.polls > 0 ? opt.polls : -1, 0};
+    streams[2] = {opt.writes > 0 ? opt.writes : -1, 0};
+    if (!opt.json) {
+        char rate[32] = "max";
+        if (opt.interval > 0) std::snprintf(rate, sizeof(rate), "%.1f", (double)opt.sensors / opt.interval);
+        std::printf("%zu sensors in %zu building(s) (%s readings/s), %.1f polls/s, %.1f writes/s, %zu connections, "
+                    "%.0f s against %s\n",
+                    opt.sensors, opt.buildings, rate, opt.polls, opt.writes, opt.connections, opt.duration,
+                    target_host.c_str());
+    }
+
+    std::vector<Stats> stats(opt.connections);
+    std::vector<std::thread> threads;
+    run_start = lg_clock::now();
+    run_end = run_start + std::chrono::duration_cast<lg_clock::duration>(std::chrono::duration<double>(opt.duration));
+    for (size_t t = 0; t < opt.connections; ++t) threads.emplace_back(run_connection, std::ref(stats[t]));
+    for (std::thread &t : threads) t.join();
+    double seconds = std::chrono::duration<double>(lg_clock::now() - run_start).count();
+
+    // give triggers still queued in the server a moment to reach the stub
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    if (opt.target.empty()) {
+        stop_server();
+        fs::remove_all(dir);
+    }
+
+    std::vector<uint32_t> latency[KindCount + 1];
+    uint64_t errors[KindCount + 1] = {};
+    for (Stats &s : stats) {
+        for (int k = 0; k < KindCount; ++k) {
+            latency[k].insert(latency[k].end(), s.latency_us[k].begin(), s.latency_us[k].end());
+            latency[KindCount].insert(latency[KindCount].end(), s.latency_us[k].begin(), s.latency_us[k].end());
+            errors[k] += s.errors[k];
+            errors[KindCount] += s.errors[k];
+        }
+    }
+    for (std::vector<uint32_t> &l : latency) std::sort(l.begin(), l.end());
+    report(latency, errors, seconds);
+    return 0;
+}
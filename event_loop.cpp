@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "event_loop.h"
+#include "http.h"
+#include "metrics.h"
+#include "trace.h"
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unordered_map>
+#include <vector>
+#include <cerrno>
+
+std::atomic<int> KEEPALIVE_TIMEOUT_SECONDS(5);
+std::atomic<int> KEEPALIVE_MAX_REQUESTS(100);
+
+static bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return false;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static void close_connection(int epfd, std::unordered_map<int, Connection> &conns, int fd) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    conns.erase(fd);
+    metrics_count(Counter::ConnectionsClosed);
+}
+
+// Write as much of the pending output as the socket accepts. A client reading its
+// responses counts as active, as its input may be paused behind them.
+// Returns false if the connection failed and must be closed.
+static bool flush_output(Connection &c) {
+    while (c.out_offset < c.out.size()) {
+        ssize_t n = send(c.fd, c.out.data() + c.out_offset, c.out.size() - c.out_offset, MSG_NOSIGNAL);
+        if (n > 0) {
+            c.out_offset += (size_t)n;
+            c.last_activity = std::chrono::steady_clock::now();
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // a client reading slowly but steadily never drains `out`: drop the sent part
+            if (c.out_offset >= c.out.size() / 2) {
+                c.out.erase(0, c.out_offset);
+                c.out_offset = 0;
+            }
+            return true;
+        }
+        metrics_count(Counter::ConnectionsFailed);
+        return false;
+    }
+    c.out.clear();
+    c.out_offset = 0;
+    return true;
+}
+
+static bool output_full(const Connection &c) {
+    return c.out.size() - c.out_offset >= MAX_PENDING_OUTPUT;
+}
+
+// Run request processing for every complete request buffered on the connection.
+// Pipelined requests are answered in order; their responses are queued back-to-back.
+// Stops once the queued output is full; the remaining requests wait in `in`.
+// `read_start`/`read_end` time the read that delivered the data, when tracing is on (else 0).
+static void process_buffered_requests(Connection &c, bool verbose, uint64_t read_start, uint64_t read_end) {
+    while (!c.close_after_write && !output_full(c)) {
+        std::string_view pending(c.in.data() + c.in_offset, c.in.size() - c.in_offset);
+        uint64_t parse_start = read_end ? trace_now() : 0;
+        HttpParser::Result r = c.parser.parse(pending);
+        if (r == HttpParser::Result::Incomplete) {
+            if (c.parser.expect_continue() && !c.continue_sent) {
+                c.out += "HTTP/1.1 100 Continue\r\n\r\n";
+                c.continue_sent = true;
+            }
+            break;
+        }
+        if (r == HttpParser::Result::Error) {
+            append_response(c.out, build_status_response(c.parser.error_status()), false, 0, 0);
+            c.close_after_write = true;
+            break;
+        }
+        const HttpRequest &req = c.parser.request();
+        if (verbose) std::cout << "Request:\n" << req.raw << "\n";
+        uint64_t trace = read_end ? trace_sample() : 0;
+        if (trace) {
+            trace_record(trace, "read", read_start, read_end);
+            trace_record(trace, "parse", parse_start, trace_now());
+            current_trace = trace;
+        }
+
+        ++c.requests_served;
+        int max_requests = KEEPALIVE_MAX_REQUESTS.load();
+        bool keep_alive = req.keep_alive && c.requests_served < max_requests;
+        process_request(req, c.out, keep_alive, KEEPALIVE_TIMEOUT_SECONDS.load(), max_requests - c.requests_served);
+        if (!keep_alive) c.close_after_write = true;
+        if (trace) {
+            current_trace = 0;
+            c.trace = trace;
+        }
+
+        c.in_offset += c.parser.message_length();
+        c.parser.reset();
+        c.continue_sent = false;
+    }
+    // drop consumed bytes; the parser's offsets are relative to `in_offset`, so they stay valid
+    if (c.in_offset == c.in.size()) {
+        c.in.clear();
+        c.in_offset = 0;
+    } else if (c.in_offset > 0) {
+        c.in.erase(0, c.in_offset);
+        c.in_offset = 0;
+    }
+}
+
+// Answer the requests left buffered by a pause, then drain the socket (edge-triggered:
+// read until EAGAIN), answering requests as they complete. Once the queued output is
+// full, reading stops and `input_paused` is set; the event loop calls this again after
+// flush_output() has made room. `in` thus holds at most one request plus one read.
+// Returns false if the peer closed or the read failed.
+static bool serve_input(Connection &c, bool verbose) {
+    if (c.input_paused) process_buffered_requests(c, verbose, 0, 0);
+    bool tracing = trace_enabled();
+    char buffer[4096];
+    while (!(c.input_paused = output_full(c))) {
+        uint64_t read_start = tracing ? trace_now() : 0;
+        ssize_t n = recv(c.fd, buffer, sizeof(buffer), 0);
+        if (n > 0) {
+            // once a response is queued the rest of the input is ignored
+            if (!c.close_after_write) {
+                c.in.append(buffer, n);
+                process_buffered_requests(c, verbose, read_start, tracing ? trace_now() : 0);
+            }
+            continue;
+        }
+        if (n == 0) return false;
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+        metrics_count(Counter::ConnectionsFailed);
+        return false;
+    }
+    return true;
+}
+
+static void accept_clients(int epfd, int listen_fd, std::unordered_map<int, Connection> &conns) {
+    while (true) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept");
+                metrics_count(Counter::ConnectionsFailed);
+            }
+            return;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = fd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            metrics_count(Counter::ConnectionsFailed);
+            continue;
+        }
+        metrics_count(Counter::ConnectionsAccepted);
+        Connection &c = conns[fd];
+        c.fd = fd;
+        c.last_activity = std::chrono::steady_clock::now();
+    }
+}
+
+// Drop connections that have not delivered a complete request in time, and idle
+// keep-alive connections whose idle timeout has passed.
+static void expire_connections(int epfd, std::unordered_map<int, Connection> &conns) {
+    auto now = std::chrono::steady_clock::now();
+    auto idle_limit = std::chrono::seconds(KEEPALIVE_TIMEOUT_SECONDS.load());
+    std::vector<int> expired;
+    for (const auto &kv : conns) {
+        const Connection &c = kv.second;
+        bool idle = c.requests_served > 0 && c.in.empty() && c.out.empty();
+        auto limit = idle ? idle_limit : std::chrono::seconds(REQUEST_TIMEOUT_SECONDS);
+        if (now - c.last_activity > limit) expired.push_back(kv.first);
+    }
+    for (int fd : expired) close_connection(epfd, conns, fd);
+}
+
+bool run_event_loop(int listen_fd, const std::atomic<bool> &keep_running, bool verbose) {
+    if (!set_nonblocking(listen_fd)) {
+        perror("fcntl(O_NONBLOCK)");
+        return false;
+    }
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        return false;
+    }
+    epoll_event lev{};
+    lev.events = EPOLLIN | EPOLLET;
+    lev.data.fd = listen_fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &lev) < 0) {
+        perror("epoll_ctl");
+        close(epfd);
+        return false;
+    }
+
+    std::unordered_map<int, Connection> conns;
+    std::vector<epoll_event> events(256);
+    auto last_sweep = std::chrono::steady_clock::now();
+    while (keep_running.load()) {
+        // wake up periodically to notice shutdown and expire stalled clients
+        int n = epoll_wait(epfd, events.data(), (int)events.size(), 250);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == listen_fd) {
+                accept_clients(epfd, listen_fd, conns);
+                continue;
+            }
+            auto it = conns.find(fd);
+            if (it == conns.end()) continue;
+            Connection &c = it->second;
+            bool alive = !(events[i].events & EPOLLERR);
+            if (!alive) metrics_count(Counter::ConnectionsFailed);
+            bool open = true;
+            if (alive && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))) {
+                c.last_activity = std::chrono::steady_clock::now();
+                open = serve_input(c, verbose);
+            }
+            uint64_t write_start = c.trace ? trace_now() : 0;
+            if (alive) alive = flush_output(c);
+            // the client read enough of a full output queue: resume its paused input
+            while (alive && open && c.input_paused && !output_full(c)) {
+                open = serve_input(c, verbose);
+                alive = flush_output(c);
+            }
+            // a half-closed peer may still be waiting for its response
+            if (!open && c.out.empty()) alive = false;
+            if (c.trace) {
+                // the write of the traced response (and of anything queued with it)
+                trace_record(c.trace, "write", write_start, trace_now());
+                c.trace = 0;
+            }
+            if (!alive || (c.close_after_write && c.out.empty())) close_connection(epfd, conns, fd);
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_sweep >= std::chrono::seconds(1)) {
+            expire_connections(epfd, conns);
+            last_sweep = now;
+        }
+    }
+
+    for (auto &kv : conns) close(kv.first);
+    metrics_count(Counter::ConnectionsClosed, conns.size());
+    close(epfd);
+    return true;
+}
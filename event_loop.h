@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "http_parser.h"
+
+// Per-connection state owned by the event loop. Client sockets are non-blocking;
+// bytes are accumulated in `in` and fed to the incremental parser as they arrive;
+// responses are queued in `out` until the socket accepts them.
+struct Connection {
+    int fd = -1;
+    std::string in;
+    size_t in_offset = 0;     // start of the request currently being parsed
+    HttpParser parser;
+    std::string out;
+    size_t out_offset = 0;
+    int requests_served = 0;
+    bool continue_sent = false;
+    bool close_after_write = false;
+    bool input_paused = false;  // input left unread while `out` is over MAX_PENDING_OUTPUT
+    uint64_t trace = 0;       // traced request whose response is queued in `out` (trace.h)
+    std::chrono::steady_clock::time_point last_activity;
+};
+
+// Queued response bytes above which a connection's input is neither read nor parsed
+// until the client has read some of them, so a pipelining client that never reads its
+// socket cannot grow `out` (or `in`) without bound.
+constexpr size_t MAX_PENDING_OUTPUT = 1 << 20;
+
+// Seconds a client may take to deliver a complete request before it is dropped.
+constexpr int REQUEST_TIMEOUT_SECONDS = 30;
+
+// Seconds an idle persistent (keep-alive) connection is kept open between requests.
+extern std::atomic<int> KEEPALIVE_TIMEOUT_SECONDS;
+// Maximum number of requests served on one persistent connection before it is closed.
+extern std::atomic<int> KEEPALIVE_MAX_REQUESTS;
+
+// Run an edge-triggered epoll reactor serving `listen_fd` until `keep_running` is cleared.
+// Each worker thread runs its own loop on its own listening socket; nothing is shared
+// between loops except the (thread-safe) request handlers.
+// Returns false if the reactor could not be set up.
+bool run_event_loop(int listen_fd, const std::atomic<bool> &keep_running, bool verbose);
+
+#endif // EVENT_LOOP_H
@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "history.h"
+#include "storage.h"
+#include "history_store.h"
+#include "json.h"
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+
+std::atomic<int> HISTORY_SAMPLES(10080);  // a week of one-minute readings
+
+static constexpr int16_t MISSING = INT16_MIN;
+
+static int16_t quantize(float v) {
+    if (std::isnan(v)) return MISSING;
+    float q = std::round(v * 100.0f);
+    return (int16_t)std::clamp(q, (float)(INT16_MIN + 1), (float)INT16_MAX);
+}
+
+static double dequantize(int16_t q) {
+    return q == MISSING ? NAN : q / 100.0;
+}
+
+SensorHistory::SensorHistory(size_t max_samples)
+    : max_blocks_((max_samples + HISTORY_BLOCK_SAMPLES - 1) / HISTORY_BLOCK_SAMPLES + 1) {}
+
+int64_t SensorHistory::block_end(size_t i) const {
+    const Block &b = block(i);
+    return b.base + b.offset[b.count - 1];
+}
+
+void SensorHistory::append(int64_t timestamp, float temp, float hum) {
+    Block *b = used_ ? &blocks_[(first_ + used_ - 1) % blocks_.size()] : nullptr;
+    if (b) timestamp = std::max(timestamp, b->base + b->offset[b->count - 1]);
+    if (!b || b->count == HISTORY_BLOCK_SAMPLES || timestamp - b->base > UINT16_MAX) {
+        // start a block: grow the ring until it reaches its size, then reuse the oldest
+        if (blocks_.size() < max_blocks_) {
+            if (blocks_.capacity() == blocks_.size()) blocks_.reserve(std::min(max_blocks_, blocks_.size() * 2 + 1));
+            blocks_.emplace_back();
+            ++used_;
+        } else {
+            samples_ -= blocks_[first_].count;
+            first_ = (first_ + 1) % blocks_.size();
+        }
+        b = &blocks_[(first_ + used_ - 1) % blocks_.size()];
+        b->base = timestamp;
+        b->count = 0;
+    }
+    uint16_t i = b->count++;
+    b->offset[i] = (uint16_t)(timestamp - b->base);
+    b->temp[i] = quantize(temp);
+    b->hum[i] = quantize(hum);
+    ++samples_;
+}
+
+void SensorHistory::query(int64_t from, int64_t to, std::vector<HistoryPoint> &out) const {
+    if (used_ == 0 || from > to) return;
+    // first block ending at or after `from`
+    size_t lo = 0, hi = used_;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (block_end(mid) < from) lo = mid + 1;
+        else hi = mid;
+    }
+    for (size_t k = lo; k < used_; ++k) {
+        const Block &b = block(k);
+        if (b.base > to) break;
+        size_t i = 0;
+        if (from > b.base) {
+            int64_t rel = from - b.base;
+            i = (size_t)(std::lower_bound(b.offset, b.offset + b.count, rel,
+                                          [](uint16_t o, int64_t v){ return (int64_t)o < v; }) - b.offset);
+        }
+        for (; i < b.count; ++i) {
+            int64_t ts = b.base + b.offset[i];
+            if (ts > to) return;
+            out.push_back(HistoryPoint{ts, dequantize(b.temp[i]), dequantize(b.hum[i])});
+        }
+    }
+}
+
+// ---- per-sensor store ----
+
+struct HistoryEntry {
+    std::mutex mutex;
+    SensorHistory history;
+    explicit HistoryEntry(size_t samples) : history(samples) {}
+};
+
+// Indexed by sensor handle; the vector is guarded by histories_mutex, each history by its own mutex
+static std::vector<std::unique_ptr<HistoryEntry>> histories;
+static std::shared_mutex histories_mutex;
+
+void history_append(SensorHandle h, const SensorReading &reading) {
+    int samples = HISTORY_SAMPLES.load();
+    if (samples <= 0) return;
+    {
+        std::shared_lock<std::shared_mutex> lk(histories_mutex);
+        if (h < histories.size() && histories[h]) {
+            HistoryEntry &e = *histories[h];
+            std::lock_guard<std::mutex> elk(e.mutex);
+            e.history.append(reading.timestamp, reading.temp, reading.hum);
+            return;
+        }
+    }
+    std::unique_lock<std::shared_mutex> lk(histories_mutex);
+    if (histories.size() <= h) histories.resize(h + 1);
+    if (!histories[h]) histories[h] = std::make_unique<HistoryEntry>((size_t)samples);
+    histories[h]->history.append(reading.timestamp, reading.temp, reading.hum);
+}
+
+bool history_query(SensorHandle h, int64_t from, int64_t to, std::vector<HistoryPoint> &out) {
+    std::shared_lock<std::shared_mutex> lk(histories_mutex);
+    if (h >= histories.size() || !histories[h]) return false;
+    HistoryEntry &e = *histories[h];
+    std::lock_guard<std::mutex> elk(e.mutex);
+    e.history.query(from, to, out);
+    return true;
+}
+
+void history_memory(size_t &samples, size_t &bytes) {
+    samples = bytes = 0;
+    std::shared_lock<std::shared_mutex> lk(histories_mutex);
+    for (const auto &e : histories) {
+        if (!e) continue;
+        std::lock_guard<std::mutex> elk(e->mutex);
+        samples += e->history.size();
+        bytes += e->history.memory_bytes();
+    }
+}
+
+static void write_point(JsonWriter &w, int64_t ts, double temp, double hum) {
+    w.begin_array();
+    w.value_int(ts);
+    w.value_number(temp);  // NaN is written as null
+    w.value_number(hum);
+    w.end_array();
+}
+
+std::string history_json(const std::string &id, int64_t from, int64_t to, int64_t step) {
+    std::string sid = sanitize_id(id);
+    SensorHandle h = sensor_registry.find(sid);
+    if (h == INVALID_SENSOR) return std::string();
+    std::vector<HistoryPoint> points;
+    bool in_memory = history_query(h, from, to, points);
+    // whatever is older than the ring (or everything, with history off) comes from disk
+    std::vector<SensorReading> stored;
+    int64_t disk_to = points.empty() ? to : points.front().timestamp - 1;
+    if (from <= disk_to && history_store_query(sid, from, disk_to, stored)) {
+        std::vector<HistoryPoint> merged;
+        merged.reserve(stored.size() + points.size());
+        // same precision as the ring
+        for (const SensorReading &r : stored) merged.push_back(HistoryPoint{r.timestamp, dequantize(quantize(r.temp)), dequantize(quantize(r.hum))});
+        merged.insert(merged.end(), points.begin(), points.end());
+        points.swap(merged);
+    } else if (!in_memory) {
+        return std::string();
+    }
+
+    std::string out;
+    JsonWriter w(out);
+    w.begin_object();
+    w.key("sensor");
+    w.value_string(sid);
+    w.key("from");
+    w.value_int(from);
+    w.key("to");
+    w.value_int(to);
+    w.key("step");
+    w.value_int(step);
+    w.key("points");
+    w.begin_array();
+    if (step <= 0) {
+        for (const HistoryPoint &p : points) write_point(w, p.timestamp, p.temp, p.hum);
+    } else {
+        // average per bucket, skipping values the sensor did not report
+        size_t i = 0;
+        while (i < points.size()) {
+            int64_t bucket = from + (points[i].timestamp - from) / step * step;
+            double temp = 0, hum = 0;
+            int nt = 0, nh = 0;
+            for (; i < points.size() && points[i].timestamp < bucket + step; ++i) {
+                if (!std::isnan(points[i].temp)) { temp += points[i].temp; ++nt; }
+                if (!std::isnan(points[i].hum)) { hum += points[i].hum; ++nh; }
+            }
+            write_point(w, bucket, nt ? std::round(temp / nt * 100) / 100 : NAN, nh ? std::round(hum / nh * 100) / 100 : NAN);
+        }
+    }
+    w.end_array();
+    w.end_object();
+    return out;
+}
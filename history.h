@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "sensor_registry.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Per-sensor reading history in fixed memory. Samples are packed in blocks of 64: one
+// absolute timestamp per block, then per sample a 16-bit offset from it and temperature
+// and humidity quantized to int16 hundredths (6 bytes a sample). The blocks form a ring;
+// once a sensor's ring is full its oldest block is dropped. Timestamps never decrease,
+// so a time range is found by binary search over blocks and then within one.
+
+// Samples kept per sensor (at least; up to one block more). 0 disables history.
+extern std::atomic<int> HISTORY_SAMPLES;
+constexpr int HISTORY_BLOCK_SAMPLES = 64;
+
+struct HistoryPoint {
+    int64_t timestamp;
+    double temp;  // NaN if not reported
+    double hum;
+};
+
+// History of one sensor. Not thread-safe.
+class SensorHistory {
+public:
+    explicit SensorHistory(size_t max_samples);
+
+    // Add a sample; a timestamp older than the newest sample is treated as equal to it
+    void append(int64_t timestamp, float temp, float hum);
+    // Append all samples with from <= timestamp <= to to `out`, oldest first
+    void query(int64_t from, int64_t to, std::vector<HistoryPoint> &out) const;
+
+    size_t size() const { return samples_; }
+    // Bytes held by the samples (allocated lazily, bounded by the capacity)
+    size_t memory_bytes() const { return blocks_.capacity() * sizeof(Block); }
+
+private:
+    struct Block {
+        int64_t base = 0;  // timestamp of the first sample
+        uint16_t count = 0;
+        uint16_t offset[HISTORY_BLOCK_SAMPLES];  // seconds after base
+        int16_t temp[HISTORY_BLOCK_SAMPLES];
+        int16_t hum[HISTORY_BLOCK_SAMPLES];
+    };
+
+    const Block &block(size_t i) const { return blocks_[(first_ + i) % blocks_.size()]; }
+    int64_t block_end(size_t i) const;
+
+    std::vector<Block> blocks_;
+    size_t max_blocks_;
+    size_t first_ = 0;  // ring index of the oldest block
+    size_t used_ = 0;   // blocks in use
+    size_t samples_ = 0;
+};
+
+// Record a reading of sensor `h` in its history (no-op when HISTORY_SAMPLES is 0)
+void history_append(SensorHandle h, const SensorReading &reading);
+// Samples held and bytes allocated by all in-memory histories
+void history_memory(size_t &samples, size_t &bytes);
+// Samples of sensor `h` in [from, to]; false if the sensor has no history
+bool history_query(SensorHandle h, int64_t from, int64_t to, std::vector<HistoryPoint> &out);
+// JSON for GET /history/<id>: {"sensor":..,"from":..,"to":..,"step":..,"points":[[t,temp,hum],..]}
+// With step > 0 the samples are averaged per step-second bucket starting at `from`
+// (bucket timestamp = its start). Readings older than the in-memory ring are read from the
+// on-disk history (history_store.h). Empty if the sensor has no history.
+std::string history_json(const std::string &id, int64_t from, int64_t to, int64_t step);
+
+#endif // HISTORY_H
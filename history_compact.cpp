@@ -0,0 +1,315 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "history_compact.h"
+#include "history_store.h"
+#include "json.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+std::atomic<int> HISTORY_RAW_DAYS(30);
+std::atomic<int> HISTORY_RETENTION_DAYS(730);
+std::atomic<int> HISTORY_COMPACT_RATE_KB(4096);
+
+using SegmentList = std::vector<std::shared_ptr<const HistorySegment>>;
+
+static std::thread compactor_thread;
+static std::atomic<bool> compactor_running(false);
+static std::atomic<bool> compactor_stopping(false);
+static bool compaction_requested = false;
+static std::mutex compactor_mutex;
+static std::condition_variable compactor_cv;
+
+// one run at a time: the thread's and a direct call (tests, tools)
+static std::mutex run_mutex;
+static std::mutex stats_mutex;
+static CompactionStats stats;
+
+// Sleep long enough that `bytes` of I/O stay within HISTORY_COMPACT_RATE_KB. False if
+// the compactor is being stopped.
+static bool throttle(uint64_t bytes) {
+    int rate = HISTORY_COMPACT_RATE_KB.load();
+    if (rate > 0 && bytes > 0) {
+        auto pause = std::chrono::microseconds(bytes * 1000000 / ((uint64_t)rate * 1024));
+        std::unique_lock<std::mutex> lk(compactor_mutex);
+        compactor_cv.wait_for(lk, pause, []{ return compactor_stopping.load(); });
+    }
+    return !compactor_stopping.load();
+}
+
+// All readings of `inputs` per sensor id, oldest first
+static bool read_segments(const SegmentList &inputs, std::map<std::string, std::vector<SensorReading>> &out) {
+    for (const auto &seg : inputs) {
+        for (size_t i = 0; i < seg->sensors(); ++i) {
+            std::string_view id = seg->sensor(i);
+            seg->query(id, INT64_MIN, INT64_MAX, out[std::string(id)]);
+        }
+        {
+            std::lock_guard<std::mutex> lk(stats_mutex);
+            stats.bytes_read += seg->file_bytes();
+        }
+        if (!throttle(seg->file_bytes())) return false;
+    }
+    auto older = [](const SensorReading &a, const SensorReading &b){ return a.timestamp < b.timestamp; };
+    for (auto &s : out) std::stable_sort(s.second.begin(), s.second.end(), older);
+    return true;
+}
+
+// Average of the values that are numbers; NaN if none are
+struct Mean {
+    double sum = 0;
+    uint32_t n = 0;
+    void add(float v) { if (!std::isnan(v)) { sum += v; ++n; } }
+    float get() const { return n ? (float)(sum / n) : NAN; }
+};
+
+// One row per HISTORY_DOWNSAMPLE_STEP seconds holding readings. Rows already
+// downsampled count as one reading each.
+static std::vector<SensorReading> downsample(const std::vector<SensorReading> &readings) {
+    std::vector<SensorReading> out;
+    for (size_t i = 0; i < readings.size();) {
+        int64_t bucket = readings[i].timestamp - (((readings[i].timestamp % HISTORY_DOWNSAMPLE_STEP) + HISTORY_DOWNSAMPLE_STEP) % HISTORY_DOWNSAMPLE_STEP);
+        Mean temp, hum, batt;
+        for (; i < readings.size() && readings[i].timestamp < bucket + HISTORY_DOWNSAMPLE_STEP; ++i) {
+            temp.add(readings[i].temp);
+            hum.add(readings[i].hum);
+            batt.add(readings[i].batt);
+        }
+        SensorReading r;
+        r.timestamp = bucket;
+        r.temp = temp.get();
+        r.hum = hum.get();
+        r.batt = batt.get();
+        out.push_back(r);
+    }
+    return out;
+}
+
+// Replace `inputs` (all segments of one window) by a single segment for `window`,
+// downsampled when `step` is set
+static bool compact_window(const SegmentList &inputs, int64_t window, uint32_t step) {
+    std::map<std::string, std::vector<SensorReading>> readings;
+    if (!read_segments(inputs, readings)) return false;
+    std::vector<SegmentSeries> series;
+    series.reserve(readings.size());
+    for (auto &r : readings) {
+        if (r.second.empty()) continue;
+        series.push_back(SegmentSeries{r.first, step ? downsample(r.second) : std::move(r.second)});
+    }
+    uint64_t first = UINT64_MAX, last = 0;
+    for (const auto &seg : inputs) {
+        first = std::min(first, seg->first_sequence());
+        last = std::max(last, seg->last_sequence());
+    }
+    std::string path = HISTORY_DIR + "/" + std::to_string(window) + "-" + std::to_string(first) + "-" +
+                       std::to_string(last) + ".seg";
+    if (!write_history_segment(path, series, step)) {
+        perror("write history segment");
+        return false;
+    }
+    int64_t reclaimed = replace_history_segments(inputs, path);
+    if (reclaimed < 0) {
+        std::cerr << "Compacted history segment " << path << " could not be opened\n";
+        unlink(path.c_str());
+        return false;
+    }
+    uint64_t written = 0;
+    for (const auto &seg : history_segments()) {
+        if (seg->path() == path) written = seg->file_bytes();
+    }
+    {
+        std::lock_guard<std::mutex> lk(stats_mutex);
+        (step ? stats.downsampled : stats.merged) += inputs.size();
+        stats.bytes_written += written;
+        stats.bytes_reclaimed += (uint64_t)std::max<int64_t>(0, reclaimed - (int64_t)written);
+    }
+    return throttle(written);
+}
+
+bool run_history_compaction(int64_t now) {
+    if (HISTORY_DIR.empty()) return true;
+    std::lock_guard<std::mutex> run_lk(run_mutex);
+    SegmentList segments = history_segments();
+    int64_t raw_days = HISTORY_RAW_DAYS.load(), retention_days = HISTORY_RETENTION_DAYS.load();
+    int64_t raw_cutoff = raw_days > 0 ? now - raw_days * 86400 : INT64_MIN;
+    int64_t expire_cutoff = retention_days > 0 ? now - retention_days * 86400 : INT64_MIN;
+
+    // retention first, so nothing about to expire is compacted
+    SegmentList expired, kept;
+    for (const auto &seg : segments) (seg->window_end() <= expire_cutoff ? expired : kept).push_back(seg);
+    // four-week windows that are past the raw cutoff and still hold raw segments; then
+    // finished days with more than one segment
+    std::map<int64_t, SegmentList> downsample_jobs, merge_jobs;
+    for (const auto &seg : kept) {
+        int64_t window = history_window_of(seg->window_start(), HISTORY_DOWNSAMPLE_STEP);
+        if (window + HISTORY_DOWNSAMPLED_WINDOW <= raw_cutoff) downsample_jobs[window].push_back(seg);
+        else if (seg->step() == 0 && seg->window_end() <= now) merge_jobs[seg->window_start()].push_back(seg);
+    }
+    for (auto it = downsample_jobs.begin(); it != downsample_jobs.end();) {
+        bool raw = std::any_of(it->second.begin(), it->second.end(), [](const auto &s){ return s->step() == 0; });
+        it = raw ? std::next(it) : downsample_jobs.erase(it);
+    }
+    for (auto it = merge_jobs.begin(); it != merge_jobs.end();) {
+        it = it->second.size() > 1 ? std::next(it) : merge_jobs.erase(it);
+    }
+    {
+        std::lock_guard<std::mutex> lk(stats_mutex);
+        stats.running = true;
+        stats.jobs = (expired.empty() ? 0 : 1) + downsample_jobs.size() + merge_jobs.size();
+        stats.jobs_done = 0;
+    }
+    auto job_done = []{
+        std::lock_guard<std::mutex> lk(stats_mutex);
+        ++stats.jobs_done;
+    };
+
+    bool ok = true;
+    if (!expired.empty()) {
+        int64_t reclaimed = replace_history_segments(expired, std::string());
+        std::lock_guard<std::mutex> lk(stats_mutex);
+        stats.expired += expired.size();
+        stats.bytes_reclaimed += (uint64_t)std::max<int64_t>(0, reclaimed);
+        ++stats.jobs_done;
+    }
+    for (const auto &job : downsample_jobs) {
+        if (!(ok = compact_window(job.second, job.first, HISTORY_DOWNSAMPLE_STEP))) break;
+        job_done();
+    }
+    if (ok) {
+        for (const auto &job : merge_jobs) {
+            if (!(ok = compact_window(job.second, job.first, 0))) break;
+            job_done();
+        }
+    }
+    std::lock_guard<std::mutex> lk(stats_mutex);
+    stats.running = false;
+    ++stats.runs;
+    stats.last_run = (int64_t)std::time(nullptr);
+    return ok;
+}
+
+static void compactor_loop() {
+    // background work: lowest CPU priority and, where supported, idle I/O class
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+#ifdef SYS_ioprio_set
+    syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, 0, 3 << 13 /* IOPRIO_CLASS_IDLE */);
+#endif
+    std::unique_lock<std::mutex> lk(compactor_mutex);
+    while (!compactor_stopping.load()) {
+        lk.unlock();
+        try {
+            run_history_compaction((int64_t)std::time(nullptr));
+        } catch (...) {}
+        lk.lock();
+        compactor_cv.wait(lk, []{ return compactor_stopping.load() || compaction_requested; });
+        compaction_requested = false;
+    }
+}
+
+void start_history_compactor() {
+    if (HISTORY_DIR.empty() || compactor_running.load()) return;
+    compactor_stopping.store(false);
+    compactor_running.store(true);
+    compactor_thread = std::thread(compactor_loop);
+}
+
+void stop_history_compactor() {
+    if (!compactor_running.load()) return;
+    {
+        std::lock_guard<std::mutex> lk(compactor_mutex);
+        compactor_stopping.store(true);
+    }
+    compactor_cv.notify_all();
+    if (compactor_thread.joinable()) compactor_thread.join();
+    compactor_running.store(false);
+    compactor_stopping.store(false);
+}
+
+void request_history_compaction() {
+    if (!compactor_running.load()) return;
+    {
+        std::lock_guard<std::mutex> lk(compactor_mutex);
+        compaction_requested = true;
+    }
+    compactor_cv.notify_all();
+}
+
+CompactionStats history_compaction_stats() {
+    std::lock_guard<std::mutex> lk(stats_mutex);
+    return stats;
+}
+
+std::string history_status_json() {
+    uint64_t raw = 0, raw_bytes = 0, downsampled = 0, downsampled_bytes = 0;
+    for (const auto &seg : history_segments()) {
+        if (seg->step()) {
+            ++downsampled;
+            downsampled_bytes += seg->file_bytes();
+        } else {
+            ++raw;
+            raw_bytes += seg->file_bytes();
+        }
+    }
+    CompactionStats c = history_compaction_stats();
+    std::string out;
+    JsonWriter w(out);
+    w.begin_object();
+    w.key("raw");
+    w.begin_object();
+    w.key("segments"); w.value_int((long long)raw);
+    w.key("bytes"); w.value_int((long long)raw_bytes);
+    w.key("keep_days"); w.value_int(HISTORY_RAW_DAYS.load());
+    w.end_object();
+    w.key("downsampled");
+    w.begin_object();
+    w.key("segments"); w.value_int((long long)downsampled);
+    w.key("bytes"); w.value_int((long long)downsampled_bytes);
+    w.key("step"); w.value_int(HISTORY_DOWNSAMPLE_STEP);
+    w.key("keep_days"); w.value_int(HISTORY_RETENTION_DAYS.load());
+    w.end_object();
+    w.key("compaction");
+    w.begin_object();
+    w.key("running"); w.value_bool(c.running);
+    w.key("jobs"); w.value_int((long long)c.jobs);
+    w.key("jobs_done"); w.value_int((long long)c.jobs_done);
+    w.key("runs"); w.value_int((long long)c.runs);
+    w.key("last_run"); w.value_int(c.last_run);
+    w.key("merged"); w.value_int((long long)c.merged);
+    w.key("downsampled"); w.value_int((long long)c.downsampled);
+    w.key("expired"); w.value_int((long long)c.expired);
+    w.key("bytes_read"); w.value_int((long long)c.bytes_read);
+    w.key("bytes_written"); w.value_int((long long)c.bytes_written);
+    w.key("bytes_reclaimed"); w.value_int((long long)c.bytes_reclaimed);
+    w.end_object();
+    w.end_object();
+    return out;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef HISTORY_COMPACT_H
+#define HISTORY_COMPACT_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Background compaction and retention of the on-disk history (history_store.h). After
+// every periodic flush a low-priority thread
+//   - merges the segments of each finished day into one,
+//   - downsamples raw readings older than HISTORY_RAW_DAYS into averages per
+//     HISTORY_DOWNSAMPLE_STEP seconds, one segment per four-week window,
+//   - deletes downsampled segments older than HISTORY_RETENTION_DAYS.
+// Its reads and writes are paced to HISTORY_COMPACT_RATE_KB so the flusher and the
+// request path never wait behind a burst of compaction I/O.
+
+// Raw readings are kept this many days, then downsampled (0 = keep them raw)
+extern std::atomic<int> HISTORY_RAW_DAYS;
+// Downsampled readings are kept this many days (0 = forever)
+extern std::atomic<int> HISTORY_RETENTION_DAYS;
+// Segment bytes read plus written per second, in KiB (0 = unthrottled)
+extern std::atomic<int> HISTORY_COMPACT_RATE_KB;
+// Seconds averaged into one downsampled row
+constexpr uint32_t HISTORY_DOWNSAMPLE_STEP = 900;
+
+struct CompactionStats {
+    uint64_t runs = 0;
+    uint64_t merged = 0;       // segments replaced by a merged day
+    uint64_t downsampled = 0;  // segments replaced by a downsampled window
+    uint64_t expired = 0;      // segments deleted by retention
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+    uint64_t bytes_reclaimed = 0;  // deleted minus written
+    // windows to process in the current (or last) run, and how many are done
+    uint64_t jobs = 0;
+    uint64_t jobs_done = 0;
+    bool running = false;
+    int64_t last_run = 0;  // epoch seconds the last run finished
+};
+
+// Start the compaction thread; it runs once right away and after every request
+void start_history_compactor();
+// Stop it, abandoning a run in progress (its inputs stay in place)
+void stop_history_compactor();
+// Ask the thread for a run (called by the flusher after writing segments)
+void request_history_compaction();
+// One compaction run as of `now` on the calling thread. Returns false if it was
+// stopped or a segment could not be written.
+bool run_history_compaction(int64_t now);
+// Totals since startup
+CompactionStats history_compaction_stats();
+// JSON for GET /historyStatus: segment counts and bytes per level plus the compaction stats
+std::string history_status_json();
+
+#endif // HISTORY_COMPACT_H
@@ -0,0 +1,467 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "history_store.h"
+#include "storage.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::string HISTORY_DIR = "history";
+
+static const char SEGMENT_MAGIC[8] = {'S', 'H', 'T', 'S', 'E', 'G', '1', '\0'};
+
+struct SegmentHeader {
+    char magic[8];
+    uint32_t sensors;
+    uint32_t step;
+    uint64_t rows;
+    int64_t min_ts;
+    int64_t max_ts;
+    uint64_t names_offset;
+    uint64_t columns_offset;
+};
+static_assert(sizeof(SegmentHeader) == 56, "segment header layout");
+
+struct SegmentIndexEntry {
+    uint32_t name_offset;
+    uint32_t name_length;
+    uint64_t first_row;
+    uint64_t rows;
+    int64_t first_ts;
+    int64_t last_ts;
+};
+static_assert(sizeof(SegmentIndexEntry) == 40, "segment index layout");
+
+// bytes per row over all four columns
+static constexpr size_t ROW_BYTES = 8 + 4 * 3;
+
+static size_t align8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+int64_t history_window_of(int64_t ts, uint32_t step) {
+    int64_t window = step ? HISTORY_DOWNSAMPLED_WINDOW : HISTORY_SEGMENT_WINDOW;
+    return (ts / window - (ts % window < 0)) * window;
+}
+
+// "<window start>-<sequence>.seg" or, after compaction, "<window start>-<first>-<last>.seg"
+static bool parse_segment_name(const std::string &name, int64_t &window, uint64_t &first, uint64_t &last) {
+    if (name.size() < 4 || name.compare(name.size() - 4, 4, ".seg") != 0) return false;
+    const char *stop = name.c_str() + name.size() - 4;
+    char *end = nullptr;
+    window = strtoll(name.c_str(), &end, 10);
+    if (end == name.c_str() || *end != '-') return false;
+    const char *s = end + 1;
+    first = last = strtoull(s, &end, 10);
+    if (end == s || !isdigit((unsigned char)*s)) return false;
+    if (*end == '-') {
+        s = end + 1;
+        last = strtoull(s, &end, 10);
+        if (end == s || !isdigit((unsigned char)*s) || last < first) return false;
+    }
+    return end == stop;
+}
+
+std::shared_ptr<const HistorySegment> HistorySegment::open(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SegmentHeader)) {
+        close(fd);
+        return nullptr;
+    }
+    void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return nullptr;
+    // queries jump straight to one sensor's rows; readahead would pull in everyone else's
+    madvise(p, (size_t)st.st_size, MADV_RANDOM);
+
+    std::shared_ptr<HistorySegment> seg(new HistorySegment());
+    seg->path_ = path;
+    seg->data_ = (const char *)p;
+    seg->size_ = (size_t)st.st_size;
+    SegmentHeader h;
+    memcpy(&h, seg->data_, sizeof(h));
+    if (memcmp(h.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0) return nullptr;
+    size_t index_end = sizeof(SegmentHeader) + (size_t)h.sensors * sizeof(SegmentIndexEntry);
+    if (h.names_offset != index_end || h.columns_offset < h.names_offset || h.columns_offset % 8 != 0 ||
+        h.columns_offset > seg->size_ || h.rows > (seg->size_ - h.columns_offset) / ROW_BYTES) {
+        return nullptr;
+    }
+    seg->sensors_ = h.sensors;
+    seg->rows_ = (size_t)h.rows;
+    seg->min_ts_ = h.min_ts;
+    seg->max_ts_ = h.max_ts;
+    seg->names_offset_ = (size_t)h.names_offset;
+    seg->columns_offset_ = (size_t)h.columns_offset;
+    seg->step_ = h.step;
+    std::string name = std::filesystem::path(path).filename().string();
+    if (!parse_segment_name(name, seg->window_, seg->first_seq_, seg->last_seq_)) {
+        seg->window_ = history_window_of(seg->min_ts_, seg->step_);
+    }
+    size_t names_bytes = seg->columns_offset_ - seg->names_offset_;
+    for (size_t i = 0; i < seg->sensors_; ++i) {
+        const SegmentIndexEntry *e = seg->entry(i);
+        if ((size_t)e->name_offset + e->name_length > names_bytes || e->first_row > seg->rows_ ||
+            e->rows > seg->rows_ - e->first_row) {
+            return nullptr;
+        }
+    }
+    return seg;
+}
+
+HistorySegment::~HistorySegment() {
+    if (data_) munmap((void *)data_, size_);
+}
+
+const SegmentIndexEntry *HistorySegment::entry(size_t i) const {
+    return (const SegmentIndexEntry *)(data_ + sizeof(SegmentHeader)) + i;
+}
+
+std::string_view HistorySegment::sensor(size_t i) const {
+    const SegmentIndexEntry *e = entry(i);
+    return std::string_view(data_ + names_offset_ + e->name_offset, e->name_length);
+}
+
+int64_t HistorySegment::last_timestamp(size_t i) const {
+    return entry(i)->last_ts;
+}
+
+bool HistorySegment::supersedes(const HistorySegment &other) const {
+    if (&other == this) return false;
+    if (other.window_start() < window_start() || other.window_end() > window_end()) return false;
+    if (other.first_sequence() < first_seq_ || other.last_sequence() > last_seq_) return false;
+    // a raw segment downsampled on its own keeps its sequence, in a wider window
+    return other.window_end() - other.window_start() < window_end() - window_start() ||
+           other.first_sequence() != first_seq_ || other.last_sequence() != last_seq_;
+}
+
+size_t HistorySegment::query(std::string_view sensor, int64_t from, int64_t to, std::vector<SensorReading> &out) const {
+    if (from > max_ts_ || to < min_ts_) return 0;
+    size_t lo = 0, hi = sensors_;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (this->sensor(mid) < sensor) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == sensors_ || this->sensor(lo) != sensor) return 0;
+    const SegmentIndexEntry *e = entry(lo);
+    if (e->rows == 0 || e->first_ts > to || e->last_ts < from) return 0;
+    const int64_t *timestamps = (const int64_t *)(data_ + columns_offset_);
+    const float *temps = (const float *)(timestamps + rows_);
+    const float *hums = temps + rows_;
+    const float *batts = hums + rows_;
+    const int64_t *first = timestamps + e->first_row, *last = first + e->rows;
+    const int64_t *begin = std::lower_bound(first, last, from);
+    const int64_t *end = std::upper_bound(begin, last, to);
+    for (const int64_t *t = begin; t < end; ++t) {
+        size_t row = (size_t)(t - timestamps);
+        SensorReading r;
+        r.timestamp = *t;
+        r.temp = temps[row];
+        r.hum = hums[row];
+        r.batt = batts[row];
+        out.push_back(r);
+    }
+    return (size_t)(end - begin);
+}
+
+bool write_history_segment(const std::string &path, const std::vector<SegmentSeries> &series, uint32_t step) {
+    SegmentHeader h{};
+    memcpy(h.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+    h.sensors = (uint32_t)series.size();
+    h.step = step;
+    h.min_ts = INT64_MAX;
+    h.max_ts = INT64_MIN;
+    std::vector<SegmentIndexEntry> index(series.size());
+    std::string names;
+    for (size_t i = 0; i < series.size(); ++i) {
+        const SegmentSeries &s = series[i];
+        SegmentIndexEntry &e = index[i];
+        e.name_offset = (uint32_t)names.size();
+        e.name_length = (uint32_t)s.sensor.size();
+        e.first_row = h.rows;
+        e.rows = s.readings.size();
+        e.first_ts = s.readings.empty() ? 0 : s.readings.front().timestamp;
+        e.last_ts = s.readings.empty() ? 0 : s.readings.back().timestamp;
+        names += s.sensor;
+        h.rows += s.readings.size();
+        if (!s.readings.empty()) {
+            h.min_ts = std::min(h.min_ts, e.first_ts);
+            h.max_ts = std::max(h.max_ts, e.last_ts);
+        }
+    }
+    if (h.rows == 0) h.min_ts = h.max_ts = 0;
+    h.names_offset = sizeof(SegmentHeader) + index.size() * sizeof(SegmentIndexEntry);
+    h.columns_offset = align8(h.names_offset + names.size());
+
+    std::string buf(h.columns_offset + h.rows * ROW_BYTES, '\0');
+    memcpy(&buf[0], &h, sizeof(h));
+    if (!index.empty()) memcpy(&buf[sizeof(h)], index.data(), index.size() * sizeof(SegmentIndexEntry));
+    if (!names.empty()) memcpy(&buf[h.names_offset], names.data(), names.size());
+    char *timestamps = &buf[h.columns_offset];
+    char *temps = timestamps + h.rows * 8, *hums = temps + h.rows * 4, *batts = hums + h.rows * 4;
+    size_t row = 0;
+    for (const SegmentSeries &s : series) {
+        for (const SensorReading &r : s.readings) {
+            memcpy(timestamps + row * 8, &r.timestamp, 8);
+            memcpy(temps + row * 4, &r.temp, 4);
+            memcpy(hums + row * 4, &r.hum, 4);
+            memcpy(batts + row * 4, &r.batt, 4);
+            ++row;
+        }
+    }
+    return write_file_atomically(path, buf);
+}
+
+// ---- segment catalog ----
+
+// Open segments ordered by their oldest reading; queries copy the pointers and read
+// without holding the lock
+static std::vector<std::shared_ptr<const HistorySegment>> segments;
+// Newest reading of every sensor already in a segment (for write-ahead log replay)
+static std::unordered_map<std::string, int64_t> persisted_until;
+static uint64_t next_sequence = 1;
+static std::shared_mutex segments_mutex;
+static std::atomic<bool> segments_loaded(false);
+static std::mutex segments_load_mutex;
+
+// Readings waiting for the next flush, indexed by sensor handle
+static std::vector<std::vector<SensorReading>> pending;
+static std::mutex pending_mutex;
+
+// Add an opened segment to the catalog. Caller holds segments_mutex exclusively.
+static void add_segment_locked(std::shared_ptr<const HistorySegment> seg) {
+    for (size_t i = 0; i < seg->sensors(); ++i) {
+        int64_t &until = persisted_until.emplace(std::string(seg->sensor(i)), INT64_MIN).first->second;
+        until = std::max(until, seg->last_timestamp(i));
+    }
+    auto pos = std::upper_bound(segments.begin(), segments.end(), seg->min_timestamp(),
+                                [](int64_t ts, const auto &s){ return ts < s->min_timestamp(); });
+    segments.insert(pos, std::move(seg));
+}
+
+static bool load_segments_locked() {
+    std::vector<std::shared_ptr<const HistorySegment>> found;
+    uint64_t max_seq = 0;
+    bool ok = true;
+    std::error_code ec;
+    if (!HISTORY_DIR.empty() && std::filesystem::is_directory(HISTORY_DIR, ec)) {
+        for (const auto &de : std::filesystem::directory_iterator(HISTORY_DIR, ec)) {
+            int64_t window;
+            uint64_t first, last;
+            if (!parse_segment_name(de.path().filename().string(), window, first, last)) continue;
+            auto seg = HistorySegment::open(de.path().string());
+            if (!seg) {
+                std::cerr << "Skipping unreadable history segment " << de.path().string() << "\n";
+                ok = false;
+                continue;
+            }
+            max_seq = std::max(max_seq, last);
+            found.push_back(std::move(seg));
+        }
+        if (ec) ok = false;
+    }
+    // finish a compaction that was interrupted before it deleted its inputs
+    std::vector<std::shared_ptr<const HistorySegment>> live;
+    for (const auto &seg : found) {
+        bool superseded = std::any_of(found.begin(), found.end(), [&](const auto &o){ return o->supersedes(*seg); });
+        if (!superseded) live.push_back(seg);
+        else unlink(seg->path().c_str());
+    }
+    found.swap(live);
+    std::unique_lock<std::shared_mutex> lk(segments_mutex);
+    segments.clear();
+    persisted_until.clear();
+    for (auto &seg : found) add_segment_locked(std::move(seg));
+    next_sequence = std::max(next_sequence, max_seq + 1);
+    segments_loaded.store(true, std::memory_order_release);
+    return ok;
+}
+
+bool load_history_segments() {
+    std::lock_guard<std::mutex> lk(segments_load_mutex);
+    return load_segments_locked();
+}
+
+static void ensure_segments_loaded() {
+    if (segments_loaded.load(std::memory_order_acquire)) return;
+    std::lock_guard<std::mutex> lk(segments_load_mutex);
+    if (!segments_loaded.load()) load_segments_locked();
+}
+
+void history_store_append(SensorHandle h, const SensorReading &reading) {
+    if (HISTORY_DIR.empty()) return;
+    std::lock_guard<std::mutex> lk(pending_mutex);
+    if (pending.size() <= h) pending.resize(h + 1);
+    pending[h].push_back(reading);
+}
+
+void history_store_replay(SensorHandle h, const SensorReading &reading) {
+    if (HISTORY_DIR.empty()) return;
+    ensure_segments_loaded();
+    {
+        std::shared_lock<std::shared_mutex> lk(segments_mutex);
+        auto it = persisted_until.find(sensor_registry.name(h));
+        if (it != persisted_until.end() && reading.timestamp <= it->second) return;
+    }
+    history_store_append(h, reading);
+}
+
+bool flush_history_segments() {
+    if (HISTORY_DIR.empty()) return true;
+    // the periodic flusher and the shutdown path may flush concurrently
+    static std::mutex flush_mutex;
+    std::lock_guard<std::mutex> flk(flush_mutex);
+    ensure_segments_loaded();
+    // swapped with the pending buffers, so each sensor's vector keeps its capacity from one
+    // flush to the one after next and appends stop allocating once it fits an interval
+    static std::vector<std::vector<SensorReading>> batch;
+    for (std::vector<SensorReading> &readings : batch) readings.clear();
+    {
+        std::lock_guard<std::mutex> lk(pending_mutex);
+        if (batch.size() < pending.size()) batch.resize(pending.size());
+        batch.swap(pending);
+    }
+    std::vector<std::pair<std::string, SensorHandle>> sensors;
+    for (SensorHandle h = 0; h < (SensorHandle)batch.size(); ++h) {
+        if (batch[h].empty()) continue;
+        std::stable_sort(batch[h].begin(), batch[h].end(),
+                         [](const SensorReading &a, const SensorReading &b){ return a.timestamp < b.timestamp; });
+        sensors.emplace_back(sensor_registry.name(h), h);
+    }
+    if (sensors.empty()) return true;
+    std::sort(sensors.begin(), sensors.end());
+
+    // split every sensor's readings by window; series stay sorted by sensor id
+    std::map<int64_t, std::vector<SegmentSeries>> windows;
+    std::map<int64_t, std::vector<SensorHandle>> window_handles;
+    for (const auto &s : sensors) {
+        const std::vector<SensorReading> &readings = batch[s.second];
+        for (size_t i = 0; i < readings.size();) {
+            int64_t window = history_window_of(readings[i].timestamp, 0);
+            size_t j = i;
+            while (j < readings.size() && history_window_of(readings[j].timestamp, 0) == window) ++j;
+            windows[window].push_back(SegmentSeries{s.first, std::vector<SensorReading>(readings.begin() + i, readings.begin() + j)});
+            window_handles[window].push_back(s.second);
+            i = j;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(HISTORY_DIR, ec);
+    bool ok = true;
+    for (const auto &w : windows) {
+        uint64_t seq;
+        {
+            std::unique_lock<std::shared_mutex> lk(segments_mutex);
+            seq = next_sequence++;
+        }
+        std::string path = HISTORY_DIR + "/" + std::to_string(w.first) + "-" + std::to_string(seq) + ".seg";
+        std::shared_ptr<const HistorySegment> seg;
+        if (write_history_segment(path, w.second)) seg = HistorySegment::open(path);
+        if (seg) {
+            std::unique_lock<std::shared_mutex> lk(segments_mutex);
+            add_segment_locked(std::move(seg));
+            continue;
+        }
+        perror("write history segment");
+        ok = false;
+        // keep the readings for the next attempt
+        std::lock_guard<std::mutex> lk(pending_mutex);
+        const std::vector<SensorHandle> &handles = window_handles[w.first];
+        for (size_t i = 0; i < w.second.size(); ++i) {
+            SensorHandle h = handles[i];
+            if (pending.size() <= h) pending.resize(h + 1);
+            pending[h].insert(pending[h].end(), w.second[i].readings.begin(), w.second[i].readings.end());
+        }
+    }
+    return ok;
+}
+
+bool history_store_query(std::string_view id, int64_t from, int64_t to, std::vector<SensorReading> &out) {
+    if (HISTORY_DIR.empty() || from > to) return false;
+    ensure_segments_loaded();
+    size_t before = out.size();
+    std::vector<std::shared_ptr<const HistorySegment>> overlapping;
+    {
+        std::shared_lock<std::shared_mutex> lk(segments_mutex);
+        for (const auto &seg : segments) {
+            if (seg->min_timestamp() > to) break;
+            if (seg->max_timestamp() >= from) overlapping.push_back(seg);
+        }
+    }
+    for (const auto &seg : overlapping) seg->query(id, from, to, out);
+    SensorHandle h = sensor_registry.find(id);
+    if (h != INVALID_SENSOR) {
+        std::lock_guard<std::mutex> lk(pending_mutex);
+        if (h < pending.size()) {
+            for (const SensorReading &r : pending[h]) {
+                if (r.timestamp >= from && r.timestamp <= to) out.push_back(r);
+            }
+        }
+    }
+    // segments of one window may overlap in time
+    auto older = [](const SensorReading &a, const SensorReading &b){ return a.timestamp < b.timestamp; };
+    if (!std::is_sorted(out.begin() + before, out.end(), older)) std::stable_sort(out.begin() + before, out.end(), older);
+    return out.size() > before;
+}
+
+size_t history_segment_count() {
+    ensure_segments_loaded();
+    std::shared_lock<std::shared_mutex> lk(segments_mutex);
+    return segments.size();
+}
+
+std::vector<std::shared_ptr<const HistorySegment>> history_segments() {
+    ensure_segments_loaded();
+    std::shared_lock<std::shared_mutex> lk(segments_mutex);
+    return segments;
+}
+
+int64_t replace_history_segments(const std::vector<std::shared_ptr<const HistorySegment>> &old, const std::string &path) {
+    std::shared_ptr<const HistorySegment> seg;
+    if (!path.empty() && !(seg = HistorySegment::open(path))) return -1;
+    {
+        std::unique_lock<std::shared_mutex> lk(segments_mutex);
+        segments.erase(std::remove_if(segments.begin(), segments.end(), [&](const auto &s){
+            return std::find(old.begin(), old.end(), s) != old.end();
+        }), segments.end());
+        if (seg) add_segment_locked(std::move(seg));
+    }
+    // queries still holding an old segment keep reading its mapping
+    int64_t reclaimed = 0;
+    for (const auto &o : old) {
+        if (o->path() == path) continue;
+        if (unlink(o->path().c_str()) == 0) reclaimed += (int64_t)o->file_bytes();
+    }
+    return reclaimed;
+}
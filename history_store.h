@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef HISTORY_STORE_H
+#define HISTORY_STORE_H
+
+#include "sensor_registry.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// On-disk reading history. Every accepted reading is buffered in memory; the flusher
+// writes the buffer out as immutable columnar segment files in HISTORY_DIR, one per
+// time window (UTC day) it touches, named <window start>-<sequence>.seg. Segments are
+// read through mmap: a query looks up the sensor in each overlapping segment's index and
+// binary-searches its timestamps, so it only touches the pages holding that sensor's
+// rows in the requested range.
+//
+// Compaction (history_compact.h) replaces all segments of a window by one file named
+// <window start>-<first sequence>-<last sequence>.seg. It supersedes every segment in
+// its window whose sequences lie in that range, so segments left behind by an
+// interrupted compaction are dropped when the directory is loaded.
+//
+// Segment layout (host byte order, sections 8-byte aligned):
+//   header   char magic[8] "SHTSEG1\0" | uint32 sensors | uint32 step | uint64 rows
+//            int64 min_ts | int64 max_ts | uint64 names offset | uint64 columns offset
+//   index    per sensor, sorted by id: uint32 name offset | uint32 name length
+//            uint64 first row | uint64 rows | int64 first ts | int64 last ts
+//   names    id bytes
+//   columns  int64 timestamp[rows] | float temp[rows] | float hum[rows] | float batt[rows]
+// Rows are grouped by sensor in index order, oldest first within a sensor. `step` is 0
+// for raw readings; downsampled segments hold one averaged row per sensor and step
+// seconds, stamped with the start of the step.
+
+// Directory of the segment files; empty disables the on-disk history.
+extern std::string HISTORY_DIR;
+// Time window covered by one segment file of raw readings
+constexpr int64_t HISTORY_SEGMENT_WINDOW = 86400;
+// Time window covered by one segment file of downsampled readings (four weeks)
+constexpr int64_t HISTORY_DOWNSAMPLED_WINDOW = 28 * 86400;
+
+// Readings of one sensor, oldest first
+struct SegmentSeries {
+    std::string sensor;
+    std::vector<SensorReading> readings;
+};
+
+struct SegmentIndexEntry;
+
+// A read-only, memory-mapped segment file
+class HistorySegment {
+public:
+    // Map the segment at `path`; null if it cannot be read or is malformed. The window
+    // and sequence range are taken from the file name (see above) when it has that form.
+    static std::shared_ptr<const HistorySegment> open(const std::string &path);
+    ~HistorySegment();
+    HistorySegment(const HistorySegment &) = delete;
+    HistorySegment &operator=(const HistorySegment &) = delete;
+
+    const std::string &path() const { return path_; }
+    int64_t min_timestamp() const { return min_ts_; }
+    int64_t max_timestamp() const { return max_ts_; }
+    size_t rows() const { return rows_; }
+    size_t file_bytes() const { return size_; }
+    size_t sensors() const { return sensors_; }
+    // Seconds per row of a downsampled segment; 0 for raw readings
+    uint32_t step() const { return step_; }
+    int64_t window_start() const { return window_; }
+    int64_t window_end() const { return window_ + (step_ ? HISTORY_DOWNSAMPLED_WINDOW : HISTORY_SEGMENT_WINDOW); }
+    uint64_t first_sequence() const { return first_seq_; }
+    uint64_t last_sequence() const { return last_seq_; }
+    // True if this segment replaced `other` (same or wider window, covering its sequences)
+    bool supersedes(const HistorySegment &other) const;
+    std::string_view sensor(size_t i) const;
+    int64_t last_timestamp(size_t i) const;
+
+    // Append the readings of `sensor` with from <= timestamp <= to to `out`, oldest
+    // first. Returns the number appended.
+    size_t query(std::string_view sensor, int64_t from, int64_t to, std::vector<SensorReading> &out) const;
+
+private:
+    HistorySegment() = default;
+    const SegmentIndexEntry *entry(size_t i) const;
+
+    std::string path_;
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+    size_t sensors_ = 0;
+    size_t rows_ = 0;
+    int64_t min_ts_ = 0, max_ts_ = 0;
+    size_t names_offset_ = 0, columns_offset_ = 0;
+    uint32_t step_ = 0;
+    int64_t window_ = 0;
+    uint64_t first_seq_ = 0, last_seq_ = 0;
+};
+
+// Write `series` (sorted by sensor id, readings oldest first) as a segment file at `path`
+// (atomically, via a temp file). Returns false on I/O errors.
+bool write_history_segment(const std::string &path, const std::vector<SegmentSeries> &series, uint32_t step = 0);
+// Start of the raw (step 0) or downsampled window holding `ts`
+int64_t history_window_of(int64_t ts, uint32_t step);
+
+// Buffer a reading of sensor `h` for the next flush (no-op when HISTORY_DIR is empty)
+void history_store_append(SensorHandle h, const SensorReading &reading);
+// Buffer a reading replayed from the write-ahead log unless a segment already holds it
+void history_store_replay(SensorHandle h, const SensorReading &reading);
+// Write the buffered readings to new segment files. On failure they stay buffered.
+bool flush_history_segments();
+// (Re)open all segment files in HISTORY_DIR (done on first use otherwise)
+bool load_history_segments();
+// Readings of sensor `id` in [from, to] from the segments and the buffer, oldest first;
+// false if there are none
+bool history_store_query(std::string_view id, int64_t from, int64_t to, std::vector<SensorReading> &out);
+// Number of segment files currently open
+size_t history_segment_count();
+// The open segments, ordered by their oldest reading
+std::vector<std::shared_ptr<const HistorySegment>> history_segments();
+// Swap `old` for the segment file at `path` (empty: just drop `old`) in one step, then
+// delete the files of `old`. Queries see either all of `old` or the new segment. Returns
+// the bytes of the deleted files, or -1 (and changes nothing) if `path` cannot be opened.
+int64_t replace_history_segments(const std::vector<std::shared_ptr<const HistorySegment>> &old, const std::string &path);
+
+#endif // HISTORY_STORE_H
@@ -20,71 +20,67 @@
 
 #include "http.h"
 #include "storage.h"
-#include <curl/curl.h>
+#include "http_parser.h"
+#include "trigger_dispatch.h"
+#include "rules.h"
+#include "history.h"
+#include "rollup.h"
+#include "history_compact.h"
+#include "analytics.h"
+#include "metrics.h"
+#include "trace.h"
 #include <set>
 #include <algorithm>
+#include <charconv>
+#include <cmath>
 
 
-// Forward declarations: functions declared in server.h are implemented here.
-
-// (implementation moved earlier)
-
-std::string read_request(int client_fd) {
-    std::string req;
-    char buffer[4096];
-    ssize_t received;
-
-    while ((received = recv(client_fd, buffer, sizeof(buffer), 0)) > 0) {
-        req.append(buffer, received);
-        size_t header_end = req.find("\r\n\r\n");
-        if (header_end != std::string::npos) {
-            size_t cl_pos = req.find("Content-Length:");
-            if (cl_pos != std::string::npos) {
-                size_t line_end = req.find('\r', cl_pos);
-                std::string cl_line = req.substr(cl_pos, (line_end==std::string::npos? req.size(): line_end)-cl_pos);
-                int content_length = 0;
-                std::istringstream iss(cl_line);
-                std::string tmp;
-                iss >> tmp >> content_length;
-                // If client used Expect: 100-continue, send interim response so client will send body
-                std::string req_l = req;
-                std::transform(req_l.begin(), req_l.end(), req_l.begin(), [](unsigned char c){ return std::tolower(c); });
-                size_t expect_pos = req_l.find("expect:");
-                if (expect_pos != std::string::npos) {
-                    size_t expect_end = req_l.find('\r', expect_pos);
-                    std::string expect_line = req_l.substr(expect_pos, (expect_end==std::string::npos? req_l.size(): expect_end)-expect_pos);
-                    if (expect_line.find("100-continue") != std::string::npos) {
-                        const char *cont = "HTTP/1.1 100 Continue\r\n\r\n";
-                        send(client_fd, cont, strlen(cont), 0);
-                    }
-                }
-                size_t body_len = req.size() - (header_end + 4);
-                while ((int)body_len < content_length) {
-                    received = recv(client_fd, buffer, sizeof(buffer), 0);
-                    if (received <= 0) break;
-                    req.append(buffer, received);
-                    body_len = req.size() - (header_end + 4);
-                }
-            }
-            break;
-        }
+static void append_number(std::string &out, long long v) {
+    char buf[24];
+    auto res = std::to_chars(buf, buf + sizeof(buf), v);
+    out.append(buf, res.ptr);
+}
+
+static void append_connection_header(std::string &out, bool keep_alive, int timeout_seconds, int max_requests) {
+    if (!keep_alive) {
+        out += "Connection: close\r\n";
+        return;
     }
+    out += "Connection: keep-alive\r\nKeep-Alive: timeout=";
+    append_number(out, timeout_seconds);
+    out += ", max=";
+    append_number(out, max_requests);
+    out += "\r\n";
+}
 
-    return req;
+void append_response(std::string &out, const std::string &response, bool keep_alive, int timeout_seconds, int max_requests) {
+    size_t status_end = response.find("\r\n");
+    if (status_end == std::string::npos) {
+        out += response;
+        return;
+    }
+    out.append(response, 0, status_end + 2);
+    append_connection_header(out, keep_alive, timeout_seconds, max_requests);
+    out.append(response, status_end + 2, std::string::npos);
 }
 
 // URL-decode a string (handles %XX and +)
-static std::string url_decode(const std::string &s) {
+std::string url_decode(std::string_view s) {
     std::string out;
     out.reserve(s.size());
+    auto hex = [](char h) -> int {
+        if (h >= '0' && h <= '9') return h - '0';
+        if (h >= 'a' && h <= 'f') return h - 'a' + 10;
+        if (h >= 'A' && h <= 'F') return h - 'A' + 10;
+        return -1;
+    };
     for (size_t i = 0; i < s.size(); ++i) {
         char c = s[i];
         if (c == '+') {
             out.push_back(' ');
         } else if (c == '%' && i + 2 < s.size()) {
-            std::string hex = s.substr(i+1, 2);
-            char decoded = (char) strtol(hex.c_str(), nullptr, 16);
-            out.push_back(decoded);
+            int hi = hex(s[i+1]), lo = hex(s[i+2]);
+            out.push_back((char)((hi < 0 || lo < 0) ? 0 : (hi << 4 | lo)));
             i += 2;
         } else {
             out.push_back(c);
@@ -93,63 +89,175 @@ static std::string url_decode(const std::string &s) {
     return out;
 }
 
+std::string_view url_decode(std::string_view s, Arena &arena) {
+    if (s.find_first_of("%+") == std::string_view::npos) return s;
+    // decoding never lengthens the text
+    char *out = static_cast<char *>(arena.allocate(s.size(), 1));
+    auto hex = [](char h) -> int {
+        if (h >= '0' && h <= '9') return h - '0';
+        if (h >= 'a' && h <= 'f') return h - 'a' + 10;
+        if (h >= 'A' && h <= 'F') return h - 'A' + 10;
+        return -1;
+    };
+    size_t n = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+        char c = s[i];
+        if (c == '+') {
+            out[n++] = ' ';
+        } else if (c == '%' && i + 2 < s.size()) {
+            int hi = hex(s[i+1]), lo = hex(s[i+2]);
+            out[n++] = (char)((hi < 0 || lo < 0) ? 0 : (hi << 4 | lo));
+            i += 2;
+        } else {
+            out[n++] = c;
+        }
+    }
+    return std::string_view(out, n);
+}
+
 // Parse query string like "a=1&b=2" into a map with URL-decoded keys/values
-std::map<std::string,std::string> parse_query(const std::string &query) {
+std::map<std::string,std::string> parse_query(std::string_view query) {
     std::map<std::string,std::string> params;
     if (query.empty()) return params;
     size_t start = 0;
     while (start < query.size()) {
         size_t eq = query.find('=', start);
-        if (eq == std::string::npos) break;
-        std::string key = query.substr(start, eq - start);
+        if (eq == std::string_view::npos) break;
+        std::string_view key = query.substr(start, eq - start);
         size_t amp = query.find('&', eq + 1);
-        std::string val = (amp == std::string::npos) ? query.substr(eq + 1) : query.substr(eq + 1, amp - eq - 1);
+        std::string_view val = (amp == std::string_view::npos) ? query.substr(eq + 1) : query.substr(eq + 1, amp - eq - 1);
         params[url_decode(key)] = url_decode(val);
-        if (amp == std::string::npos) break;
+        if (amp == std::string_view::npos) break;
         start = amp + 1;
     }
     return params;
 }
 
+QueryParams::QueryParams(std::string_view query, Arena &arena) : params_(ArenaAllocator<std::pair<std::string_view, std::string_view>>(arena)) {
+    if (query.empty()) return;
+    params_.reserve((size_t)std::count(query.begin(), query.end(), '&') + 1);
+    // the same splitting as parse_query()
+    size_t start = 0;
+    while (start < query.size()) {
+        size_t eq = query.find('=', start);
+        if (eq == std::string_view::npos) break;
+        std::string_view key = query.substr(start, eq - start);
+        size_t amp = query.find('&', eq + 1);
+        std::string_view val = (amp == std::string_view::npos) ? query.substr(eq + 1) : query.substr(eq + 1, amp - eq - 1);
+        params_.emplace_back(url_decode(key, arena), url_decode(val, arena));
+        if (amp == std::string_view::npos) break;
+        start = amp + 1;
+    }
+}
+
+const std::string_view *QueryParams::find(std::string_view name) const {
+    for (auto it = params_.rbegin(); it != params_.rend(); ++it) {
+        if (it->first == name) return &it->second;
+    }
+    return nullptr;
+}
+
 // forward declaration for background executor used below
-static void execute_url_background(const std::string &url);
 
 RequestLine parse_request_line(const std::string &req) {
     RequestLine rl;
-    std::istringstream request_stream(req);
-    std::string request_line;
-    std::getline(request_stream, request_line);
-    if (!request_line.empty() && request_line.back() == '\r') request_line.pop_back();
-    std::istringstream line_stream(request_line);
-    line_stream >> rl.method >> rl.path >> rl.version;
+    std::string_view line(req);
+    size_t eol = line.find('\n');
+    if (eol != std::string_view::npos) line = line.substr(0, eol);
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    size_t sp1 = line.find(' ');
+    rl.method = std::string(line.substr(0, sp1));
+    if (sp1 == std::string_view::npos) return rl;
+    size_t sp2 = line.find(' ', sp1 + 1);
+    rl.path = std::string(line.substr(sp1 + 1, sp2 == std::string_view::npos ? std::string_view::npos : sp2 - sp1 - 1));
+    if (sp2 != std::string_view::npos) rl.version = std::string(line.substr(sp2 + 1));
     return rl;
 }
 
-std::string build_response(const std::string &content_type, const std::string &body) {
-    std::ostringstream resp;
-    resp << "HTTP/1.1 200 OK\r\n"
-         << "Content-Type: " << content_type << "\r\n"
-         << "Content-Length: " << body.size() << "\r\n"
-         << "Access-Control-Allow-Origin: *\r\n"
-         << "\r\n"
-         << body;
-    return resp.str();
+std::string build_status_response(int status) {
+    const char *reason = "Bad Request";
+    switch (status) {
+        case 404: reason = "Not Found"; break;
+        case 405: reason = "Method Not Allowed"; break;
+        case 413: reason = "Payload Too Large"; break;
+        case 431: reason = "Request Header Fields Too Large"; break;
+        case 501: reason = "Not Implemented"; break;
+        case 505: reason = "HTTP Version Not Supported"; break;
+        default: status = 400; break;
+    }
+    return "HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\nContent-Length: 0\r\n\r\n";
+}
+
+// Headers and body of a 200 response, after the status line (and Connection headers)
+static void append_ok_content(std::string &out, std::string_view content_type, std::string_view body) {
+    out += "Content-Type: ";
+    out += content_type;
+    out += "\r\nContent-Length: ";
+    append_number(out, (long long)body.size());
+    out += "\r\nAccess-Control-Allow-Origin: *\r\n\r\n";
+    out += body;
+}
+
+std::string build_response(std::string_view content_type, std::string_view body) {
+    std::string resp;
+    resp.reserve(body.size() + content_type.size() + 128);
+    resp += "HTTP/1.1 200 OK\r\n";
+    append_ok_content(resp, content_type, body);
+    return resp;
+}
+
+// Route tables mirroring the dispatch in process_*_request. Both the latency histogram
+// of a request (route_of) and the methods OPTIONS advertises for a path come from them.
+using RouteEntry = std::pair<std::string_view, Route>;
+static const RouteEntry get_routes[] = {
+    {"/", Route::Root}, {"", Route::Root}, {"/sensors", Route::Sensors}, {"/allSensors", Route::Sensors},
+    {"/saveSensorInformation", Route::SaveSensorInformation}, {"/triggers", Route::Triggers},
+    {"/triggerEvents", Route::Triggers}, {"/historyStatus", Route::HistoryStatus}, {"/rules", Route::Rules},
+    {"/roomStates", Route::RoomStates}, {"/triggersEnabled", Route::TriggersEnabled},
+    {"/settings", Route::Settings}, {"/metrics", Route::Metrics}, {"/debug/traces", Route::DebugTraces},
+};
+static const RouteEntry get_prefixes[] = {
+    {"/sensor/", Route::Sensor}, {"/history/", Route::History}, {"/rollup/", Route::Rollup},
+    {"/analytics/", Route::Analytics}, {"/settings/", Route::RoomSettings},
+};
+static const RouteEntry post_routes[] = {
+    {"/setDesiredTemperature", Route::SetDesiredTemperature}, {"/setHighTrigger", Route::SetHighTrigger},
+    {"/setLowTrigger", Route::SetLowTrigger}, {"/setTriggerControl", Route::SetTriggerControl},
+    {"/addRule", Route::AddRule}, {"/addSchedule", Route::AddSchedule}, {"/triggerAllHigh", Route::TriggerAllHigh},
+    {"/triggerAllLow", Route::TriggerAllLow}, {"/disableTriggers", Route::DisableTriggers},
+    {"/enableTriggers", Route::EnableTriggers}, {"/setTraceSampling", Route::SetTraceSampling},
+};
+static const RouteEntry delete_routes[] = {
+    {"/triggerLog", Route::DeleteTriggerLog},
+};
+static const RouteEntry delete_prefixes[] = {
+    {"/settings", Route::DeleteSettings}, {"/rules/", Route::DeleteRules}, {"/schedules/", Route::DeleteSchedules},
+};
+
+static Route get_route(std::string_view path) {
+    for (const auto &r : get_routes) if (path == r.first) return r.second;
+    for (const auto &r : get_prefixes) if (path.rfind(r.first, 0) == 0) return r.second;
+    return Route::GetOther;
+}
+
+static Route post_route(std::string_view path) {
+    for (const auto &r : post_routes) if (path == r.first) return r.second;
+    return Route::PostOther;
+}
+
+static Route delete_route(std::string_view path) {
+    for (const auto &r : delete_prefixes) if (path.rfind(r.first, 0) == 0) return r.second;
+    for (const auto &r : delete_routes) if (path == r.first) return r.second;
+    return Route::DeleteOther;
 }
 
 // Determine allowed methods for a given request path
-static std::string get_allowed_methods_for_path(const RequestLine &rl) {
+static std::string get_allowed_methods_for_path(const HttpRequest &req) {
     std::set<std::string> methods;
     methods.insert("OPTIONS");
-    if (rl.path == "/" || rl.path.empty() || rl.path == "/sensors" || rl.path.rfind("/sensor/", 0) == 0 || rl.path == "/triggers" || rl.path == "/settings") {
-        methods.insert("GET");
-    }
-    if (rl.path.rfind("/settings", 0) == 0 || rl.path == "/settings") {
-        methods.insert("DELETE");
-    }
-    if (rl.path == "/setDesiredTemperature" || rl.path == "/setHighTrigger" || rl.path == "/setLowTrigger" || rl.path == "/triggerAllHigh" || rl.path == "/triggerAllLow" || rl.path == "/disableTriggers" || rl.path == "/enableTriggers") {
-        methods.insert("POST");
-    }
-    if (rl.path == "/triggerLog") methods.insert("DELETE");
+    if (get_route(req.path) != Route::GetOther) methods.insert("GET");
+    if (post_route(req.path) != Route::PostOther) methods.insert("POST");
+    if (delete_route(req.path) != Route::DeleteOther) methods.insert("DELETE");
 
     std::string out;
     for (const auto &m : methods) {
@@ -160,21 +268,10 @@ static std::string get_allowed_methods_for_path(const RequestLine &rl) {
 }
 
 // Build an OPTIONS response with Allow and CORS headers
-static std::string process_options_request(const RequestLine &rl, const std::string &req) {
-    std::string allow = get_allowed_methods_for_path(rl);
-    // find Access-Control-Request-Headers if present
-    std::string acrh;
-    std::string lower = req;
-    std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c){ return std::tolower(c); });
-    size_t pos = lower.find("access-control-request-headers:");
-    if (pos != std::string::npos) {
-        size_t eol = lower.find('\r', pos);
-        if (eol == std::string::npos) eol = lower.find('\n', pos);
-        size_t start = pos + std::string("access-control-request-headers:").size();
-        acrh = req.substr(start, (eol==std::string::npos? req.size(): eol) - start);
-        while (!acrh.empty() && (acrh.front()==' ' || acrh.front()=='\t')) acrh.erase(acrh.begin());
-        while (!acrh.empty() && (acrh.back()==' ' || acrh.back()=='\t' || acrh.back()=='\r' || acrh.back()=='\n')) acrh.pop_back();
-    }
+static std::string process_options_request(const HttpRequest &req) {
+    std::string allow = get_allowed_methods_for_path(req);
+    // echo Access-Control-Request-Headers if present
+    std::string_view acrh = req.header("Access-Control-Request-Headers");
 
     std::ostringstream resp;
     resp << "HTTP/1.1 204 No Content\r\n";
@@ -190,111 +287,245 @@ static std::string process_options_request(const RequestLine &rl, const std::str
 }
 
 std::string process_request_and_build_response(const std::string &req) {
-    RequestLine rl = parse_request_line(req);
-    
-    if (rl.method == "GET") {
-        return process_get_request(rl);
-    } else if (rl.method == "POST") {
-        return process_post_request(rl, req);
-    } else if (rl.method == "DELETE") {
-        return process_delete_request(rl);
-    } else if (rl.method == "OPTIONS") {
-        return process_options_request(rl, req);
+    HttpParser parser;
+    if (parser.parse(req) != HttpParser::Result::Complete) {
+        return build_status_response(parser.error_status());
+    }
+    return process_request_and_build_response(parser.request());
+}
+
+// Latency histogram a request is recorded in
+static Route route_of(const HttpRequest &req) {
+    if (req.method == "GET") return get_route(req.path);
+    if (req.method == "POST") return post_route(req.path);
+    if (req.method == "DELETE") return delete_route(req.path);
+    if (req.method == "OPTIONS") return Route::Options;
+    return Route::Other;
+}
+
+static std::string dispatch_request(const HttpRequest &req) {
+    if (req.method == "GET") {
+        return process_get_request(req);
+    } else if (req.method == "POST") {
+        return process_post_request(req);
+    } else if (req.method == "DELETE") {
+        return process_delete_request(req);
+    } else if (req.method == "OPTIONS") {
+        return process_options_request(req);
     }
 
     return std::string("HTTP/1.1 405 Method Not Allowed\r\nContent-Length: 0\r\n\r\n");
 }
 
-std::string process_get_request(const RequestLine &rl) {
-    if (rl.path == "/" || rl.path == "") {
-            std::string body = all_sensors_json();
-            return build_response("application/json", body);
-        } else if (rl.path.rfind("/sensor/", 0) == 0) {
-            std::string id = rl.path.substr(std::string("/sensor/").size());
+// Latency of a handler in its route's histogram, and its span if the request is traced
+static void record_request(Route route, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+    metrics_record_latency(route, (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+    if (current_trace) {
+        // the handler as a whole, named after its route
+        const char *method, *path;
+        route_label(route, method, path);
+        auto ns = [](std::chrono::steady_clock::time_point t) {
+            return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+        };
+        trace_record(current_trace, path, ns(start), ns(end));
+    }
+}
+
+std::string process_request_and_build_response(const HttpRequest &req) {
+    auto start = std::chrono::steady_clock::now();
+    std::string resp = dispatch_request(req);
+    record_request(route_of(req), start, std::chrono::steady_clock::now());
+    return resp;
+}
+
+// Numeric query parameter of a sensor report; NaN if absent or not a number
+static float parse_reading_value(const QueryParams &params, const char *name) {
+    const std::string_view *v = params.find(name);
+    if (!v || v->empty()) return NAN;
+    float out;
+    auto res = std::from_chars(v->data(), v->data() + v->size(), out);
+    if (res.ec != std::errc() || res.ptr != v->data() + v->size()) return NAN;
+    return out;
+}
+
+// Optional unsigned integer query parameter; false if present but not a number
+static bool parse_unsigned_param(const std::map<std::string, std::string> &params, const char *name, unsigned long long &out) {
+    auto it = params.find(name);
+    if (it == params.end()) return true;
+    const std::string &v = it->second;
+    auto res = std::from_chars(v.data(), v.data() + v.size(), out);
+    return res.ec == std::errc() && res.ptr == v.data() + v.size();
+}
+
+// GET /saveSensorInformation: store the reading, then run the room's trigger state machine
+// and the rules that reference the sensor. Decoded parameters and the response `body` live
+// in `arena`, so a reading that fires no trigger makes no heap allocation.
+static void save_sensor_information(const HttpRequest &req, Arena &arena, ArenaString &body) {
+    TracePhases phase("query");
+    QueryParams params(req.query, arena);
+
+    std::string_view sensor = "unknown";
+    if (const std::string_view *v = params.find("sensor")) sensor = *v;
+    else if (const std::string_view *id = params.find("id")) sensor = *id;
+    SensorReading reading;
+    reading.timestamp = (int64_t)std::time(nullptr);
+    reading.temp = parse_reading_value(params, "temp");
+    reading.hum = parse_reading_value(params, "hum");
+    reading.batt = parse_reading_value(params, "batt");
+
+    phase.next("store");
+    bool ok = save_sensor_data(sensor, reading);
+
+    // After storing, run the room's trigger state machine; it fires only when the
+    // room switches between heating and cooling (or re-asserts its state)
+    phase.next("trigger");
+    std::string type, url;
+    if (ok && !std::isnan(reading.temp) && evaluate_room_trigger(sensor, reading.temp, reading.timestamp, type, url)) {
+        uint64_t seq = log_trigger_event(std::string(sensor), type, url);
+        if (TRIGGERS_ENABLED.load()) dispatch_trigger(seq, url);
+    }
+    // then the rules that reference this sensor (possibly for other rooms)
+    phase.next("rules");
+    if (ok) {
+        for (const RuleFiring &f : evaluate_rules_for_sensor(sanitize_id(sensor, arena), reading.timestamp)) {
+            uint64_t seq = log_trigger_event(f.room, f.type, f.url);
+            if (TRIGGERS_ENABLED.load()) dispatch_trigger(seq, f.url);
+        }
+    }
+
+    phase.next("build");
+    body.reserve(32 + sensor.size());
+    body += ok ? "Stored sensor data for: " : "Failed to store data for: ";
+    body += sensor;
+}
+
+void process_request(const HttpRequest &req, std::string &out, bool keep_alive, int timeout_seconds, int max_requests) {
+    Arena &arena = request_arena();
+    ArenaScope scope(arena);
+    auto start = std::chrono::steady_clock::now();
+    Route route = route_of(req);
+    if (route == Route::SaveSensorInformation) {
+        ArenaString body{ArenaAllocator<char>(arena)};
+        save_sensor_information(req, arena, body);
+        auto end = std::chrono::steady_clock::now();
+        record_request(route, start, end);
+        uint64_t respond_start = current_trace ? trace_now() : 0;
+        out += "HTTP/1.1 200 OK\r\n";
+        append_connection_header(out, keep_alive, timeout_seconds, max_requests);
+        append_ok_content(out, "text/plain", body);
+        if (current_trace) trace_record(current_trace, "respond", respond_start, trace_now());
+    } else {
+        std::string response = dispatch_request(req);
+        record_request(route, start, std::chrono::steady_clock::now());
+        uint64_t respond_start = current_trace ? trace_now() : 0;
+        append_response(out, response, keep_alive, timeout_seconds, max_requests);
+        if (current_trace) trace_record(current_trace, "respond", respond_start, trace_now());
+    }
+}
+
+std::string process_get_request(const HttpRequest &req) {
+    if (req.path == "/" || req.path == "") {
+            return build_response("application/json", *sensors_snapshot());
+        } else if (req.path.rfind("/sensor/", 0) == 0) {
+            std::string id(req.path.substr(std::string_view("/sensor/").size()));
             std::string data = read_sensor_data(id);
             if (data.empty()) {
                 return std::string("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
             }
             return build_response("application/json", data);
-        } else if (rl.path.rfind("/saveSensorInformation", 0) == 0) {
-            std::string path = rl.path;
-            size_t qpos = path.find('?');
-            std::string query = (qpos!=std::string::npos) ? path.substr(qpos+1) : std::string();
-            std::map<std::string,std::string> params = parse_query(query);
-
-            std::string sensor = "unknown";
-            if (params.count("sensor")) sensor = params["sensor"];
-            else if (params.count("id")) sensor = params["id"];
-            std::string hum = params.count("hum") ? params["hum"] : std::string();
-            std::string temp = params.count("temp") ? params["temp"] : std::string();
-            std::string batt = params.count("batt") ? params["batt"] : std::string();
-
-            std::ostringstream payload;
-            auto now = std::chrono::system_clock::now();
-            std::time_t t = std::chrono::system_clock::to_time_t(now);
-            payload << "{\"timestamp\":\"" << std::put_time(std::localtime(&t), "%Y-%m-%d %H:%M:%S") << "\"";
-            payload << ",\"sensor\":\"" << sensor << "\"";
-            if (!temp.empty()) payload << ",\"temp\":\"" << temp << "\"";
-            if (!hum.empty()) payload << ",\"hum\":\"" << hum << "\"";
-            if (!batt.empty()) payload << ",\"batt\":\"" << batt << "\"";
-            payload << "}";
-
-            bool ok = save_sensor_data(sensor, payload.str());
-            std::string resp_body = ok ? (std::string("Stored sensor data for: ") + sensor) : (std::string("Failed to store data for: ") + sensor);
-
-            // After storing, check desired temperature and triggers
-            if (ok && !temp.empty()) {
-                try {
-                    double measured = std::stod(temp);
-                    double desired = 0.0;
-                    bool has_desired = false;
-                    std::string high_url, low_url;
-                    if (get_room_settings(sensor, desired, has_desired, high_url, low_url) && has_desired) {
-                        if (measured > desired && !high_url.empty()) {
-                            log_trigger_event(sensor, "high", high_url);
-                            if (TRIGGERS_ENABLED.load()) execute_url_background(high_url);
-                        } else if (measured < desired && !low_url.empty()) {
-                            log_trigger_event(sensor, "low", low_url);
-                            if (TRIGGERS_ENABLED.load()) execute_url_background(low_url);
-                        }
-                    }
-                } catch(...) {
-                    // ignore parse errors
-                }
+        } else if (req.path == "/saveSensorInformation") {
+            ArenaScope scope(request_arena());
+            ArenaString body{ArenaAllocator<char>(request_arena())};
+            save_sensor_information(req, request_arena(), body);
+            return build_response("text/plain", body);
+        } else if (req.path == "/sensors" || req.path == "/allSensors") {
+            return build_response("application/json", *sensors_snapshot());
+        } else if (req.path == "/triggers" || req.path == "/triggerEvents") {
+            // optional paging: ?since=<seq>&limit=<n>
+            std::map<std::string,std::string> params = parse_query(req.query);
+            unsigned long long since = 0, limit = SIZE_MAX;
+            if (!parse_unsigned_param(params, "since", since) || !parse_unsigned_param(params, "limit", limit)) {
+                return build_status_response(400);
             }
-
-            return build_response("text/plain", resp_body);
-        } else if (rl.path == "/sensors" || rl.path == "/allSensors") {
-            std::string json = all_sensors_json();
-            return build_response("application/json", json);
-        } else if (rl.path == "/triggers" || rl.path == "/triggerEvents") {
-            std::string json = all_trigger_events_json();
-            return build_response("application/json", json);
-        } else if (rl.path == "/triggersEnabled") {
+            return build_response("application/json", trigger_events_json(since, (size_t)limit));
+        } else if (req.path.rfind("/history/", 0) == 0) {
+            // ?from=&to= (epoch seconds, default: the last 24 hours) &step= (seconds per averaged point, default raw)
+            std::string id(req.path.substr(std::string_view("/history/").size()));
+            std::map<std::string,std::string> params = parse_query(req.query);
+            unsigned long long to = (unsigned long long)std::time(nullptr), from, step = 0;
+            if (!parse_unsigned_param(params, "to", to)) return build_status_response(400);
+            from = to > 86400 ? to - 86400 : 0;
+            if (!parse_unsigned_param(params, "from", from) || !parse_unsigned_param(params, "step", step) ||
+                from > to || to > (unsigned long long)INT64_MAX || step > 31536000) {
+                return build_status_response(400);
+            }
+            std::string js = history_json(id, (int64_t)from, (int64_t)to, (int64_t)step);
+            if (js.empty()) return std::string("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+            return build_response("application/json", js);
+        } else if (req.path.rfind("/rollup/", 0) == 0) {
+            // ?res=minute|hour|day (default hour) &from=&to= (epoch seconds, default everything kept)
+            std::string id(req.path.substr(std::string_view("/rollup/").size()));
+            std::map<std::string,std::string> params = parse_query(req.query);
+            RollupRes res = RollupRes::Hour;
+            unsigned long long from = 0, to = (unsigned long long)INT64_MAX;
+            if ((params.count("res") && !parse_rollup_res(params["res"], res)) || !parse_unsigned_param(params, "from", from) ||
+                !parse_unsigned_param(params, "to", to) || from > to || to > (unsigned long long)INT64_MAX) {
+                return build_status_response(400);
+            }
+            std::string js = rollup_json(id, res, (int64_t)from, (int64_t)to);
+            if (js.empty()) return std::string("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+            return build_response("application/json", js);
+        } else if (req.path.rfind("/analytics/", 0) == 0) {
+            std::string room(req.path.substr(std::string_view("/analytics/").size()));
+            std::string js = analytics_json(room);
+            if (js.empty()) return std::string("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+            return build_response("application/json", js);
+        } else if (req.path == "/metrics") {
+            return build_response("text/plain; version=0.0.4", metrics_text());
+        } else if (req.path == "/debug/traces") {
+            return build_response("application/json", traces_json());
+        } else if (req.path == "/historyStatus") {
+            return build_response("application/json", history_status_json());
+        } else if (req.path == "/rules") {
+            return build_response("application/json", rules_json());
+        } else if (req.path == "/roomStates") {
+            return build_response("application/json", room_states_json());
+        } else if (req.path == "/triggersEnabled") {
             std::string js = TRIGGERS_ENABLED.load() ? "{\"enabled\":true}" : "{\"enabled\":false}";
             return build_response("application/json", js);
-        } else if (rl.path == "/settings") {
+        } else if (req.path == "/settings") {
             std::string json = all_settings_json();
             return build_response("application/json", json);
-        } else if (rl.path.rfind("/settings/", 0) == 0) {
-            std::string room = rl.path.substr(std::string("/settings/").size());
+        } else if (req.path.rfind("/settings/", 0) == 0) {
+            std::string room(req.path.substr(std::string_view("/settings/").size()));
             if (room.empty()) return std::string("HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n");
             std::string js = room_settings_json(room);
             if (js.empty()) return std::string("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
             return build_response("application/json", js);
         } else {
-            std::string body = all_sensors_json();
-            return build_response("application/json", body);
+            return build_response("application/json", *sensors_snapshot());
         }
 }
 
-std::string process_delete_request(const RequestLine &rl) {
-    if (rl.path.rfind("/settings", 0) == 0) {
-        std::string room = rl.path.substr(std::string("/settings/").size());
+std::string process_delete_request(const HttpRequest &req) {
+    if (req.path.rfind("/settings", 0) == 0) {
+        std::string_view rest = req.path.substr(std::string_view("/settings").size());
+        if (!rest.empty() && rest.front() == '/') rest.remove_prefix(1);
+        std::string room(rest);
         if (room.empty()) return build_response("text/plain", "Missing room name");
         bool ok = delete_room_settings(room);
         return build_response("text/plain", ok ? "OK" : "Failed");
-    } if (rl.path == "/triggerLog") {
+    } if (req.path.rfind("/rules/", 0) == 0) {
+        std::string room(req.path.substr(std::string_view("/rules/").size()));
+        if (room.empty()) return build_response("text/plain", "Missing room name");
+        bool ok = clear_room_rules(room);
+        return build_response("text/plain", ok ? "OK" : "Failed");
+    } if (req.path.rfind("/schedules/", 0) == 0) {
+        std::string room(req.path.substr(std::string_view("/schedules/").size()));
+        if (room.empty()) return build_response("text/plain", "Missing room name");
+        bool ok = clear_room_schedule(room);
+        return build_response("text/plain", ok ? "OK" : "Failed");
+    } if (req.path == "/triggerLog") {
         bool ec = clear_trigger_events_log();
         return build_response("text/plain", ec ? "OK" : "Failed");
 
@@ -303,13 +534,11 @@ std::string process_delete_request(const RequestLine &rl) {
     }
 }
 
-std::string process_post_request(const RequestLine &rl, const std::string &req) {
-    size_t header_end = req.find("\r\n\r\n");
-        std::string body = (header_end != std::string::npos) ? req.substr(header_end + 4) : "";
+std::string process_post_request(const HttpRequest &req) {
         // parse POST body as application/x-www-form-urlencoded
-        auto params = parse_query(body);
+        auto params = parse_query(req.body);
         // Route: set desired temperature
-        if (rl.path == "/setDesiredTemperature") {
+        if (req.path == "/setDesiredTemperature") {
             std::string room = params.count("room") ? params["room"] : (params.count("sensor") ? params["sensor"] : "");
             std::string desired_s = params.count("desired") ? params["desired"] : params["value"];
             if (room.empty() || desired_s.empty()) {
@@ -325,7 +554,7 @@ std::string process_post_request(const RequestLine &rl, const std::string &req)
         }
 
         // Route: set high trigger URL
-        if (rl.path == "/setHighTrigger") {
+        if (req.path == "/setHighTrigger") {
             std::string room = params.count("room") ? params["room"] : (params.count("sensor") ? params["sensor"] : "");
             std::string url = params.count("url") ? params["url"] : params["trigger"];
             if (room.empty() || url.empty()) return build_response("text/plain", "Missing room or url");
@@ -334,7 +563,7 @@ std::string process_post_request(const RequestLine &rl, const std::string &req)
         }
 
         // Route: set low trigger URL
-        if (rl.path == "/setLowTrigger") {
+        if (req.path == "/setLowTrigger") {
             std::string room = params.count("room") ? params["room"] : (params.count("sensor") ? params["sensor"] : "");
             std::string url = params.count("url") ? params["url"] : params["trigger"];
             if (room.empty() || url.empty()) return build_response("text/plain", "Missing room or url");
@@ -342,64 +571,126 @@ std::string process_post_request(const RequestLine &rl, const std::string &req)
             return build_response("text/plain", ok ? "OK" : "Failed");
         }
 
+        // Route: set hysteresis band, minimum dwell, re-assert interval and predictive mode (any subset)
+        if (req.path == "/setTriggerControl") {
+            std::string room = params.count("room") ? params["room"] : (params.count("sensor") ? params["sensor"] : "");
+            if (room.empty()) return build_response("text/plain", "Missing room");
+            std::optional<double> hysteresis;
+            std::optional<int> min_dwell, reassert;
+            std::optional<bool> predictive;
+            try {
+                if (params.count("hysteresis")) {
+                    hysteresis = std::stod(params["hysteresis"]);
+                    if (!(*hysteresis >= 0 && *hysteresis <= MAX_HYSTERESIS)) throw std::out_of_range("hysteresis");
+                }
+                for (const char *name : {"min_dwell", "reassert"}) {
+                    if (!params.count(name)) continue;
+                    long v = std::stol(params[name]);
+                    if (v < 0 || v > MAX_CONTROL_SECONDS) throw std::out_of_range(name);
+                    (std::string(name) == "min_dwell" ? min_dwell : reassert) = (int)v;
+                }
+                if (params.count("predictive")) {
+                    const std::string &v = params["predictive"];
+                    if (v == "1" || v == "true") predictive = true;
+                    else if (v == "0" || v == "false") predictive = false;
+                    else throw std::invalid_argument("predictive");
+                }
+            } catch (...) {
+                return build_response("text/plain", "Invalid control value");
+            }
+            if (!hysteresis && !min_dwell && !reassert && !predictive) {
+                return build_response("text/plain", "Missing hysteresis, min_dwell, reassert or predictive");
+            }
+            bool ok = set_trigger_control(room, hysteresis, min_dwell, reassert, predictive);
+            return build_response("text/plain", ok ? "OK" : "Failed");
+        }
+
+        // Route: add a trigger rule to a room (see rules.h for the syntax)
+        if (req.path == "/addRule") {
+            std::string room = params.count("room") ? params["room"] : "";
+            std::string when = params.count("when") ? params["when"] : "";
+            std::string fire = params.count("fire") ? params["fire"] : "";
+            if (room.empty() || when.empty() || fire.empty()) return build_response("text/plain", "Missing room, when or fire");
+            std::string error;
+            if (!add_room_rule(room, when, fire, error)) return build_response("text/plain", "Invalid rule: " + error);
+            return build_response("text/plain", "OK");
+        }
+
+        // Route: add a switch point to a room's weekly schedule (see schedule.h)
+        if (req.path == "/addSchedule") {
+            std::string room = params.count("room") ? params["room"] : "";
+            std::string days = params.count("days") ? params["days"] : "";
+            std::string at = params.count("at") ? params["at"] : "";
+            std::string desired_s = params.count("desired") ? params["desired"] : "";
+            if (room.empty() || days.empty() || at.empty() || desired_s.empty()) {
+                return build_response("text/plain", "Missing room, days, at or desired");
+            }
+            double desired;
+            try {
+                desired = std::stod(desired_s);
+            } catch (...) {
+                return build_response("text/plain", "Invalid desired value");
+            }
+            if (!std::isfinite(desired)) return build_response("text/plain", "Invalid desired value");
+            std::string error;
+            if (!add_room_schedule(room, days, at, desired, error)) return build_response("text/plain", "Invalid schedule: " + error);
+            return build_response("text/plain", "OK");
+        }
+
         // Route: trigger all high triggers immediately
-        if (rl.path == "/triggerAllHigh") {
+        if (req.path == "/triggerAllHigh") {
             auto m = get_all_trigger_urls("high");
             int count = 0;
             for (const auto &kv : m) {
                 const std::string &room = kv.first;
                 const std::string &url = kv.second;
-                log_trigger_event(room, "high", url);
-                if (TRIGGERS_ENABLED.load()) execute_url_background(url);
+                uint64_t seq = log_trigger_event(room, "high", url);
+                note_room_trigger(room, "high", (int64_t)std::time(nullptr));
+                if (TRIGGERS_ENABLED.load()) dispatch_trigger(seq, url);
                 ++count;
             }
             return build_response("text/plain", std::string("Triggered high for: ") + std::to_string(count));
         }
 
         // Route: trigger all low triggers immediately
-        if (rl.path == "/triggerAllLow") {
+        if (req.path == "/triggerAllLow") {
             auto m = get_all_trigger_urls("low");
             int count = 0;
             for (const auto &kv : m) {
                 const std::string &room = kv.first;
                 const std::string &url = kv.second;
-                log_trigger_event(room, "low", url);
-                if (TRIGGERS_ENABLED.load()) execute_url_background(url);
+                uint64_t seq = log_trigger_event(room, "low", url);
+                note_room_trigger(room, "low", (int64_t)std::time(nullptr));
+                if (TRIGGERS_ENABLED.load()) dispatch_trigger(seq, url);
                 ++count;
             }
             return build_response("text/plain", std::string("Triggered low for: ") + std::to_string(count));
         }
 
         // Route: disable triggers
-        if (rl.path == "/disableTriggers") {
+        if (req.path == "/disableTriggers") {
             TRIGGERS_ENABLED.store(false);
             return build_response("text/plain", "Triggers disabled");
         }
 
         // Route: enable triggers
-        if (rl.path == "/enableTriggers") {
+        if (req.path == "/enableTriggers") {
             TRIGGERS_ENABLED.store(true);
             return build_response("text/plain", "Triggers enabled");
         }
 
+        // Route: trace one request in `every` (0 = off), see GET /debug/traces
+        if (req.path == "/setTraceSampling") {
+            unsigned long long every;
+            if (!params.count("every")) return build_response("text/plain", "Missing every");
+            if (!parse_unsigned_param(params, "every", every) || every > INT32_MAX) {
+                return build_response("text/plain", "Invalid every value");
+            }
+            TRACE_SAMPLE_EVERY.store((int)every);
+            return build_response("text/plain", "OK");
+        }
+
         
 
         return build_response("text/plain", "Unknown POST route");
 }
-
-// execute URL in background using libcurl (no fork/exec)
-static void execute_url_background(const std::string &url) {
-    std::thread([url]{
-        CURL *c = curl_easy_init();
-        if (!c) return;
-        curl_easy_setopt(c, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(c, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt(c, CURLOPT_TIMEOUT, 10L);
-        curl_easy_setopt(c, CURLOPT_NOSIGNAL, 1L);
-        curl_easy_setopt(c, CURLOPT_TCP_KEEPALIVE, 1L);
-        // suppress output
-        curl_easy_setopt(c, CURLOPT_WRITEFUNCTION, +[](char*, size_t sz, size_t nmemb, void*){ return sz*nmemb; });
-        curl_easy_perform(c);
-        curl_easy_cleanup(c);
-    }).detach();
-}
@@ -22,6 +22,7 @@
 #define HTTP_H
 
 #include <string>
+#include <string_view>
 #include <map>
 #include <sstream>
 #include <iostream>
@@ -35,6 +36,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <math.h>
+#include "http_parser.h"
+#include "arena.h"
 
 struct RequestLine {
     std::string method;
@@ -42,22 +45,48 @@ struct RequestLine {
     std::string version;
 };
 
-// Read full HTTP request from a connected socket (reads headers and body if Content-Length present)
-std::string read_request(int client_fd);
+// Append `response` to `out` (a connection's output buffer) with `Connection` (and
+// `Keep-Alive`) headers inserted right after its status line.
+void append_response(std::string &out, const std::string &response, bool keep_alive, int timeout_seconds, int max_requests);
 
 // Parse the request line (first line) into method, path and version
 RequestLine parse_request_line(const std::string &req);
 
 // Build a full HTTP response given content type and body
-std::string build_response(const std::string &content_type, const std::string &body);
+std::string build_response(std::string_view content_type, std::string_view body);
+
+// Build an empty-bodied error response for the given status (400, 404, 405, 413, 431, 501, 505)
+std::string build_status_response(int status);
 
 // Process the incoming raw request and return a full HTTP response string
 std::string process_request_and_build_response(const std::string &req);
+// Process an already parsed request (views into the connection buffer)
+std::string process_request_and_build_response(const HttpRequest &req);
+// Same, but append the response with its Connection headers (see append_response) to `out`,
+// a connection's output buffer. Readings (/saveSensorInformation) are answered without
+// heap allocations: everything they need lives in the thread's request arena.
+void process_request(const HttpRequest &req, std::string &out, bool keep_alive, int timeout_seconds, int max_requests);
 
+// Decode %XX escapes and '+' (space) of a URL component
+std::string url_decode(std::string_view s);
+// Same, decoding into `arena`; returns `s` itself if it has nothing to decode
+std::string_view url_decode(std::string_view s, Arena &arena);
 // Parse a URL query string into a map of key->value (URL-decoded)
-std::map<std::string,std::string> parse_query(const std::string &query);
+std::map<std::string,std::string> parse_query(std::string_view query);
+
+// Query parameters split as by parse_query(), as views of the query string (or of `arena`
+// where a key or value had to be decoded); for handlers that must not allocate.
+class QueryParams {
+public:
+    QueryParams(std::string_view query, Arena &arena);
+    // Value of `name` (the last one if repeated); nullptr if absent
+    const std::string_view *find(std::string_view name) const;
+
+private:
+    ArenaVector<std::pair<std::string_view, std::string_view>> params_;
+};
 
-std::string process_get_request(const RequestLine &rl);
-std::string process_post_request(const RequestLine &rl, const std::string &body);
-std::string process_delete_request(const RequestLine &rl);
+std::string process_get_request(const HttpRequest &req);
+std::string process_post_request(const HttpRequest &req);
+std::string process_delete_request(const HttpRequest &req);
 #endif // HTTP_H
@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "http_parser.h"
+#include <cstring>
+
+static char ascii_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+bool iequals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (ascii_lower(a[i]) != ascii_lower(b[i])) return false;
+    }
+    return true;
+}
+
+static std::string_view trim_ows(std::string_view v) {
+    while (!v.empty() && (v.front() == ' ' || v.front() == '\t')) v.remove_prefix(1);
+    while (!v.empty() && (v.back() == ' ' || v.back() == '\t')) v.remove_suffix(1);
+    return v;
+}
+
+std::string_view HttpRequest::header(std::string_view name) const {
+    for (size_t i = 0; i < header_count; ++i) {
+        if (iequals(headers[i].name, name)) return headers[i].value;
+    }
+    return std::string_view();
+}
+
+void HttpParser::reset() {
+    *this = HttpParser();
+}
+
+HttpParser::Result HttpParser::fail(int status) {
+    state_ = State::Failed;
+    error_status_ = status;
+    return Result::Error;
+}
+
+bool HttpParser::parse_request_line(std::string_view line, size_t line_off) {
+    size_t sp1 = line.find(' ');
+    if (sp1 == std::string_view::npos || sp1 == 0) return false;
+    size_t sp2 = line.find(' ', sp1 + 1);
+    if (sp2 == std::string_view::npos || sp2 == sp1 + 1 || sp2 + 1 >= line.size()) return false;
+    method_ = {line_off, sp1};
+    target_ = {line_off + sp1 + 1, sp2 - sp1 - 1};
+    version_ = {line_off + sp2 + 1, line.size() - sp2 - 1};
+    return true;
+}
+
+// Parse one "Name: value" line; tracks the headers that affect framing and connection reuse.
+bool HttpParser::parse_header_line(std::string_view line, size_t line_off) {
+    if (line.front() == ' ' || line.front() == '\t') return false;  // obsolete line folding
+    size_t colon = line.find(':');
+    if (colon == std::string_view::npos || colon == 0) return false;
+    std::string_view name = line.substr(0, colon);
+    if (name.back() == ' ' || name.back() == '\t') return false;
+    std::string_view raw_value = line.substr(colon + 1);
+    std::string_view value = trim_ows(raw_value);
+    size_t value_off = line_off + colon + 1 + (size_t)(value.data() - raw_value.data());
+
+    header_names_[header_count_] = {line_off, name.size()};
+    header_values_[header_count_] = {value_off, value.size()};
+    ++header_count_;
+
+    if (iequals(name, "Content-Length")) {
+        if (value.empty()) return false;
+        size_t len = 0;
+        for (char c : value) {
+            if (c < '0' || c > '9') return false;
+            len = len * 10 + (size_t)(c - '0');
+            if (len > MAX_BODY_BYTES) { error_status_ = 413; return false; }
+        }
+        content_length_ = len;
+    } else if (iequals(name, "Transfer-Encoding")) {
+        if (iequals(value, "chunked")) chunked_ = true;
+        else if (!iequals(value, "identity")) { error_status_ = 501; return false; }
+    } else if (iequals(name, "Connection")) {
+        // comma-separated token list, e.g. "keep-alive, Upgrade"
+        while (!value.empty()) {
+            size_t comma = value.find(',');
+            std::string_view token = trim_ows(value.substr(0, comma));
+            if (iequals(token, "close")) conn_close_ = true;
+            else if (iequals(token, "keep-alive")) conn_keep_alive_ = true;
+            if (comma == std::string_view::npos) break;
+            value.remove_prefix(comma + 1);
+        }
+    } else if (iequals(name, "Expect")) {
+        expect_continue_ = iequals(value, "100-continue");
+    }
+    return true;
+}
+
+void HttpParser::build_request(std::string_view buf) {
+    auto view = [&](const Span &s) { return buf.substr(s.off, s.len); };
+    req_.method = view(method_);
+    req_.target = view(target_);
+    size_t q = req_.target.find('?');
+    req_.path = req_.target.substr(0, q);
+    req_.query = (q == std::string_view::npos) ? std::string_view() : req_.target.substr(q + 1);
+    req_.version = view(version_);
+    req_.body = chunked_ ? std::string_view(chunked_body_) : buf.substr(header_len_, content_length_);
+    req_.raw = buf.substr(method_.off, message_length() - method_.off);
+    req_.header_count = header_count_;
+    for (size_t i = 0; i < header_count_; ++i) {
+        req_.headers[i].name = view(header_names_[i]);
+        req_.headers[i].value = view(header_values_[i]);
+    }
+    req_.keep_alive = keep_alive_;
+}
+
+// Decode a chunked body: "<hex size>[;ext]\r\n<data>\r\n" ... "0\r\n[trailers]\r\n".
+// Chunk-size lines and the trailer section are held to MAX_HEADER_BYTES, like headers.
+HttpParser::Result HttpParser::parse_chunked(std::string_view buf) {
+    while (state_ != State::Done) {
+        if (state_ == State::ChunkData) {
+            // chunk data plus its trailing CRLF
+            if (buf.size() - pos_ < chunk_remaining_ + 2) return Result::Incomplete;
+            chunked_body_.append(buf.data() + pos_, chunk_remaining_);
+            pos_ += chunk_remaining_;
+            if (buf[pos_] != '\r' || buf[pos_ + 1] != '\n') return fail(400);
+            pos_ += 2;
+            state_ = State::ChunkSize;
+            continue;
+        }
+        const char *nl = (pos_ < buf.size())
+            ? static_cast<const char *>(memchr(buf.data() + pos_, '\n', buf.size() - pos_)) : nullptr;
+        // a line (or the trailers) may start no further back than the limit
+        size_t line_start = state_ == State::Trailers ? trailers_off_ : pos_;
+        size_t line_end = nl ? (size_t)(nl - buf.data()) + 1 : buf.size();
+        if (line_end - line_start > MAX_HEADER_BYTES) return fail(400);
+        if (!nl) return Result::Incomplete;
+        std::string_view line = buf.substr(pos_, line_end - 1 - pos_);
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        pos_ = line_end;
+        if (state_ == State::Trailers) {
+            if (line.empty()) state_ = State::Done;
+            continue;
+        }
+        size_t size = 0, digits = 0;
+        for (char c : line) {
+            int v;
+            if (c >= '0' && c <= '9') v = c - '0';
+            else if (c >= 'a' && c <= 'f') v = c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') v = c - 'A' + 10;
+            else break;
+            size = size * 16 + (size_t)v;
+            ++digits;
+            if (chunked_body_.size() + size > MAX_BODY_BYTES) return fail(413);
+        }
+        if (digits == 0) return fail(400);
+        if (size == 0) {
+            state_ = State::Trailers;
+            trailers_off_ = pos_;
+        } else {
+            chunk_remaining_ = size;
+            state_ = State::ChunkData;
+        }
+    }
+    return Result::Complete;
+}
+
+HttpParser::Result HttpParser::parse(std::string_view buf) {
+    if (state_ == State::Failed) return Result::Error;
+    while (state_ == State::RequestLine || state_ == State::Headers) {
+        const char *nl = (pos_ < buf.size())
+            ? static_cast<const char *>(memchr(buf.data() + pos_, '\n', buf.size() - pos_)) : nullptr;
+        if (!nl) {
+            if (buf.size() > MAX_HEADER_BYTES) return fail(431);
+            return Result::Incomplete;
+        }
+        size_t line_end = (size_t)(nl - buf.data());
+        if (line_end + 1 > MAX_HEADER_BYTES) return fail(431);
+        std::string_view line = buf.substr(pos_, line_end - pos_);
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        size_t line_off = pos_;
+        pos_ = line_end + 1;
+
+        if (state_ == State::RequestLine) {
+            if (line.empty()) continue;  // tolerate stray CRLF between pipelined requests
+            if (!parse_request_line(line, line_off)) return fail(400);
+            std::string_view version = buf.substr(version_.off, version_.len);
+            if (version.substr(0, 5) != "HTTP/") return fail(400);
+            if (version != "HTTP/1.1" && version != "HTTP/1.0") return fail(505);
+            state_ = State::Headers;
+            continue;
+        }
+
+        if (line.empty()) {
+            header_len_ = pos_;
+            bool http11 = buf.substr(version_.off, version_.len) == "HTTP/1.1";
+            keep_alive_ = http11 ? !conn_close_ : conn_keep_alive_;
+            if (chunked_) state_ = State::ChunkSize;
+            else state_ = (content_length_ > 0) ? State::Body : State::Done;
+            break;
+        }
+        if (header_count_ == MAX_HEADER_COUNT) return fail(431);
+        if (!parse_header_line(line, line_off)) return fail(error_status_ ? error_status_ : 400);
+    }
+    if (state_ == State::Body && buf.size() >= header_len_ + content_length_) state_ = State::Done;
+    if (state_ == State::ChunkSize || state_ == State::ChunkData || state_ == State::Trailers) {
+        Result r = parse_chunked(buf);
+        if (r == Result::Error) return r;
+    }
+    if (state_ != State::Done) return Result::Incomplete;
+    build_request(buf);
+    return Result::Complete;
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <string>
+#include <string_view>
+#include <cstddef>
+
+// Limits enforced while parsing a single request.
+constexpr size_t MAX_HEADER_BYTES = 8192;     // request line + headers
+constexpr size_t MAX_HEADER_COUNT = 32;
+constexpr size_t MAX_BODY_BYTES = 1 << 20;    // Content-Length upper bound
+
+struct HttpHeader {
+    std::string_view name;
+    std::string_view value;
+};
+
+// A parsed request. All views point into the buffer passed to HttpParser::parse()
+// and stay valid only as long as that buffer is not modified. The one exception is a
+// chunked body, which is decoded into storage owned by the parser.
+struct HttpRequest {
+    std::string_view method;
+    std::string_view target;   // path plus optional "?query"
+    std::string_view path;
+    std::string_view query;    // without the leading '?'
+    std::string_view version;
+    std::string_view body;
+    std::string_view raw;      // the whole message
+    HttpHeader headers[MAX_HEADER_COUNT];
+    size_t header_count = 0;
+    bool keep_alive = false;
+
+    // Case-insensitive header lookup; returns an empty view if the header is absent.
+    std::string_view header(std::string_view name) const;
+};
+
+// Case-insensitive ASCII comparison (header names, tokens).
+bool iequals(std::string_view a, std::string_view b);
+
+// Resumable HTTP/1.x request parser. Feed it the connection buffer after every read;
+// it continues from where the previous call stopped, so each byte is scanned once.
+// Bytes before the start of the buffer's current request must not change between
+// calls; bytes may only be appended.
+class HttpParser {
+public:
+    enum class Result { Incomplete, Complete, Error };
+
+    Result parse(std::string_view buf);
+
+    // Valid after parse() returned Complete.
+    const HttpRequest &request() const { return req_; }
+    // Length of the complete message (valid after Complete).
+    size_t message_length() const { return chunked_ ? pos_ : header_len_ + content_length_; }
+    // HTTP status to answer with after parse() returned Error (400, 413, 431, 501, 505).
+    // An over-long chunk-size line or trailer section is a 400.
+    int error_status() const { return error_status_; }
+    // Headers are complete, the body is still pending and the client sent Expect: 100-continue.
+    bool expect_continue() const { return (state_ == State::Body || state_ == State::ChunkSize) && expect_continue_; }
+
+    // Prepare for the next request (e.g. the next pipelined one).
+    void reset();
+
+private:
+    enum class State { RequestLine, Headers, Body, ChunkSize, ChunkData, Trailers, Done, Failed };
+    struct Span { size_t off = 0; size_t len = 0; };
+
+    Result fail(int status);
+    Result parse_chunked(std::string_view buf);
+    bool parse_request_line(std::string_view line, size_t line_off);
+    bool parse_header_line(std::string_view line, size_t line_off);
+    void build_request(std::string_view buf);
+
+    State state_ = State::RequestLine;
+    size_t pos_ = 0;
+    Span method_, target_, version_;
+    Span header_names_[MAX_HEADER_COUNT];
+    Span header_values_[MAX_HEADER_COUNT];
+    size_t header_count_ = 0;
+    size_t header_len_ = 0;
+    size_t content_length_ = 0;
+    size_t chunk_remaining_ = 0;
+    size_t trailers_off_ = 0;
+    std::string chunked_body_;
+    bool chunked_ = false;
+    bool expect_continue_ = false;
+    bool keep_alive_ = false;
+    bool conn_close_ = false;
+    bool conn_keep_alive_ = false;
+    int error_status_ = 0;
+    HttpRequest req_;
+};
+
+#endif // HTTP_PARSER_H
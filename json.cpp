@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "json.h"
+#include <charconv>
+#include <cstdio>
+#include <cmath>
+#include <ctime>
+
+void json_escape_to(std::string &out, std::string_view s) {
+    for (char c : s) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if ((unsigned char)c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", (unsigned)(unsigned char)c);
+                    out += buf;
+                } else {
+                    out.push_back(c);
+                }
+        }
+    }
+}
+
+size_t format_local_timestamp(int64_t epoch_seconds, char *buf, size_t size) {
+    std::time_t t = (std::time_t)epoch_seconds;
+    std::tm tm_buf;
+    localtime_r(&t, &tm_buf);
+    return strftime(buf, size, "%Y-%m-%d %H:%M:%S", &tm_buf);
+}
+
+bool parse_local_timestamp(std::string_view ts, int64_t &epoch_seconds) {
+    char buf[32];
+    if (ts.size() >= sizeof(buf)) return false;
+    ts.copy(buf, ts.size());
+    buf[ts.size()] = '\0';
+    std::tm tm_buf{};
+    const char *end = strptime(buf, "%Y-%m-%d %H:%M:%S", &tm_buf);
+    if (!end || *end != '\0') return false;
+    tm_buf.tm_isdst = -1;
+    epoch_seconds = (int64_t)mktime(&tm_buf);
+    return true;
+}
+
+// ---- JsonReader ----
+
+void JsonReader::skip_ws() {
+    while (pos_ < s_.size()) {
+        char c = s_[pos_];
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r') break;
+        ++pos_;
+    }
+}
+
+char JsonReader::peek() {
+    if (!ok_) return 0;
+    skip_ws();
+    return pos_ < s_.size() ? s_[pos_] : 0;
+}
+
+bool JsonReader::begin_object() {
+    if (peek() != '{' || depth_ >= 63) return fail();
+    ++pos_;
+    ++depth_;
+    first_bits_ |= (1ull << depth_);
+    return true;
+}
+
+bool JsonReader::begin_array() {
+    if (peek() != '[' || depth_ >= 63) return fail();
+    ++pos_;
+    ++depth_;
+    first_bits_ |= (1ull << depth_);
+    return true;
+}
+
+bool JsonReader::next_key(std::string_view &key, std::string &scratch) {
+    char c = peek();
+    if (c == '}') {
+        ++pos_;
+        first_bits_ &= ~(1ull << depth_);
+        --depth_;
+        return false;
+    }
+    if (!(first_bits_ & (1ull << depth_))) {
+        if (c != ',') return fail();
+        ++pos_;
+    }
+    first_bits_ &= ~(1ull << depth_);
+    if (!read_string(key, scratch)) return fail();
+    if (peek() != ':') return fail();
+    ++pos_;
+    return true;
+}
+
+bool JsonReader::next_element() {
+    char c = peek();
+    if (c == ']') {
+        ++pos_;
+        first_bits_ &= ~(1ull << depth_);
+        --depth_;
+        return false;
+    }
+    if (!(first_bits_ & (1ull << depth_))) {
+        if (c != ',') return fail();
+        ++pos_;
+    } else if (c == 0) {
+        return fail();
+    }
+    first_bits_ &= ~(1ull << depth_);
+    return ok_;
+}
+
+// Find the closing quote of the string starting at pos_ (which must be '"').
+bool JsonReader::scan_string(size_t &end, bool &has_escapes) {
+    has_escapes = false;
+    size_t i = pos_ + 1;
+    while (i < s_.size()) {
+        char c = s_[i];
+        if (c == '\\') { has_escapes = true; i += 2; continue; }
+        if (c == '"') { end = i; return true; }
+        ++i;
+    }
+    return false;
+}
+
+static int hex_value(char h) {
+    if (h >= '0' && h <= '9') return h - '0';
+    if (h >= 'a' && h <= 'f') return h - 'a' + 10;
+    if (h >= 'A' && h <= 'F') return h - 'A' + 10;
+    return -1;
+}
+
+static void append_utf8(std::string &out, uint32_t cp) {
+    if (cp < 0x80) {
+        out.push_back((char)cp);
+    } else if (cp < 0x800) {
+        out.push_back((char)(0xC0 | (cp >> 6)));
+        out.push_back((char)(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        out.push_back((char)(0xE0 | (cp >> 12)));
+        out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back((char)(0x80 | (cp & 0x3F)));
+    } else {
+        out.push_back((char)(0xF0 | (cp >> 18)));
+        out.push_back((char)(0x80 | ((cp >> 12) & 0x3F)));
+        out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back((char)(0x80 | (cp & 0x3F)));
+    }
+}
+
+bool JsonReader::read_string(std::string_view &out, std::string &scratch) {
+    if (peek() != '"') return fail();
+    size_t end;
+    bool has_escapes;
+    if (!scan_string(end, has_escapes)) return fail();
+    std::string_view body = s_.substr(pos_ + 1, end - pos_ - 1);
+    pos_ = end + 1;
+    if (!has_escapes) {
+        out = body;
+        return true;
+    }
+    scratch.clear();
+    for (size_t i = 0; i < body.size(); ++i) {
+        char c = body[i];
+        if (c != '\\') { scratch.push_back(c); continue; }
+        if (++i >= body.size()) return fail();
+        switch (body[i]) {
+            case '"': scratch.push_back('"'); break;
+            case '\\': scratch.push_back('\\'); break;
+            case '/': scratch.push_back('/'); break;
+            case 'b': scratch.push_back('\b'); break;
+            case 'f': scratch.push_back('\f'); break;
+            case 'n': scratch.push_back('\n'); break;
+            case 'r': scratch.push_back('\r'); break;
+            case 't': scratch.push_back('\t'); break;
+            case 'u': {
+                auto read_hex4 = [&](size_t at, uint32_t &v) {
+                    if (at + 4 > body.size()) return false;
+                    v = 0;
+                    for (size_t k = 0; k < 4; ++k) {
+                        int h = hex_value(body[at + k]);
+                        if (h < 0) return false;
+                        v = (v << 4) | (uint32_t)h;
+                    }
+                    return true;
+                };
+                uint32_t cp;
+                if (!read_hex4(i + 1, cp)) return fail();
+                i += 4;
+                // surrogate pair
+                if (cp >= 0xD800 && cp <= 0xDBFF && body.substr(i + 1, 2) == "\\u") {
+                    uint32_t lo;
+                    if (read_hex4(i + 3, lo) && lo >= 0xDC00 && lo <= 0xDFFF) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                        i += 6;
+                    }
+                }
+                append_utf8(scratch, cp);
+                break;
+            }
+            default: return fail();
+        }
+    }
+    out = scratch;
+    return true;
+}
+
+bool JsonReader::read_number(double &out) {
+    char c = peek();
+    if (!(c == '-' || (c >= '0' && c <= '9'))) return fail();
+    const char *first = s_.data() + pos_;
+    const char *last = s_.data() + s_.size();
+    auto res = std::from_chars(first, last, out);
+    if (res.ec != std::errc()) return fail();
+    pos_ += (size_t)(res.ptr - first);
+    return true;
+}
+
+bool JsonReader::read_bool(bool &out) {
+    char c = peek();
+    if (c == 't' && s_.substr(pos_, 4) == "true") { pos_ += 4; out = true; return true; }
+    if (c == 'f' && s_.substr(pos_, 5) == "false") { pos_ += 5; out = false; return true; }
+    return fail();
+}
+
+bool JsonReader::read_null() {
+    if (peek() == 'n' && s_.substr(pos_, 4) == "null") { pos_ += 4; return true; }
+    return fail();
+}
+
+bool JsonReader::skip_value(std::string_view *raw) {
+    char c = peek();
+    size_t start = pos_;
+    if (c == '"') {
+        size_t end;
+        bool esc;
+        if (!scan_string(end, esc)) return fail();
+        pos_ = end + 1;
+    } else if (c == '{' || c == '[') {
+        // scan to the matching bracket, honoring strings; bit n of `objects` tells
+        // whether nesting level n is an object (so mismatched closers are rejected)
+        int depth = 0;
+        uint64_t objects = 0;
+        while (pos_ < s_.size()) {
+            char ch = s_[pos_];
+            if (ch == '"') {
+                size_t end;
+                bool esc;
+                if (!scan_string(end, esc)) return fail();
+                pos_ = end + 1;
+                continue;
+            }
+            ++pos_;
+            if (ch == '{' || ch == '[') {
+                if (++depth + depth_ > 63) return fail();
+                if (ch == '{') objects |= (1ull << depth);
+                else objects &= ~(1ull << depth);
+            } else if (ch == '}' || ch == ']') {
+                if (((objects >> depth) & 1) != (ch == '}')) return fail();
+                if (--depth == 0) break;
+            }
+        }
+        if (depth != 0) return fail();
+    } else if (c == 0) {
+        return fail();
+    } else {
+        while (pos_ < s_.size()) {
+            char ch = s_[pos_];
+            if (ch == ',' || ch == '}' || ch == ']' || ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r') break;
+            ++pos_;
+        }
+        if (pos_ == start) return fail();
+    }
+    if (raw) *raw = s_.substr(start, pos_ - start);
+    return true;
+}
+
+// ---- JsonWriter ----
+
+void JsonWriter::separator() {
+    if (after_key_) {
+        after_key_ = false;
+        return;
+    }
+    uint64_t bit = 1ull << (depth_ & 63);
+    if (first_bits_ & bit) first_bits_ &= ~bit;
+    else out_.push_back(',');
+}
+
+void JsonWriter::key(std::string_view k) {
+    separator();
+    out_.push_back('"');
+    json_escape_to(out_, k);
+    out_ += "\":";
+    after_key_ = true;
+}
+
+void JsonWriter::value_string(std::string_view v) {
+    separator();
+    out_.push_back('"');
+    json_escape_to(out_, v);
+    out_.push_back('"');
+}
+
+void JsonWriter::value_number(double v) {
+    separator();
+    if (!std::isfinite(v)) {
+        out_ += "null";
+        return;
+    }
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%.15g", v);
+    out_.append(buf, (size_t)n);
+}
+
+void JsonWriter::value_int(long long v) {
+    separator();
+    char buf[24];
+    auto res = std::to_chars(buf, buf + sizeof(buf), v);
+    out_.append(buf, (size_t)(res.ptr - buf));
+}
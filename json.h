@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef JSON_H
+#define JSON_H
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+// Minimal single-pass JSON reader/writer shared by the storage code (settings,
+// sensor data, trigger log). The reader pulls values from a string_view without
+// building a DOM; strings without escapes are returned as views into the input.
+
+// Append `s` to `out` with JSON string escaping (no surrounding quotes)
+void json_escape_to(std::string &out, std::string_view s);
+
+// Timestamps in stored JSON are local time "YYYY-mm-dd HH:MM:SS".
+// Format `epoch_seconds` into `buf` (at least 20 bytes); returns the length.
+size_t format_local_timestamp(int64_t epoch_seconds, char *buf, size_t size);
+// Parse such a string back into seconds since the epoch.
+bool parse_local_timestamp(std::string_view ts, int64_t &epoch_seconds);
+
+class JsonReader {
+public:
+    explicit JsonReader(std::string_view s) : s_(s) {}
+
+    // Peek at the first character of the next value ('{', '[', '"', 'n', 't', 'f' or a digit/'-');
+    // returns 0 at end of input.
+    char peek();
+
+    // Objects: begin_object(), then next_key() until it returns false, reading one value per key.
+    bool begin_object();
+    bool next_key(std::string_view &key, std::string &scratch);
+    // Arrays: begin_array(), then next_element() until it returns false, reading one value each time.
+    bool begin_array();
+    bool next_element();
+
+    // Read a string value. The view points into the input when the string has no escapes,
+    // otherwise into `scratch` (which is overwritten).
+    bool read_string(std::string_view &out, std::string &scratch);
+    bool read_number(double &out);
+    bool read_bool(bool &out);
+    bool read_null();
+    // Skip any value; `raw` (optional) receives its exact source text.
+    bool skip_value(std::string_view *raw = nullptr);
+
+    // False once a syntax error was seen; all further reads fail.
+    bool ok() const { return ok_; }
+    size_t position() const { return pos_; }
+
+private:
+    void skip_ws();
+    bool fail() { ok_ = false; return false; }
+    bool scan_string(size_t &end, bool &has_escapes);
+
+    std::string_view s_;
+    size_t pos_ = 0;
+    bool ok_ = true;
+    // per nesting level: whether the first member/element is still to come
+    uint64_t first_bits_ = 0;
+    int depth_ = 0;
+};
+
+// Streaming writer appending to a caller-owned string. Commas are inserted automatically.
+class JsonWriter {
+public:
+    explicit JsonWriter(std::string &out) : out_(out) {}
+
+    void begin_object() { separator(); out_.push_back('{'); push(); }
+    void end_object() { pop(); out_.push_back('}'); }
+    void begin_array() { separator(); out_.push_back('['); push(); }
+    void end_array() { pop(); out_.push_back(']'); }
+
+    void key(std::string_view k);
+    void value_string(std::string_view v);
+    void value_number(double v);
+    void value_int(long long v);
+    void value_bool(bool v) { separator(); out_ += v ? "true" : "false"; }
+    void value_null() { separator(); out_ += "null"; }
+    // Insert an already serialized JSON value verbatim
+    void value_raw(std::string_view v) { separator(); out_.append(v.data(), v.size()); }
+
+private:
+    void separator();
+    void push() { ++depth_; first_bits_ |= (1ull << (depth_ & 63)); }
+    void pop() { first_bits_ &= ~(1ull << (depth_ & 63)); --depth_; }
+
+    std::string &out_;
+    uint64_t first_bits_ = 1;
+    int depth_ = 0;
+    bool after_key_ = false;
+};
+
+#endif // JSON_H
@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "metrics.h"
+#include "storage.h"
+#include "history.h"
+#include "history_store.h"
+#include "timer_wheel.h"
+#include "trigger_dispatch.h"
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Shards of all threads that recorded anything; never freed, so counts of threads that
+// exited stay in the totals
+static std::vector<std::unique_ptr<MetricsShard>> shards;
+static std::mutex shards_mutex;
+
+MetricsShard &metrics_shard() {
+    thread_local MetricsShard *shard = nullptr;
+    if (!shard) {
+        auto s = std::make_unique<MetricsShard>();  // value-initialized: all zero
+        shard = s.get();
+        std::lock_guard<std::mutex> lk(shards_mutex);
+        shards.push_back(std::move(s));
+    }
+    return *shard;
+}
+
+uint64_t latency_bucket_limit(size_t b) {
+    constexpr size_t sub = (size_t)1 << LATENCY_SUB_BITS;
+    if (b < sub) return b + 1;
+    int shift = (int)(b >> LATENCY_SUB_BITS) - 1;
+    return (uint64_t)(sub + (b & (sub - 1)) + 1) << shift;
+}
+
+static const struct { const char *method, *path; } route_labels[] = {
+    {"GET", "/"}, {"GET", "/sensors"}, {"GET", "/sensor/<id>"}, {"GET", "/saveSensorInformation"},
+    {"GET", "/triggers"}, {"GET", "/history/<id>"}, {"GET", "/rollup/<id>"}, {"GET", "/analytics/<room>"},
+    {"GET", "/historyStatus"}, {"GET", "/rules"}, {"GET", "/roomStates"}, {"GET", "/triggersEnabled"},
+    {"GET", "/settings"}, {"GET", "/settings/<room>"}, {"GET", "/metrics"}, {"GET", "/debug/traces"}, {"GET", "other"},
+    {"POST", "/setDesiredTemperature"}, {"POST", "/setHighTrigger"}, {"POST", "/setLowTrigger"},
+    {"POST", "/setTriggerControl"}, {"POST", "/addRule"}, {"POST", "/addSchedule"}, {"POST", "/triggerAllHigh"},
+    {"POST", "/triggerAllLow"}, {"POST", "/disableTriggers"}, {"POST", "/enableTriggers"},
+    {"POST", "/setTraceSampling"}, {"POST", "other"},
+    {"DELETE", "/settings/<room>"}, {"DELETE", "/rules/<room>"}, {"DELETE", "/schedules/<room>"},
+    {"DELETE", "/triggerLog"}, {"DELETE", "other"},
+    {"OPTIONS", "*"}, {"other", "other"},
+};
+static_assert(sizeof(route_labels) / sizeof(route_labels[0]) == (size_t)Route::Count, "a label per route");
+
+void route_label(Route r, const char *&method, const char *&path) {
+    method = route_labels[(size_t)r].method;
+    path = route_labels[(size_t)r].path;
+}
+
+uint64_t metrics_counter(Counter c) {
+    uint64_t total = 0;
+    std::lock_guard<std::mutex> lk(shards_mutex);
+    for (const auto &s : shards) total += s->counters[(size_t)c].load(std::memory_order_relaxed);
+    return total;
+}
+
+uint64_t metrics_route_count(Route r) {
+    uint64_t total = 0;
+    std::lock_guard<std::mutex> lk(shards_mutex);
+    for (const auto &s : shards) {
+        for (const auto &b : s->latency[(size_t)r]) total += b.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+static void append_number(std::string &out, double v) {
+    char buf[32];
+    int n = std::snprintf(buf, sizeof(buf), "%.9g", v);
+    out.append(buf, (size_t)n);
+}
+
+static void append_metric(std::string &out, const char *name, const char *type, const char *help) {
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+static void append_sample(std::string &out, const char *name, const char *labels, double v) {
+    out += name;
+    if (labels) {
+        out += '{';
+        out += labels;
+        out += '}';
+    }
+    out += ' ';
+    append_number(out, v);
+    out += '\n';
+}
+
+std::string metrics_text() {
+    constexpr size_t routes = (size_t)Route::Count;
+    std::vector<uint64_t> latency(routes * LATENCY_BUCKETS), latency_sum(routes);
+    uint64_t counters[(size_t)Counter::Count] = {};
+    {
+        std::lock_guard<std::mutex> lk(shards_mutex);
+        for (const auto &s : shards) {
+            for (size_t r = 0; r < routes; ++r) {
+                for (size_t b = 0; b < LATENCY_BUCKETS; ++b) {
+                    latency[r * LATENCY_BUCKETS + b] += s->latency[r][b].load(std::memory_order_relaxed);
+                }
+                latency_sum[r] += s->latency_sum_us[r].load(std::memory_order_relaxed);
+            }
+            for (size_t c = 0; c < (size_t)Counter::Count; ++c) counters[c] += s->counters[c].load(std::memory_order_relaxed);
+        }
+    }
+    auto counter = [&](Counter c) { return (double)counters[(size_t)c]; };
+
+    std::string out;
+    out.reserve(16384);
+    const char *hist = "shelly_http_request_duration_seconds";
+    append_metric(out, hist, "histogram", "Time to handle a request and build its response, per route.");
+    std::string labels, bucket_labels;
+    for (size_t r = 0; r < routes; ++r) {
+        const uint64_t *buckets = &latency[r * LATENCY_BUCKETS];
+        size_t last = LATENCY_BUCKETS;
+        for (size_t b = 0; b < LATENCY_BUCKETS; ++b) {
+            if (buckets[b]) last = b;
+        }
+        if (last == LATENCY_BUCKETS) continue;  // never requested
+        const char *method, *path;
+        route_label((Route)r, method, path);
+        labels = std::string("method=\"") + method + "\",route=\"" + path + "\"";
+        uint64_t cumulative = 0;
+        for (size_t b = 0; b <= last; ++b) {
+            // only buckets that were used: a bucket once listed stays listed
+            if (!buckets[b]) continue;
+            cumulative += buckets[b];
+            bucket_labels = labels + ",le=\"";
+            char le[32];
+            int n = std::snprintf(le, sizeof(le), "%.9g", (double)latency_bucket_limit(b) / 1e6);
+            bucket_labels.append(le, (size_t)n);
+            bucket_labels += '"';
+            append_sample(out, "shelly_http_request_duration_seconds_bucket", bucket_labels.c_str(), (double)cumulative);
+        }
+        append_sample(out, "shelly_http_request_duration_seconds_bucket", (labels + ",le=\"+Inf\"").c_str(), (double)cumulative);
+        append_sample(out, "shelly_http_request_duration_seconds_sum", labels.c_str(), (double)latency_sum[r] / 1e6);
+        append_sample(out, "shelly_http_request_duration_seconds_count", labels.c_str(), (double)cumulative);
+    }
+
+    append_metric(out, "shelly_connections_accepted_total", "counter", "Client connections accepted.");
+    append_sample(out, "shelly_connections_accepted_total", nullptr, counter(Counter::ConnectionsAccepted));
+    append_metric(out, "shelly_connections_failed_total", "counter", "Connections that failed to set up or hit a socket error.");
+    append_sample(out, "shelly_connections_failed_total", nullptr, counter(Counter::ConnectionsFailed));
+    append_metric(out, "shelly_connections_open", "gauge", "Client connections currently open.");
+    append_sample(out, "shelly_connections_open", nullptr,
+                  counter(Counter::ConnectionsAccepted) - counter(Counter::ConnectionsClosed));
+
+    append_metric(out, "shelly_trigger_requests_total", "counter", "Trigger requests by final outcome.");
+    append_sample(out, "shelly_trigger_requests_total", "outcome=\"success\"", counter(Counter::TriggersSucceeded));
+    append_sample(out, "shelly_trigger_requests_total", "outcome=\"http_error\"", counter(Counter::TriggersHttpError));
+    append_sample(out, "shelly_trigger_requests_total", "outcome=\"failed\"", counter(Counter::TriggersFailed));
+    append_sample(out, "shelly_trigger_requests_total", "outcome=\"rejected\"", counter(Counter::TriggersRejected));
+    append_sample(out, "shelly_trigger_requests_total", "outcome=\"cancelled\"", counter(Counter::TriggersCancelled));
+    append_metric(out, "shelly_trigger_retries_total", "counter", "Trigger requests retried after a failure.");
+    append_sample(out, "shelly_trigger_retries_total", nullptr, counter(Counter::TriggersRetried));
+    append_metric(out, "shelly_trigger_queue_depth", "gauge", "Triggers waiting, in flight or waiting for a retry.");
+    append_sample(out, "shelly_trigger_queue_depth", nullptr, (double)trigger_queue_depth());
+
+    append_metric(out, "shelly_readings_flushes_total", "counter", "Snapshots of the readings written to disk.");
+    append_sample(out, "shelly_readings_flushes_total", nullptr, counter(Counter::ReadingsFlushes));
+    append_metric(out, "shelly_readings_flush_failures_total", "counter", "Snapshots of the readings that could not be written.");
+    append_sample(out, "shelly_readings_flush_failures_total", nullptr, counter(Counter::ReadingsFlushFailures));
+    append_metric(out, "shelly_readings_flush_seconds_total", "counter", "Time spent writing snapshots of the readings.");
+    append_sample(out, "shelly_readings_flush_seconds_total", nullptr, counter(Counter::ReadingsFlushMicros) / 1e6);
+    append_metric(out, "shelly_readings_flush_bytes_total", "counter", "Bytes of snapshots of the readings written.");
+    append_sample(out, "shelly_readings_flush_bytes_total", nullptr, counter(Counter::ReadingsFlushBytes));
+
+    size_t samples, bytes;
+    history_memory(samples, bytes);
+    append_metric(out, "shelly_sensors", "gauge", "Sensors known.");
+    append_sample(out, "shelly_sensors", nullptr, (double)sensor_registry.size());
+    append_metric(out, "shelly_history_samples", "gauge", "Readings held in the in-memory history.");
+    append_sample(out, "shelly_history_samples", nullptr, (double)samples);
+    append_metric(out, "shelly_history_memory_bytes", "gauge", "Memory allocated by the in-memory history.");
+    append_sample(out, "shelly_history_memory_bytes", nullptr, (double)bytes);
+    append_metric(out, "shelly_history_segments", "gauge", "History segment files on disk.");
+    append_sample(out, "shelly_history_segments", nullptr, (double)history_segment_count());
+    append_metric(out, "shelly_timers_pending", "gauge", "Timers waiting on the timer wheel.");
+    append_sample(out, "shelly_timers_pending", nullptr, (double)pending_timers());
+    return out;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Counters and latency histograms exported on GET /metrics in the Prometheus text format.
+// Every thread records into its own shard, created on its first use: a record is a
+// relaxed load and store on memory no other thread writes, so it costs a few
+// nanoseconds and takes no lock. A scrape adds up the shards; values may lag a record
+// or two behind but never go backwards.
+
+// Routes with their own latency histogram (route_label() gives the method and path)
+enum class Route : uint8_t {
+    Root, Sensors, Sensor, SaveSensorInformation, Triggers, History, Rollup, Analytics, HistoryStatus,
+    Rules, RoomStates, TriggersEnabled, Settings, RoomSettings, Metrics, DebugTraces, GetOther,
+    SetDesiredTemperature, SetHighTrigger, SetLowTrigger, SetTriggerControl, AddRule, AddSchedule,
+    TriggerAllHigh, TriggerAllLow, DisableTriggers, EnableTriggers, SetTraceSampling, PostOther,
+    DeleteSettings, DeleteRules, DeleteSchedules, DeleteTriggerLog, DeleteOther,
+    Options, Other,
+    Count
+};
+
+enum class Counter : uint8_t {
+    ConnectionsAccepted,
+    ConnectionsFailed,     // accept or setup failed, or a socket error while serving
+    ConnectionsClosed,
+    TriggersSucceeded,     // 2xx-4xx response
+    TriggersHttpError,     // 5xx response after the last retry
+    TriggersFailed,        // no response after the last retry
+    TriggersRejected,      // dispatcher not running or queue full
+    TriggersCancelled,
+    TriggersRetried,
+    ReadingsFlushes,
+    ReadingsFlushFailures,
+    ReadingsFlushMicros,
+    ReadingsFlushBytes,
+    Count
+};
+
+// Latency buckets: microseconds 0-7 one each, then 8 linear steps per power of two
+// (at most 12.5% wide) up to 2^26 µs (~67 s); slower requests land in the last bucket.
+constexpr int LATENCY_SUB_BITS = 3;
+constexpr size_t LATENCY_BUCKETS = (26 - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS;
+
+// Bucket of a latency of `us` microseconds
+inline size_t latency_bucket(uint64_t us) {
+    constexpr uint64_t sub = 1u << LATENCY_SUB_BITS;
+    if (us < sub) return (size_t)us;
+    int e = 63 - __builtin_clzll(us);  // e >= LATENCY_SUB_BITS
+    size_t b = ((size_t)(e - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS) | (size_t)((us >> (e - LATENCY_SUB_BITS)) & (sub - 1));
+    return std::min(b, LATENCY_BUCKETS - 1);
+}
+// Exclusive upper bound of bucket `b`, in microseconds
+uint64_t latency_bucket_limit(size_t b);
+
+struct MetricsShard {
+    std::atomic<uint64_t> latency[(size_t)Route::Count][LATENCY_BUCKETS];
+    std::atomic<uint64_t> latency_sum_us[(size_t)Route::Count];
+    std::atomic<uint64_t> counters[(size_t)Counter::Count];
+};
+
+// This thread's shard
+MetricsShard &metrics_shard();
+
+// Only the owning thread writes a shard, so a plain load and store is enough
+inline void metrics_bump(std::atomic<uint64_t> &v, uint64_t n) {
+    v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline void metrics_count(Counter c, uint64_t n = 1) {
+    metrics_bump(metrics_shard().counters[(size_t)c], n);
+}
+
+inline void metrics_record_latency(Route r, uint64_t us) {
+    MetricsShard &s = metrics_shard();
+    metrics_bump(s.latency[(size_t)r][latency_bucket(us)], 1);
+    metrics_bump(s.latency_sum_us[(size_t)r], us);
+}
+
+// "GET", "/sensor/<id>" etc.
+void route_label(Route r, const char *&method, const char *&path);
+
+// Sum of a counter over all shards
+uint64_t metrics_counter(Counter c);
+// Requests recorded for a route over all shards
+uint64_t metrics_route_count(Route r);
+
+// The Prometheus exposition: counters, per-route histograms (buckets up to the highest
+// one used) and gauges of the in-memory state
+std::string metrics_text();
+
+#endif // METRICS_H
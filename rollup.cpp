@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "rollup.h"
+#include "storage.h"
+#include "json.h"
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+
+std::atomic<int> ROLLUP_MINUTES(1440);
+std::atomic<int> ROLLUP_HOURS(744);
+std::atomic<int> ROLLUP_DAYS(731);
+
+static int64_t floor_div(int64_t a, int64_t b) {
+    return a / b - (a % b < 0);
+}
+
+// Local UTC offset at `ts`; localtime_r() is only called once per hour of timestamps
+static int64_t local_offset(int64_t ts) {
+    thread_local int64_t cached_hour = INT64_MIN;
+    thread_local int64_t cached_offset = 0;
+    int64_t hour = floor_div(ts, 3600);
+    if (hour != cached_hour) {
+        std::time_t t = (std::time_t)ts;
+        std::tm tm{};
+        localtime_r(&t, &tm);
+        cached_hour = hour;
+        cached_offset = tm.tm_gmtoff;
+    }
+    return cached_offset;
+}
+
+static int64_t bucket_number(RollupRes res, int64_t ts) {
+    switch (res) {
+        case RollupRes::Minute: return floor_div(ts, 60);
+        case RollupRes::Hour: return floor_div(ts, 3600);
+        default: return floor_div(ts + local_offset(ts), 86400);
+    }
+}
+
+static int64_t bucket_start(RollupRes res, int64_t number) {
+    if (res == RollupRes::Minute) return number * 60;
+    if (res == RollupRes::Hour) return number * 3600;
+    // local midnight of that calendar day (23 or 25 hours before the next on DST changes)
+    std::time_t t = (std::time_t)(number * 86400);
+    std::tm tm{};
+    gmtime_r(&t, &tm);
+    tm.tm_isdst = -1;
+    return (int64_t)mktime(&tm);
+}
+
+SensorRollups::SensorRollups() = default;
+
+void SensorRollups::add(int64_t timestamp, float temp, float hum) {
+    static const std::atomic<int> *const lengths[3] = {&ROLLUP_MINUTES, &ROLLUP_HOURS, &ROLLUP_DAYS};
+    for (int r = 0; r < 3; ++r) {
+        Level &level = levels_[r];
+        if (level.ring.empty()) {
+            int length = lengths[r]->load();
+            if (length <= 0) continue;
+            level.ring.resize((size_t)length);
+        }
+        int64_t number = bucket_number((RollupRes)r, timestamp);
+        int64_t size = (int64_t)level.ring.size();
+        // older than anything the ring still holds
+        if (level.newest != INT64_MIN && number <= level.newest - size) continue;
+        level.newest = std::max(level.newest, number);
+        Slot &slot = level.ring[(size_t)(((number % size) + size) % size)];
+        if (slot.number != number) {
+            slot.number = number;
+            slot.stats = RollupStats();
+        }
+        RollupStats &s = slot.stats;
+        ++s.count;
+        if (!std::isnan(temp)) {
+            s.temp_min = s.temp_count ? std::min(s.temp_min, temp) : temp;
+            s.temp_max = s.temp_count ? std::max(s.temp_max, temp) : temp;
+            s.temp_sum += temp;
+            ++s.temp_count;
+        }
+        if (!std::isnan(hum)) {
+            s.hum_min = s.hum_count ? std::min(s.hum_min, hum) : hum;
+            s.hum_max = s.hum_count ? std::max(s.hum_max, hum) : hum;
+            s.hum_sum += hum;
+            ++s.hum_count;
+        }
+    }
+}
+
+void SensorRollups::query(RollupRes res, int64_t from, int64_t to, std::vector<RollupBucket> &out) const {
+    const Level &level = levels_[(int)res];
+    if (level.newest == INT64_MIN || from > to) return;
+    // keep the bucket arithmetic (and localtime) in range; the rings hold far less anyway
+    constexpr int64_t LIMIT = (int64_t)1 << 40;
+    from = std::clamp(from, -LIMIT, LIMIT);
+    to = std::clamp(to, -LIMIT, LIMIT);
+    int64_t size = (int64_t)level.ring.size();
+    int64_t first = std::max(bucket_number(res, from), level.newest - size + 1);
+    int64_t last = std::min(bucket_number(res, to), level.newest);
+    for (int64_t n = first; n <= last; ++n) {
+        const Slot &slot = level.ring[(size_t)(((n % size) + size) % size)];
+        if (slot.number == n) out.push_back(RollupBucket{bucket_start(res, n), slot.stats});
+    }
+}
+
+bool parse_rollup_res(const std::string &name, RollupRes &res) {
+    if (name == "minute") res = RollupRes::Minute;
+    else if (name == "hour") res = RollupRes::Hour;
+    else if (name == "day") res = RollupRes::Day;
+    else return false;
+    return true;
+}
+
+// ---- per-sensor store ----
+
+struct RollupEntry {
+    std::mutex mutex;
+    SensorRollups rollups;
+};
+
+// Indexed by sensor handle; the vector is guarded by rollups_mutex, each entry by its own mutex
+static std::vector<std::unique_ptr<RollupEntry>> rollups;
+static std::shared_mutex rollups_mutex;
+
+void rollup_add(SensorHandle h, const SensorReading &reading) {
+    {
+        std::shared_lock<std::shared_mutex> lk(rollups_mutex);
+        if (h < rollups.size() && rollups[h]) {
+            RollupEntry &e = *rollups[h];
+            std::lock_guard<std::mutex> elk(e.mutex);
+            e.rollups.add(reading.timestamp, reading.temp, reading.hum);
+            return;
+        }
+    }
+    std::unique_lock<std::shared_mutex> lk(rollups_mutex);
+    if (rollups.size() <= h) rollups.resize(h + 1);
+    if (!rollups[h]) rollups[h] = std::make_unique<RollupEntry>();
+    rollups[h]->rollups.add(reading.timestamp, reading.temp, reading.hum);
+}
+
+static void write_stat(JsonWriter &w, uint32_t n, double v) {
+    if (n == 0) w.value_null();
+    else w.value_number(std::round(v * 100) / 100);
+}
+
+std::string rollup_json(const std::string &id, RollupRes res, int64_t from, int64_t to) {
+    std::string sid = sanitize_id(id);
+    SensorHandle h = sensor_registry.find(sid);
+    if (h == INVALID_SENSOR) return std::string();
+    std::vector<RollupBucket> buckets;
+    {
+        std::shared_lock<std::shared_mutex> lk(rollups_mutex);
+        if (h >= rollups.size() || !rollups[h]) return std::string();
+        RollupEntry &e = *rollups[h];
+        std::lock_guard<std::mutex> elk(e.mutex);
+        e.rollups.query(res, from, to, buckets);
+    }
+
+    static const char *const RES_NAMES[] = {"minute", "hour", "day"};
+    std::string out;
+    JsonWriter w(out);
+    w.begin_object();
+    w.key("sensor");
+    w.value_string(sid);
+    w.key("res");
+    w.value_string(RES_NAMES[(int)res]);
+    w.key("columns");
+    w.begin_array();
+    for (const char *c : {"start", "count", "temp_min", "temp_avg", "temp_max", "hum_min", "hum_avg", "hum_max"}) w.value_string(c);
+    w.end_array();
+    w.key("points");
+    w.begin_array();
+    for (const RollupBucket &b : buckets) {
+        const RollupStats &s = b.stats;
+        w.begin_array();
+        w.value_int(b.start);
+        w.value_int(s.count);
+        write_stat(w, s.temp_count, s.temp_min);
+        write_stat(w, s.temp_count, s.temp_count ? s.temp_sum / s.temp_count : 0);
+        write_stat(w, s.temp_count, s.temp_max);
+        write_stat(w, s.hum_count, s.hum_min);
+        write_stat(w, s.hum_count, s.hum_count ? s.hum_sum / s.hum_count : 0);
+        write_stat(w, s.hum_count, s.hum_max);
+        w.end_array();
+    }
+    w.end_array();
+    w.end_object();
+    return out;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include "sensor_registry.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Per-sensor rollups: count, min, max and average of temperature and humidity per
+// minute, hour and (local) day. Every reading updates the current bucket of each
+// resolution in O(1); each resolution is a fixed ring of buckets, allocated on its
+// first reading, so a sensor's rollups take constant memory and a query costs at most
+// one ring's length however many readings went into it.
+
+enum class RollupRes { Minute, Hour, Day };
+
+// Buckets kept per resolution, 0 = off: by default a day of minutes, a month of hours
+// and two years of days (56 bytes a bucket, about 160 KB per sensor). Rings
+// allocated before a change keep their length.
+extern std::atomic<int> ROLLUP_MINUTES;
+extern std::atomic<int> ROLLUP_HOURS;
+extern std::atomic<int> ROLLUP_DAYS;
+
+struct RollupStats {
+    uint32_t count = 0;       // readings
+    uint32_t temp_count = 0;  // readings with a temperature
+    uint32_t hum_count = 0;
+    float temp_min = 0, temp_max = 0;
+    float hum_min = 0, hum_max = 0;
+    double temp_sum = 0, hum_sum = 0;
+};
+
+struct RollupBucket {
+    int64_t start;  // epoch seconds; day buckets start at local midnight
+    RollupStats stats;
+};
+
+// Rollups of one sensor. Not thread-safe.
+class SensorRollups {
+public:
+    SensorRollups();
+
+    void add(int64_t timestamp, float temp, float hum);
+    // Buckets of resolution `res` that overlap [from, to] and hold readings, oldest first
+    void query(RollupRes res, int64_t from, int64_t to, std::vector<RollupBucket> &out) const;
+
+private:
+    // Buckets are numbered from the epoch (minutes, hours, local days); slot = number % size
+    struct Slot {
+        int64_t number = INT64_MIN;
+        RollupStats stats;
+    };
+    struct Level {
+        std::vector<Slot> ring;
+        int64_t newest = INT64_MIN;
+    };
+
+    Level levels_[3];
+};
+
+// "minute", "hour" or "day"
+bool parse_rollup_res(const std::string &name, RollupRes &res);
+
+// Update the rollups of sensor `h` with a reading
+void rollup_add(SensorHandle h, const SensorReading &reading);
+// JSON for GET /rollup/<id>: {"sensor":..,"res":..,"columns":[..],"points":[[..],..]}.
+// Empty if the sensor has no rollups.
+std::string rollup_json(const std::string &id, RollupRes res, int64_t from, int64_t to);
+
+#endif // ROLLUP_H
@@ -0,0 +1,492 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "rules.h"
+#include "storage.h"
+#include "json.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <ctime>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+
+namespace {
+
+constexpr int MAX_STACK = 32;
+// Parentheses, function calls and prefix operators recurse before anything is emitted,
+// so the stack depth check alone does not bound the parser's own recursion
+constexpr int MAX_NESTING = 32;
+constexpr size_t MAX_RULE_SENSORS = 16;
+constexpr size_t MAX_RULE_CONSTANTS = 256;
+
+// Recursive-descent compiler emitting postfix code as it parses.
+class RuleCompiler {
+public:
+    RuleCompiler(std::string_view src, SensorRegistry &registry, CompiledRule &out)
+        : s_(src), registry_(registry), out_(out) {}
+
+    bool compile(std::string &error) {
+        out_ = CompiledRule();
+        bool ok = parse_or();
+        skip_ws();
+        if (ok && pos_ < s_.size()) ok = fail("unexpected '" + std::string(1, s_[pos_]) + "'");
+        if (ok && out_.sensors.empty()) ok = fail("rule must reference at least one sensor");
+        if (!ok) {
+            if (error_.empty()) fail("syntax error");
+            error = error_ + " at offset " + std::to_string(error_pos_);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    bool fail(const std::string &msg) {
+        if (error_.empty()) {
+            error_ = msg;
+            error_pos_ = pos_;
+        }
+        return false;
+    }
+
+    void skip_ws() {
+        while (pos_ < s_.size() && (s_[pos_] == ' ' || s_[pos_] == '\t' || s_[pos_] == '\n' || s_[pos_] == '\r')) ++pos_;
+    }
+
+    // Consume `tok` if it comes next. Word operators must not run into an identifier.
+    bool accept(std::string_view tok) {
+        skip_ws();
+        if (s_.substr(pos_, tok.size()) != tok) return false;
+        if (std::isalpha((unsigned char)tok[0])) {
+            size_t end = pos_ + tok.size();
+            if (end < s_.size() && (std::isalnum((unsigned char)s_[end]) || s_[end] == '_' || s_[end] == '-' || s_[end] == '.')) return false;
+        }
+        pos_ += tok.size();
+        return true;
+    }
+
+    // Enter one level of nesting; fails once the rule nests deeper than MAX_NESTING
+    bool nest() {
+        if (++nesting_ > MAX_NESTING) return fail("expression too deeply nested");
+        return true;
+    }
+
+    bool emit(RuleOp op, int stack_delta, uint32_t arg = 0, uint8_t field = 0) {
+        out_.code.push_back(RuleInstr{op, field, arg});
+        depth_ += stack_delta;
+        if (depth_ > MAX_STACK) return fail("expression too deeply nested");
+        return true;
+    }
+
+    bool parse_or() {
+        if (!parse_and()) return false;
+        while (accept("or") || accept("||")) {
+            if (!parse_and() || !emit(RuleOp::Or, -1)) return false;
+        }
+        return true;
+    }
+
+    bool parse_and() {
+        if (!parse_not()) return false;
+        while (accept("and") || accept("&&")) {
+            if (!parse_not() || !emit(RuleOp::And, -1)) return false;
+        }
+        return true;
+    }
+
+    bool parse_not() {
+        skip_ws();
+        // "!=" is a comparison, not a negation
+        if (accept("not") || (s_.substr(pos_, 2) != "!=" && accept("!"))) {
+            bool ok = nest() && parse_not() && emit(RuleOp::Not, 0);
+            --nesting_;
+            return ok;
+        }
+        return parse_comparison();
+    }
+
+    bool parse_comparison() {
+        if (!parse_sum()) return false;
+        static const std::pair<std::string_view, RuleOp> ops[] = {
+            {"<=", RuleOp::Le}, {">=", RuleOp::Ge}, {"==", RuleOp::Eq}, {"!=", RuleOp::Ne},
+            {"<", RuleOp::Lt}, {">", RuleOp::Gt}};
+        for (const auto &op : ops) {
+            if (accept(op.first)) return parse_sum() && emit(op.second, -1);
+        }
+        return true;
+    }
+
+    bool parse_sum() {
+        if (!parse_product()) return false;
+        while (true) {
+            if (accept("+")) {
+                if (!parse_product() || !emit(RuleOp::Add, -1)) return false;
+            } else if (accept("-")) {
+                if (!parse_product() || !emit(RuleOp::Sub, -1)) return false;
+            } else {
+                return true;
+            }
+        }
+    }
+
+    bool parse_product() {
+        if (!parse_unary()) return false;
+        while (true) {
+            if (accept("*")) {
+                if (!parse_unary() || !emit(RuleOp::Mul, -1)) return false;
+            } else if (accept("/")) {
+                if (!parse_unary() || !emit(RuleOp::Div, -1)) return false;
+            } else {
+                return true;
+            }
+        }
+    }
+
+    bool parse_unary() {
+        if (accept("-")) {
+            bool ok = nest() && parse_unary() && emit(RuleOp::Neg, 0);
+            --nesting_;
+            return ok;
+        }
+        return parse_primary();
+    }
+
+    bool parse_primary() {
+        skip_ws();
+        if (pos_ >= s_.size()) return fail("unexpected end of rule");
+        char c = s_[pos_];
+        if (accept("(")) {
+            bool ok = nest() && parse_or() && (accept(")") || fail("expected ')'"));
+            --nesting_;
+            return ok;
+        }
+        if ((c >= '0' && c <= '9') || c == '.') {
+            double v;
+            auto res = std::from_chars(s_.data() + pos_, s_.data() + s_.size(), v);
+            if (res.ec != std::errc()) return fail("invalid number");
+            pos_ = (size_t)(res.ptr - s_.data());
+            if (out_.consts.size() >= MAX_RULE_CONSTANTS) return fail("too many constants");
+            out_.consts.push_back(v);
+            return emit(RuleOp::Const, 1, (uint32_t)(out_.consts.size() - 1));
+        }
+        if (!(std::isalnum((unsigned char)c) || c == '_')) return fail("unexpected '" + std::string(1, c) + "'");
+
+        // sensor ids may contain '-', so scan the widest name and split it afterwards
+        size_t start = pos_, end = pos_;
+        while (end < s_.size() && (std::isalnum((unsigned char)s_[end]) || s_[end] == '_' || s_[end] == '-')) ++end;
+        if (end < s_.size() && s_[end] == '.') return parse_sensor_ref(s_.substr(start, end - start), end + 1);
+        // not a sensor reference: a word ends at the first '-' ("hour-1")
+        size_t dash = s_.find('-', start);
+        if (dash < end) end = dash;
+        std::string_view word = s_.substr(start, end - start);
+        pos_ = end;
+        if (word == "hour" || word == "weekday") {
+            return emit(word == "hour" ? RuleOp::Hour : RuleOp::Weekday, 1);
+        }
+        if (word == "avg" || word == "min" || word == "max") {
+            if (!accept("(")) return fail("expected '(' after " + std::string(word));
+            if (!nest()) return false;
+            int args = 0;
+            do {
+                if (!parse_or()) return false;
+                ++args;
+            } while (accept(","));
+            if (!accept(")")) return fail("expected ')'");
+            --nesting_;
+            RuleOp op = word == "avg" ? RuleOp::Avg : word == "min" ? RuleOp::Min : RuleOp::Max;
+            return emit(op, 1 - args, (uint32_t)args);
+        }
+        return fail("unknown name '" + std::string(word) + "'");
+    }
+
+    bool parse_sensor_ref(std::string_view sensor, size_t field_pos) {
+        size_t end = field_pos;
+        while (end < s_.size() && std::isalpha((unsigned char)s_[end])) ++end;
+        std::string_view name = s_.substr(field_pos, end - field_pos);
+        uint8_t field;
+        if (name == "temp") field = 0;
+        else if (name == "hum") field = 1;
+        else if (name == "batt") field = 2;
+        else if (name == "age") field = 3;
+        else {
+            pos_ = field_pos;
+            return fail("unknown field '" + std::string(name) + "' (temp, hum, batt or age)");
+        }
+        pos_ = end;
+        SensorHandle h = registry_.intern(sanitize_id(std::string(sensor)));
+        if (std::find(out_.sensors.begin(), out_.sensors.end(), h) == out_.sensors.end()) {
+            if (out_.sensors.size() >= MAX_RULE_SENSORS) return fail("too many sensors");
+            out_.sensors.push_back(h);
+        }
+        return emit(RuleOp::Load, 1, h, field);
+    }
+
+    std::string_view s_;
+    size_t pos_ = 0;
+    SensorRegistry &registry_;
+    CompiledRule &out_;
+    int depth_ = 0;
+    int nesting_ = 0;
+    std::string error_;
+    size_t error_pos_ = 0;
+};
+
+}  // namespace
+
+bool compile_rule(std::string_view expr, SensorRegistry &registry, CompiledRule &out, std::string &error) {
+    return RuleCompiler(expr, registry, out).compile(error);
+}
+
+// Local time for the hour/weekday operands, converted at most once per minute:
+// localtime_r() costs more than evaluating a typical rule set.
+struct RuleClock {
+    int64_t now;
+    bool converted = false;
+    double hour = 0;
+    int weekday = 0;
+
+    void convert() {
+        static std::mutex cache_mutex;
+        static int64_t cached_minute = INT64_MIN;
+        static int cached_hour = 0, cached_min = 0, cached_wday = 0;
+        int64_t minute = now / 60 - (now % 60 < 0);
+        std::lock_guard<std::mutex> lk(cache_mutex);
+        if (minute != cached_minute) {
+            std::time_t t = (std::time_t)now;
+            std::tm local{};
+            localtime_r(&t, &local);
+            cached_minute = minute;
+            cached_hour = local.tm_hour;
+            cached_min = local.tm_min;
+            cached_wday = local.tm_wday;
+        }
+        hour = cached_hour + cached_min / 60.0;
+        weekday = cached_wday;
+        converted = true;
+    }
+    double get_hour() {
+        if (!converted) convert();
+        return hour;
+    }
+    int get_weekday() {
+        if (!converted) convert();
+        return weekday;
+    }
+};
+
+// Run the bytecode. `readings` and `present` are indexed by sensor handle and hold (at
+// least) every sensor the rule references.
+static bool run_rule(const CompiledRule &rule, const SensorReading *readings, const bool *present, RuleClock &clock) {
+    int64_t now = clock.now;
+
+    double stack[MAX_STACK];
+    int sp = 0;
+    auto truth = [](double v) { return v != 0 && !std::isnan(v); };
+    for (const RuleInstr &in : rule.code) {
+        switch (in.op) {
+            case RuleOp::Const: stack[sp++] = rule.consts[in.arg]; break;
+            case RuleOp::Load: {
+                double v = NAN;
+                if (present[in.arg]) {
+                    const SensorReading &r = readings[in.arg];
+                    if (in.field == 0) v = r.temp;
+                    else if (in.field == 1) v = r.hum;
+                    else if (in.field == 2) v = r.batt;
+                    else v = (double)(now - r.timestamp);
+                }
+                stack[sp++] = v;
+                break;
+            }
+            case RuleOp::Hour: stack[sp++] = clock.get_hour(); break;
+            case RuleOp::Weekday: stack[sp++] = clock.get_weekday(); break;
+            case RuleOp::Neg: stack[sp - 1] = -stack[sp - 1]; break;
+            case RuleOp::Not: stack[sp - 1] = std::isnan(stack[sp - 1]) ? NAN : (truth(stack[sp - 1]) ? 0 : 1); break;
+            case RuleOp::Avg:
+            case RuleOp::Min:
+            case RuleOp::Max: {
+                sp -= in.arg;
+                double acc = NAN;
+                int n = 0;
+                for (uint32_t i = 0; i < in.arg; ++i) {
+                    double v = stack[sp + i];
+                    if (std::isnan(v)) continue;
+                    if (n++ == 0) acc = v;
+                    else if (in.op == RuleOp::Avg) acc += v;
+                    else if (in.op == RuleOp::Min) acc = std::min(acc, v);
+                    else acc = std::max(acc, v);
+                }
+                if (in.op == RuleOp::Avg && n > 0) acc /= n;
+                stack[sp++] = acc;
+                break;
+            }
+#define RULE_BINARY(OP, EXPR)                 \
+            case RuleOp::OP: {                \
+                double b = stack[--sp];       \
+                double a = stack[sp - 1];     \
+                stack[sp - 1] = (EXPR);       \
+                break;                        \
+            }
+            RULE_BINARY(Add, a + b)
+            RULE_BINARY(Sub, a - b)
+            RULE_BINARY(Mul, a * b)
+            RULE_BINARY(Div, a / b)
+            // comparisons with NaN are false, as in IEEE arithmetic
+            RULE_BINARY(Lt, a < b)
+            RULE_BINARY(Le, a <= b)
+            RULE_BINARY(Gt, a > b)
+            RULE_BINARY(Ge, a >= b)
+            RULE_BINARY(Eq, a == b)
+            RULE_BINARY(Ne, !std::isnan(a) && !std::isnan(b) && a != b)
+            RULE_BINARY(And, truth(a) && truth(b))
+            RULE_BINARY(Or, truth(a) || truth(b))
+#undef RULE_BINARY
+        }
+    }
+    return sp == 1 && truth(stack[0]);
+}
+
+bool evaluate_rule(const CompiledRule &rule, const SensorRegistry &registry, int64_t now) {
+    SensorHandle max_handle = 0;
+    for (SensorHandle h : rule.sensors) max_handle = std::max(max_handle, h);
+    std::vector<SensorReading> readings(max_handle + 1);
+    std::unique_ptr<bool[]> present(new bool[max_handle + 1]());
+    registry.get_many(rule.sensors.data(), rule.sensors.size(), readings.data(), present.get());
+    RuleClock clock{now};
+    return run_rule(rule, readings.data(), present.get(), clock);
+}
+
+// ---- active rule set ----
+
+struct ActiveRule {
+    RuleSource source;
+    CompiledRule rule;
+    std::string error;  // compile error; such rules never fire
+    // value at the previous evaluation; readings evaluate the rule concurrently
+    std::atomic<bool> last{false};
+};
+
+// Per sensor handle: the rules that reference it, and every sensor those rules read
+struct SensorRules {
+    std::vector<uint32_t> rules;  // indices into active_rules
+    std::vector<SensorHandle> inputs;
+};
+
+// Guarded by rules_mutex: evaluation takes it shared, load_rules() exclusively.
+// A deque, as ActiveRule (holding an atomic) cannot be moved.
+static std::deque<ActiveRule> active_rules;
+static std::vector<SensorRules> rules_by_sensor;
+static std::shared_mutex rules_mutex;
+
+// Readings copied from the registry for one evaluation, indexed by handle. One set per
+// thread, so concurrent evaluations do not share them.
+struct RuleInputs {
+    std::vector<SensorReading> readings;
+    std::unique_ptr<bool[]> present;
+
+    void reserve(size_t handles) {
+        if (readings.size() >= handles) return;
+        readings.resize(handles);
+        present.reset(new bool[handles]());
+    }
+};
+static thread_local RuleInputs rule_inputs;
+
+void load_rules(const std::vector<RuleSource> &rules) {
+    std::deque<ActiveRule> next;
+    std::vector<SensorRules> index;
+    for (const RuleSource &src : rules) {
+        ActiveRule &ar = next.emplace_back();
+        ar.source = src;
+        if (compile_rule(src.when, sensor_registry, ar.rule, ar.error)) {
+            for (SensorHandle h : ar.rule.sensors) {
+                if (index.size() <= h) index.resize(h + 1);
+                index[h].rules.push_back((uint32_t)(next.size() - 1));
+                for (SensorHandle in : ar.rule.sensors) {
+                    auto &inputs = index[h].inputs;
+                    if (std::find(inputs.begin(), inputs.end(), in) == inputs.end()) inputs.push_back(in);
+                }
+            }
+        }
+    }
+    std::unique_lock<std::shared_mutex> lk(rules_mutex);
+    for (ActiveRule &ar : next) {
+        for (const ActiveRule &old : active_rules) {
+            if (old.source.room == ar.source.room && old.source.when == ar.source.when) {
+                ar.last.store(old.last.load());
+                break;
+            }
+        }
+    }
+    active_rules.swap(next);
+    rules_by_sensor.swap(index);
+}
+
+std::vector<RuleFiring> evaluate_rules_for_sensor(std::string_view id, int64_t now) {
+    std::vector<RuleFiring> fired;
+    SensorHandle h = sensor_registry.find(id);
+    std::shared_lock<std::shared_mutex> lk(rules_mutex);
+    if (h == INVALID_SENSOR || h >= rules_by_sensor.size()) return fired;
+    // one registry lock for the inputs of all affected rules
+    const SensorRules &sr = rules_by_sensor[h];
+    RuleInputs &in = rule_inputs;
+    in.reserve(rules_by_sensor.size());
+    sensor_registry.get_many(sr.inputs.data(), sr.inputs.size(), in.readings.data(), in.present.get());
+    RuleClock clock{now};
+    for (uint32_t i : sr.rules) {
+        ActiveRule &ar = active_rules[i];
+        bool value = run_rule(ar.rule, in.readings.data(), in.present.get(), clock);
+        // the exchange lets exactly one of two concurrent readings see the edge
+        bool was = ar.last.exchange(value);
+        if (value && !was && !ar.source.url.empty()) {
+            fired.push_back(RuleFiring{ar.source.room, ar.source.fire, ar.source.url});
+        }
+    }
+    return fired;
+}
+
+std::string rules_json() {
+    std::string out;
+    JsonWriter w(out);
+    w.begin_array();
+    std::shared_lock<std::shared_mutex> lk(rules_mutex);
+    for (const ActiveRule &ar : active_rules) {
+        w.begin_object();
+        w.key("room");
+        w.value_string(ar.source.room);
+        w.key("when");
+        w.value_string(ar.source.when);
+        w.key("fire");
+        w.value_string(ar.source.fire);
+        if (ar.error.empty()) {
+            w.key("value");
+            w.value_bool(ar.last.load());
+        } else {
+            w.key("error");
+            w.value_string(ar.error);
+        }
+        w.end_object();
+    }
+    w.end_array();
+    return out;
+}
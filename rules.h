@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef RULES_H
+#define RULES_H
+
+#include "sensor_registry.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Trigger rules: conditions over sensor readings and the time of day, e.g.
+//
+//   avg(bedroom1.temp, bedroom2.temp) < 20 and window.age < 900 and hour >= 6
+//
+// Values: numbers, <sensor>.<field> with field temp, hum, batt or age (seconds since the
+// sensor last reported), hour (local, fractional: 6.5 is 06:30) and weekday (0 = Sunday).
+// Operators, loosest first: or (||), and (&&), not (!), comparisons (< <= > >= == !=),
+// + -, * /, unary minus. Functions: avg, min and max of any number of arguments; they
+// skip values a sensor did not report. Any comparison with a missing value is false.
+//
+// A rule is compiled once into postfix bytecode. Rules are indexed by the sensors they
+// reference, so a reading only evaluates the rules that depend on that sensor. A rule
+// fires when its condition changes from false to true.
+
+enum class RuleOp : uint8_t {
+    Const, Load, Hour, Weekday,
+    Add, Sub, Mul, Div, Neg,
+    Lt, Le, Gt, Ge, Eq, Ne,
+    And, Or, Not,
+    Avg, Min, Max
+};
+
+struct RuleInstr {
+    RuleOp op;
+    uint8_t field;  // Load: 0 temp, 1 hum, 2 batt, 3 age
+    uint32_t arg;   // Const: constant index; Load: sensor handle; Avg/Min/Max: argument count
+};
+
+struct CompiledRule {
+    std::vector<RuleInstr> code;
+    std::vector<double> consts;
+    std::vector<SensorHandle> sensors;  // distinct sensors referenced
+};
+
+// Compile `expr`. Sensor names are interned in `registry`, so rules may refer to sensors
+// that have not reported yet. Returns false and sets `error` if the rule is invalid.
+bool compile_rule(std::string_view expr, SensorRegistry &registry, CompiledRule &out, std::string &error);
+// Evaluate a compiled rule against the current readings at `now` (seconds since the epoch).
+bool evaluate_rule(const CompiledRule &rule, const SensorRegistry &registry, int64_t now);
+
+// A rule as configured for a room: fire the room's `fire` ("high" or "low") URL `url`
+// whenever `when` becomes true.
+struct RuleSource {
+    std::string room;
+    std::string when;
+    std::string fire;
+    std::string url;
+};
+
+struct RuleFiring {
+    std::string room;
+    std::string type;
+    std::string url;
+};
+
+// Replace the active rule set. Rules that fail to compile are kept (and reported by
+// rules_json()) but never fire. Rules whose room and condition are unchanged keep their
+// last value, so reloading does not fire them again.
+void load_rules(const std::vector<RuleSource> &rules);
+// Evaluate the rules that reference sensor `id` after it reported; returns the rules
+// that became true.
+std::vector<RuleFiring> evaluate_rules_for_sensor(std::string_view id, int64_t now);
+// All active rules with their current value (or compile error) as a JSON array
+std::string rules_json();
+
+#endif // RULES_H
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "schedule.h"
+#include <cstdio>
+#include <ctime>
+
+static const char *const DAY_NAMES[7] = {"sun", "mon", "tue", "wed", "thu", "fri", "sat"};
+
+static int parse_day(const std::string &name) {
+    for (int d = 0; d < 7; ++d) {
+        if (name == DAY_NAMES[d]) return d;
+    }
+    return -1;
+}
+
+bool parse_schedule_days(const std::string &text, uint8_t &days) {
+    if (text == "daily" || text == "*") {
+        days = 0x7f;
+        return true;
+    }
+    uint8_t mask = 0;
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t comma = text.find(',', start);
+        std::string part = text.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        size_t dash = part.find('-');
+        int first = parse_day(part.substr(0, dash));
+        int last = dash == std::string::npos ? first : parse_day(part.substr(dash + 1));
+        if (first < 0 || last < 0) return false;
+        for (int d = first;; d = (d + 1) % 7) {
+            mask |= (uint8_t)(1 << d);
+            if (d == last) break;
+        }
+        if (comma == std::string::npos) break;
+        start = comma + 1;
+    }
+    days = mask;
+    return mask != 0;
+}
+
+std::string format_schedule_days(uint8_t days) {
+    std::string out;
+    // walk Monday..Sunday, folding runs of three or more days into a range
+    for (int i = 0; i < 7;) {
+        int d = (i + 1) % 7;
+        if (!(days & (1 << d))) {
+            ++i;
+            continue;
+        }
+        int j = i;
+        while (j + 1 < 7 && (days & (1 << ((j + 2) % 7)))) ++j;
+        if (!out.empty()) out += ',';
+        out += DAY_NAMES[d];
+        if (j - i >= 2) {
+            out += '-';
+            out += DAY_NAMES[(j + 1) % 7];
+        } else if (j > i) {
+            out += ',';
+            out += DAY_NAMES[(j + 1) % 7];
+        }
+        i = j + 1;
+    }
+    return out;
+}
+
+bool parse_time_of_day(const std::string &text, int &minute) {
+    int h = 0, m = 0;
+    size_t colon = text.find(':');
+    if (colon == std::string::npos || colon == 0 || colon > 2 || text.size() != colon + 3) return false;
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (i == colon) continue;
+        if (text[i] < '0' || text[i] > '9') return false;
+        if (i < colon) h = h * 10 + (text[i] - '0');
+        else m = m * 10 + (text[i] - '0');
+    }
+    if (h > 23 || m > 59) return false;
+    minute = h * 60 + m;
+    return true;
+}
+
+std::string format_time_of_day(int minute) {
+    char buf[8];
+    snprintf(buf, sizeof(buf), "%02d:%02d", minute / 60 % 24, minute % 60);
+    return buf;
+}
+
+int next_schedule_switch(const std::vector<ScheduleEntry> &entries, int64_t after, int64_t &when) {
+    std::time_t t = (std::time_t)after;
+    std::tm base{};
+    localtime_r(&t, &base);
+    int best = -1;
+    // today plus a full week covers every entry's next occurrence
+    for (int d = 0; d <= 7; ++d) {
+        int wday = (base.tm_wday + d) % 7;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const ScheduleEntry &e = entries[i];
+            if (!(e.days & (1 << wday))) continue;
+            std::tm at = base;
+            at.tm_mday += d;
+            at.tm_hour = e.minute / 60;
+            at.tm_min = e.minute % 60;
+            at.tm_sec = 0;
+            at.tm_isdst = -1;
+            int64_t candidate = (int64_t)mktime(&at);
+            if (candidate <= after) continue;
+            if (best < 0 || candidate < when) {
+                best = (int)i;
+                when = candidate;
+            }
+        }
+        if (best >= 0) break;
+    }
+    return best;
+}
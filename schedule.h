@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Weekly setpoint schedules. A room's schedule is a list of switch points ("mon-fri
+// 06:30 -> 21.0"); at each one the room's desired temperature is set to the entry's
+// value and stays there until the next switch point or a manual change.
+
+struct ScheduleEntry {
+    uint8_t days = 0;    // bit d set: applies on weekday d (0 = Sunday)
+    int minute = 0;      // local time of day, minutes after midnight
+    double desired = 0;
+};
+
+// Parse a day list such as "mon-fri", "sat,sun", "mon,wed-fri", "daily" or "*" into a
+// day mask. Ranges may wrap ("fri-mon"). Returns false on anything else.
+bool parse_schedule_days(const std::string &text, uint8_t &days);
+// Canonical form of a day mask, weeks starting on Monday ("mon-fri", "mon,wed,sat-sun")
+std::string format_schedule_days(uint8_t days);
+// Parse "HH:MM" (24-hour) into minutes after midnight
+bool parse_time_of_day(const std::string &text, int &minute);
+// "HH:MM" for minutes after midnight
+std::string format_time_of_day(int minute);
+
+// First switch point strictly after `after` (seconds since the epoch, local time rules
+// including DST). Returns the index of its entry and sets `when`, or -1 if the schedule
+// has no entries.
+int next_schedule_switch(const std::vector<ScheduleEntry> &entries, int64_t after, int64_t &when);
+
+#endif // SCHEDULE_H
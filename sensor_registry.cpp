@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "sensor_registry.h"
+#include "json.h"
+#include <charconv>
+#include <mutex>
+
+SensorHandle SensorRegistry::intern(std::string_view id) {
+    {
+        std::shared_lock<std::shared_mutex> lk(mutex_);
+        auto it = index_.find(id);
+        if (it != index_.end()) return it->second;
+    }
+    std::unique_lock<std::shared_mutex> lk(mutex_);
+    auto it = index_.find(id);
+    if (it != index_.end()) return it->second;
+    SensorHandle h = (SensorHandle)names_.size();
+    names_.emplace_back(id);
+    index_.emplace(names_.back(), h);
+    timestamps_.push_back(NO_READING);
+    temps_.push_back(NAN);
+    hums_.push_back(NAN);
+    batts_.push_back(NAN);
+    return h;
+}
+
+SensorHandle SensorRegistry::find(std::string_view id) const {
+    std::shared_lock<std::shared_mutex> lk(mutex_);
+    auto it = index_.find(id);
+    return it == index_.end() ? INVALID_SENSOR : it->second;
+}
+
+void SensorRegistry::update(SensorHandle h, const SensorReading &reading) {
+    std::unique_lock<std::shared_mutex> lk(mutex_);
+    if (h >= names_.size()) return;
+    timestamps_[h] = reading.timestamp;
+    temps_[h] = reading.temp;
+    hums_[h] = reading.hum;
+    batts_[h] = reading.batt;
+    version_.fetch_add(1, std::memory_order_release);
+}
+
+bool SensorRegistry::get(SensorHandle h, SensorReading &out) const {
+    std::shared_lock<std::shared_mutex> lk(mutex_);
+    if (h >= names_.size() || !has_reading(h)) return false;
+    out.timestamp = timestamps_[h];
+    out.temp = temps_[h];
+    out.hum = hums_[h];
+    out.batt = batts_[h];
+    return true;
+}
+
+void SensorRegistry::get_many(const SensorHandle *handles, size_t n, SensorReading *out, bool *present) const {
+    std::shared_lock<std::shared_mutex> lk(mutex_);
+    for (size_t i = 0; i < n; ++i) {
+        SensorHandle h = handles[i];
+        present[h] = h < names_.size() && has_reading(h);
+        if (!present[h]) continue;
+        out[h].timestamp = timestamps_[h];
+        out[h].temp = temps_[h];
+        out[h].hum = hums_[h];
+        out[h].batt = batts_[h];
+    }
+}
+
+std::string SensorRegistry::name(SensorHandle h) const {
+    std::shared_lock<std::shared_mutex> lk(mutex_);
+    return h < names_.size() ? names_[h] : std::string();
+}
+
+size_t SensorRegistry::size() const {
+    std::shared_lock<std::shared_mutex> lk(mutex_);
+    return names_.size();
+}
+
+// Values are written as strings, as the sensor endpoint always has
+static void write_value(JsonWriter &w, const char *key, float v) {
+    if (std::isnan(v)) return;
+    char buf[32];
+    auto res = std::to_chars(buf, buf + sizeof(buf), v);
+    w.key(key);
+    w.value_string(std::string_view(buf, (size_t)(res.ptr - buf)));
+}
+
+void SensorRegistry::write_reading(JsonWriter &w, SensorHandle h) const {
+    char ts[32];
+    size_t ts_len = format_local_timestamp(timestamps_[h], ts, sizeof(ts));
+    w.begin_object();
+    w.key("timestamp");
+    w.value_string(std::string_view(ts, ts_len));
+    w.key("sensor");
+    w.value_string(names_[h]);
+    write_value(w, "temp", temps_[h]);
+    write_value(w, "hum", hums_[h]);
+    write_value(w, "batt", batts_[h]);
+    w.end_object();
+}
+
+bool SensorRegistry::reading_json(SensorHandle h, std::string &out) const {
+    std::shared_lock<std::shared_mutex> lk(mutex_);
+    if (h >= names_.size() || !has_reading(h)) return false;
+    JsonWriter w(out);
+    write_reading(w, h);
+    return true;
+}
+
+void SensorRegistry::write_all_json(JsonWriter &w) const {
+    std::shared_lock<std::shared_mutex> lk(mutex_);
+    w.begin_object();
+    for (SensorHandle h = 0; h < (SensorHandle)names_.size(); ++h) {
+        if (!has_reading(h)) continue;
+        w.key(names_[h]);
+        write_reading(w, h);
+    }
+    w.end_object();
+}
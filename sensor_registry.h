@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SENSOR_REGISTRY_H
+#define SENSOR_REGISTRY_H
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class JsonWriter;
+
+// Dense integer handle of an interned sensor id. Handles are never reused.
+using SensorHandle = uint32_t;
+constexpr SensorHandle INVALID_SENSOR = UINT32_MAX;
+
+// Latest reading of one sensor. Values the sensor did not report are NaN.
+struct SensorReading {
+    int64_t timestamp = 0;  // seconds since the epoch
+    float temp = NAN;
+    float hum = NAN;
+    float batt = NAN;
+};
+
+// Registry of all sensors that ever reported. Ids are interned once; readings live in
+// parallel arrays indexed by handle (structure of arrays), and JSON is only produced
+// when a reading is serialized. All methods are thread-safe.
+class SensorRegistry {
+public:
+    // Return the handle of `id` (already sanitized), registering it if needed.
+    SensorHandle intern(std::string_view id);
+    // Return the handle of `id`, or INVALID_SENSOR if it is unknown.
+    SensorHandle find(std::string_view id) const;
+
+    // Store the latest reading of sensor `h`.
+    void update(SensorHandle h, const SensorReading &reading);
+    // Copy the latest reading of `h`; false if it never reported.
+    bool get(SensorHandle h, SensorReading &out) const;
+    // Copy the readings of `n` sensors under one lock into out[h] / present[h] for each
+    // handle h in `handles` (both arrays are indexed by handle).
+    void get_many(const SensorHandle *handles, size_t n, SensorReading *out, bool *present) const;
+    // Id of sensor `h` (empty for an invalid handle).
+    std::string name(SensorHandle h) const;
+    size_t size() const;
+    // Incremented by every update(); lets caches tell whether their copy is stale.
+    uint64_t version() const { return version_.load(std::memory_order_acquire); }
+
+    // Serialize the reading of `h` as a JSON object; false if it never reported.
+    bool reading_json(SensorHandle h, std::string &out) const;
+    // Serialize all reported sensors as one JSON object: id -> reading.
+    void write_all_json(JsonWriter &w) const;
+
+private:
+    bool has_reading(SensorHandle h) const { return timestamps_[h] != NO_READING; }
+    void write_reading(JsonWriter &w, SensorHandle h) const;
+
+    static constexpr int64_t NO_READING = INT64_MIN;
+
+    mutable std::shared_mutex mutex_;
+    // deque keeps element addresses stable, so the index can key on views of the names
+    std::deque<std::string> names_;
+    std::unordered_map<std::string_view, SensorHandle> index_;
+    std::vector<int64_t> timestamps_;
+    std::vector<float> temps_;
+    std::vector<float> hums_;
+    std::vector<float> batts_;
+    std::atomic<uint64_t> version_{0};
+};
+
+#endif // SENSOR_REGISTRY_H
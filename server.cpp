@@ -21,11 +21,19 @@
 #include "server.h"
 #include "http.h"
 #include "storage.h"
+#include "event_loop.h"
+#include "wal.h"
+#include "trigger_dispatch.h"
+#include "timer_wheel.h"
+#include "history.h"
+#include "history_store.h"
+#include "history_compact.h"
+#include "rollup.h"
+#include "trace.h"
 #include <curl/curl.h>
 
 
-static volatile sig_atomic_t keep_running = 1;
-static int g_server_fd = -1;
+static std::atomic<bool> keep_running(true);
 
 // notifier thread: when shutdown starts, repeatedly echo a message until shutdown completes
 static std::atomic<bool> shutdown_in_progress(false);
@@ -38,11 +46,60 @@ static void signal_handler(int sig) {
     const char msg[] = "Shutdown requested; waiting for server to stop...\n";
     write(STDERR_FILENO, msg, sizeof(msg)-1);
     shutdown_in_progress.store(true);
-    keep_running = 0;
-    if (g_server_fd != -1) {
-        // try to shutdown socket to interrupt accept()/connections
-        shutdown(g_server_fd, SHUT_RDWR);
-        close(g_server_fd);
+    // worker event loops poll this flag at least every 250 ms
+    keep_running.store(false);
+}
+
+// Open a listening socket on `port`. Every worker opens its own socket on the same
+// port (SO_REUSEPORT) so the kernel spreads new connections across the workers.
+static int open_listener(int port) {
+    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    // allow immediate reuse of the address after the server is killed
+    int opt = 1;
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt(SO_REUSEADDR)");
+    }
+#ifdef SO_REUSEPORT
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        // non-fatal
+    }
+#endif
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+
+    if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        perror("bind");
+        close(server_fd);
+        return -1;
+    }
+
+    if (listen(server_fd, SOMAXCONN) < 0) {
+        perror("listen");
+        close(server_fd);
+        return -1;
+    }
+    return server_fd;
+}
+
+// Worker thread body: optionally pin to a core, then run this worker's event loop.
+static void worker_main(int listen_fd, int cpu, bool verbose) {
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (rc != 0) std::cerr << "Failed to pin worker to CPU " << cpu << ": " << strerror(rc) << "\n";
+    }
+    if (!run_event_loop(listen_fd, keep_running, verbose)) {
+        keep_running.store(false);
     }
 }
 
@@ -70,6 +127,25 @@ int main(int argc, char **argv) {
         std::cout << "  -v, -verbose, --verbose Enable verbose request logging\n";
         std::cout << "  -i, --flush-interval <seconds>  Periodic flush interval in seconds (default 3600)\n";
         std::cout << "  -m, --max-triggers <n>         Maximum in-memory trigger events to keep (default 100)\n";
+        std::cout << "  -w, --workers <n>              Number of worker threads, each with its own listener (default 1)\n";
+        std::cout << "  --pin-cpus                     Pin worker threads to CPU cores (worker i -> core i)\n";
+        std::cout << "  --keepalive-timeout <seconds>  Idle timeout for persistent connections (default 5)\n";
+        std::cout << "  --keepalive-max <n>            Maximum requests per persistent connection (default 100)\n";
+        std::cout << "  --wal-sync <ms>                Write-ahead log group commit interval (default 1000, 0 = fsync every reading)\n";
+        std::cout << "  --snapshot-interval <ms>       Minimum time between rebuilds of the /sensors response (default 1000, 0 = on every change)\n";
+        std::cout << "  --trigger-queue <n>            Maximum trigger requests waiting or in flight (default 64)\n";
+        std::cout << "  --trigger-host-limit <n>       Maximum concurrent trigger requests per host (default 2)\n";
+        std::cout << "  --trigger-retries <n>          Retries of a failed trigger request, 2 s apart and doubling (default 2)\n";
+        std::cout << "  --history <n>                  Readings kept per sensor for /history (default 10080, 0 = off)\n";
+        std::cout << "  --history-dir <path>           Directory of the on-disk history segments (default history, \"\" = off)\n";
+        std::cout << "  --history-raw-days <n>         Days raw readings are kept on disk before downsampling (default 30, 0 = forever)\n";
+        std::cout << "  --history-retention-days <n>   Days downsampled readings are kept on disk (default 730, 0 = forever)\n";
+        std::cout << "  --compact-rate <KiB/s>         I/O budget of history compaction (default 4096, 0 = unthrottled)\n";
+        std::cout << "  --rollup-minutes <n>           Minute rollups kept per sensor (default 1440, 0 = off)\n";
+        std::cout << "  --rollup-hours <n>             Hour rollups kept per sensor (default 744, 0 = off)\n";
+        std::cout << "  --rollup-days <n>              Day rollups kept per sensor (default 731, 0 = off)\n";
+        std::cout << "  --stale-after <minutes>        Log a \"stale\" event for sensors silent this long (default 0 = off)\n";
+        std::cout << "  --trace-sample <n>             Trace one request in n for /debug/traces (default 0 = off)\n";
         std::cout << "Arguments:\n";
         std::cout << "  port                   Optional TCP port to listen on (default " << DEFAULT_PORT << ")\n";
     };
@@ -78,6 +154,8 @@ int main(int argc, char **argv) {
     bool verbose = false;
     int flush_interval = 3600; // seconds
     int max_triggers = 100;
+    int workers = 1;
+    bool pin_cpus = false;
     for (int i = 1; i < argc; ++i) {
         std::string a = argv[i];
         if (a == "-h" || a == "-help" || a == "--help") {
@@ -118,6 +196,177 @@ int main(int argc, char **argv) {
             ++i;
             continue;
         }
+        if (a == "-w" || a == "--workers") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << a << "\n";
+                return 1;
+            }
+            char *endptr = nullptr;
+            long v = strtol(argv[i+1], &endptr, 10);
+            if (endptr == argv[i+1] || *endptr != '\0' || v <= 0 || v > 1024) {
+                std::cerr << "Invalid workers value: " << argv[i+1] << "\n";
+                return 1;
+            }
+            workers = static_cast<int>(v);
+            ++i;
+            continue;
+        }
+        if (a == "--keepalive-timeout" || a == "--keepalive-max") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << a << "\n";
+                return 1;
+            }
+            char *endptr = nullptr;
+            long v = strtol(argv[i+1], &endptr, 10);
+            if (endptr == argv[i+1] || *endptr != '\0' || v <= 0) {
+                std::cerr << "Invalid " << a.substr(2) << " value: " << argv[i+1] << "\n";
+                return 1;
+            }
+            if (a == "--keepalive-timeout") KEEPALIVE_TIMEOUT_SECONDS.store(static_cast<int>(v));
+            else KEEPALIVE_MAX_REQUESTS.store(static_cast<int>(v));
+            ++i;
+            continue;
+        }
+        if (a == "--wal-sync") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << a << "\n";
+                return 1;
+            }
+            char *endptr = nullptr;
+            long v = strtol(argv[i+1], &endptr, 10);
+            if (endptr == argv[i+1] || *endptr != '\0' || v < 0 || v > 3600000) {
+                std::cerr << "Invalid wal-sync value: " << argv[i+1] << "\n";
+                return 1;
+            }
+            WAL_SYNC_INTERVAL_MS.store(static_cast<int>(v));
+            ++i;
+            continue;
+        }
+        if (a == "--snapshot-interval") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << a << "\n";
+                return 1;
+            }
+            char *endptr = nullptr;
+            long v = strtol(argv[i+1], &endptr, 10);
+            if (endptr == argv[i+1] || *endptr != '\0' || v < 0 || v > 3600000) {
+                std::cerr << "Invalid snapshot-interval value: " << argv[i+1] << "\n";
+                return 1;
+            }
+            SNAPSHOT_INTERVAL_MS.store(static_cast<int>(v));
+            ++i;
+            continue;
+        }
+        if (a == "--trigger-queue" || a == "--trigger-host-limit") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << a << "\n";
+                return 1;
+            }
+            char *endptr = nullptr;
+            long v = strtol(argv[i+1], &endptr, 10);
+            if (endptr == argv[i+1] || *endptr != '\0' || v <= 0 || v > 100000) {
+                std::cerr << "Invalid " << a.substr(2) << " value: " << argv[i+1] << "\n";
+                return 1;
+            }
+            if (a == "--trigger-queue") TRIGGER_QUEUE_CAPACITY.store(static_cast<int>(v));
+            else TRIGGER_HOST_CONCURRENCY.store(static_cast<int>(v));
+            ++i;
+            continue;
+        }
+        if (a == "--trigger-retries" || a == "--stale-after") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << a << "\n";
+                return 1;
+            }
+            char *endptr = nullptr;
+            long v = strtol(argv[i+1], &endptr, 10);
+            long max = (a == "--trigger-retries") ? 10 : 525600;  // a year of minutes
+            if (endptr == argv[i+1] || *endptr != '\0' || v < 0 || v > max) {
+                std::cerr << "Invalid " << a.substr(2) << " value: " << argv[i+1] << "\n";
+                return 1;
+            }
+            if (a == "--trigger-retries") TRIGGER_RETRIES.store(static_cast<int>(v));
+            else STALE_SENSOR_SECONDS.store(static_cast<int>(v) * 60);
+            ++i;
+            continue;
+        }
+        if (a == "--trace-sample") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << a << "\n";
+                return 1;
+            }
+            char *endptr = nullptr;
+            long v = strtol(argv[i+1], &endptr, 10);
+            if (endptr == argv[i+1] || *endptr != '\0' || v < 0 || v > 1000000) {
+                std::cerr << "Invalid trace-sample value: " << argv[i+1] << "\n";
+                return 1;
+            }
+            TRACE_SAMPLE_EVERY.store(static_cast<int>(v));
+            ++i;
+            continue;
+        }
+        if (a == "--history") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << a << "\n";
+                return 1;
+            }
+            char *endptr = nullptr;
+            long v = strtol(argv[i+1], &endptr, 10);
+            if (endptr == argv[i+1] || *endptr != '\0' || v < 0 || v > 10000000) {
+                std::cerr << "Invalid history value: " << argv[i+1] << "\n";
+                return 1;
+            }
+            HISTORY_SAMPLES.store(static_cast<int>(v));
+            ++i;
+            continue;
+        }
+        if (a == "--history-raw-days" || a == "--history-retention-days" || a == "--compact-rate") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << a << "\n";
+                return 1;
+            }
+            char *endptr = nullptr;
+            long v = strtol(argv[i+1], &endptr, 10);
+            if (endptr == argv[i+1] || *endptr != '\0' || v < 0 || v > 1000000) {
+                std::cerr << "Invalid " << a.substr(2) << " value: " << argv[i+1] << "\n";
+                return 1;
+            }
+            if (a == "--history-raw-days") HISTORY_RAW_DAYS.store(static_cast<int>(v));
+            else if (a == "--history-retention-days") HISTORY_RETENTION_DAYS.store(static_cast<int>(v));
+            else HISTORY_COMPACT_RATE_KB.store(static_cast<int>(v));
+            ++i;
+            continue;
+        }
+        if (a == "--rollup-minutes" || a == "--rollup-hours" || a == "--rollup-days") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << a << "\n";
+                return 1;
+            }
+            char *endptr = nullptr;
+            long v = strtol(argv[i+1], &endptr, 10);
+            if (endptr == argv[i+1] || *endptr != '\0' || v < 0 || v > 1000000) {
+                std::cerr << "Invalid " << a.substr(2) << " value: " << argv[i+1] << "\n";
+                return 1;
+            }
+            if (a == "--rollup-minutes") ROLLUP_MINUTES.store(static_cast<int>(v));
+            else if (a == "--rollup-hours") ROLLUP_HOURS.store(static_cast<int>(v));
+            else ROLLUP_DAYS.store(static_cast<int>(v));
+            ++i;
+            continue;
+        }
+        if (a == "--history-dir") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << a << "\n";
+                return 1;
+            }
+            HISTORY_DIR = argv[i+1];
+            ++i;
+            continue;
+        }
+        if (a == "--pin-cpus") {
+            pin_cpus = true;
+            continue;
+        }
         // otherwise try parse as port
         char *endptr = nullptr;
         long p = strtol(argv[i], &endptr, 10);
@@ -129,92 +378,88 @@ int main(int argc, char **argv) {
         port = static_cast<int>(p);
     }
 
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0) {
-        perror("socket");
+#ifndef SO_REUSEPORT
+    if (workers > 1) {
+        std::cerr << "Multiple workers require SO_REUSEPORT support\n";
         return 1;
     }
-
-    // allow immediate reuse of the address after the server is killed
-    int opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        perror("setsockopt(SO_REUSEADDR)");
-    }
-#ifdef SO_REUSEPORT
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
-        // non-fatal
-    }
 #endif
-
-    sockaddr_in address{};
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(port);
-
-    if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
-        perror("bind");
-        return 1;
-    }
-
-    if (listen(server_fd, 10) < 0) {
-        perror("listen");
-        return 1;
+    std::vector<int> listen_fds;
+    for (int w = 0; w < workers; ++w) {
+        int fd = open_listener(port);
+        if (fd < 0) {
+            for (int open_fd : listen_fds) close(open_fd);
+            return 1;
+        }
+        listen_fds.push_back(fd);
     }
 
     // register signal handlers for clean shutdown
-    g_server_fd = server_fd;
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
 
     // start notifier thread (will wait until shutdown requested)
     notifier_thread = std::thread(notifier_loop);
 
-    // start periodic flusher
+    // start periodic flusher, and the timer service before anything schedules timers
     start_periodic_flusher(flush_interval);
+    start_timer_service();
     // apply configured max triggers
     MAX_TRIGGER_EVENTS.store(max_triggers);
+    // load room settings once; from here on they are served from memory
+    load_settings_from_disk();
+    // open the on-disk history, then load last sensor readings into the registry (snapshot
+    // plus write-ahead log) and log every new reading
+    if (!load_history_segments()) std::cerr << "Warning: some history segments in " << HISTORY_DIR << " could not be read\n";
+    load_readings_from_disk();
+    start_history_compactor();
+    if (!start_wal()) std::cerr << "Warning: write-ahead log disabled, readings are only saved by the periodic flush\n";
+    watch_stale_sensors();
     // load existing triggers from disk into memory (trimmed to max)
     load_triggers_from_disk();
-    // initialize libcurl (required for threaded use)
+    // initialize libcurl (required for threaded use), then start the trigger dispatcher
     curl_global_init(CURL_GLOBAL_DEFAULT);
+    if (!start_trigger_dispatcher()) std::cerr << "Warning: trigger dispatcher failed to start, trigger URLs will not be called\n";
 
     std::cout << "Server running on http://localhost:" << port << "/";
     if (verbose) std::cout << "  (verbose)";
     std::cout << "  (flush-interval=" << flush_interval << "s)";
     std::cout << "  (max-triggers=" << max_triggers << ")";
+    std::cout << "  (workers=" << workers << (pin_cpus ? ", pinned" : "") << ")";
+    std::cout << "  (keepalive=" << KEEPALIVE_TIMEOUT_SECONDS.load() << "s/" << KEEPALIVE_MAX_REQUESTS.load() << ")";
+    std::cout << "  (wal-sync=" << WAL_SYNC_INTERVAL_MS.load() << "ms)";
+    std::cout << "  (snapshot-interval=" << SNAPSHOT_INTERVAL_MS.load() << "ms)";
+    std::cout << "  (trigger-queue=" << TRIGGER_QUEUE_CAPACITY.load() << ", per host " << TRIGGER_HOST_CONCURRENCY.load()
+              << ", retries " << TRIGGER_RETRIES.load() << ")";
+    std::cout << "  (history=" << HISTORY_SAMPLES.load();
+    if (!HISTORY_DIR.empty()) std::cout << ", " << history_segment_count() << " segments in " << HISTORY_DIR;
+    std::cout << ")";
+    if (STALE_SENSOR_SECONDS.load() > 0) std::cout << "  (stale-after=" << STALE_SENSOR_SECONDS.load() / 60 << "min)";
+    if (TRACE_SAMPLE_EVERY.load() > 0) std::cout << "  (trace-sample=1/" << TRACE_SAMPLE_EVERY.load() << ")";
     std::cout << "\n";
-    while (keep_running) {
-        int client_fd = accept(server_fd, nullptr, nullptr);
-        if (client_fd < 0) {
-            if (!keep_running) break;
-            perror("accept");
-            continue;
-        }
-
-        std::string req = read_request(client_fd);
-        if (req.empty()) {
-            close(client_fd);
-            continue;
-        }
-
-        if (verbose) std::cout << "Request:\n" << req << "\n";
-
-        std::string response = process_request_and_build_response(req);
-        write(client_fd, response.c_str(), response.size());
-        close(client_fd);
+    // serve clients from one epoll reactor per worker until a shutdown signal arrives
+    unsigned ncpu = std::thread::hardware_concurrency();
+    std::vector<std::thread> worker_threads;
+    for (int w = 0; w < workers; ++w) {
+        int cpu = (pin_cpus && ncpu > 0) ? (int)(w % ncpu) : -1;
+        worker_threads.emplace_back(worker_main, listen_fds[w], cpu, verbose);
     }
+    for (auto &t : worker_threads) t.join();
 
-    // shutdown sequence
+    // shutdown sequence; pending triggers are recorded as cancelled before the final flush
+    stop_trigger_dispatcher();
+    stop_timer_service();
+    stop_history_compactor();
     stop_periodic_flusher();
     // ensure final flush
     flush_readings_to_disk();
+    stop_wal();
 
     // mark shutdown complete so notifier stops
     shutdown_complete.store(true);
     if (notifier_thread.joinable()) notifier_thread.join();
 
-    close(server_fd);
-    g_server_fd = -1;
+    for (int fd : listen_fds) close(fd);
     // cleanup libcurl
     curl_global_cleanup();
     return 0;
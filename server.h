@@ -31,6 +31,9 @@
 #include <atomic>
 #include <thread>
 #include <chrono>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
 // Server configuration
 constexpr int DEFAULT_PORT = 8080;
 
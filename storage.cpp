@@ -20,6 +20,21 @@
 
 #include "storage.h"
 #include "storage_json.h"
+#include "json.h"
+#include "wal.h"
+#include "rules.h"
+#include "history.h"
+#include "history_store.h"
+#include "history_compact.h"
+#include "rollup.h"
+#include "analytics.h"
+#include "trigger_dispatch.h"
+#include "trace.h"
+#include <algorithm>
+#include <iomanip>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
 
 // define SETTINGS_JSON_FILE default
 std::string SETTINGS_JSON_FILE = "settings.json";
@@ -28,31 +43,40 @@ std::string TRIGGERS_LOG_FILE = "triggers.log";
 // define SENSOR_DATA_JSON_FILE default
 std::string SENSOR_DATA_JSON_FILE = "sensor_data.json";
 
-// in-memory cache for latest readings (sensor id -> JSON payload)
+// latest reading of every sensor
 // defined here and exposed via `extern` in storage.h so JSON helpers
 // implemented in storage_json.cpp can access it.
-std::unordered_map<std::string, std::string> in_memory_readings;
-std::mutex in_memory_mutex;
-// in-memory queue for trigger events (to be flushed periodically)
-std::deque<std::string> in_memory_triggers;
-std::mutex in_memory_triggers_mutex;
+SensorRegistry sensor_registry;
 
 // maximum triggers to hold in memory before dropping oldest entries
 std::atomic<int> MAX_TRIGGER_EVENTS(100);
 // triggers enabled by default
 std::atomic<bool> TRIGGERS_ENABLED(true);
+std::atomic<int> STALE_SENSOR_SECONDS(0);
+
+// In-memory authoritative settings store (room -> settings). Loaded from SETTINGS_JSON_FILE
+// on first use; mutations update memory and mark the store dirty so the flusher thread
+// persists it (write-behind). Readers take a shared lock only.
+static std::unordered_map<std::string, RoomSettings> settings_store;
+static std::shared_mutex settings_mutex;
+static std::atomic<bool> settings_loaded(false);
+static std::atomic<bool> settings_dirty(false);
+
+static bool load_settings(bool only_if_unloaded);
+
+// Load the store from disk if this is the first access. Caller must not hold settings_mutex.
+static void ensure_settings_loaded() {
+    if (settings_loaded.load(std::memory_order_acquire)) return;
+    load_settings(true);
+}
 
 std::map<std::string, std::string> get_all_trigger_urls(const std::string &type) {
-    std::map<std::string, std::tuple<std::optional<double>, std::string, std::string>> m;
-    read_settings_map(m);
+    ensure_settings_loaded();
     std::map<std::string, std::string> res;
-    for (const auto &kv : m) {
-        const std::string &room = kv.first;
-        const auto &tpl = kv.second;
-        const std::string &high = std::get<1>(tpl);
-        const std::string &low = std::get<2>(tpl);
-        if (type == "high" && !high.empty()) res[room] = high;
-        if (type == "low" && !low.empty()) res[room] = low;
+    std::shared_lock<std::shared_mutex> lk(settings_mutex);
+    for (const auto &kv : settings_store) {
+        if (type == "high" && !kv.second.high.empty()) res[kv.first] = kv.second.high;
+        if (type == "low" && !kv.second.low.empty()) res[kv.first] = kv.second.low;
     }
     return res;
 }
@@ -63,21 +87,94 @@ static std::atomic<bool> flusher_running(false);
 static std::condition_variable flusher_cv;
 static std::mutex flusher_mutex;
 static int flusher_interval_seconds = 3600; // default: 1 hour
+// set when trigger events are waiting to be appended to the log
+static std::atomic<bool> triggers_dirty(false);
+
+static bool id_char(char c) {
+    return std::isalnum((unsigned char)c) || c=='-' || c=='_';
+}
 
 std::string sanitize_id(const std::string &id) {
     std::string out;
     for (char c : id) {
-        if (std::isalnum((unsigned char)c) || c=='-' || c=='_' ) out.push_back(c);
+        if (id_char(c)) out.push_back(c);
     }
     if (out.empty()) out = "unknown";
     return out;
 }
 
-bool save_sensor_data(const std::string &id, const std::string &body) {
+std::string_view sanitize_id(std::string_view id, Arena &arena) {
+    if (!id.empty() && std::all_of(id.begin(), id.end(), id_char)) return id;
+    char *out = static_cast<char *>(arena.allocate(id.size(), 1));
+    size_t n = 0;
+    for (char c : id) {
+        if (id_char(c)) out[n++] = c;
+    }
+    return n ? std::string_view(out, n) : std::string_view("unknown");
+}
+
+// sanitize_id() into a per-thread buffer that keeps its capacity, for looking a room up on
+// the reading path without allocating (unordered_map has no string_view lookup before C++20)
+static const std::string &room_key(std::string_view room) {
+    static thread_local std::string key;
+    key.clear();
+    for (char c : room) {
+        if (id_char(c)) key.push_back(c);
+    }
+    if (key.empty()) key = "unknown";
+    return key;
+}
+
+// Pending stale timer of every sensor, indexed by handle
+static std::vector<TimerId> stale_timers;
+static std::mutex stale_mutex;
+
+// (Re-)arm the stale timer of a sensor that last reported at `last`
+static void arm_stale_timer(SensorHandle h, int64_t last) {
+    int stale = STALE_SENSOR_SECONDS.load();
+    if (stale <= 0) return;
+    int64_t delay_ms = (last + stale - (int64_t)std::time(nullptr)) * 1000;
+    std::lock_guard<std::mutex> lk(stale_mutex);
+    if (stale_timers.size() <= h) stale_timers.resize(h + 1, INVALID_TIMER);
+    cancel_timer(stale_timers[h]);
+    // captures no string, so the callback fits std::function without a heap allocation
+    stale_timers[h] = schedule_timer(delay_ms, [h, stale]{
+        // a reading may have arrived while this timer was already due
+        SensorReading r;
+        if (!sensor_registry.get(h, r) || r.timestamp + stale > (int64_t)std::time(nullptr)) return;
+        log_trigger_event(sensor_registry.name(h), "stale", "");
+    });
+}
+
+void watch_stale_sensors() {
+    if (STALE_SENSOR_SECONDS.load() <= 0) return;
+    for (SensorHandle h = 0; h < (SensorHandle)sensor_registry.size(); ++h) {
+        SensorReading r;
+        if (sensor_registry.get(h, r)) arm_stale_timer(h, r.timestamp);
+    }
+}
+
+bool save_sensor_data(std::string_view id, const SensorReading &reading) {
     // store latest reading in memory; flusher will persist to disk periodically
-    std::string sid = sanitize_id(id);
-    std::lock_guard<std::mutex> lk(in_memory_mutex);
-    in_memory_readings[sid] = body;
+    TracePhases phase("registry");
+    ensure_readings_loaded();
+    ArenaScope scope(request_arena());
+    std::string_view sid = sanitize_id(id, request_arena());
+    SensorHandle h = sensor_registry.intern(sid);
+    sensor_registry.update(h, reading);
+    // buffered before it is logged, so a log rotated away by a flush is always covered
+    phase.next("history_store");
+    history_store_append(h, reading);
+    phase.next("wal");
+    wal_append(sid, reading);
+    phase.next("history");
+    history_append(h, reading);
+    phase.next("rollup");
+    rollup_add(h, reading);
+    phase.next("analytics");
+    analytics_add(h, reading);
+    phase.next("stale_timer");
+    arm_stale_timer(h, reading.timestamp);
     return true;
 }
 
@@ -86,187 +183,327 @@ bool save_sensor_data(const std::string &id, const std::string &body) {
 // Return a JSON object mapping sensor id -> stored JSON payload
 // all_sensors_json: implemented in storage_json.cpp
 
-// Read settings JSON into map: room -> (optional desired, high, low)
-bool read_settings_map(std::map<std::string, std::tuple<std::optional<double>, std::string, std::string>> &out) {
+// Read settings JSON into map: room -> settings
+bool read_settings_map(std::map<std::string, RoomSettings> &out) {
     std::ifstream ifs(SETTINGS_JSON_FILE);
     out.clear();
     if (!ifs) return false;
     std::string s((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
-    try {
-        std::regex entry_re(R"RE("([^"]+)"\s*:\s*\{([^}]*)\})RE");
-        auto begin = std::sregex_iterator(s.begin(), s.end(), entry_re);
-        auto end = std::sregex_iterator();
-        for (auto it = begin; it != end; ++it) {
-            std::smatch match = *it;
-            std::string room = match[1].str();
-            std::string body = match[2].str();
-            std::optional<double> desired;
-            std::string high, low;
-            std::smatch sub;
-            if (std::regex_search(body, sub, std::regex(R"RE("desired"\s*:\s*(null|[-0-9.+eE]+))RE"))) {
-                std::string val = sub[1].str();
-                if (val != "null") {
-                    try { desired = std::stod(val); } catch(...) { desired.reset(); }
+    if (s.find_first_not_of(" \t\r\n") == std::string::npos) return true;
+    JsonReader r(s);
+    if (!r.begin_object()) return false;
+    std::string room_scratch, key_scratch, value_scratch;
+    std::string_view room, key, value;
+    while (r.next_key(room, room_scratch)) {
+        RoomSettings rs;
+        if (r.peek() != '{') {
+            if (!r.skip_value()) return false;
+            continue;
+        }
+        r.begin_object();
+        while (r.next_key(key, key_scratch)) {
+            if ((key == "desired" || key == "hysteresis" || key == "min_dwell" || key == "reassert") && r.peek() != 'n') {
+                double d;
+                if (!r.read_number(d)) return false;
+                // values /setTriggerControl would refuse (a hand-edited file) are dropped; the
+                // comparisons also keep NaN away from the int cast
+                if (key == "desired") {
+                    rs.desired = d;
+                } else if (key == "hysteresis") {
+                    if (d >= 0 && d <= MAX_HYSTERESIS) rs.hysteresis = d;
+                } else if (d >= 0 && d <= MAX_CONTROL_SECONDS) {
+                    (key == "min_dwell" ? rs.min_dwell : rs.reassert) = (int)d;
                 }
+            } else if (key == "predictive" && (r.peek() == 't' || r.peek() == 'f')) {
+                bool b;
+                if (!r.read_bool(b)) return false;
+                rs.predictive = b;
+            } else if ((key == "high" || key == "low") && r.peek() == '"') {
+                if (!r.read_string(value, value_scratch)) return false;
+                (key == "high" ? rs.high : rs.low).assign(value.data(), value.size());
+            } else if (key == "rules" && r.peek() == '[') {
+                r.begin_array();
+                while (r.next_element()) {
+                    RoomRule rule;
+                    if (!r.begin_object()) return false;
+                    while (r.next_key(key, key_scratch)) {
+                        if ((key == "when" || key == "fire") && r.peek() == '"') {
+                            if (!r.read_string(value, value_scratch)) return false;
+                            (key == "when" ? rule.when : rule.fire).assign(value.data(), value.size());
+                        } else if (!r.skip_value()) {
+                            return false;
+                        }
+                    }
+                    if (!rule.when.empty()) rs.rules.push_back(std::move(rule));
+                }
+            } else if (key == "schedule" && r.peek() == '[') {
+                r.begin_array();
+                while (r.next_element()) {
+                    ScheduleEntry entry;
+                    bool has_days = false, has_at = false, has_desired = false;
+                    if (!r.begin_object()) return false;
+                    while (r.next_key(key, key_scratch)) {
+                        if ((key == "days" || key == "at") && r.peek() == '"') {
+                            if (!r.read_string(value, value_scratch)) return false;
+                            std::string text(value);
+                            if (key == "days") has_days = parse_schedule_days(text, entry.days);
+                            else has_at = parse_time_of_day(text, entry.minute);
+                        } else if (key == "desired" && r.peek() != 'n') {
+                            if (!r.read_number(entry.desired)) return false;
+                            has_desired = true;
+                        } else if (!r.skip_value()) {
+                            return false;
+                        }
+                    }
+                    if (has_days && has_at && has_desired) rs.schedule.push_back(entry);
+                }
+            } else if (!r.skip_value()) {
+                return false;
             }
-            if (std::regex_search(body, sub, std::regex(R"RE("high"\s*:\s*"([^"]*)")RE"))) {
-                high = sub[1].str();
-            }
-            if (std::regex_search(body, sub, std::regex(R"RE("low"\s*:\s*"([^"]*)")RE"))) {
-                low = sub[1].str();
-            }
-            out[room] = std::make_tuple(desired, high, low);
         }
-    } catch(...) {
-        return false;
+        if (!r.ok()) return false;
+        out[std::string(room)] = std::move(rs);
     }
-    return true;
+    return r.ok();
 }
 
-static bool write_settings_map(const std::map<std::string, std::tuple<std::optional<double>, std::string, std::string>> &m) {
-    auto esc = [](const std::string &s){
-        std::string o; o.reserve(s.size()*2);
-        for (char c : s) {
-            switch (c) {
-                case '"': o += "\\\""; break;
-                case '\\': o += "\\\\"; break;
-                case '\b': o += "\\b"; break;
-                case '\f': o += "\\f"; break;
-                case '\n': o += "\\n"; break;
-                case '\r': o += "\\r"; break;
-                case '\t': o += "\\t"; break;
-                default: o.push_back(c);
-            }
-        }
-        return o;
-    };
-    std::ostringstream js;
-    js << "{";
-    bool first = true;
-    for (const auto &kv : m) {
-        if (!first) js << ",";
-        first = false;
-        const std::string &room = kv.first;
-        const auto &tpl = kv.second;
-        js << '"' << esc(room) << '"' << ":" << "{";
-        if (std::get<0>(tpl).has_value()) js << "\"desired\":" << std::get<0>(tpl).value();
-        else js << "\"desired\":null";
-        js << ",\"high\":\"" << esc(std::get<1>(tpl)) << "\",\"low\":\"" << esc(std::get<2>(tpl)) << "\"}";
-    }
-    js << "}";
-    // atomic write: write to temp then rename
-    std::filesystem::path p(SETTINGS_JSON_FILE);
+bool write_file_atomically(const std::string &path, const std::string &data) {
+    std::filesystem::path p(path);
     auto parent = p.parent_path();
-    if (!parent.empty()) std::filesystem::create_directories(parent);
-    std::string tmp = SETTINGS_JSON_FILE + ".tmp";
-    std::ofstream ofs(tmp, std::ios::trunc);
-    if (!ofs) return false;
-    ofs << js.str();
-    ofs.close();
     std::error_code ec;
-    std::filesystem::rename(tmp, SETTINGS_JSON_FILE, ec);
-    if (ec) {
-        // fallback: try std::rename
-        std::rename(tmp.c_str(), SETTINGS_JSON_FILE.c_str());
+    if (!parent.empty()) std::filesystem::create_directories(parent, ec);
+    std::string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t n = write(fd, data.data() + off, data.size() - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            unlink(tmp.c_str());
+            return false;
+        }
+        off += (size_t)n;
+    }
+    bool ok = fsync(fd) == 0;
+    ok = (close(fd) == 0) && ok;
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
     }
     return true;
 }
 
-// flush_readings_to_disk: implemented in storage_json.cpp
 
-void log_trigger_event(const std::string &sensor, const std::string &type, const std::string &url) {
-    auto now = std::chrono::system_clock::now();
-    std::time_t t = std::chrono::system_clock::to_time_t(now);
-    std::ostringstream ts;
-    ts << std::put_time(std::localtime(&t), "%Y-%m-%d %H:%M:%S");
-    std::string obj = "{";
-    obj += "\"timestamp\":\"" + json_escape(ts.str()) + "\",";
-    obj += "\"sensor\":\"" + json_escape(sensor) + "\",";
-    obj += "\"type\":\"" + json_escape(type) + "\",";
-    obj += "\"url\":\"" + json_escape(url) + "\"}";
-
-    // push into in-memory trigger queue; flusher will persist to disk
-    {
-        std::lock_guard<std::mutex> lk(in_memory_triggers_mutex);
-        in_memory_triggers.push_back(obj);
-        // enforce maximum size (drop oldest)
-        int maxv = MAX_TRIGGER_EVENTS.load();
-        while ((int)in_memory_triggers.size() > maxv) in_memory_triggers.pop_front();
-    }
-}
-
-std::string all_trigger_events_json() {
-    // Read persisted file entries first
-    std::ostringstream out;
-    out << "[";
-    bool first = true;
-    std::ifstream ifs(TRIGGERS_LOG_FILE);
-    if (ifs) {
-        std::string line;
-        while (std::getline(ifs, line)) {
-            if (line.empty()) continue;
-            if (!first) out << ",";
-            first = false;
-            out << line;
+// Serialize one room's settings as a JSON object
+static void append_room_json(JsonWriter &w, const RoomSettings &rs) {
+    w.begin_object();
+    w.key("desired");
+    if (rs.desired.has_value()) w.value_number(rs.desired.value());
+    else w.value_null();
+    w.key("high");
+    w.value_string(rs.high);
+    w.key("low");
+    w.value_string(rs.low);
+    if (rs.hysteresis) {
+        w.key("hysteresis");
+        w.value_number(*rs.hysteresis);
+    }
+    if (rs.min_dwell) {
+        w.key("min_dwell");
+        w.value_int(*rs.min_dwell);
+    }
+    if (rs.reassert) {
+        w.key("reassert");
+        w.value_int(*rs.reassert);
+    }
+    if (rs.predictive) {
+        w.key("predictive");
+        w.value_bool(*rs.predictive);
+    }
+    if (!rs.rules.empty()) {
+        w.key("rules");
+        w.begin_array();
+        for (const RoomRule &rule : rs.rules) {
+            w.begin_object();
+            w.key("when");
+            w.value_string(rule.when);
+            w.key("fire");
+            w.value_string(rule.fire);
+            w.end_object();
         }
+        w.end_array();
     }
-    // Append in-memory (not-yet-flushed) trigger events
-    {
-        std::lock_guard<std::mutex> lk(in_memory_triggers_mutex);
-        for (const auto &t : in_memory_triggers) {
-            if (!first) out << ",";
-            first = false;
-            out << t;
+    if (!rs.schedule.empty()) {
+        w.key("schedule");
+        w.begin_array();
+        for (const ScheduleEntry &e : rs.schedule) {
+            w.begin_object();
+            w.key("days");
+            w.value_string(format_schedule_days(e.days));
+            w.key("at");
+            w.value_string(format_time_of_day(e.minute));
+            w.key("desired");
+            w.value_number(e.desired);
+            w.end_object();
         }
+        w.end_array();
     }
-    out << "]";
-    return out.str();
+    w.end_object();
 }
 
-bool clear_trigger_events_log() {
-    // clear persisted file
-    std::ofstream ofs(TRIGGERS_LOG_FILE, std::ios::trunc);
-    bool ok = ofs.good();
-    // clear in-memory queue as well
-    {
-        std::lock_guard<std::mutex> lk(in_memory_triggers_mutex);
-        in_memory_triggers.clear();
+// Serialize the whole store, rooms sorted by name. Caller holds settings_mutex.
+static std::string settings_json_locked() {
+    std::vector<const std::pair<const std::string, RoomSettings> *> rooms;
+    rooms.reserve(settings_store.size());
+    for (const auto &kv : settings_store) rooms.push_back(&kv);
+    std::sort(rooms.begin(), rooms.end(), [](const auto *a, const auto *b){ return a->first < b->first; });
+    std::string js;
+    JsonWriter w(js);
+    w.begin_object();
+    for (const auto *kv : rooms) {
+        w.key(kv->first);
+        append_room_json(w, kv->second);
     }
-    return ok;
+    w.end_object();
+    return js;
 }
 
-void load_triggers_from_disk() {
-    std::deque<std::string> loaded;
-    std::ifstream ifs(TRIGGERS_LOG_FILE);
-    if (ifs) {
-        std::string line;
-        while (std::getline(ifs, line)) {
-            if (line.empty()) continue;
-            loaded.push_back(line);
+// Hand every room's rules, with the URLs they fire, to the rule engine. Caller holds settings_mutex.
+static void rebuild_rules_locked() {
+    std::vector<RuleSource> sources;
+    for (const auto &kv : settings_store) {
+        for (const RoomRule &rule : kv.second.rules) {
+            const std::string &url = rule.fire == "high" ? kv.second.high : kv.second.low;
+            sources.push_back(RuleSource{kv.first, rule.when, rule.fire, url});
         }
     }
-    int maxv = MAX_TRIGGER_EVENTS.load();
-    if (maxv > 0 && (int)loaded.size() > maxv) {
-        std::deque<std::string> tmp;
-        size_t start = loaded.size() - maxv;
-        for (size_t i = start; i < loaded.size(); ++i) tmp.push_back(loaded[i]);
-        loaded.swap(tmp);
+    load_rules(sources);
+}
+
+static void apply_schedule_switch(const std::string &room, int64_t when);
+static void mark_settings_dirty();
+
+// Schedule the room's next switch point after `after`, replacing any pending one.
+// Caller holds settings_mutex exclusively.
+static void arm_schedule_locked(const std::string &room, RoomSettings &rs, int64_t after) {
+    cancel_timer(rs.switch_timer);
+    rs.switch_timer = INVALID_TIMER;
+    rs.next_entry = next_schedule_switch(rs.schedule, after, rs.next_switch);
+    if (rs.next_entry < 0) return;
+    int64_t when = rs.next_switch;
+    rs.switch_timer = schedule_timer((when - (int64_t)std::time(nullptr)) * 1000,
+                                     [room, when]{ apply_schedule_switch(room, when); });
+}
+
+// Timer callback: set the desired temperature of the switch point due at `when`
+static void apply_schedule_switch(const std::string &room, int64_t when) {
+    {
+        std::unique_lock<std::shared_mutex> lk(settings_mutex);
+        auto it = settings_store.find(room);
+        // the schedule changed after this timer became due
+        if (it == settings_store.end() || it->second.next_switch != when || it->second.next_entry < 0) return;
+        RoomSettings &rs = it->second;
+        rs.desired = rs.schedule[rs.next_entry].desired;
+        rs.switch_timer = INVALID_TIMER;
+        arm_schedule_locked(room, rs, when);
+    }
+    mark_settings_dirty();
+}
+
+static bool load_settings(bool only_if_unloaded) {
+    std::map<std::string, RoomSettings> m;
+    bool ok = read_settings_map(m);
+    std::unique_lock<std::shared_mutex> lk(settings_mutex);
+    // another thread may have loaded (and modified) the store meanwhile
+    if (only_if_unloaded && settings_loaded.load()) return true;
+    for (auto &kv : settings_store) {
+        cancel_timer(kv.second.switch_timer);
+        cancel_timer(kv.second.predict_timer);
+    }
+    settings_store.clear();
+    int64_t now = (int64_t)std::time(nullptr);
+    for (auto &kv : m) {
+        RoomSettings &rs = settings_store[kv.first] = std::move(kv.second);
+        arm_schedule_locked(kv.first, rs, now);
     }
+    rebuild_rules_locked();
+    settings_loaded.store(true, std::memory_order_release);
+    settings_dirty.store(false);
+    return ok;
+}
+
+bool load_settings_from_disk() {
+    return load_settings(false);
+}
+
+bool flush_settings_to_disk() {
+    // serializes writers of the shared temp file
+    static std::mutex persist_mutex;
+    std::lock_guard<std::mutex> plk(persist_mutex);
+    if (!settings_dirty.exchange(false)) return true;
+    std::string js;
     {
-        std::lock_guard<std::mutex> lk(in_memory_triggers_mutex);
-        in_memory_triggers = std::move(loaded);
+        std::shared_lock<std::shared_mutex> lk(settings_mutex);
+        js = settings_json_locked();
+    }
+    if (!write_file_atomically(SETTINGS_JSON_FILE, js)) {
+        settings_dirty.store(true);
+        return false;
     }
+    return true;
 }
 
+// Record a settings mutation: hand it to the flusher thread, or persist inline when
+// no flusher is running (tools, tests).
+static void mark_settings_dirty() {
+    if (flusher_running.load()) {
+        {
+            std::lock_guard<std::mutex> lk(flusher_mutex);
+            settings_dirty.store(true);
+        }
+        flusher_cv.notify_all();
+    } else {
+        settings_dirty.store(true);
+        flush_settings_to_disk();
+    }
+}
 
+// flush_readings_to_disk: implemented in storage_json.cpp
+
+void mark_trigger_log_dirty() {
+    if (flusher_running.load()) {
+        {
+            std::lock_guard<std::mutex> lk(flusher_mutex);
+            triggers_dirty.store(true);
+        }
+        flusher_cv.notify_all();
+    } else {
+        flush_trigger_log();
+    }
+}
+
+// Flusher thread: persists settings and appends new trigger events shortly after they
+// change, and flushes readings every `flusher_interval_seconds`. Each flush of readings
+// is followed by a history compaction run on the (low-priority) compactor thread.
 static void flusher_loop() {
+    auto next_flush = std::chrono::steady_clock::now() + std::chrono::seconds(flusher_interval_seconds);
+    std::unique_lock<std::mutex> lk(flusher_mutex);
     while (flusher_running.load()) {
-        std::unique_lock<std::mutex> lk(flusher_mutex);
-        flusher_cv.wait_for(lk, std::chrono::seconds(flusher_interval_seconds));
+        flusher_cv.wait_until(lk, next_flush, []{ return !flusher_running.load() || settings_dirty.load() || triggers_dirty.load(); });
         if (!flusher_running.load()) break;
+        lk.unlock();
         try {
-            flush_readings_to_disk();
+            if (settings_dirty.load()) flush_settings_to_disk();
+            if (triggers_dirty.exchange(false)) flush_trigger_log();
+            if (std::chrono::steady_clock::now() >= next_flush) {
+                flush_readings_to_disk();
+                request_history_compaction();
+                next_flush = std::chrono::steady_clock::now() + std::chrono::seconds(flusher_interval_seconds);
+            }
         } catch(...) {}
+        lk.lock();
     }
 }
 
@@ -279,97 +516,319 @@ void start_periodic_flusher(int seconds) {
 
 void stop_periodic_flusher() {
     if (!flusher_running.load()) return;
-    flusher_running.store(false);
+    {
+        std::lock_guard<std::mutex> lk(flusher_mutex);
+        flusher_running.store(false);
+    }
     flusher_cv.notify_all();
     if (flusher_thread.joinable()) flusher_thread.join();
     // final flush
+    flush_settings_to_disk();
+    flush_trigger_log();
     flush_readings_to_disk();
 }
 
 std::string all_settings_json() {
-    std::ifstream ifs(SETTINGS_JSON_FILE);
-    if (!ifs) return std::string("{}");
-    std::string s((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
-    return s.empty() ? std::string("{}") : s;
+    ensure_settings_loaded();
+    std::shared_lock<std::shared_mutex> lk(settings_mutex);
+    return settings_json_locked();
 }
 
 std::string room_settings_json(const std::string &room) {
-    std::map<std::string, std::tuple<std::optional<double>, std::string, std::string>> m;
-    if (!read_settings_map(m)) return std::string();
+    ensure_settings_loaded();
     std::string sid = sanitize_id(room);
-    auto it = m.find(sid);
-    if (it == m.end()) return std::string();
-    const auto &tpl = it->second;
-    auto esc = [](const std::string &s){
-        std::string o; o.reserve(s.size()*2);
-        for (char c : s) {
-            switch (c) {
-                case '"': o += "\\\""; break;
-                case '\\': o += "\\\\"; break;
-                case '\b': o += "\\b"; break;
-                case '\f': o += "\\f"; break;
-                case '\n': o += "\\n"; break;
-                case '\r': o += "\\r"; break;
-                case '\t': o += "\\t"; break;
-                default: o.push_back(c);
-            }
-        }
-        return o;
-    };
-    std::ostringstream js;
-    js << "{";
-    if (std::get<0>(tpl).has_value()) js << "\"desired\":" << std::get<0>(tpl).value();
-    else js << "\"desired\":null";
-    js << ",\"high\":\"" << esc(std::get<1>(tpl)) << "\",\"low\":\"" << esc(std::get<2>(tpl)) << "\"}";
-    return js.str();
+    std::shared_lock<std::shared_mutex> lk(settings_mutex);
+    auto it = settings_store.find(sid);
+    if (it == settings_store.end()) return std::string();
+    std::string js;
+    JsonWriter w(js);
+    append_room_json(w, it->second);
+    return js;
 }
 
 bool set_desired_temperature(const std::string &room, double desired) {
-    std::map<std::string, std::tuple<std::optional<double>, std::string, std::string>> m;
-    read_settings_map(m);
+    ensure_settings_loaded();
     std::string sid = sanitize_id(room);
-    m[sid] = std::make_tuple(std::optional<double>(desired), std::get<1>(m[sid]), std::get<2>(m[sid]));
-    write_settings_map(m);
+    {
+        std::unique_lock<std::shared_mutex> lk(settings_mutex);
+        RoomSettings &rs = settings_store[sid];
+        rs.desired = desired;
+        rs.control = ThermostatState();
+    }
+    mark_settings_dirty();
     return true;
 }
 
 bool delete_room_settings(const std::string &room) {
-    std::map<std::string, std::tuple<std::optional<double>, std::string, std::string>> m;
-    read_settings_map(m);
+    ensure_settings_loaded();
     std::string sid = sanitize_id(room);
-    auto it = m.find(sid);
-    if (it != m.end()) {
-        m.erase(it);
-        write_settings_map(m);
+    size_t erased;
+    {
+        std::unique_lock<std::shared_mutex> lk(settings_mutex);
+        auto it = settings_store.find(sid);
+        erased = it != settings_store.end();
+        if (erased) {
+            cancel_timer(it->second.switch_timer);
+            cancel_timer(it->second.predict_timer);
+            settings_store.erase(it);
+            rebuild_rules_locked();
+        }
     }
+    if (erased) mark_settings_dirty();
     return true;
 }
 
 bool set_trigger_url(const std::string &room, const std::string &type, const std::string &url) {
-    std::map<std::string, std::tuple<std::optional<double>, std::string, std::string>> m;
-    read_settings_map(m);
+    ensure_settings_loaded();
     std::string sid = sanitize_id(room);
-    auto &entry = m[sid];
-    std::optional<double> desired = std::get<0>(entry);
-    std::string high = std::get<1>(entry);
-    std::string low = std::get<2>(entry);
-    if (type == "high") high = url;
-    else if (type == "low") low = url;
-    m[sid] = std::make_tuple(desired, high, low);
-    write_settings_map(m);
+    {
+        std::unique_lock<std::shared_mutex> lk(settings_mutex);
+        RoomSettings &rs = settings_store[sid];
+        if (type == "high") rs.high = url;
+        else if (type == "low") rs.low = url;
+        rs.control = ThermostatState();
+        if (!rs.rules.empty()) rebuild_rules_locked();
+    }
+    mark_settings_dirty();
     return true;
 }
 
 bool get_room_settings(const std::string &room, double &desired, bool &has_desired, std::string &high_url, std::string &low_url) {
-    std::map<std::string, std::tuple<std::optional<double>, std::string, std::string>> m;
-    if (!read_settings_map(m)) return false;
+    ensure_settings_loaded();
     std::string sid = sanitize_id(room);
-    auto it = m.find(sid);
-    if (it == m.end()) return false;
-    const auto &tpl = it->second;
-    if (std::get<0>(tpl).has_value()) { desired = std::get<0>(tpl).value(); has_desired = true; }
+    std::shared_lock<std::shared_mutex> lk(settings_mutex);
+    auto it = settings_store.find(sid);
+    if (it == settings_store.end()) return false;
+    const RoomSettings &rs = it->second;
+    if (rs.desired.has_value()) { desired = rs.desired.value(); has_desired = true; }
     else { desired = 0.0; has_desired = false; }
-    high_url = std::get<1>(tpl);
-    low_url = std::get<2>(tpl);
+    high_url = rs.high;
+    low_url = rs.low;
+    return true;
+}
+
+bool set_trigger_control(const std::string &room, std::optional<double> hysteresis, std::optional<int> min_dwell,
+                         std::optional<int> reassert, std::optional<bool> predictive) {
+    ensure_settings_loaded();
+    std::string sid = sanitize_id(room);
+    {
+        std::unique_lock<std::shared_mutex> lk(settings_mutex);
+        RoomSettings &rs = settings_store[sid];
+        if (hysteresis) rs.hysteresis = hysteresis;
+        if (min_dwell) rs.min_dwell = min_dwell;
+        if (reassert) rs.reassert = reassert;
+        if (predictive) rs.predictive = predictive;
+        rs.control = ThermostatState();
+    }
+    mark_settings_dirty();
+    return true;
+}
+
+static void apply_predicted_switch(const std::string &room, int64_t when);
+
+// Predictive mode: replace the room's pending predicted switch with one computed from
+// the reading `temp` at `now`. Returns the state to switch to right away, if it is due.
+// Caller holds settings_mutex (at least shared) and the room's control_mutex.
+static HeatState predict_switch_locked(const std::string &room, RoomSettings &rs, float temp, int64_t now) {
+    cancel_timer(rs.predict_timer);
+    rs.predict_timer = INVALID_TIMER;
+    rs.predict_at = 0;
+    RoomModel model;
+    if (!analytics_model(room, model)) return HeatState::Idle;
+    int64_t when;
+    HeatState next = thermostat_predict(rs.params(), rs.control, *rs.desired, model, temp, now, when);
+    if (next == HeatState::Idle || when <= now) return next;
+    rs.predict_at = when;
+    rs.predict_from = rs.control.state;
+    int64_t delay = std::max<int64_t>(0, when - (int64_t)std::time(nullptr));
+    rs.predict_timer = schedule_timer(delay * 1000,
+                                      [room, when]{ apply_predicted_switch(room, when); });
+    return HeatState::Idle;
+}
+
+// Timer callback: switch the room as predicted and fire the URL of the new state
+static void apply_predicted_switch(const std::string &room, int64_t when) {
+    HeatState next;
+    std::string url;
+    {
+        std::shared_lock<std::shared_mutex> lk(settings_mutex);
+        auto it = settings_store.find(room);
+        if (it == settings_store.end()) return;
+        RoomSettings &rs = it->second;
+        std::lock_guard<std::mutex> state_lk(rs.control_mutex.m);
+        // a reading re-planned the switch, or the room changed state or settings meanwhile
+        if (rs.predict_at != when || rs.control.state != rs.predict_from) return;
+        rs.predict_timer = INVALID_TIMER;
+        rs.predict_at = 0;
+        next = rs.predict_from == HeatState::Heating ? HeatState::Cooling : HeatState::Heating;
+        thermostat_force(rs.control, next, when);
+        url = next == HeatState::Cooling ? rs.high : rs.low;
+    }
+    if (url.empty()) return;
+    uint64_t seq = log_trigger_event(room, next == HeatState::Cooling ? "high" : "low", url);
+    if (TRIGGERS_ENABLED.load()) dispatch_trigger(seq, url);
+}
+
+bool evaluate_room_trigger(std::string_view room, float temp, int64_t now, std::string &type, std::string &url) {
+    ensure_settings_loaded();
+    const std::string &sid = room_key(room);
+    TracePhases phase("settings_lock");
+    // shared: only the room's runtime state changes, under the room's own mutex
+    std::shared_lock<std::shared_mutex> lk(settings_mutex);
+    auto it = settings_store.find(sid);
+    if (it == settings_store.end() || !it->second.desired.has_value()) return false;
+    RoomSettings &rs = it->second;
+    std::lock_guard<std::mutex> state_lk(rs.control_mutex.m);
+    phase.next("thermostat");
+    ThermostatParams params = rs.params();
+    HeatState fire = thermostat_step(params, rs.control, *rs.desired, temp, now);
+    if (params.predictive) {
+        HeatState due = predict_switch_locked(sid, rs, temp, now);
+        if (fire == HeatState::Idle && due != HeatState::Idle) {
+            thermostat_force(rs.control, due, now);
+            fire = due;
+        }
+    }
+    if (fire == HeatState::Idle) return false;
+    type = (fire == HeatState::Cooling) ? "high" : "low";
+    url = (fire == HeatState::Cooling) ? rs.high : rs.low;
+    return !url.empty();
+}
+
+void note_room_trigger(const std::string &room, const std::string &type, int64_t now) {
+    ensure_settings_loaded();
+    std::shared_lock<std::shared_mutex> lk(settings_mutex);
+    auto it = settings_store.find(sanitize_id(room));
+    if (it == settings_store.end()) return;
+    std::lock_guard<std::mutex> state_lk(it->second.control_mutex.m);
+    thermostat_force(it->second.control, type == "high" ? HeatState::Cooling : HeatState::Heating, now);
+}
+
+std::string room_states_json() {
+    ensure_settings_loaded();
+    std::shared_lock<std::shared_mutex> lk(settings_mutex);
+    std::map<std::string, const RoomSettings *> rooms;
+    for (const auto &kv : settings_store) rooms[kv.first] = &kv.second;
+    std::string js;
+    JsonWriter w(js);
+    w.begin_object();
+    for (const auto &kv : rooms) {
+        const RoomSettings &rs = *kv.second;
+        ThermostatParams p = rs.params();
+        std::lock_guard<std::mutex> state_lk(rs.control_mutex.m);
+        w.key(kv.first);
+        w.begin_object();
+        w.key("state");
+        w.value_string(heat_state_name(rs.control.state));
+        w.key("since");
+        if (rs.control.state == HeatState::Idle) {
+            w.value_null();
+        } else {
+            char ts[32];
+            size_t n = format_local_timestamp(rs.control.since, ts, sizeof(ts));
+            w.value_string(std::string_view(ts, n));
+        }
+        w.key("hysteresis");
+        w.value_number(p.hysteresis);
+        w.key("min_dwell");
+        w.value_int(p.min_dwell_seconds);
+        w.key("reassert");
+        w.value_int(p.reassert_seconds);
+        w.key("predictive");
+        w.value_bool(p.predictive);
+        if (rs.predict_at) {
+            char ts[32];
+            size_t n = format_local_timestamp(rs.predict_at, ts, sizeof(ts));
+            w.key("predicted_switch");
+            w.value_string(std::string_view(ts, n));
+        }
+        if (rs.next_entry >= 0) {
+            // upcoming schedule switch point
+            char ts[32];
+            size_t n = format_local_timestamp(rs.next_switch, ts, sizeof(ts));
+            w.key("next_switch");
+            w.value_string(std::string_view(ts, n));
+            w.key("next_desired");
+            w.value_number(rs.schedule[rs.next_entry].desired);
+        }
+        w.end_object();
+    }
+    w.end_object();
+    return js;
+}
+
+bool add_room_rule(const std::string &room, const std::string &when, const std::string &fire, std::string &error) {
+    if (fire != "high" && fire != "low") {
+        error = "fire must be high or low";
+        return false;
+    }
+    CompiledRule compiled;
+    if (!compile_rule(when, sensor_registry, compiled, error)) return false;
+    ensure_settings_loaded();
+    std::string sid = sanitize_id(room);
+    {
+        std::unique_lock<std::shared_mutex> lk(settings_mutex);
+        settings_store[sid].rules.push_back(RoomRule{when, fire});
+        rebuild_rules_locked();
+    }
+    mark_settings_dirty();
+    return true;
+}
+
+bool clear_room_rules(const std::string &room) {
+    ensure_settings_loaded();
+    std::string sid = sanitize_id(room);
+    bool changed = false;
+    {
+        std::unique_lock<std::shared_mutex> lk(settings_mutex);
+        auto it = settings_store.find(sid);
+        if (it != settings_store.end() && !it->second.rules.empty()) {
+            it->second.rules.clear();
+            rebuild_rules_locked();
+            changed = true;
+        }
+    }
+    if (changed) mark_settings_dirty();
+    return true;
+}
+
+bool add_room_schedule(const std::string &room, const std::string &days, const std::string &at, double desired,
+                       std::string &error) {
+    ScheduleEntry entry;
+    entry.desired = desired;
+    if (!parse_schedule_days(days, entry.days)) {
+        error = "days must be a list of mon..sun, ranges such as mon-fri, or daily";
+        return false;
+    }
+    if (!parse_time_of_day(at, entry.minute)) {
+        error = "at must be HH:MM";
+        return false;
+    }
+    ensure_settings_loaded();
+    std::string sid = sanitize_id(room);
+    {
+        std::unique_lock<std::shared_mutex> lk(settings_mutex);
+        RoomSettings &rs = settings_store[sid];
+        rs.schedule.push_back(entry);
+        arm_schedule_locked(sid, rs, (int64_t)std::time(nullptr));
+    }
+    mark_settings_dirty();
+    return true;
+}
+
+bool clear_room_schedule(const std::string &room) {
+    ensure_settings_loaded();
+    std::string sid = sanitize_id(room);
+    bool changed = false;
+    {
+        std::unique_lock<std::shared_mutex> lk(settings_mutex);
+        auto it = settings_store.find(sid);
+        if (it != settings_store.end() && !it->second.schedule.empty()) {
+            it->second.schedule.clear();
+            arm_schedule_locked(sid, it->second, 0);
+            changed = true;
+        }
+    }
+    if (changed) mark_settings_dirty();
     return true;
 }
@@ -19,36 +19,93 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <mutex>
+#include <shared_mutex>
 #include <thread>
 #include <condition_variable>
 #include <atomic>
 #include <chrono>
 #include <deque>
+#include <memory>
+#include "sensor_registry.h"
+#include "trigger_log.h"
+#include "thermostat.h"
+#include "schedule.h"
+#include "timer_wheel.h"
+#include "arena.h"
 
 // Path to JSON settings file (stores room settings)
 extern std::string SETTINGS_JSON_FILE;
 
-// Path to triggers log file (line-separated JSON objects)
+// Base path of the trigger log segments (line-separated JSON objects, see trigger_log.h)
 extern std::string TRIGGERS_LOG_FILE;
 
 // Path to single JSON file storing all sensor readings (new consolidated storage)
 extern std::string SENSOR_DATA_JSON_FILE;
 
-// In-memory cache for latest readings (sensor id -> JSON payload)
-// Exposed so JSON helpers can access and merge with disk state.
-extern std::unordered_map<std::string, std::string> in_memory_readings;
-extern std::mutex in_memory_mutex;
-// In-memory queue for trigger events (each item is a JSON object string)
-// In-memory queue for trigger events (each item is a JSON object string)
-extern std::deque<std::string> in_memory_triggers;
-extern std::mutex in_memory_triggers_mutex;
-
+// Latest reading of every sensor (interned ids, numeric records)
+// Exposed so JSON helpers can serialize it and merge disk state into it.
+extern SensorRegistry sensor_registry;
 // Maximum number of trigger events kept in memory before older events are dropped.
 extern std::atomic<int> MAX_TRIGGER_EVENTS;
 
 // Global flag to enable/disable trigger execution
 extern std::atomic<bool> TRIGGERS_ENABLED;
 
+// A sensor that has not reported for this many seconds gets a "stale" event in the
+// trigger log (0 = never). Each sensor has one pending timer, re-armed by every reading.
+extern std::atomic<int> STALE_SENSOR_SECONDS;
+
+// Trigger rule of a room (see rules.h): fire the room's `fire` ("high" or "low") URL
+// whenever the condition `when` becomes true
+struct RoomRule {
+    std::string when;
+    std::string fire;
+};
+
+// Mutex that copies and moves as a fresh, unlocked one, so RoomSettings stays copyable
+struct RoomStateMutex {
+    std::mutex m;
+    RoomStateMutex() = default;
+    RoomStateMutex(const RoomStateMutex &) {}
+    RoomStateMutex &operator=(const RoomStateMutex &) { return *this; }
+};
+
+// Settings of a single room as held by the in-memory settings store
+struct RoomSettings {
+    std::optional<double> desired;
+    std::string high;
+    std::string low;
+    // trigger control overrides (defaults in thermostat.h)
+    std::optional<double> hysteresis;
+    std::optional<int> min_dwell;
+    std::optional<int> reassert;
+    std::optional<bool> predictive;
+    std::vector<RoomRule> rules;
+    std::vector<ScheduleEntry> schedule;
+    // runtime trigger state; not persisted, every room starts idle. Readings update it
+    // (and the predicted switch below) holding the settings lock shared, so it has its
+    // own mutex; holders of the exclusive settings lock may skip it.
+    mutable RoomStateMutex control_mutex;
+    ThermostatState control;
+    // runtime: pending schedule switch (see schedule.h)
+    TimerId switch_timer = INVALID_TIMER;
+    int64_t next_switch = 0;
+    int next_entry = -1;
+    // runtime: pending predicted switch away from `predict_from` (see thermostat.h)
+    TimerId predict_timer = INVALID_TIMER;
+    int64_t predict_at = 0;
+    HeatState predict_from = HeatState::Idle;
+
+    ThermostatParams params() const {
+        ThermostatParams p;
+        if (hysteresis) p.hysteresis = *hysteresis;
+        if (min_dwell) p.min_dwell_seconds = *min_dwell;
+        if (reassert) p.reassert_seconds = *reassert;
+        if (predictive) p.predictive = *predictive;
+        return p;
+    }
+};
+
 // Return a map of room -> trigger url for given type ("high" or "low").
 std::map<std::string, std::string> get_all_trigger_urls(const std::string &type);
 // (TRIGGERS_LOG_FILE and SENSOR_DATA_JSON_FILE declared above)
@@ -65,26 +122,31 @@ void stop_periodic_flusher();
 // Force immediate flush of in-memory readings to disk (atomic).
 void flush_readings_to_disk();
 
-// Trigger event logging
-// Record that a trigger URL was executed for `sensor` with type `high` or `low` and the URL called
-void log_trigger_event(const std::string &sensor, const std::string &type, const std::string &url);
-// Return trigger events as a JSON array string (each entry is an object with timestamp, sensor, type, url)
-std::string all_trigger_events_json();
-// Clear all trigger events log
-bool clear_trigger_events_log();
-
-// Load trigger events from disk into the in-memory queue (keeps only latest `MAX_TRIGGER_EVENTS`)
-void load_triggers_from_disk();
+// Trigger event logging lives in trigger_log.h. New events are handed to the flusher
+// thread, or appended inline when no flusher is running (tools, tests).
+void mark_trigger_log_dirty();
 
 // Sensor data storage utilities
 // - sanitize_id: produce safe filename/id from arbitrary input
 // - save_sensor_data: store latest reading in memory (flusher persists to disk)
-// - read_sensor_data: return latest reading (prefer in-memory, then file)
+// - read_sensor_data: return latest reading as JSON (empty if unknown)
 // - all_sensors_json: return JSON mapping sensor id -> payload
 std::string sanitize_id(const std::string &id);
-bool save_sensor_data(const std::string &id, const std::string &body);
+// Same, copying into `arena` only if `id` has characters to drop
+std::string_view sanitize_id(std::string_view id, Arena &arena);
+bool save_sensor_data(std::string_view id, const SensorReading &reading);
 std::string read_sensor_data(const std::string &id);
 std::string all_sensors_json();
+// Merge readings stored in SENSOR_DATA_JSON_FILE into the registry (done on first use otherwise)
+bool load_readings_from_disk();
+
+// GET /sensors is served from an immutable, prebuilt JSON snapshot of all readings.
+// It is rebuilt after a reading changes, at most once per SNAPSHOT_INTERVAL_MS.
+extern std::atomic<int> SNAPSHOT_INTERVAL_MS;
+// Current snapshot (same content as all_sensors_json(), possibly up to one interval old)
+std::shared_ptr<const std::string> sensors_snapshot();
+// Parse a stored reading object ({"timestamp":"YYYY-mm-dd HH:MM:SS","temp":"21.5",...})
+bool parse_sensor_payload(std::string_view json, SensorReading &out);
 
 // Settings stored in a single file (per requirement)
 // Set desired temperature for a room
@@ -95,9 +157,47 @@ bool set_trigger_url(const std::string &room, const std::string &type, const std
 bool get_room_settings(const std::string &room, double &desired, bool &has_desired, std::string &high_url, std::string &low_url);
 // Clear settings for a room
 bool delete_room_settings(const std::string &room);
-
-// Read settings JSON into map: room -> (optional desired, high, low)
+// Set a room's trigger control parameters; omitted ones keep their value. Resets the room to idle.
+bool set_trigger_control(const std::string &room, std::optional<double> hysteresis, std::optional<int> min_dwell,
+                         std::optional<int> reassert, std::optional<bool> predictive = std::nullopt);
+// Run the room's trigger state machine on a new reading taken at `now`. Returns true if a
+// trigger URL must be fired; `type` receives "high" or "low" and `url` the configured URL.
+// In predictive mode it also (re)arms a timer that fires the next switch at its
+// predicted time, unless that is already due.
+bool evaluate_room_trigger(std::string_view room, float temp, int64_t now, std::string &type, std::string &url);
+// Record that the room's `type` URL was fired outside the state machine (trigger-all routes)
+void note_room_trigger(const std::string &room, const std::string &type, int64_t now);
+// JSON object mapping room -> current trigger state and effective control parameters
+std::string room_states_json();
+// Add a trigger rule to a room. Returns false and sets `error` if `when` does not compile
+// or `fire` is not "high" or "low".
+bool add_room_rule(const std::string &room, const std::string &when, const std::string &fire, std::string &error);
+// Remove all trigger rules of a room
+bool clear_room_rules(const std::string &room);
+// Add a switch point to a room's weekly schedule: on `days` (see parse_schedule_days) at
+// `at` ("HH:MM") the desired temperature becomes `desired`. Returns false and sets `error`
+// if `days` or `at` cannot be parsed.
+bool add_room_schedule(const std::string &room, const std::string &days, const std::string &at, double desired,
+                       std::string &error);
+// Remove a room's schedule
+bool clear_room_schedule(const std::string &room);
+
+// Arm a stale timer for every sensor in the registry, counted from its last reading
+// (call once after loading readings; save_sensor_data() re-arms on every reading)
+void watch_stale_sensors();
+
+// Settings live in memory; they are loaded from SETTINGS_JSON_FILE on first use (or explicitly
+// at startup) and persisted by the flusher thread shortly after every change.
+// Replace the in-memory settings with the contents of SETTINGS_JSON_FILE
+bool load_settings_from_disk();
+// Persist the in-memory settings if they changed since the last write (atomic temp-file rename)
+bool flush_settings_to_disk();
+
+// Write `data` to `path` via a temp file, fsync and rename, so readers never see a partial file
+bool write_file_atomically(const std::string &path, const std::string &data);
+
+// Read settings JSON into map: room -> settings (runtime state left at its default)
 // Exposed for callers that need to inspect raw settings map.
-bool read_settings_map(std::map<std::string, std::tuple<std::optional<double>, std::string, std::string>> &out);
+bool read_settings_map(std::map<std::string, RoomSettings> &out);
 
 #endif // STORAGE_H
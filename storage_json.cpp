@@ -2,293 +2,243 @@
 // Consolidated JSON storage for sensor readings (moved from storage.cpp)
 
 #include "storage_json.h"
+#include "json.h"
+#include "wal.h"
+#include "history_store.h"
+#include "metrics.h"
 
+#include <chrono>
 #include <fstream>
 #include <sstream>
 #include <filesystem>
 #include <iterator>
 #include <cctype>
+#include <charconv>
+#include <ctime>
 
-// helpers (internal)
-static bool extract_json_value_at(const std::string &s, size_t pos, std::string &out, size_t &new_pos) {
-    while (pos < s.size() && std::isspace((unsigned char)s[pos])) ++pos;
-    if (pos >= s.size()) return false;
-    char c = s[pos];
-    if (c == '{' || c == '[') {
-        char open = c;
-        char close = (c == '{') ? '}' : ']';
-        size_t i = pos;
-        int depth = 0;
-        while (i < s.size()) {
-            char ch = s[i];
-            if (ch == '"') {
-                ++i;
-                while (i < s.size()) {
-                    if (s[i] == '\\') { i += 2; continue; }
-                    if (s[i] == '"') { ++i; break; }
-                    ++i;
-                }
-                continue;
-            } else if (ch == open) {
-                ++depth;
-            } else if (ch == close) {
-                --depth;
-                if (depth == 0) { ++i; break; }
-            }
-            ++i;
-        }
-        if (depth != 0) return false;
-        out = s.substr(pos, i - pos);
-        new_pos = i;
-        return true;
-    } else if (c == '"') {
-        size_t i = pos + 1;
-        while (i < s.size()) {
-            if (s[i] == '\\') { i += 2; continue; }
-            if (s[i] == '"') { ++i; break; }
-            ++i;
-        }
-        if (i > s.size()) return false;
-        out = s.substr(pos, i - pos);
-        new_pos = i;
-        return true;
-    } else {
-        size_t i = pos;
-        while (i < s.size()) {
-            if (s[i] == ',' || s[i] == '}' || s[i] == ']') break;
-            ++i;
-        }
-        if (i == pos) return false;
-        size_t r = i;
-        while (r > pos && std::isspace((unsigned char)s[r-1])) --r;
-        out = s.substr(pos, r - pos);
-        new_pos = i;
-        return true;
+// Read a whole file into memory; empty string if it does not exist.
+static std::string read_whole_file(const std::string &path) {
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) return std::string();
+    std::string s;
+    ifs.seekg(0, std::ios::end);
+    std::streamoff size = ifs.tellg();
+    if (size > 0) {
+        s.resize((size_t)size);
+        ifs.seekg(0);
+        ifs.read(&s[0], size);
+        s.resize((size_t)ifs.gcount());
     }
+    return s;
 }
 
-std::string json_escape(const std::string &s) {
-    std::string o; o.reserve(s.size()*2);
-    for (char c : s) {
-        switch (c) {
-            case '"': o += "\\\""; break;
-            case '\\': o += "\\\\"; break;
-            case '\b': o += "\\b"; break;
-            case '\f': o += "\\f"; break;
-            case '\n': o += "\\n"; break;
-            case '\r': o += "\\r"; break;
-            case '\t': o += "\\t"; break;
-            default: o.push_back(c);
-        }
+// Walk the top-level object of the consolidated sensor file, calling
+// fn(key, raw_value) for each entry (views into `s`). fn returns false to stop early.
+template <typename Fn>
+static bool for_each_sensor_entry(std::string_view s, Fn fn) {
+    if (s.empty()) return true;
+    JsonReader r(s);
+    if (!r.begin_object()) return false;
+    std::string scratch;
+    std::string_view key, raw;
+    while (r.next_key(key, scratch)) {
+        if (!r.skip_value(&raw)) return false;
+        if (!fn(key, raw)) return true;
     }
+    return r.ok();
+}
+
+std::string json_escape(std::string_view s) {
+    std::string o;
+    o.reserve(s.size() + 8);
+    json_escape_to(o, s);
     return o;
 }
 
-// Return latest reading for `id`. Prefer in-memory cache; fallback to consolidated JSON file.
-std::string read_sensor_data(const std::string &id) {
-    std::string sid = sanitize_id(id);
-    {
-        std::lock_guard<std::mutex> lk(in_memory_mutex);
-        auto it = in_memory_readings.find(sid);
-        if (it != in_memory_readings.end()) return it->second;
-    }
-    std::ifstream ifs(SENSOR_DATA_JSON_FILE);
-    if (!ifs) return std::string();
-    std::string s((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
-    size_t obj_start = s.find('{');
-    if (obj_start == std::string::npos) return std::string();
-    size_t pos = obj_start + 1;
-    while (pos < s.size()) {
-        while (pos < s.size() && (std::isspace((unsigned char)s[pos]) || s[pos] == ',')) ++pos;
-        if (pos >= s.size() || s[pos] == '}') break;
-        if (s[pos] != '"') break;
-        size_t key_start = pos + 1;
-        size_t i = key_start;
-        while (i < s.size()) {
-            if (s[i] == '\\') { i += 2; continue; }
-            if (s[i] == '"') break;
-            ++i;
-        }
-        if (i >= s.size()) break;
-        std::string key = s.substr(key_start, i - key_start);
-        pos = i + 1;
-        while (pos < s.size() && std::isspace((unsigned char)s[pos])) ++pos;
-        if (pos >= s.size() || s[pos] != ':') break;
-        ++pos;
-        std::string val; size_t val_end;
-        if (!extract_json_value_at(s, pos, val, val_end)) break;
-        if (key == sid) return val;
-        pos = val_end;
+// Parse a value stored either as a JSON number or as numeric text ("21.5")
+static bool read_float_value(JsonReader &r, std::string &scratch, float &out) {
+    if (r.peek() == '"') {
+        std::string_view sv;
+        if (!r.read_string(sv, scratch)) return false;
+        float v;
+        auto res = std::from_chars(sv.data(), sv.data() + sv.size(), v);
+        if (res.ec == std::errc() && res.ptr == sv.data() + sv.size()) out = v;
+        return true;
     }
-    return std::string();
+    if (r.peek() == 'n') return r.read_null();
+    double d;
+    if (!r.read_number(d)) return false;
+    out = (float)d;
+    return true;
 }
 
-// Return JSON object mapping sensor id -> payload. In-memory override file entries.
-std::string all_sensors_json() {
-    std::ostringstream out;
-    out << "{";
-    bool first = true;
-    {
-        std::lock_guard<std::mutex> lk(in_memory_mutex);
-        for (const auto &kv : in_memory_readings) {
-            if (!first) out << ",";
-            first = false;
-            out << "\"" << kv.first << "\":" << kv.second;
-        }
-    }
-    std::ifstream ifs(SENSOR_DATA_JSON_FILE);
-    if (ifs) {
-        std::string s((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
-        size_t obj_start = s.find('{');
-        if (obj_start != std::string::npos) {
-            size_t pos = obj_start + 1;
-            while (pos < s.size()) {
-                while (pos < s.size() && (std::isspace((unsigned char)s[pos]) || s[pos] == ',')) ++pos;
-                if (pos >= s.size() || s[pos] == '}') break;
-                if (s[pos] != '"') break;
-                size_t key_start = pos + 1;
-                size_t i = key_start;
-                while (i < s.size()) {
-                    if (s[i] == '\\') { i += 2; continue; }
-                    if (s[i] == '"') break;
-                    ++i;
-                }
-                if (i >= s.size()) break;
-                std::string key = s.substr(key_start, i - key_start);
-                pos = i + 1;
-                while (pos < s.size() && std::isspace((unsigned char)s[pos])) ++pos;
-                if (pos >= s.size() || s[pos] != ':') break;
-                ++pos;
-                std::string val; size_t val_end;
-                if (!extract_json_value_at(s, pos, val, val_end)) break;
-                {
-                    std::lock_guard<std::mutex> lk(in_memory_mutex);
-                    if (in_memory_readings.find(key) == in_memory_readings.end()) {
-                        if (!first) out << ",";
-                        first = false;
-                        out << "\"" << key << "\":" << val;
-                    }
-                }
-                pos = val_end;
-            }
+bool parse_sensor_payload(std::string_view json, SensorReading &out) {
+    JsonReader r(json);
+    if (!r.begin_object()) return false;
+    std::string key_scratch, scratch;
+    std::string_view key;
+    while (r.next_key(key, key_scratch)) {
+        bool ok;
+        if (key == "timestamp" && r.peek() == '"') {
+            std::string_view ts;
+            ok = r.read_string(ts, scratch);
+            if (ok) parse_local_timestamp(ts, out.timestamp);
+        } else if (key == "timestamp" && r.peek() != 'n') {
+            double d;
+            ok = r.read_number(d);
+            if (ok) out.timestamp = (int64_t)d;
+        } else if (key == "temp") {
+            ok = read_float_value(r, scratch, out.temp);
+        } else if (key == "hum") {
+            ok = read_float_value(r, scratch, out.hum);
+        } else if (key == "batt") {
+            ok = read_float_value(r, scratch, out.batt);
+        } else {
+            ok = r.skip_value();
         }
+        if (!ok) return false;
     }
-    out << "}";
-    return out.str();
+    return r.ok();
 }
 
-// Flush in-memory readings to the consolidated JSON file atomically.
-// Legacy per-file writes removed.
-void flush_readings_to_disk() {
-    std::unordered_map<std::string, std::string> copy;
-    {
-        std::lock_guard<std::mutex> lk(in_memory_mutex);
-        copy = in_memory_readings;
-    }
-    // Read existing file into map
-    std::unordered_map<std::string, std::string> combined;
-    std::ifstream ifs(SENSOR_DATA_JSON_FILE);
-    if (ifs) {
-        std::string s((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
-        size_t obj_start = s.find('{');
-        if (obj_start != std::string::npos) {
-            size_t pos = obj_start + 1;
-            while (pos < s.size()) {
-                while (pos < s.size() && (std::isspace((unsigned char)s[pos]) || s[pos] == ',')) ++pos;
-                if (pos >= s.size() || s[pos] == '}') break;
-                if (s[pos] != '"') break;
-                size_t key_start = pos + 1;
-                size_t i = key_start;
-                while (i < s.size()) {
-                    if (s[i] == '\\') { i += 2; continue; }
-                    if (s[i] == '"') break;
-                    ++i;
-                }
-                if (i >= s.size()) break;
-                std::string key = s.substr(key_start, i - key_start);
-                pos = i + 1;
-                while (pos < s.size() && std::isspace((unsigned char)s[pos])) ++pos;
-                if (pos >= s.size() || s[pos] != ':') break;
-                ++pos;
-                std::string val; size_t val_end;
-                if (!extract_json_value_at(s, pos, val, val_end)) break;
-                combined[key] = val;
-                pos = val_end;
-            }
-        }
-    }
-    // Merge with in-memory
-    for (const auto &kv : copy) combined[kv.first] = kv.second;
+static std::atomic<bool> readings_loaded(false);
+static std::mutex readings_load_mutex;
 
-    // Build JSON
-    std::ostringstream js;
-    js << "{";
-    bool first = true;
-    for (const auto &kv : combined) {
-        if (!first) js << ",";
-        first = false;
-        js << "\"" << json_escape(kv.first) << "\":" << kv.second;
+// Keep whichever reading is newer; never replaces a reading that arrived after the
+// file being loaded was written. Log records are in arrival order, so a replayed one
+// (`from_log`) also wins a tie: it came after the entry from the same second.
+static void merge_reading(std::string_view id, const SensorReading &reading, bool from_log) {
+    SensorHandle h = sensor_registry.intern(sanitize_id(std::string(id)));
+    SensorReading current;
+    if (!sensor_registry.get(h, current) || current.timestamp < reading.timestamp ||
+        (from_log && current.timestamp == reading.timestamp)) {
+        sensor_registry.update(h, reading);
     }
-    js << "}";
+}
 
-    // atomic write
-    std::filesystem::path p(SENSOR_DATA_JSON_FILE);
-    auto parent = p.parent_path();
-    if (!parent.empty()) std::filesystem::create_directories(parent);
-    std::string tmp = SENSOR_DATA_JSON_FILE + ".tmp";
-    std::ofstream ofs(tmp, std::ios::trunc);
-    if (!ofs) return;
-    ofs << js.str();
-    ofs.close();
-    std::error_code ec;
-    std::filesystem::rename(tmp, SENSOR_DATA_JSON_FILE, ec);
-    if (ec) std::rename(tmp.c_str(), SENSOR_DATA_JSON_FILE.c_str());
+// Load the last snapshot, then replay the write-ahead log(s) written after it.
+// Caller holds readings_load_mutex.
+static bool load_readings_locked() {
+    readings_loaded.store(true, std::memory_order_release);
+    std::string s = read_whole_file(SENSOR_DATA_JSON_FILE);
+    bool ok = for_each_sensor_entry(s, [&](std::string_view key, std::string_view raw) {
+        SensorReading reading;
+        if (parse_sensor_payload(raw, reading)) merge_reading(key, reading, false);
+        return true;
+    });
+    // logged readings not yet in a history segment are buffered again
+    auto replay = [](std::string_view id, const SensorReading &reading) {
+        merge_reading(id, reading, true);
+        history_store_replay(sensor_registry.find(sanitize_id(std::string(id))), reading);
+    };
+    wal_replay(WAL_FILE + ".prev", replay);
+    wal_replay(WAL_FILE, replay);
+    return ok;
+}
 
-    // Flush pending trigger events (append) and clear in-memory queue
-        std::deque<std::string> pending;
-    {
-        std::lock_guard<std::mutex> lk(in_memory_triggers_mutex);
-        pending.swap(in_memory_triggers);
-    }
-    if (!pending.empty()) {
-        // read existing persisted triggers
-        std::deque<std::string> existing;
-        std::ifstream ifs2(TRIGGERS_LOG_FILE);
-        if (ifs2) {
-            std::string line;
-            while (std::getline(ifs2, line)) {
-                if (line.empty()) continue;
-                existing.push_back(line);
-            }
-        }
-        // append pending in-memory events
-        for (const auto &line : pending) existing.push_back(line);
+bool load_readings_from_disk() {
+    std::lock_guard<std::mutex> lk(readings_load_mutex);
+    return load_readings_locked();
+}
 
-        // trim to keep only latest MAX_TRIGGER_EVENTS entries
-        int maxv = MAX_TRIGGER_EVENTS.load();
-        if (maxv > 0 && (int)existing.size() > maxv) {
-            std::deque<std::string> tmp;
-            size_t start = existing.size() - maxv;
-            for (size_t i = start; i < existing.size(); ++i) tmp.push_back(existing[i]);
-            existing.swap(tmp);
-        }
+void ensure_readings_loaded() {
+    if (readings_loaded.load(std::memory_order_acquire)) return;
+    std::lock_guard<std::mutex> lk(readings_load_mutex);
+    if (!readings_loaded.load()) load_readings_locked();
+}
+
+// Return latest reading for `id` as JSON (empty if the sensor never reported).
+std::string read_sensor_data(const std::string &id) {
+    ensure_readings_loaded();
+    std::string out;
+    sensor_registry.reading_json(sensor_registry.find(sanitize_id(id)), out);
+    return out;
+}
+
+// Return JSON object mapping sensor id -> payload.
+std::string all_sensors_json() {
+    ensure_readings_loaded();
+    std::string out;
+    JsonWriter w(out);
+    sensor_registry.write_all_json(w);
+    return out;
+}
 
-        // atomic write the trimmed list back to disk
-        std::filesystem::path tp(TRIGGERS_LOG_FILE);
-        auto parent = tp.parent_path();
-        if (!parent.empty()) std::filesystem::create_directories(parent);
-        std::string ttmp = TRIGGERS_LOG_FILE + ".tmp";
-        std::ofstream ofs2(ttmp, std::ios::trunc);
-        if (ofs2) {
-            for (const auto &line : existing) ofs2 << line << "\n";
-            ofs2.close();
-            std::error_code ec2;
-            std::filesystem::rename(ttmp, TRIGGERS_LOG_FILE, ec2);
-            if (ec2) std::rename(ttmp.c_str(), TRIGGERS_LOG_FILE.c_str());
+std::atomic<int> SNAPSHOT_INTERVAL_MS(1000);
+
+struct SensorsSnapshot {
+    uint64_t version;  // registry version the snapshot was built from
+    std::chrono::steady_clock::time_point built;
+    std::string json;
+};
+
+// Published snapshot; only accessed through std::atomic_load/std::atomic_store.
+static std::shared_ptr<const SensorsSnapshot> current_snapshot;
+// Bumped after every publish so readers can keep a per-thread copy of the pointer and
+// skip the shared_ptr atomics (which take a lock in libstdc++) while nothing changed.
+static std::atomic<uint64_t> snapshot_generation(0);
+static std::mutex snapshot_rebuild_mutex;
+
+static bool snapshot_is_current(const SensorsSnapshot &snap) {
+    if (snap.version == sensor_registry.version()) return true;
+    auto age = std::chrono::steady_clock::now() - snap.built;
+    return age < std::chrono::milliseconds(SNAPSHOT_INTERVAL_MS.load());
+}
+
+std::shared_ptr<const std::string> sensors_snapshot() {
+    thread_local std::shared_ptr<const SensorsSnapshot> cached;
+    thread_local uint64_t cached_generation = 0;
+    uint64_t gen = snapshot_generation.load(std::memory_order_acquire);
+    if (!cached || gen != cached_generation) {
+        cached = std::atomic_load(&current_snapshot);
+        cached_generation = gen;
+    }
+    if (!cached || !snapshot_is_current(*cached)) {
+        // one thread rebuilds; the others keep serving the previous snapshot meanwhile
+        std::unique_lock<std::mutex> lk(snapshot_rebuild_mutex, std::defer_lock);
+        if (cached) {
+            if (!lk.try_lock()) return std::shared_ptr<const std::string>(cached, &cached->json);
         } else {
-            // write failed: requeue pending back into memory
-            std::lock_guard<std::mutex> lk(in_memory_triggers_mutex);
-            for (const auto &line : pending) in_memory_triggers.push_back(line);
+            lk.lock();
+        }
+        auto latest = std::atomic_load(&current_snapshot);
+        if (!latest || !snapshot_is_current(*latest)) {
+            auto snap = std::make_shared<SensorsSnapshot>();
+            // read the version first: an update racing with the build triggers another rebuild
+            snap->version = sensor_registry.version();
+            snap->built = std::chrono::steady_clock::now();
+            snap->json = all_sensors_json();
+            latest = std::move(snap);
+            std::atomic_store(&current_snapshot, latest);
+            snapshot_generation.fetch_add(1, std::memory_order_release);
         }
+        cached = std::move(latest);
+        cached_generation = snapshot_generation.load(std::memory_order_acquire);
+    }
+    return std::shared_ptr<const std::string>(cached, &cached->json);
+}
+
+// Flush in-memory readings to the consolidated JSON file atomically.
+// Legacy per-file writes removed.
+void flush_readings_to_disk() {
+    // the periodic flusher and the shutdown path may flush concurrently; they share temp files
+    static std::mutex flush_mutex;
+    std::lock_guard<std::mutex> flk(flush_mutex);
+    // entries only present on disk were merged into the registry on first use
+    ensure_readings_loaded();
+    // readings logged so far go to WAL_FILE.prev; the snapshot below includes all of them
+    wal_rotate();
+    // readings in the rotated log are all buffered for the history segments by now
+    flush_history_segments();
+    auto start = std::chrono::steady_clock::now();
+    std::string js = all_sensors_json();
+    if (!write_file_atomically(SENSOR_DATA_JSON_FILE, js)) {
+        metrics_count(Counter::ReadingsFlushFailures);
+        return;
     }
+    metrics_count(Counter::ReadingsFlushes);
+    metrics_count(Counter::ReadingsFlushBytes, js.size());
+    metrics_count(Counter::ReadingsFlushMicros, (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                                                    std::chrono::steady_clock::now() - start).count());
+    wal_drop_rotated();
 }
@@ -4,6 +4,7 @@
 #define STORAGE_JSON_H
 
 #include "storage.h"
+#include <string_view>
 
 // Implementations moved from storage.cpp:
 // - read_sensor_data
@@ -11,6 +12,9 @@
 // - flush_readings_to_disk
 
 // Utility exported for other modules
-std::string json_escape(const std::string &s);
+std::string json_escape(std::string_view s);
+
+// Merge SENSOR_DATA_JSON_FILE into the registry unless that already happened
+void ensure_readings_loaded();
 
 #endif // STORAGE_JSON_H
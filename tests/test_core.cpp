@@ -20,20 +20,115 @@
 
 #include "../http.h"
 #include "../storage.h"
+#include "../json.h"
+#include "../wal.h"
+#include "../trigger_dispatch.h"
+#include "../rules.h"
+#include "../schedule.h"
+#include "../timer_wheel.h"
+#include "../history.h"
+#include "../history_store.h"
+#include "../history_compact.h"
+#include "../rollup.h"
+#include "../analytics.h"
+#include "../metrics.h"
+#include "../trace.h"
+#include "../event_loop.h"
 #include <iostream>
 #include <cassert>
 #include <filesystem>
 #include <fstream>
+#include <cmath>
+#include <thread>
+#include <new>
+#include <cstring>
+#include <cstdlib>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 using namespace std;
 namespace fs = std::filesystem;
 
+// Heap allocations of the calling thread while counting is on (test_ingest_allocations)
+static thread_local bool count_allocations = false;
+static thread_local uint64_t allocations = 0;
+
+void *operator new(size_t n) {
+    if (count_allocations) ++allocations;
+    if (void *p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+void *operator new[](size_t n) { return operator new(n); }
+void *operator new(size_t n, const std::nothrow_t &) noexcept {
+    if (count_allocations) ++allocations;
+    return std::malloc(n ? n : 1);
+}
+void *operator new[](size_t n, const std::nothrow_t &t) noexcept { return operator new(n, t); }
+// not inlined into the standard allocators, which GCC would flag as mismatched with malloc
+__attribute__((noinline)) void operator delete(void *p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete[](void *p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete[](void *p, size_t) noexcept { std::free(p); }
+
+// Trigger log of tests that do not use their own; the default would rotate into the tree
+static const std::string TEST_TRIGGERS_LOG = "./test_data/triggers.log";
+
 void test_parse_query() {
     auto m = parse_query("a=1&b=hello%20world+plus&empty=&encoded=%7B%22k%22%3A%22v%22%7D");
     assert(m["a"] == "1");
     assert(m["b"] == "hello world plus");
     assert(m["empty"] == "");
     assert(m["encoded"] == "{\"k\":\"v\"}");
+
+    // the arena-backed parameters split and decode the same way; the last repeat wins
+    Arena arena(64);
+    QueryParams q("a=1&b=hello%20world+plus&empty=&encoded=%7B%22k%22%3A%22v%22%7D&a=2", arena);
+    assert(q.find("a") && *q.find("a") == "2");
+    assert(*q.find("b") == "hello world plus");
+    assert(q.find("empty") && q.find("empty")->empty());
+    assert(*q.find("encoded") == "{\"k\":\"v\"}");
+    assert(!q.find("missing"));
+    std::string_view plain = "no-escapes";
+    assert(url_decode(plain, arena).data() == plain.data());
+}
+
+void test_arena() {
+    Arena arena(256);
+    Arena::Mark start = arena.mark();
+    char *first = static_cast<char *>(arena.allocate(100));
+    assert(reinterpret_cast<uintptr_t>(arena.allocate(8, 8)) % 8 == 0);
+    // larger than the block: a new block is added
+    char *big = static_cast<char *>(arena.allocate(1000, 1));
+    std::memset(big, 'x', 1000);
+    size_t capacity = arena.capacity();
+    assert(capacity >= 256 + 1000);
+    {
+        ArenaScope scope(arena);
+        ArenaVector<int> v{ArenaAllocator<int>(arena)};
+        for (int i = 0; i < 100; ++i) v.push_back(i);
+        assert(v[99] == 99);
+        ArenaString s{ArenaAllocator<char>(arena)};
+        s = "a string longer than the small-string buffer";
+        assert(arena.copy(s) == s);
+    }
+    // rewinding reuses the same memory; the blocks are kept
+    arena.rewind(start);
+    assert(arena.allocate(100) == first);
+    assert(arena.allocate(1000, 1) == big);
+    arena.rewind(start);
+    size_t grown = arena.capacity();
+    for (int round = 0; round < 3; ++round) {
+        ArenaScope scope(arena);
+        for (int i = 0; i < 20; ++i) arena.allocate(200);
+    }
+    size_t settled = arena.capacity();
+    for (int round = 0; round < 3; ++round) {
+        ArenaScope scope(arena);
+        for (int i = 0; i < 20; ++i) arena.allocate(200);
+    }
+    assert(grown >= capacity && arena.capacity() == settled);
 }
 
 void test_sanitize_id() {
@@ -45,13 +140,18 @@ void test_sanitize_id() {
 
 void test_storage_roundtrip() {
     string id = "sensor-test";
-    string payload = "{\"timestamp\":\"t\",\"sensor\":\"sensor-test\",\"temp\":\"22.5\"}";
-    bool wrote = save_sensor_data(id, payload);
+    SensorReading reading;
+    reading.timestamp = 1700000000;
+    reading.temp = 22.5f;
+    reading.hum = 41.0f;
+    bool wrote = save_sensor_data(id, reading);
     assert(wrote);
     string read = read_sensor_data(id);
-    assert(read == payload);
+    // values are serialized from the numeric record; unreported ones are omitted
+    assert(read.find("\"sensor\":\"sensor-test\",\"temp\":\"22.5\",\"hum\":\"41\"}") != string::npos);
+    assert(read.find("batt") == string::npos);
     // flush in-memory readings to disk and verify consolidated JSON file
-    SENSOR_DATA_JSON_FILE = "./sensor_data.json";
+    SENSOR_DATA_JSON_FILE = "./test_data/sensor_data.json";
     flush_readings_to_disk();
     std::ifstream ifs(SENSOR_DATA_JSON_FILE);
     assert(ifs && "Consolidated sensor_data.json should exist after flush");
@@ -59,16 +159,611 @@ void test_storage_roundtrip() {
     std::string file_contents = tmpbuf.str();
     // should contain the sensor key and the payload
     assert(file_contents.find("\"sensor-test\":") != string::npos);
-    assert(file_contents.find(payload) != string::npos);
+    assert(file_contents.find(read) != string::npos);
+
+    // the stored payload parses back into the same record
+    SensorReading parsed;
+    assert(parse_sensor_payload(read, parsed));
+    assert(parsed.timestamp == reading.timestamp && parsed.temp == 22.5f && parsed.hum == 41.0f);
+    assert(std::isnan(parsed.batt));
 
     string all = all_sensors_json();
     // should contain "sensor-test":{...}
     assert(all.find("\"sensor-test\":") != string::npos);
 }
 
+void test_sensor_registry() {
+    SensorRegistry reg;
+    SensorHandle a = reg.intern("alpha");
+    SensorHandle b = reg.intern("beta");
+    assert(a != b && reg.intern("alpha") == a);
+    assert(reg.find("gamma") == INVALID_SENSOR);
+    assert(reg.name(b) == "beta");
+    SensorReading r;
+    assert(!reg.get(a, r));  // interned but never reported
+    std::string js;
+    assert(!reg.reading_json(a, js));
+    SensorReading in;
+    in.timestamp = 1700000000;
+    in.temp = 21.3f;
+    reg.update(b, in);
+    assert(reg.get(b, r) && r.temp == 21.3f && std::isnan(r.hum));
+    std::string all;
+    JsonWriter w(all);
+    reg.write_all_json(w);
+    // only sensors with a reading are listed
+    assert(all.find("\"alpha\"") == string::npos);
+    assert(all.find("\"beta\":{") == 1 && all.find("\"temp\":\"21.3\"") != string::npos);
+}
+
+void test_sensors_snapshot() {
+    SensorReading reading;
+    reading.timestamp = 1700000000;
+    reading.temp = 20.0f;
+    SNAPSHOT_INTERVAL_MS.store(0);
+    save_sensor_data("snap-a", reading);
+    auto first = sensors_snapshot();
+    assert(first->find("\"snap-a\"") != string::npos);
+    // unchanged readings: the same immutable snapshot is handed out again
+    assert(sensors_snapshot() == first);
+    // within the interval a change is not visible yet; afterwards it is
+    SNAPSHOT_INTERVAL_MS.store(60000);
+    save_sensor_data("snap-b", reading);
+    assert(sensors_snapshot() == first);
+    SNAPSHOT_INTERVAL_MS.store(0);
+    auto second = sensors_snapshot();
+    assert(second != first && second->find("\"snap-b\"") != string::npos);
+    assert(*second == all_sensors_json());
+}
+
+void test_wal() {
+    WAL_FILE = "./test_data/test_wal.log";
+    fs::remove(WAL_FILE);
+    fs::remove(WAL_FILE + ".prev");
+    WAL_SYNC_INTERVAL_MS.store(60000);
+    assert(start_wal());
+    SensorReading r;
+    r.timestamp = 1700000000;
+    r.temp = 19.5f;
+    wal_append("kitchen", r);
+    r.hum = 50.0f;
+    wal_append("hall", r);
+    // nothing is on disk before the group commit
+    assert(wal_replay(WAL_FILE, [](std::string_view, const SensorReading &){}) == 0);
+    assert(wal_sync());
+    std::vector<std::string> ids;
+    float last_hum = 0;
+    assert(wal_replay(WAL_FILE, [&](std::string_view id, const SensorReading &rr){ ids.emplace_back(id); last_hum = rr.hum; }) == 2);
+    assert(ids.size() == 2 && ids[0] == "kitchen" && ids[1] == "hall" && last_hum == 50.0f);
+    stop_wal();
+
+    // a torn record at the end is ignored on replay and cut off when the log is reopened
+    size_t valid = 0;
+    { std::ofstream(WAL_FILE, std::ios::app) << "torn"; }
+    assert(wal_replay(WAL_FILE, [](std::string_view, const SensorReading &){}, &valid) == 2);
+    assert(valid + 4 == fs::file_size(WAL_FILE));
+    WAL_SYNC_INTERVAL_MS.store(0);  // fsync every record
+    assert(start_wal());
+    wal_append("attic", r);
+    assert(wal_replay(WAL_FILE, [](std::string_view, const SensorReading &){}) == 3);
+
+    // rotation moves the log aside for a snapshot; new records start a fresh log
+    assert(wal_rotate());
+    assert(!wal_rotate());  // the previous one was not dropped yet
+    wal_append("porch", r);
+    assert(wal_replay(WAL_FILE + ".prev", [](std::string_view, const SensorReading &){}) == 3);
+    assert(wal_replay(WAL_FILE, [](std::string_view, const SensorReading &){}) == 1);
+    wal_drop_rotated();
+    assert(!fs::exists(WAL_FILE + ".prev"));
+    stop_wal();
+    fs::remove(WAL_FILE);
+
+    // the log is ordered: a record from the same second as the snapshot entry is newer
+    SensorReading snap;
+    snap.timestamp = 1700000000;
+    snap.temp = 19.0f;
+    assert(save_sensor_data("wal-same-second", snap));
+    flush_readings_to_disk();
+    assert(start_wal());
+    snap.temp = 20.0f;
+    wal_append("wal-same-second", snap);
+    stop_wal();
+    assert(load_readings_from_disk());
+    assert(read_sensor_data("wal-same-second").find("\"temp\":\"20\"") != string::npos);
+    fs::remove(WAL_FILE);
+}
+
+void test_trigger_log() {
+    fs::remove_all("./test_triggers");
+    fs::create_directories("./test_triggers");
+    TRIGGERS_LOG_FILE = "./test_triggers/triggers.log";
+    MAX_TRIGGER_EVENTS.store(3);
+    // a single-file log from an older version, ending in a torn line
+    {
+        std::ofstream ofs(TRIGGERS_LOG_FILE);
+        ofs << "{\"timestamp\":\"2024-01-01 10:00:00\",\"sensor\":\"old\",\"type\":\"high\",\"url\":\"http://a/\"}\n";
+        ofs << "{\"timestamp\":\"2024-01-01 11:00:00\",\"sensor\":\"old\",\"type\":\"low\",\"url\":\"http://b/\"}\n";
+        ofs << "{\"timestamp\":\"2024-01-01 12:";
+    }
+    load_triggers_from_disk();
+    assert(!fs::exists(TRIGGERS_LOG_FILE) && fs::exists(TRIGGERS_LOG_FILE + ".1"));
+    std::string all = all_trigger_events_json();
+    assert(all.find("\"url\":\"http://a/\"") != string::npos && all.find("\"url\":\"http://b/\"") != string::npos);
+
+    uint64_t s1 = log_trigger_event("room", "high", "http://c/");
+    uint64_t s2 = log_trigger_event("room", "low", "http://d/");
+    assert(s2 == s1 + 1);
+    // the ring keeps the newest three; reads page by sequence number
+    all = all_trigger_events_json();
+    assert(all.find("http://a/") == string::npos && all.find("http://b/") != string::npos);
+    std::string page = trigger_events_json(s1, 10);
+    assert(page.rfind("[{\"seq\":" + std::to_string(s2) + ",", 0) == 0 && page.find("http://c/") == string::npos);
+    page = trigger_events_json(0, 1);
+    assert(page.find("http://b/") != string::npos && page.find("http://c/") == string::npos);
+    assert(process_request_and_build_response("GET /triggers?since=x HTTP/1.1\r\n\r\n").rfind("HTTP/1.1 400", 0) == 0);
+    std::string resp = process_request_and_build_response("GET /triggers?since=" + std::to_string(s1) + " HTTP/1.1\r\n\r\n");
+    assert(resp.find("http://d/") != string::npos && resp.find("http://c/") == string::npos);
+
+    // new events were appended to the segment; a reload sees the same newest three
+    load_triggers_from_disk();
+    all = all_trigger_events_json();
+    assert(all.find("http://b/") != string::npos && all.find("http://d/") != string::npos);
+
+    assert(clear_trigger_events_log());
+    assert(all_trigger_events_json() == "[]");
+    assert(log_trigger_event("room", "high", "http://e/") > s2);
+    MAX_TRIGGER_EVENTS.store(100);
+    TRIGGERS_LOG_FILE = TEST_TRIGGERS_LOG;
+    fs::remove_all("./test_triggers");
+}
+
+// Wait until event `seq` has a result; returns its JSON
+static std::string wait_for_trigger_result(uint64_t seq) {
+    for (int i = 0; i < 500; ++i) {
+        std::string js = trigger_events_json(seq - 1, 1);
+        if (js.find("\"latency_ms\"") != string::npos) return js;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return "";
+}
+
+void test_trigger_dispatch() {
+    assert(trigger_url_host("http://User@Relay.local:8080/relay/0?turn=on") == "relay.local:8080");
+    assert(trigger_url_host("10.0.0.5/x") == "10.0.0.5");
+
+    fs::remove_all("./test_triggers");
+    fs::create_directories("./test_triggers");
+    TRIGGERS_LOG_FILE = "./test_triggers/triggers.log";
+    load_triggers_from_disk();
+    // rejected while the dispatcher is not running
+    uint64_t seq = log_trigger_event("room", "high", "http://127.0.0.1:1/");
+    assert(!dispatch_trigger(seq, "http://127.0.0.1:1/"));
+    assert(trigger_events_json(seq - 1, 1).find("\"error\":\"dispatcher not running\"") != string::npos);
+
+    // a tiny keep-alive relay answering 204 (503 to the first request for /flaky);
+    // counts the connections it accepts
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(bind(lfd, (sockaddr *)&addr, sizeof(addr)) == 0 && listen(lfd, 8) == 0);
+    socklen_t len = sizeof(addr);
+    getsockname(lfd, (sockaddr *)&addr, &len);
+    std::atomic<int> accepted(0), flaky(0);
+    std::thread relay([&]{
+        int fd;
+        while ((fd = accept(lfd, nullptr, nullptr)) >= 0) {
+            ++accepted;
+            std::string in;
+            char buf[1024];
+            ssize_t n;
+            while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+                in.append(buf, (size_t)n);
+                size_t end;
+                while ((end = in.find("\r\n\r\n")) != string::npos) {
+                    bool fail = in.compare(0, 11, "GET /flaky ") == 0 && flaky++ == 0;
+                    in.erase(0, end + 4);
+                    const char ok[] = "HTTP/1.1 204 No Content\r\nContent-Length: 0\r\n\r\n";
+                    const char unavailable[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n";
+                    if (fail) send(fd, unavailable, sizeof(unavailable) - 1, MSG_NOSIGNAL);
+                    else send(fd, ok, sizeof(ok) - 1, MSG_NOSIGNAL);
+                }
+            }
+            close(fd);
+        }
+    });
+    std::string url = "http://127.0.0.1:" + std::to_string(ntohs(addr.sin_port)) + "/relay";
+
+    assert(start_trigger_dispatcher());
+    for (int i = 0; i < 3; ++i) {
+        seq = log_trigger_event("room", "low", url);
+        assert(dispatch_trigger(seq, url));
+        std::string js = wait_for_trigger_result(seq);
+        assert(js.find("\"status\":204") != string::npos && js.find("\"error\"") == string::npos);
+    }
+    // all three went over one cached connection
+    assert(accepted.load() == 1);
+
+    // a 503 is retried once the retry timer fires
+    TRIGGER_RETRY_DELAY_MS.store(50);
+    start_timer_service();
+    std::string flaky_url = "http://127.0.0.1:" + std::to_string(ntohs(addr.sin_port)) + "/flaky";
+    seq = log_trigger_event("room", "low", flaky_url);
+    assert(dispatch_trigger(seq, flaky_url));
+    std::string js = wait_for_trigger_result(seq);
+    assert(js.find("\"status\":204") != string::npos && flaky.load() == 2);
+    stop_timer_service();
+    TRIGGER_RETRY_DELAY_MS.store(2000);
+    stop_trigger_dispatcher();
+    uint64_t late = log_trigger_event("room", "low", url);
+    assert(!dispatch_trigger(late, url));
+    shutdown(lfd, SHUT_RDWR);
+    close(lfd);
+    relay.join();
+
+    // results that arrived after the event was written survive a reload
+    load_triggers_from_disk();
+    std::string all = all_trigger_events_json();
+    assert(all.find("\"status\":204") != string::npos && all.find("dispatcher not running") != string::npos);
+    TRIGGERS_LOG_FILE = TEST_TRIGGERS_LOG;
+    fs::remove_all("./test_triggers");
+}
+
+void test_timer_wheel() {
+    TimerWheel wheel(10);
+    std::vector<uint64_t> fired;
+    uint64_t now = 10;
+    std::vector<TimerWheel::Callback> due;
+    auto run_to = [&](uint64_t tick) {
+        while (now < tick) {
+            wheel.advance(++now, due);
+            for (auto &cb : due) cb();
+            due.clear();
+        }
+    };
+    // one timer per level boundary, plus one beyond the wheel's range
+    std::vector<uint64_t> at = {5, 11, 73, 74, 75, 4105, 4106, 262154, 300000, (1u << 24) + 500};
+    std::vector<TimerId> ids;
+    for (uint64_t t : at) ids.push_back(wheel.add(t, [&fired, &now]{ fired.push_back(now); }));
+    assert(wheel.size() == at.size());
+    // cancel one; a second cancel and an unknown id fail
+    assert(wheel.cancel(ids[4]));
+    assert(!wheel.cancel(ids[4]) && !wheel.cancel(INVALID_TIMER) && !wheel.cancel(987654321));
+    run_to((1u << 24) + 600);
+    // the past timer fires on the first tick, every other exactly when due
+    std::vector<uint64_t> expected = {11, 11, 73, 74, 4105, 4106, 262154, 300000, (1u << 24) + 500};
+    assert(fired == expected);
+    assert(wheel.size() == 0);
+    // ids of expired timers stay dead even when their slot is reused
+    TimerId reused = wheel.add(now + 3, []{});
+    assert(!wheel.cancel(ids[0]) && wheel.cancel(reused));
+
+    // service: callbacks run on the timer thread; cancelled ones never do
+    start_timer_service();
+    std::atomic<int> ran(0);
+    schedule_timer(20, [&ran]{ ran += 1; });
+    TimerId never = schedule_timer(150, [&ran]{ ran += 100; });
+    assert(cancel_timer(never));
+    for (int i = 0; i < 200 && ran.load() == 0; ++i) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    assert(ran.load() == 1 && pending_timers() == 0);
+    stop_timer_service();
+}
+
+void test_schedule() {
+    uint8_t days = 0;
+    assert(parse_schedule_days("mon-fri", days) && days == 0x3e && format_schedule_days(days) == "mon-fri");
+    assert(parse_schedule_days("sat,sun", days) && format_schedule_days(days) == "sat,sun");
+    assert(parse_schedule_days("fri-mon", days) && format_schedule_days(days) == "mon,fri-sun");
+    assert(parse_schedule_days("daily", days) && format_schedule_days(days) == "mon-sun");
+    assert(!parse_schedule_days("mon-xyz", days) && !parse_schedule_days("", days));
+    int minute = 0;
+    assert(parse_time_of_day("06:30", minute) && minute == 390 && format_time_of_day(minute) == "06:30");
+    assert(parse_time_of_day("7:05", minute) && minute == 425);
+    assert(!parse_time_of_day("24:00", minute) && !parse_time_of_day("12:60", minute) && !parse_time_of_day("1230", minute));
+
+    auto local = [](int mday, int hour, int min) {
+        std::tm tm{};
+        tm.tm_year = 2026 - 1900;
+        tm.tm_mon = 9;  // October; the 14th is a Wednesday
+        tm.tm_mday = mday;
+        tm.tm_hour = hour;
+        tm.tm_min = min;
+        tm.tm_isdst = -1;
+        return (int64_t)mktime(&tm);
+    };
+    std::vector<ScheduleEntry> entries = {{0x3e, 390, 21.0}, {0x7f, 1320, 18.0}};
+    int64_t when = 0;
+    assert(next_schedule_switch(entries, local(14, 7, 0), when) == 1 && when == local(14, 22, 0));
+    assert(next_schedule_switch(entries, local(14, 22, 0), when) == 0 && when == local(15, 6, 30));
+    // Friday night: the weekend has no 06:30 switch point
+    assert(next_schedule_switch(entries, local(16, 23, 0), when) == 1 && when == local(17, 22, 0));
+    assert(next_schedule_switch({}, local(14, 7, 0), when) == -1);
+
+    // stored with the room, armed on a timer and shown in /roomStates
+    SETTINGS_JSON_FILE = "./test_data/settings.json";
+    delete_room_settings("sched-room");
+    std::string error;
+    assert(!add_room_schedule("sched-room", "someday", "06:30", 21, error) && !error.empty());
+    assert(add_room_schedule("sched-room", "mon-fri", "06:30", 21.5, error));
+    std::string js = room_settings_json("sched-room");
+    assert(js.find("\"schedule\":[{\"days\":\"mon-fri\",\"at\":\"06:30\",\"desired\":21.5}]") != string::npos);
+    assert(room_states_json().find("\"next_desired\":21.5") != string::npos);
+    std::string resp = process_request_and_build_response("POST /addSchedule HTTP/1.1\r\nContent-Length: 42\r\n\r\nroom=sched-room&days=x&at=06:30&desired=20");
+    assert(resp.find("Invalid schedule") != string::npos);
+    // reloading re-arms it
+    load_settings_from_disk();
+    assert(room_states_json().find("\"next_desired\":21.5") != string::npos);
+    resp = process_request_and_build_response("DELETE /schedules/sched-room HTTP/1.1\r\n\r\n");
+    assert(resp.find("OK") != string::npos && room_settings_json("sched-room").find("schedule") == string::npos);
+    assert(room_states_json().find("next_desired") == string::npos);
+    delete_room_settings("sched-room");
+}
+
+void test_stale_sensors() {
+    fs::remove_all("./test_triggers");
+    fs::create_directories("./test_triggers");
+    TRIGGERS_LOG_FILE = "./test_triggers/triggers.log";
+    load_triggers_from_disk();
+    STALE_SENSOR_SECONDS.store(60);
+    start_timer_service();
+    SensorReading r;
+    r.temp = 20;
+    // last heard from two minutes ago: stale right away
+    r.timestamp = (int64_t)std::time(nullptr) - 120;
+    save_sensor_data("quiet-sensor", r);
+    // fresh: its timer is a minute out
+    r.timestamp = (int64_t)std::time(nullptr);
+    save_sensor_data("chatty-sensor", r);
+    std::string all;
+    for (int i = 0; i < 200; ++i) {
+        all = all_trigger_events_json();
+        if (all.find("quiet-sensor") != string::npos) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    assert(all.find("\"quiet-sensor\"") != string::npos && all.find("\"stale\"") != string::npos);
+    assert(all.find("chatty-sensor") == string::npos);
+    stop_timer_service();
+    STALE_SENSOR_SECONDS.store(0);
+    TRIGGERS_LOG_FILE = TEST_TRIGGERS_LOG;
+    fs::remove_all("./test_triggers");
+}
+
+void test_history() {
+    // a week of one-minute samples, then some more: the oldest are dropped block-wise
+    SensorHistory h(10080);
+    const int64_t t0 = 1700000000;
+    for (int i = 0; i < 12000; ++i) h.append(t0 + i * 60, 20.0f + (i % 10) * 0.1f, i % 2 == 1 ? NAN : 45.0f);
+    assert(h.size() >= 10080 && h.size() <= 10080 + HISTORY_BLOCK_SAMPLES);
+    assert(h.memory_bytes() <= 64 * 1024);
+    std::vector<HistoryPoint> pts;
+    h.query(t0, t0 + 12000 * 60, pts);
+    assert(pts.size() == h.size() && pts.back().timestamp == t0 + 11999 * 60);
+    // exact range, quantized values and missing humidity come back
+    pts.clear();
+    h.query(t0 + 11000 * 60, t0 + 11002 * 60, pts);
+    assert(pts.size() == 3 && pts[0].timestamp == t0 + 11000 * 60);
+    assert(pts[0].temp == 20.0 && pts[1].temp == 20.1 && pts[2].temp == 20.2);
+    assert(pts[0].hum == 45.0 && std::isnan(pts[1].hum));
+    pts.clear();
+    h.query(t0 + 11000 * 60 + 1, t0 + 11000 * 60 + 59, pts);
+    assert(pts.empty());
+
+    // a gap longer than the 16-bit offset starts a new block; older timestamps are clamped
+    SensorHistory g(100);
+    g.append(t0, 21.5f, NAN);
+    g.append(t0 + 100000, -5.25f, 99.99f);
+    g.append(t0 + 50, 22.0f, 50.0f);
+    pts.clear();
+    g.query(0, INT64_MAX, pts);
+    assert(pts.size() == 3 && pts[1].timestamp == t0 + 100000 && pts[2].timestamp == t0 + 100000);
+    assert(pts[1].temp == -5.25 && pts[1].hum == 99.99);
+
+    // through save_sensor_data and GET /history
+    for (int i = 0; i < 10; ++i) {
+        SensorReading r;
+        r.timestamp = t0 + i * 30;
+        r.temp = 20.0f + i;
+        r.hum = 40.0f;
+        save_sensor_data("history-sensor", r);
+    }
+    std::string resp = process_request_and_build_response("GET /history/history-sensor?from=1700000000&to=1700000060 HTTP/1.1\r\n\r\n");
+    assert(resp.find("\"points\":[[1700000000,20,40],[1700000030,21,40],[1700000060,22,40]]") != string::npos);
+    resp = process_request_and_build_response("GET /history/history-sensor?from=1700000000&to=1700000299&step=120 HTTP/1.1\r\n\r\n");
+    assert(resp.find("\"points\":[[1700000000,21.5,40],[1700000120,25.5,40],[1700000240,28.5,40]]") != string::npos);
+    resp = process_request_and_build_response("GET /history/history-sensor?from=5&to=4 HTTP/1.1\r\n\r\n");
+    assert(resp.find("400") != string::npos);
+    resp = process_request_and_build_response("GET /history/no-such-sensor HTTP/1.1\r\n\r\n");
+    assert(resp.find("404") != string::npos);
+}
+
+void test_history_store() {
+    // start from an empty directory, without readings of earlier tests pending
+    flush_history_segments();
+    fs::remove_all(HISTORY_DIR);
+    // two sensors in one segment; a query reads one sensor's rows only
+    std::vector<SegmentSeries> series(2);
+    series[0].sensor = "a-sensor";
+    series[1].sensor = "b-sensor";
+    const int64_t t0 = 1700000000;
+    for (int i = 0; i < 100; ++i) {
+        SensorReading r;
+        r.timestamp = t0 + i * 60;
+        r.temp = 20.0f + i * 0.5f;
+        r.hum = 40.0f;
+        series[0].readings.push_back(r);
+        r.temp = -1.0f;
+        r.batt = 80.0f;
+        series[1].readings.push_back(r);
+    }
+    fs::create_directories(HISTORY_DIR);
+    std::string path = HISTORY_DIR + "/manual.seg";
+    assert(write_history_segment(path, series));
+    auto seg = HistorySegment::open(path);
+    assert(seg && seg->rows() == 200 && seg->sensors() == 2 && seg->sensor(1) == "b-sensor");
+    assert(seg->min_timestamp() == t0 && seg->max_timestamp() == t0 + 99 * 60);
+    std::vector<SensorReading> out;
+    assert(seg->query("a-sensor", t0 + 60, t0 + 180, out) == 3);
+    assert(out[0].timestamp == t0 + 60 && out[0].temp == 20.5f && out[2].temp == 21.5f && std::isnan(out[0].batt));
+    out.clear();
+    assert(seg->query("b-sensor", t0 + 99 * 60, INT64_MAX, out) == 1 && out[0].batt == 80.0f);
+    assert(seg->query("c-sensor", 0, INT64_MAX, out) == 0);
+    // a truncated file is rejected
+    fs::resize_file(path, seg->file_bytes() - 8);
+    assert(!HistorySegment::open(path));
+    fs::remove(path);
+
+    // readings saved over two days are flushed into one segment per day; with the
+    // in-memory history off, /history is served from them alone
+    size_t samples = HISTORY_SAMPLES.load();
+    HISTORY_SAMPLES.store(0);
+    assert(load_history_segments() && history_segment_count() == 0);
+    for (int i = 0; i < 4; ++i) {
+        SensorReading r;
+        r.timestamp = 1699920000 + 86400 - 120 + i * 60;  // two before midnight UTC, two after
+        r.temp = 18.0f + i;
+        r.hum = 50.0f;
+        save_sensor_data("store-sensor", r);
+    }
+    out.clear();
+    assert(history_store_query("store-sensor", 0, INT64_MAX, out) && out.size() == 4);
+    assert(flush_history_segments() && history_segment_count() == 2);
+    // still there after reopening the directory
+    assert(load_history_segments() && history_segment_count() == 2);
+    out.clear();
+    assert(history_store_query("store-sensor", 1699920000 + 86400, INT64_MAX, out) && out.size() == 2 && out[0].temp == 20.0f);
+
+    std::string resp = process_request_and_build_response("GET /history/store-sensor?from=1700006280&to=1700006400 HTTP/1.1\r\n\r\n");
+    assert(resp.find("\"points\":[[1700006280,18,50],[1700006340,19,50],[1700006400,20,50]]") != string::npos);
+    HISTORY_SAMPLES.store(samples);
+    fs::remove_all(HISTORY_DIR);
+    load_history_segments();
+}
+
+void test_history_compaction() {
+    flush_history_segments();
+    fs::remove_all(HISTORY_DIR);
+    fs::create_directories(HISTORY_DIR);
+    HISTORY_COMPACT_RATE_KB.store(0);
+    const int64_t now = 1750000000;
+    auto write = [](int64_t window, const std::string &seqs, uint32_t step, int64_t ts, float temp, int n) {
+        std::vector<SegmentSeries> series(1);
+        series[0].sensor = "compact-sensor";
+        for (int i = 0; i < n; ++i) {
+            SensorReading r;
+            r.timestamp = ts + i * 60;
+            r.temp = temp + i;
+            r.hum = 50.0f;
+            series[0].readings.push_back(r);
+        }
+        std::string path = HISTORY_DIR + "/" + std::to_string(window) + "-" + seqs + ".seg";
+        assert(write_history_segment(path, series, step));
+        return path;
+    };
+    // two flushes of a day 100 days ago are downsampled, two of the day before
+    // yesterday merged, today's single one stays and a three-year-old one expires
+    int64_t old_day = history_window_of(now - 100 * 86400, 0);
+    int64_t old_window = history_window_of(old_day, HISTORY_DOWNSAMPLE_STEP);
+    write(old_day, "1", 0, old_day + 3600, 10.0f, 10);
+    write(old_day, "2", 0, old_day + 7200, 30.0f, 1);
+    int64_t recent_day = history_window_of(now - 2 * 86400, 0);
+    write(recent_day, "3", 0, recent_day + 60, 20.0f, 2);
+    write(recent_day, "4", 0, recent_day + 3600, 22.0f, 2);
+    write(history_window_of(now, 0), "5", 0, history_window_of(now, 0) + 60, 25.0f, 1);
+    int64_t ancient = history_window_of(now - 3 * 365 * 86400, HISTORY_DOWNSAMPLE_STEP);
+    write(ancient, "6-6", HISTORY_DOWNSAMPLE_STEP, ancient, 5.0f, 1);
+    assert(load_history_segments() && history_segment_count() == 6);
+
+    assert(run_history_compaction(now));
+    assert(history_segment_count() == 3);
+    CompactionStats c = history_compaction_stats();
+    assert(c.expired == 1 && c.downsampled == 2 && c.merged == 2 && c.jobs == 3 && c.jobs_done == 3);
+    assert(c.bytes_read > 0 && c.bytes_reclaimed > 0 && !c.running);
+    std::string downsampled = HISTORY_DIR + "/" + std::to_string(old_window) + "-1-2.seg";
+    assert(fs::exists(downsampled) && fs::exists(HISTORY_DIR + "/" + std::to_string(recent_day) + "-3-4.seg"));
+    // ten readings a minute apart average into one row per 15 minutes
+    std::vector<SensorReading> out;
+    assert(history_store_query("compact-sensor", old_day, old_day + 86400, out) && out.size() == 2);
+    assert(out[0].timestamp == old_day + 3600 && out[0].temp == 14.5f && out[0].hum == 50.0f && out[1].temp == 30.0f);
+    out.clear();
+    assert(history_store_query("compact-sensor", recent_day, recent_day + 86400, out) && out.size() == 4);
+    std::string js = history_status_json();
+    assert(js.find("\"downsampled\":{\"segments\":1,") != string::npos && js.find("\"raw\":{\"segments\":2,") != string::npos);
+    // nothing left to do
+    assert(run_history_compaction(now) && history_segment_count() == 3 && history_compaction_stats().jobs == 0);
+
+    // a compaction that stopped before deleting its inputs is finished on load
+    std::string late = write(old_day, "8", 0, old_day + 60, 12.0f, 1);
+    std::string redone = write(old_window, "1-8", HISTORY_DOWNSAMPLE_STEP, old_day, 12.0f, 1);
+    assert(load_history_segments() && history_segment_count() == 3);
+    assert(!fs::exists(late) && !fs::exists(downsampled) && fs::exists(redone));
+
+    HISTORY_COMPACT_RATE_KB.store(4096);
+    fs::remove_all(HISTORY_DIR);
+    load_history_segments();
+}
+
+void test_rollups() {
+    // 26 hours of one-minute readings starting on an hour boundary
+    SensorRollups r;
+    const int64_t t0 = 1700002800;  // 2023-11-14 23:00 UTC
+    for (int i = 0; i < 26 * 60; ++i) r.add(t0 + i * 60, 20.0f + (i % 60) / 10.0f, i < 60 ? NAN : 50.0f);
+    std::vector<RollupBucket> b;
+    r.query(RollupRes::Hour, t0, t0 + 3 * 3600 - 1, b);
+    assert(b.size() == 3 && b[0].start == t0 && b[1].start == t0 + 3600);
+    assert(b[0].stats.count == 60 && b[0].stats.temp_count == 60 && b[0].stats.hum_count == 0);
+    assert(b[0].stats.temp_min == 20.0f && std::fabs(b[0].stats.temp_max - 25.9f) < 1e-4);
+    assert(std::fabs(b[0].stats.temp_sum / 60 - 22.95) < 1e-4 && b[1].stats.hum_sum / b[1].stats.hum_count == 50.0);
+    // the minute ring keeps its last day only
+    b.clear();
+    r.query(RollupRes::Minute, 0, INT64_MAX, b);
+    assert(b.size() == (size_t)ROLLUP_MINUTES.load() && b.back().start == t0 + (26 * 60 - 1) * 60 && b[0].start == t0 + 2 * 3600);
+    // day buckets start at local midnight and count every reading once
+    b.clear();
+    r.query(RollupRes::Day, 0, INT64_MAX, b);
+    uint32_t total = 0;
+    for (const RollupBucket &d : b) {
+        total += d.stats.count;
+        std::time_t t = (std::time_t)d.start;
+        std::tm tm{};
+        localtime_r(&t, &tm);
+        assert(tm.tm_hour == 0 && tm.tm_min == 0);
+    }
+    assert(total == 26 * 60 && b.size() >= 2 && b.size() <= 3);
+    // readings older than the ring are ignored
+    r.add(t0 - 3 * 86400, 99.0f, 99.0f);
+    b.clear();
+    r.query(RollupRes::Minute, 0, t0, b);
+    assert(b.empty());
+    // a resolution of length 0 is off
+    ROLLUP_HOURS.store(0);
+    SensorRollups off;
+    off.add(t0, 20.0f, 50.0f);
+    b.clear();
+    off.query(RollupRes::Hour, 0, INT64_MAX, b);
+    assert(b.empty());
+    off.query(RollupRes::Minute, 0, INT64_MAX, b);
+    assert(b.size() == 1 && b[0].stats.count == 1);
+    ROLLUP_HOURS.store(744);
+
+    for (int i = 0; i < 4; ++i) {
+        SensorReading rd;
+        rd.timestamp = 1700006400 + i * 1200;  // three in the first hour, one in the next
+        rd.temp = 20.0f + i;
+        rd.hum = 40.0f;
+        save_sensor_data("rollup-sensor", rd);
+    }
+    std::string resp = process_request_and_build_response("GET /rollup/rollup-sensor?res=hour HTTP/1.1\r\n\r\n");
+    assert(resp.find("\"points\":[[1700006400,3,20,21,22,40,40,40],[1700010000,1,23,23,23,40,40,40]]") != string::npos);
+    resp = process_request_and_build_response("GET /rollup/rollup-sensor?res=minute&from=1700010000 HTTP/1.1\r\n\r\n");
+    assert(resp.find("\"points\":[[1700010000,1,23,23,23,40,40,40]]") != string::npos);
+    resp = process_request_and_build_response("GET /rollup/rollup-sensor?res=week HTTP/1.1\r\n\r\n");
+    assert(resp.find("400") != string::npos);
+}
+
 void test_settings() {
     // place settings inside test_data for isolation
-    SETTINGS_JSON_FILE = "./settings.json";
+    SETTINGS_JSON_FILE = "./test_data/settings.json";
 
     string room = "living-room";
     // set desired temp
@@ -88,6 +783,36 @@ void test_settings() {
     assert(low == "http://example.com/low");
 }
 
+void test_settings_store() {
+    SETTINGS_JSON_FILE = "./test_data/settings.json";
+    set_desired_temperature("store-room", 19.0);
+    set_trigger_url("store-room", "low", "http://example.com/low");
+    // settings survive a reload from disk
+    assert(load_settings_from_disk());
+    std::string js = room_settings_json("store-room");
+    assert(js == "{\"desired\":19,\"high\":\"\",\"low\":\"http://example.com/low\"}");
+    assert(get_all_trigger_urls("low").count("store-room") == 1);
+    assert(get_all_trigger_urls("high").count("store-room") == 0);
+    delete_room_settings("store-room");
+    assert(room_settings_json("store-room").empty());
+    assert(load_settings_from_disk());
+    assert(room_settings_json("store-room").empty());
+
+    // a hand-edited file: values /setTriggerControl would refuse are dropped on load
+    {
+        std::ofstream ofs(SETTINGS_JSON_FILE, std::ios::trunc);
+        ofs << "{\"edited\":{\"desired\":21.5,\"hysteresis\":50,\"min_dwell\":1e12,\"reassert\":600},"
+               "\"negative\":{\"desired\":20,\"hysteresis\":-1,\"min_dwell\":-5,\"reassert\":604801}}";
+    }
+    std::map<std::string, RoomSettings> loaded;
+    assert(read_settings_map(loaded));
+    const RoomSettings &edited = loaded.at("edited");
+    assert(edited.desired == 21.5 && !edited.hysteresis && !edited.min_dwell && edited.reassert == 600);
+    const RoomSettings &negative = loaded.at("negative");
+    assert(negative.desired == 20.0 && !negative.hysteresis && !negative.min_dwell && !negative.reassert);
+    fs::remove(SETTINGS_JSON_FILE);
+}
+
 static void assert_contains(const std::string &haystack, const std::string &needle) {
     if (haystack.find(needle) == std::string::npos) {
         std::cerr << "Expected to find: [" << needle << "]\nIn response:\n" << haystack << '\n';
@@ -95,6 +820,288 @@ static void assert_contains(const std::string &haystack, const std::string &need
     }
 }
 
+void test_thermostat() {
+    ThermostatParams p;
+    p.hysteresis = 0.5;
+    p.min_dwell_seconds = 300;
+    p.reassert_seconds = 3600;
+    ThermostatState st;
+    int64_t t = 1000;
+    // inside the band an idle room stays idle
+    assert(thermostat_step(p, st, 21.0, 20.8f, t) == HeatState::Idle && st.state == HeatState::Idle);
+    assert(thermostat_step(p, st, 21.0, 20.4f, t) == HeatState::Heating);
+    // further cold readings do not fire again
+    assert(thermostat_step(p, st, 21.0, 20.0f, t + 60) == HeatState::Idle && st.state == HeatState::Heating);
+    // crossing the upper edge waits out the dwell time
+    assert(thermostat_step(p, st, 21.0, 21.6f, t + 120) == HeatState::Idle && st.state == HeatState::Heating);
+    assert(thermostat_step(p, st, 21.0, 21.6f, t + 400) == HeatState::Cooling);
+    // re-assert after the interval even without a transition
+    assert(thermostat_step(p, st, 21.0, 21.2f, t + 3999) == HeatState::Idle);
+    assert(thermostat_step(p, st, 21.0, 21.2f, t + 4000) == HeatState::Cooling && st.since == t + 400);
+    // without hysteresis the band edges are the desired value itself, at reading precision
+    ThermostatParams exact;
+    exact.hysteresis = 0;
+    ThermostatState st2;
+    assert(thermostat_step(exact, st2, 21.3, 21.3f, t) == HeatState::Idle);
+    assert(thermostat_step(exact, st2, 21.3, 21.4f, t) == HeatState::Cooling);
+
+    // through the settings store
+    set_desired_temperature("hyst-room", 21.0);
+    set_trigger_url("hyst-room", "low", "http://example.com/on");
+    assert(set_trigger_control("hyst-room", 0.5, 300, std::nullopt));
+    assert(room_settings_json("hyst-room").find("\"hysteresis\":0.5,\"min_dwell\":300}") != string::npos);
+    std::string type, url;
+    assert(evaluate_room_trigger("hyst-room", 20.0f, t, type, url) && type == "low" && url == "http://example.com/on");
+    assert(!evaluate_room_trigger("hyst-room", 19.5f, t + 60, type, url));
+    // cooling has no URL configured: the state changes but nothing fires
+    assert(!evaluate_room_trigger("hyst-room", 22.0f, t + 400, type, url));
+    std::string states = room_states_json();
+    assert(states.find("\"hyst-room\":{\"state\":\"cooling\"") != string::npos && states.find("\"reassert\":3600") != string::npos);
+    // changing a setting resets the room to idle
+    set_desired_temperature("hyst-room", 23.0);
+    assert(room_states_json().find("\"hyst-room\":{\"state\":\"idle\",\"since\":null") != string::npos);
+    std::string resp = process_request_and_build_response("POST /setTriggerControl HTTP/1.1\r\nContent-Length: 23\r\n\r\nroom=hyst-room&reassert");
+    assert(resp.find("Missing hysteresis") != string::npos);
+    resp = process_request_and_build_response("POST /setTriggerControl HTTP/1.1\r\nContent-Length: 25\r\n\r\nroom=hyst-room&reassert=x");
+    assert(resp.find("Invalid control value") != string::npos);
+    delete_room_settings("hyst-room");
+}
+
+void test_rules() {
+    CompiledRule rule;
+    std::string err;
+    assert(!compile_rule("bedroom.foo < 1", sensor_registry, rule, err) && err.find("unknown field") != string::npos);
+    assert(!compile_rule("hour > 6", sensor_registry, rule, err) && err.find("at least one sensor") != string::npos);
+    assert(!compile_rule("(rule-a.temp < 1", sensor_registry, rule, err) && err.find("expected ')'") != string::npos);
+    assert(!compile_rule("rule-a.temp < 1 )", sensor_registry, rule, err));
+    // nesting is bounded before the parser's recursion can exhaust the stack
+    for (const char *prefix : {"(", "-", "!", "not "}) {
+        std::string deep;
+        for (int i = 0; i < 100000; ++i) deep += prefix;
+        deep += "rule-a.temp";
+        assert(!compile_rule(deep, sensor_registry, rule, err) && err.find("too deeply nested") != string::npos);
+    }
+    assert(compile_rule("((((-(-rule-a.temp)))) < 1) and not !(rule-a.temp > 0)", sensor_registry, rule, err));
+
+    int64_t now = (int64_t)std::time(nullptr);
+    SensorReading a;
+    a.timestamp = now - 30;
+    a.temp = 19.0f;
+    a.hum = 55.0f;
+    save_sensor_data("rule-a", a);
+    SensorReading b = a;
+    b.temp = 20.0f;
+    save_sensor_data("rule-b", b);
+    auto eval = [&](const char *expr) {
+        std::string e;
+        CompiledRule r;
+        bool compiled = compile_rule(expr, sensor_registry, r, e);
+        assert(compiled);
+        return evaluate_rule(r, sensor_registry, now);
+    };
+    assert(eval("avg(rule-a.temp, rule-b.temp) < 20 and rule-a.hum >= 50"));
+    assert(!eval("min(rule-a.temp, rule-b.temp) > 19 || max(rule-a.temp, rule-b.temp) != 20"));
+    assert(eval("rule-a.temp-1 == 18 and -rule-a.temp * 2 / 4 == -9.5"));
+    assert(eval("rule-a.age >= 30 and rule-a.age < 3600 and hour >= 0 and hour < 24 and weekday <= 6"));
+    // a sensor that never reported: comparisons are false, avg skips it
+    assert(!eval("rule-missing.temp < 100") && eval("not (rule-missing.temp < 100)"));
+    assert(eval("avg(rule-a.temp, rule-missing.temp) == 19"));
+
+    // the engine fires a room's URL when a rule becomes true, once per edge
+    delete_room_settings("rule-room");
+    set_trigger_url("rule-room", "low", "http://example.com/heat");
+    assert(!add_room_rule("rule-room", "rule-a.temp < 19", "sideways", err));
+    assert(add_room_rule("rule-room", "rule-a.temp < 18.5 and rule-b.temp < 21", "low", err));
+    assert(room_settings_json("rule-room").find("\"rules\":[{\"when\":\"rule-a.temp < 18.5 and rule-b.temp < 21\",\"fire\":\"low\"}]") != string::npos);
+    assert(evaluate_rules_for_sensor("rule-a", now).empty());
+    a.temp = 18.0f;
+    save_sensor_data("rule-a", a);
+    auto fired = evaluate_rules_for_sensor("rule-a", now);
+    assert(fired.size() == 1 && fired[0].room == "rule-room" && fired[0].type == "low" && fired[0].url == "http://example.com/heat");
+    assert(evaluate_rules_for_sensor("rule-a", now).empty());
+    assert(rules_json().find("\"value\":true") != string::npos);
+    // only rules referencing the reporting sensor are evaluated
+    assert(evaluate_rules_for_sensor("rule-unrelated", now).empty());
+    // reloading the settings keeps the rule and its state
+    assert(load_settings_from_disk());
+    assert(evaluate_rules_for_sensor("rule-b", now).empty());
+    a.temp = 19.0f;
+    save_sensor_data("rule-a", a);
+    assert(evaluate_rules_for_sensor("rule-a", now).empty());
+    a.temp = 18.0f;
+    save_sensor_data("rule-a", a);
+    assert(evaluate_rules_for_sensor("rule-a", now).size() == 1);
+    // concurrent evaluations of the same edge fire the rule once
+    a.temp = 19.0f;
+    save_sensor_data("rule-a", a);
+    assert(evaluate_rules_for_sensor("rule-a", now).empty());
+    a.temp = 18.0f;
+    save_sensor_data("rule-a", a);
+    std::atomic<int> concurrent_fired(0);
+    std::vector<std::thread> evaluators;
+    for (int t = 0; t < 4; ++t) {
+        evaluators.emplace_back([&] { concurrent_fired += (int)evaluate_rules_for_sensor("rule-a", now).size(); });
+    }
+    for (auto &t : evaluators) t.join();
+    assert(concurrent_fired == 1);
+
+    std::string resp = process_request_and_build_response("POST /addRule HTTP/1.1\r\nContent-Length: 37\r\n\r\nroom=rule-room&when=rule-a.x&fire=low");
+    assert(resp.find("Invalid rule: unknown field 'x'") != string::npos);
+    resp = process_request_and_build_response("DELETE /rules/rule-room HTTP/1.1\r\n\r\n");
+    assert(resp.find("OK") != string::npos && rules_json() == "[]");
+    delete_room_settings("rule-room");
+}
+
+void test_predictive() {
+    ThermostatParams p;
+    p.hysteresis = 0.5;
+    p.min_dwell_seconds = 300;
+    ThermostatState st;
+    thermostat_force(st, HeatState::Heating, 1000);
+    RoomModel m;
+    int64_t when;
+    // unknown rate: nothing to predict
+    assert(thermostat_predict(p, st, 21.0, m, 20.2f, 2000, when) == HeatState::Idle);
+    m.heat_rate = 2.0;
+    m.heat_overshoot = 0.3;
+    m.cool_rate = -1.0;
+    m.cool_overshoot = 0.2;
+    // heating stops at 21.2 so the overshoot peaks at the upper edge: half an hour away
+    assert(thermostat_predict(p, st, 21.0, m, 20.2f, 2000, when) == HeatState::Cooling && when == 3800);
+    assert(thermostat_predict(p, st, 21.0, m, 21.2f, 2000, when) == HeatState::Cooling && when == 2000);
+    // beyond the horizon: wait for more readings
+    assert(thermostat_predict(p, st, 21.0, m, 10.0f, 2000, when) == HeatState::Idle);
+    // cooling starts heating at 20.7, 0.8 hours below 21.5
+    thermostat_force(st, HeatState::Cooling, 0);
+    assert(thermostat_predict(p, st, 21.0, m, 21.5f, 2000, when) == HeatState::Heating && when == 2000 + 2880);
+    // overshoots beyond the hysteresis share it: the switch points 21.25 and 20.75 stay
+    // one hysteresis apart
+    m.heat_overshoot = 0.5;
+    m.cool_overshoot = 0.5;
+    assert(thermostat_predict(p, st, 21.0, m, 21.5f, 2000, when) == HeatState::Heating && when == 2000 + 2700);
+    thermostat_force(st, HeatState::Heating, 1000);
+    assert(thermostat_predict(p, st, 21.0, m, 20.0f, 2000, when) == HeatState::Cooling && when == 2000 + 2250);
+    // never within the dwell
+    ThermostatState fresh;
+    thermostat_force(fresh, HeatState::Heating, 1900);
+    assert(thermostat_predict(p, fresh, 21.0, m, 21.3f, 1900, when) == HeatState::Cooling && when == 2200);
+    ThermostatState idle;
+    assert(thermostat_predict(p, idle, 21.0, m, 15.0f, 2000, when) == HeatState::Idle);
+
+    // the setting is stored per room and shown in /roomStates
+    delete_room_settings("pred-room");
+    set_desired_temperature("pred-room", 21.0);
+    assert(set_trigger_control("pred-room", std::nullopt, std::nullopt, std::nullopt, true));
+    assert(room_settings_json("pred-room").find("\"predictive\":true") != string::npos);
+    std::string states = room_states_json();
+    size_t at = states.find("\"pred-room\":{");
+    assert(at != string::npos && states.find("\"predictive\":true", at) != string::npos);
+    // without a learned model predictive mode behaves like the plain band
+    std::string type, url;
+    set_trigger_url("pred-room", "low", "http://example.com/on");
+    assert(evaluate_room_trigger("pred-room", 20.0f, 1000, type, url) && type == "low");
+    assert(!evaluate_room_trigger("pred-room", 20.9f, 2000, type, url));
+    std::string resp = process_request_and_build_response("POST /setTriggerControl HTTP/1.1\r\nContent-Length: 31\r\n\r\nroom=pred-room&predictive=maybe");
+    assert(resp.find("Invalid control value") != string::npos);
+    resp = process_request_and_build_response("POST /setTriggerControl HTTP/1.1\r\nContent-Length: 27\r\n\r\nroom=pred-room&predictive=0");
+    assert(resp.find("OK") != string::npos && room_settings_json("pred-room").find("\"predictive\":false") != string::npos);
+    delete_room_settings("pred-room");
+}
+
+void test_metrics() {
+    // log-linear buckets: exact below 8 µs, then 8 per power of two
+    assert(latency_bucket(0) == 0 && latency_bucket(7) == 7 && latency_bucket(8) == 8 && latency_bucket(16) == 16);
+    assert(latency_bucket(17) == 16 && latency_bucket_limit(16) == 18 && latency_bucket_limit(7) == 8);
+    for (uint64_t us = 1; us < (1u << 20); ++us) {
+        size_t b = latency_bucket(us);
+        assert(us < latency_bucket_limit(b) && us >= latency_bucket_limit(b - 1));
+        assert(latency_bucket_limit(b) - us <= std::max<uint64_t>(1, us / 8));
+    }
+    assert(latency_bucket(UINT64_MAX) == LATENCY_BUCKETS - 1);
+
+    // each request lands in its route's histogram
+    uint64_t before = metrics_route_count(Route::RoomStates), other = metrics_route_count(Route::PostOther);
+    process_request_and_build_response("GET /roomStates HTTP/1.1\r\n\r\n");
+    process_request_and_build_response("POST /nope HTTP/1.1\r\nContent-Length: 0\r\n\r\n");
+    assert(metrics_route_count(Route::RoomStates) == before + 1 && metrics_route_count(Route::PostOther) == other + 1);
+
+    // every thread records into its own shard; a scrape adds them up
+    before = metrics_route_count(Route::Options);
+    uint64_t accepted = metrics_counter(Counter::ConnectionsAccepted);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([]{
+            for (int i = 0; i < 1000; ++i) {
+                metrics_record_latency(Route::Options, (uint64_t)i);
+                metrics_count(Counter::ConnectionsAccepted);
+            }
+        });
+    }
+    for (auto &th : threads) th.join();
+    assert(metrics_route_count(Route::Options) == before + 4000);
+    assert(metrics_counter(Counter::ConnectionsAccepted) == accepted + 4000);
+
+    // triggers submitted without a dispatcher are counted as rejected
+    uint64_t rejected = metrics_counter(Counter::TriggersRejected);
+    assert(!dispatch_trigger(0, "http://127.0.0.1:1/"));
+    assert(metrics_counter(Counter::TriggersRejected) == rejected + 1);
+
+    std::string resp = process_request_and_build_response("GET /metrics HTTP/1.1\r\n\r\n");
+    assert(resp.find("Content-Type: text/plain; version=0.0.4") != string::npos);
+    assert(resp.find("# TYPE shelly_http_request_duration_seconds histogram") != string::npos);
+    assert(resp.find("shelly_http_request_duration_seconds_bucket{method=\"GET\",route=\"/roomStates\",le=\"+Inf\"}") != string::npos);
+    assert(resp.find("shelly_http_request_duration_seconds_count{method=\"OPTIONS\",route=\"*\"}") != string::npos);
+    assert(resp.find("route=\"/history/<id>\"") == string::npos || metrics_route_count(Route::History) > 0);
+    assert(resp.find("shelly_trigger_requests_total{outcome=\"rejected\"}") != string::npos);
+    assert(resp.find("\nshelly_sensors ") != string::npos && resp.find("\nshelly_timers_pending ") != string::npos);
+}
+
+void test_tracing() {
+    // off by default: nothing sampled, nothing recorded
+    assert(TRACE_SAMPLE_EVERY.load() == 0 && trace_sample() == 0);
+    process_request_and_build_response("GET /saveSensorInformation?sensor=trace-room&temp=20.5 HTTP/1.1\r\n\r\n");
+    assert(traces_json() == "{\"traceEvents\":[],\"displayTimeUnit\":\"ns\"}");
+
+    std::string resp = process_request_and_build_response("POST /setTraceSampling HTTP/1.1\r\nContent-Length: 7\r\n\r\nevery=x");
+    assert(resp.find("Invalid every value") != string::npos);
+    resp = process_request_and_build_response("POST /setTraceSampling HTTP/1.1\r\nContent-Length: 7\r\n\r\nevery=3");
+    assert(resp.find("OK") != string::npos && TRACE_SAMPLE_EVERY.load() == 3);
+    int sampled = 0;
+    for (int i = 0; i < 3; ++i) sampled += trace_sample() != 0;
+    assert(sampled == 1);
+
+    // the phases of a traced reading, each a complete ("X") event of the same trace
+    TRACE_SAMPLE_EVERY.store(1);
+    uint64_t id = trace_sample();
+    assert(id != 0);
+    current_trace = id;
+    process_request_and_build_response("GET /saveSensorInformation?sensor=trace-room&temp=20.6 HTTP/1.1\r\n\r\n");
+    current_trace = 0;
+    std::string js = traces_json();
+    for (const char *phase : {"query", "store", "registry", "wal", "history", "trigger", "rules", "build", "/saveSensorInformation"}) {
+        assert(js.find(std::string("{\"name\":\"") + phase + "\",\"cat\":\"request\",\"ph\":\"X\"") != string::npos);
+    }
+    assert(js.find("\"args\":{\"trace\":" + std::to_string(id) + "}") != string::npos);
+    assert(process_request_and_build_response("GET /debug/traces HTTP/1.1\r\n\r\n").find("\"traceEvents\":[{") != string::npos);
+
+    // the ring keeps the newest TRACE_RING_SPANS spans, also with concurrent writers (less
+    // the few a stalled writer may have overwritten with older ones)
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([]{
+            for (size_t i = 0; i < TRACE_RING_SPANS; ++i) trace_record(7, "spin", i, i + 1000);
+        });
+    }
+    for (int i = 0; i < 10; ++i) traces_json();
+    for (auto &th : threads) th.join();
+    js = traces_json();
+    size_t events = 0;
+    for (size_t at = js.find("\"ph\""); at != string::npos; at = js.find("\"ph\"", at + 1)) ++events;
+    assert(events <= TRACE_RING_SPANS && events > TRACE_RING_SPANS / 2 && js.find("\"name\":\"query\"") == string::npos);
+    assert(js.find("\"dur\":1,") != string::npos);
+    TRACE_SAMPLE_EVERY.store(0);
+}
+
 void test_options_preflight() {
     // 1) Known endpoint should advertise GET + OPTIONS and echo requested headers
     {
@@ -140,15 +1147,494 @@ void test_options_preflight() {
         assert_contains(resp, "Allow: OPTIONS, POST\r\n");
         assert_contains(resp, "Access-Control-Allow-Methods: OPTIONS, POST\r\n");
     }
+
+    // 4) Routes added later come from the same tables as the dispatch
+    {
+        auto allow = [](const char *path) {
+            std::string resp = process_request_and_build_response(std::string("OPTIONS ") + path + " HTTP/1.1\r\n\r\n");
+            size_t at = resp.find("Allow: ");
+            return resp.substr(at + 7, resp.find("\r\n", at) - at - 7);
+        };
+        assert(allow("/addRule") == "OPTIONS, POST");
+        assert(allow("/setTraceSampling") == "OPTIONS, POST");
+        assert(allow("/rules/kitchen") == "DELETE, OPTIONS");
+        assert(allow("/schedules/kitchen") == "DELETE, OPTIONS");
+        assert(allow("/history/kitchen") == "GET, OPTIONS");
+        assert(allow("/metrics") == "GET, OPTIONS");
+        assert(allow("/rules") == "GET, OPTIONS");
+        assert(allow("/settings/kitchen") == "DELETE, GET, OPTIONS");
+        assert(allow("/triggerLog") == "DELETE, OPTIONS");
+    }
+}
+
+void test_keep_alive() {
+    auto keep_alive = [](const std::string &req) {
+        HttpParser p;
+        assert(p.parse(req) == HttpParser::Result::Complete);
+        return p.request().keep_alive;
+    };
+    assert(keep_alive("GET / HTTP/1.1\r\nHost: x\r\n\r\n"));
+    assert(!keep_alive("GET / HTTP/1.1\r\nconnection: Close\r\n\r\n"));
+    assert(!keep_alive("GET / HTTP/1.0\r\n\r\n"));
+    assert(keep_alive("GET / HTTP/1.0\r\nConnection: keep-alive\r\n\r\n"));
+
+    const std::string status = "HTTP/1.1 200 OK\r\n";
+    std::string resp = build_response("text/plain", "OK");
+    assert(resp.rfind(status, 0) == 0);
+    std::string rest = resp.substr(status.size());
+    std::string out = "queued";
+    append_response(out, resp, true, 5, 99);
+    assert(out == "queued" + status + "Connection: keep-alive\r\nKeep-Alive: timeout=5, max=99\r\n" + rest);
+    out.clear();
+    append_response(out, resp, false, 0, 0);
+    assert(out == status + "Connection: close\r\n" + rest);
+}
+
+void test_ingest_allocations() {
+    // a room whose name does not fit the small-string buffer, with triggers configured
+    const std::string room = "north-wing-living-room";
+    assert(set_desired_temperature(room, 21.0));
+    assert(set_trigger_url(room, "high", "http://127.0.0.1:9/high"));
+    assert(set_trigger_url(room, "low", "http://127.0.0.1:9/low"));
+
+    std::string out;
+    auto ingest = [&](int i) {
+        // the escaped '-' is decoded into the arena; the temperature stays within the band
+        char buf[256];
+        snprintf(buf, sizeof(buf), "GET /saveSensorInformation?id=north-wing-living%%2Droom&temp=%.1f&hum=45&batt=90 "
+                 "HTTP/1.1\r\nHost: x\r\n\r\n", 20.9 + (i % 3) * 0.1);
+        HttpParser p;
+        assert(p.parse(buf) == HttpParser::Result::Complete);
+        out.clear();
+        process_request(p.request(), out, true, 5, 100);
+    };
+    // warm up: arenas, history and rollup rings, per-thread buffers; the flushes leave the
+    // pending on-disk history buffers sized for one interval of readings
+    for (int round = 0; round < 2; ++round) {
+        for (int i = 0; i < 500; ++i) ingest(i);
+        assert(flush_history_segments());
+    }
+    uint64_t before = metrics_route_count(Route::SaveSensorInformation);
+    allocations = 0;
+    count_allocations = true;
+    for (int i = 0; i < 500; ++i) ingest(i);
+    count_allocations = false;
+    assert(allocations == 0);
+    assert(metrics_route_count(Route::SaveSensorInformation) == before + 500);
+    assert(out.rfind("HTTP/1.1 200 OK\r\nConnection: keep-alive\r\nKeep-Alive: timeout=5, max=100\r\nContent-Type: text/plain\r\n", 0) == 0);
+    std::string body = "Stored sensor data for: " + room;
+    assert(out.size() > body.size() && out.compare(out.size() - body.size(), body.size(), body) == 0);
+    assert(read_sensor_data(room).find("\"temp\":\"21") != std::string::npos);
+
+    // the same response as the general path plus append_response()
+    std::string expected;
+    append_response(expected, process_request_and_build_response(
+        std::string("GET /saveSensorInformation?id=north-wing-living-room&temp=21.0 HTTP/1.1\r\n\r\n")), false, 0, 0);
+    HttpParser p;
+    assert(p.parse("GET /saveSensorInformation?id=north-wing-living-room&temp=21.0 HTTP/1.1\r\n\r\n") == HttpParser::Result::Complete);
+    out.clear();
+    process_request(p.request(), out, false, 0, 0);
+    assert(out == expected);
+    delete_room_settings(room);
+}
+
+void test_http_parser() {
+    // bytes arrive in arbitrary pieces; the parser resumes where it stopped
+    std::string buf;
+    std::string msg = "POST /setDesiredTemperature?x=1 HTTP/1.1\r\nHost: x\r\ncontent-length: 19\r\n"
+                      "Expect: 100-continue\r\n\r\nroom=a&desired=21.5";
+    HttpParser p;
+    size_t split = msg.find("\r\n\r\n") + 4;
+    buf = msg.substr(0, 10);
+    assert(p.parse(buf) == HttpParser::Result::Incomplete);
+    buf = msg.substr(0, split);
+    assert(p.parse(buf) == HttpParser::Result::Incomplete);
+    assert(p.expect_continue());
+    buf = msg;
+    assert(p.parse(buf) == HttpParser::Result::Complete);
+    const HttpRequest &r = p.request();
+    assert(r.method == "POST");
+    assert(r.path == "/setDesiredTemperature");
+    assert(r.query == "x=1");
+    assert(r.body == "room=a&desired=21.5");
+    assert(r.header("Content-Length") == "19");
+    assert(r.header("HOST") == "x");
+    assert(p.message_length() == msg.size());
+
+    // two pipelined requests in one buffer are framed one at a time
+    std::string pipelined = "GET /a HTTP/1.1\r\n\r\nPOST /b HTTP/1.1\r\nContent-Length: 3\r\n\r\nx=1";
+    HttpParser pp;
+    assert(pp.parse(pipelined) == HttpParser::Result::Complete);
+    assert(pp.request().path == "/a");
+    size_t first = pp.message_length();
+    pp.reset();
+    assert(pp.parse(std::string_view(pipelined).substr(first)) == HttpParser::Result::Complete);
+    assert(pp.request().path == "/b" && pp.request().body == "x=1");
+
+    // limits
+    HttpParser big;
+    assert(big.parse("POST / HTTP/1.1\r\nContent-Length: 99999999\r\n\r\n") == HttpParser::Result::Error);
+    assert(big.error_status() == 413);
+    HttpParser huge;
+    assert(huge.parse("GET / HTTP/1.1\r\nX: " + std::string(MAX_HEADER_BYTES, 'a')) == HttpParser::Result::Error);
+    assert(huge.error_status() == 431);
+    HttpParser bad;
+    assert(bad.parse("garbage\r\n\r\n") == HttpParser::Result::Error);
+    assert(bad.error_status() == 400);
+    // chunk-size lines (extensions included) and trailers are held to the header limit
+    const std::string chunked_head = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n";
+    HttpParser chunk_ext;
+    assert(chunk_ext.parse(chunked_head + "3;" + std::string(MAX_HEADER_BYTES, 'x')) == HttpParser::Result::Error);
+    assert(chunk_ext.error_status() == 400);
+    HttpParser trailers;
+    std::string many_trailers = chunked_head + "3\r\nx=1\r\n0\r\n";
+    for (size_t i = 0; i * 8 <= MAX_HEADER_BYTES; ++i) many_trailers += "X-T: 1\r\n";
+    assert(trailers.parse(many_trailers) == HttpParser::Result::Error);
+    assert(trailers.error_status() == 400);
+    HttpParser chunked;
+    assert(chunked.parse(chunked_head + "3;ext=1\r\nx=1\r\n0\r\nX-T: 1\r\n\r\n") == HttpParser::Result::Complete);
+    assert(chunked.request().body == "x=1");
+}
+
+// An event loop serving an ephemeral loopback port on its own thread (test_event_loop)
+struct LoopbackServer {
+    std::atomic<bool> running{true};
+    std::atomic<bool> ok{false};
+    std::thread thread;
+    int port = 0;
+
+    // `rcvbuf`: receive buffer size of the accepted connections (0 = system default)
+    explicit LoopbackServer(int rcvbuf = 0) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        assert(fd >= 0);
+        if (rcvbuf) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        int rc = bind(fd, (sockaddr *)&addr, len);
+        assert(rc == 0);
+        rc = listen(fd, 16);
+        assert(rc == 0);
+        getsockname(fd, (sockaddr *)&addr, &len);
+        port = ntohs(addr.sin_port);
+        thread = std::thread([this, fd] {
+            ok = run_event_loop(fd, running, false);
+            close(fd);
+        });
+    }
+    ~LoopbackServer() { stop(); }
+
+    // Returns whether the loop ran and shut down cleanly
+    bool stop() {
+        running = false;
+        if (thread.joinable()) thread.join();
+        return ok;
+    }
+
+    // A blocking client socket; reads give up after 5 s so a missing response fails the test.
+    // `sndbuf`: its send buffer size (0 = system default)
+    int connect_client(int sndbuf = 0) const {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        assert(fd >= 0);
+        if (sndbuf) setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+        timeval tv{5, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        int rc = connect(fd, (sockaddr *)&addr, sizeof(addr));
+        assert(rc == 0);
+        return fd;
+    }
+};
+
+static void send_all(int fd, const std::string &data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        assert(n > 0);
+        sent += (size_t)n;
+    }
+}
+
+// Read `count` responses (all carry a Content-Length) from `fd`. Bytes read past the
+// last one stay in `buf`.
+static std::vector<std::string> read_responses(int fd, size_t count, std::string &buf) {
+    std::vector<std::string> responses;
+    while (responses.size() < count) {
+        size_t head_end = buf.find("\r\n\r\n");
+        if (head_end != std::string::npos) {
+            size_t at = buf.find("Content-Length: ");
+            assert(at < head_end);
+            size_t total = head_end + 4 + std::stoul(buf.substr(at + 16));
+            if (buf.size() >= total) {
+                responses.push_back(buf.substr(0, total));
+                buf.erase(0, total);
+                continue;
+            }
+        }
+        char chunk[4096];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        assert(n > 0);
+        buf.append(chunk, n);
+    }
+    return responses;
+}
+
+void test_event_loop() {
+    LoopbackServer server;
+    int fd = server.connect_client();
+    std::string buf;
+    auto pause = [] { std::this_thread::sleep_for(std::chrono::milliseconds(20)); };
+
+    // a request trickling in a few bytes at a time: each piece arrives in its own read
+    const std::string get = "GET / HTTP/1.1\r\nHost: x\r\n\r\n";
+    for (size_t i = 0; i < get.size(); i += 5) {
+        send_all(fd, get.substr(i, 5));
+        pause();
+    }
+    std::vector<std::string> r = read_responses(fd, 1, buf);
+    assert(r[0].rfind("HTTP/1.1 200 OK\r\nConnection: keep-alive\r\n", 0) == 0);
+
+    // a body sent after its headers, and split itself
+    const std::string body = "room=loop-test&desired=21.5";
+    send_all(fd, "POST /setDesiredTemperature HTTP/1.1\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n");
+    pause();
+    send_all(fd, body.substr(0, 10));
+    pause();
+    send_all(fd, body.substr(10));
+    r = read_responses(fd, 1, buf);
+    assert(r[0].rfind("HTTP/1.1 200 OK\r\n", 0) == 0);
+
+    // two whole requests and the start of a third in one write, the rest in the next
+    send_all(fd, get + "GET /sensor/no-such-sensor HTTP/1.1\r\n\r\nGET / HT");
+    pause();
+    send_all(fd, "TP/1.1\r\n\r\n");
+    r = read_responses(fd, 3, buf);
+    assert(r[0].rfind("HTTP/1.1 200 OK\r\n", 0) == 0);
+    assert(r[1].rfind("HTTP/1.1 404 Not Found\r\n", 0) == 0);
+    assert(r[2].rfind("HTTP/1.1 200 OK\r\n", 0) == 0);
+    assert(buf.empty());
+
+    // the loop stops when asked, with the connection still open
+    assert(server.stop());
+    close(fd);
+    delete_room_settings("loop-test");
+}
+
+void test_event_loop_pipelining() {
+    const std::string get = "GET / HTTP/1.1\r\n\r\n";
+    const std::string missing = "GET /sensor/no-such-sensor HTTP/1.1\r\n\r\n";
+    std::string buf;
+
+    // requests pipelined in one write are answered in order
+    {
+        LoopbackServer server;
+        int fd = server.connect_client();
+        std::string batch;
+        for (int i = 0; i < 10; ++i) batch += i % 3 ? get : missing;
+        send_all(fd, batch);
+        std::vector<std::string> r = read_responses(fd, 10, buf);
+        for (int i = 0; i < 10; ++i)
+            assert(r[i].rfind(i % 3 ? "HTTP/1.1 200 OK\r\n" : "HTTP/1.1 404 Not Found\r\n", 0) == 0);
+        assert(buf.empty());
+        close(fd);
+        assert(server.stop());
+    }
+
+    // the connection closes after its keep-alive maximum; later requests go unanswered
+    int saved_max = KEEPALIVE_MAX_REQUESTS.exchange(3);
+    {
+        LoopbackServer server;
+        int fd = server.connect_client();
+        send_all(fd, get + get + get + get);
+        std::vector<std::string> r = read_responses(fd, 3, buf);
+        assert(r[0].find("Keep-Alive: timeout=5, max=2\r\n") != std::string::npos);
+        assert(r[1].find("Keep-Alive: timeout=5, max=1\r\n") != std::string::npos);
+        assert(r[2].rfind("HTTP/1.1 200 OK\r\nConnection: close\r\n", 0) == 0);
+        char c;
+        assert(recv(fd, &c, 1, 0) == 0 && buf.empty());
+        close(fd);
+        assert(server.stop());
+    }
+
+    // a client that never reads: past MAX_PENDING_OUTPUT of queued responses the loop
+    // stops consuming its requests, so its writes stall with little input accepted
+    KEEPALIVE_MAX_REQUESTS = 1 << 30;
+    {
+        LoopbackServer server(16 * 1024);
+        int fd = server.connect_client(16 * 1024);
+        std::string batch;
+        for (int i = 0; i < 100; ++i) batch += get;
+        size_t written = 0;
+        auto last_progress = std::chrono::steady_clock::now();
+        // an unbounded loop would take all of it
+        while (written < (4u << 20) && std::chrono::steady_clock::now() - last_progress < std::chrono::milliseconds(300)) {
+            size_t at = written % batch.size();
+            ssize_t n = send(fd, batch.data() + at, batch.size() - at, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n > 0) {
+                written += (size_t)n;
+                last_progress = std::chrono::steady_clock::now();
+            } else {
+                assert(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+        }
+        assert(written < MAX_PENDING_OUTPUT);
+        // reading resumes the paused input; every whole request is answered, in order
+        std::vector<std::string> r = read_responses(fd, written / get.size(), buf);
+        for (const std::string &resp : r) assert(resp.rfind("HTTP/1.1 200 OK\r\n", 0) == 0);
+        assert(buf.empty());
+        close(fd);
+        assert(server.stop());
+    }
+    KEEPALIVE_MAX_REQUESTS = saved_max;
+}
+
+void test_json() {
+    // writer escapes and separates automatically
+    std::string out;
+    JsonWriter w(out);
+    w.begin_object();
+    w.key("a\"b");
+    w.value_string("line\nbreak}");
+    w.key("list");
+    w.begin_array();
+    w.value_int(1);
+    w.value_number(2.5);
+    w.value_null();
+    w.value_bool(true);
+    w.end_array();
+    w.end_object();
+    assert(out == "{\"a\\\"b\":\"line\\nbreak}\",\"list\":[1,2.5,null,true]}");
+
+    // reader walks it back without a DOM
+    JsonReader r(out);
+    std::string scratch, vscratch;
+    std::string_view key, sv, raw;
+    assert(r.begin_object());
+    assert(r.next_key(key, scratch) && key == "a\"b");
+    assert(r.read_string(sv, vscratch) && sv == "line\nbreak}");
+    assert(r.next_key(key, scratch) && key == "list");
+    assert(r.skip_value(&raw) && raw == "[1,2.5,null,true]");
+    assert(!r.next_key(key, scratch) && r.ok());
+
+    std::string_view uni = "\"\\u00e9\\ud83d\\ude00\"";
+    JsonReader ru(uni);
+    assert(ru.read_string(sv, vscratch) && sv == "\xc3\xa9\xf0\x9f\x98\x80");
+    JsonReader broken("{\"a\":[1,2}");
+    assert(broken.begin_object() && broken.next_key(key, scratch) && !broken.skip_value());
+
+    // a '}' inside a trigger URL survives a settings reload
+    SETTINGS_JSON_FILE = "./test_data/settings.json";
+    set_trigger_url("json-room", "high", "http://example.com/x?q={\"on\":true}");
+    set_desired_temperature("json-room", 21.5);
+    assert(load_settings_from_disk());
+    assert(room_settings_json("json-room") == "{\"desired\":21.5,\"high\":\"http://example.com/x?q={\\\"on\\\":true}\",\"low\":\"\"}");
+    delete_room_settings("json-room");
+}
+
+void test_analytics() {
+    RoomResponse r;
+    const int64_t t0 = 1700000000;
+    r.add(t0, 20.0f);
+    r.trigger(HeatState::Heating, t0);
+    // the room keeps cooling for ten minutes, then warms at 1 °C per hour
+    r.add(t0 + 300, 19.9f);
+    r.add(t0 + 600, 19.8f);
+    for (int k = 1; k <= 10; ++k) r.add(t0 + 600 + k * 360, 19.8f + 0.1f * k);
+    assert(r.episode().responded && r.episode().dead_time == 1320);
+    double rate;
+    assert(r.episode().rate(rate) && std::fabs(rate - 1.0) < 1e-3);
+    // switched off at 20.8, it overshoots to 21.0 before falling
+    r.trigger(HeatState::Cooling, t0 + 4200);
+    r.add(t0 + 4500, 21.0f);
+    r.trigger(HeatState::Cooling, t0 + 4600);  // a re-assert continues the episode
+    r.add(t0 + 4800, 20.8f);
+    const ResponseStats &heating = r.stats(HeatState::Heating);
+    assert(heating.episodes == 1 && heating.rate.samples == 1 && std::fabs(heating.rate.value - 1.0) < 1e-3);
+    assert(heating.dead_time.value == 1320 && std::fabs(heating.overshoot.value - 0.2) < 1e-4);
+    assert(r.episode().state == HeatState::Cooling && r.episode().dead_time == 600);
+    // too few readings for a cooling rate; the episode ends after twelve hours
+    r.add(t0 + 4200 + ANALYTICS_MAX_EPISODE_SECONDS + 1, 19.0f);
+    const ResponseStats &cooling = r.stats(HeatState::Cooling);
+    assert(cooling.episodes == 1 && cooling.dead_time.samples == 1 && cooling.rate.samples == 0);
+    assert(r.episode().state == HeatState::Idle);
+    RoomModel model = r.model();
+    assert(std::fabs(model.heat_rate - 1.0) < 1e-3 && model.cool_rate == 0);
+    assert(std::fabs(model.heat_overshoot - 0.2) < 1e-4 && model.cool_overshoot == 0);
+
+    // the mean becomes exponentially weighted after ANALYTICS_WINDOW samples
+    OnlineMean m;
+    for (uint64_t i = 0; i < ANALYTICS_WINDOW; ++i) m.add(i % 2 ? 3.0 : 1.0);
+    assert(m.value == 2.0);
+    m.add(2.0 + ANALYTICS_WINDOW);
+    assert(std::fabs(m.value - 3.0) < 1e-9);
+
+    // triggers logged for a room start an episode on its sensor's readings
+    fs::remove_all("./test_triggers");
+    fs::create_directories("./test_triggers");
+    TRIGGERS_LOG_FILE = "./test_triggers/triggers.log";
+    load_triggers_from_disk();
+    SensorReading rd;
+    rd.timestamp = (int64_t)std::time(nullptr);
+    rd.temp = 18.0f;
+    save_sensor_data("analytics-room", rd);
+    log_trigger_event("analytics-room", "low", "http://example.com/low");
+    rd.temp = 18.2f;
+    save_sensor_data("analytics-room", rd);
+    std::string resp = process_request_and_build_response("GET /analytics/analytics-room HTTP/1.1\r\n\r\n");
+    assert(resp.find("\"heating\":{\"episodes\":0,\"rate\":null,\"dead_time\":null,\"overshoot\":null}") != string::npos);
+    assert(resp.find("\"episode\":{\"state\":\"heating\"") != string::npos && resp.find("\"dead_time\":0,") != string::npos);
+    resp = process_request_and_build_response("GET /analytics/no-such-room HTTP/1.1\r\n\r\n");
+    assert(resp.find("404") != string::npos);
+    TRIGGERS_LOG_FILE = TEST_TRIGGERS_LOG;
+    fs::remove_all("./test_triggers");
 }
 
 int main() {
+    // keep every file the tests write (and read back) out of the working directory
+    fs::create_directories("./test_data");
+    HISTORY_DIR = "./test_data/history";
+    TRIGGERS_LOG_FILE = TEST_TRIGGERS_LOG;
+    SETTINGS_JSON_FILE = "./test_data/settings.json";
+    SENSOR_DATA_JSON_FILE = "./test_data/sensor_data.json";
+    WAL_FILE = "./test_data/sensor_data.wal";
     try {
         test_parse_query();
+        test_arena();
         test_sanitize_id();
         test_storage_roundtrip();
+        test_sensor_registry();
+        test_sensors_snapshot();
+        test_wal();
+        test_trigger_log();
+        test_trigger_dispatch();
         test_settings();
+        test_settings_store();
+        test_thermostat();
+        test_rules();
+        test_timer_wheel();
+        test_schedule();
+        test_stale_sensors();
+        test_history();
+        test_history_store();
+        test_history_compaction();
+        test_rollups();
+        test_analytics();
+        test_predictive();
+        test_metrics();
+        test_tracing();
         test_options_preflight();
+        test_keep_alive();
+        test_ingest_allocations();
+        test_http_parser();
+        test_event_loop();
+        test_event_loop_pipelining();
+        test_json();
+        fs::remove_all("./test_data");
         cout << "All tests passed\n";
         return 0;
     } catch (const std::exception &e) {
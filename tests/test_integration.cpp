@@ -35,8 +35,9 @@ static HttpResult http_request(const std::string &method, const std::string &url
 }
 
 int main() {
-    // start server in background
-    int rc = system("./server > /tmp/shelly_server_test.log 2>&1 & echo $! > /tmp/shelly_server_test.pid");
+    // start server in background, in a scratch directory for its data files
+    int rc = system("mkdir -p test_data/integration && cd test_data/integration && "
+                    "exec ../../server > /tmp/shelly_server_test.log 2>&1 & echo $! > /tmp/shelly_server_test.pid");
     if (rc == -1) { std::cerr << "Failed to start server" << std::endl; return 2; }
 
     // wait for server to start up (try for up to 5s)
@@ -80,6 +81,7 @@ int main() {
         unlink("/tmp/shelly_server_test.pid");
     }
 
+    if (system("rm -rf test_data/integration") != 0) std::cerr << "Could not remove test_data/integration" << std::endl;
     std::cout << "Integration smoke tests passed" << std::endl;
     return 0;
 }
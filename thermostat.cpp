@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "thermostat.h"
+#include <algorithm>
+#include <cmath>
+
+HeatState thermostat_step(const ThermostatParams &p, ThermostatState &st, double desired, float temp, int64_t now) {
+    float low = (float)(desired - p.hysteresis);
+    float high = (float)(desired + p.hysteresis);
+    HeatState want = st.state;
+    if (temp < low) want = HeatState::Heating;
+    else if (temp > high) want = HeatState::Cooling;
+
+    if (want != st.state) {
+        // leaving idle is immediate; switching between heating and cooling waits out the dwell
+        if (st.state != HeatState::Idle && now - st.since < p.min_dwell_seconds) return HeatState::Idle;
+        st.state = want;
+        st.since = now;
+        st.last_fired = now;
+        return want;
+    }
+    if (st.state != HeatState::Idle && p.reassert_seconds > 0 && now - st.last_fired >= p.reassert_seconds) {
+        st.last_fired = now;
+        return st.state;
+    }
+    return HeatState::Idle;
+}
+
+HeatState thermostat_predict(const ThermostatParams &p, const ThermostatState &st, double desired, const RoomModel &m,
+                             float temp, int64_t now, int64_t &when) {
+    // Each switch point moves in from its band edge by the overshoot that follows it.
+    // Together they may move in by one hysteresis at most (shared in proportion), so the
+    // two points stay at least `hysteresis` apart and the room does not chatter.
+    double heat_advance = std::max(0.0, m.heat_overshoot);
+    double cool_advance = std::max(0.0, m.cool_overshoot);
+    double total = heat_advance + cool_advance;
+    if (total > p.hysteresis) {
+        heat_advance *= p.hysteresis / total;
+        cool_advance *= p.hysteresis / total;
+    }
+    HeatState next;
+    double threshold, rate;
+    if (st.state == HeatState::Heating && m.heat_rate > 0) {
+        next = HeatState::Cooling;
+        threshold = desired + p.hysteresis - heat_advance;
+        rate = m.heat_rate;
+    } else if (st.state == HeatState::Cooling && m.cool_rate < 0) {
+        next = HeatState::Heating;
+        threshold = desired - p.hysteresis + cool_advance;
+        rate = m.cool_rate;
+    } else {
+        return HeatState::Idle;
+    }
+    // hours; <= 0 once crossed (at the reading's float precision, as in thermostat_step)
+    double remaining = ((float)threshold - temp) / rate;
+    when = now + (remaining > 0 ? (int64_t)std::ceil(remaining * 3600) : 0);
+    when = std::max(when, st.since + p.min_dwell_seconds);
+    return when - now <= PREDICT_MAX_HORIZON_SECONDS ? next : HeatState::Idle;
+}
+
+void thermostat_force(ThermostatState &st, HeatState state, int64_t now) {
+    if (st.state != state) st.since = now;
+    st.state = state;
+    st.last_fired = now;
+}
+
+const char *heat_state_name(HeatState s) {
+    switch (s) {
+        case HeatState::Heating: return "heating";
+        case HeatState::Cooling: return "cooling";
+        default: return "idle";
+    }
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef THERMOSTAT_H
+#define THERMOSTAT_H
+
+#include <cstdint>
+
+// Per-room trigger state machine. A room is idle until the first reading outside the
+// band around its desired temperature; it then heats (low URL fired) or cools (high URL
+// fired) and stays in that state until a reading crosses the opposite edge of the band.
+// Triggers fire only on these transitions, plus a periodic re-assert of the current
+// state in case the relay missed the original request.
+//
+// In predictive mode the room's learned response (analytics.h) moves the switch point
+// ahead: heating stops once the temperature is its usual overshoot below the upper
+// edge, and starts once it is the cooling overshoot above the lower edge, so the swing
+// peaks at the edges instead of beyond them. The two switch points stay at least one
+// hysteresis apart however large the overshoots. The crossing time is predicted from the
+// learned rate, so the switch can happen between two readings.
+
+enum class HeatState { Idle, Heating, Cooling };
+
+// Defaults for rooms without their own values
+constexpr double DEFAULT_HYSTERESIS = 0.2;       // half-width of the band, degrees
+constexpr int DEFAULT_MIN_DWELL_SECONDS = 300;   // minimum time between transitions
+constexpr int DEFAULT_REASSERT_SECONDS = 3600;   // repeat the current state's URL (0 = never)
+// Accepted ranges of a room's own values (from 0)
+constexpr double MAX_HYSTERESIS = 10;
+constexpr int MAX_CONTROL_SECONDS = 7 * 24 * 3600;  // min_dwell and reassert
+// Predicted switches further out than this wait for more readings
+constexpr int64_t PREDICT_MAX_HORIZON_SECONDS = 3 * 3600;
+
+struct ThermostatParams {
+    double hysteresis = DEFAULT_HYSTERESIS;
+    int min_dwell_seconds = DEFAULT_MIN_DWELL_SECONDS;
+    int reassert_seconds = DEFAULT_REASSERT_SECONDS;
+    bool predictive = false;
+};
+
+// Learned response of a room; a rate of 0 means unknown
+struct RoomModel {
+    double heat_rate = 0;       // °C per hour while heating (positive)
+    double cool_rate = 0;       // °C per hour while cooling (negative)
+    double heat_overshoot = 0;  // °C the temperature keeps rising after heating stops
+    double cool_overshoot = 0;  // °C it keeps falling after heating starts
+};
+
+struct ThermostatState {
+    HeatState state = HeatState::Idle;
+    int64_t since = 0;       // time of the last transition
+    int64_t last_fired = 0;  // time the current state's URL was last fired
+};
+
+// Feed one reading taken at `now` (seconds). Returns the state whose URL must fire
+// (Heating: low URL, Cooling: high URL) or Idle if nothing fires. Comparisons are done
+// at the reading's float precision, so a reading of "21.3" equals a desired 21.3.
+HeatState thermostat_step(const ThermostatParams &p, ThermostatState &st, double desired, float temp, int64_t now);
+
+// Predictive mode: the state to switch to next and when (`now` if already due), given
+// the last reading `temp` at `now`. Idle if the model cannot tell (unknown rate, idle
+// room) or the switch is more than PREDICT_MAX_HORIZON_SECONDS away. Respects the dwell.
+HeatState thermostat_predict(const ThermostatParams &p, const ThermostatState &st, double desired, const RoomModel &m,
+                             float temp, int64_t now, int64_t &when);
+
+// Record that `state`'s URL was fired outside the state machine (e.g. /triggerAllHigh).
+void thermostat_force(ThermostatState &st, HeatState state, int64_t now);
+
+// "idle", "heating" or "cooling"
+const char *heat_state_name(HeatState s);
+
+#endif // THERMOSTAT_H
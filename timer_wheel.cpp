@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "timer_wheel.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+TimerWheel::TimerWheel(uint64_t start_tick) : current_(start_tick) {
+    for (uint32_t &h : heads_) h = NIL;
+}
+
+// File a node in the slot for its expiry, relative to the next tick to process
+void TimerWheel::link(uint32_t index) {
+    Node &n = nodes_[index];
+    uint64_t expires = n.expires < current_ ? current_ : n.expires;
+    uint64_t delta = expires - current_;
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (uint64_t)1 << (LEVEL_BITS * (level + 1))) ++level;
+    if (delta >= (uint64_t)1 << (LEVEL_BITS * LEVELS)) {
+        // beyond the top level: park in its farthest slot and re-file when it cascades
+        expires = current_ + ((uint64_t)1 << (LEVEL_BITS * LEVELS)) - 1;
+    }
+    int slot = level * SLOTS + (int)((expires >> (LEVEL_BITS * level)) & (SLOTS - 1));
+    n.slot = (uint16_t)slot;
+    n.prev = NIL;
+    n.next = heads_[slot];
+    if (n.next != NIL) nodes_[n.next].prev = index;
+    heads_[slot] = index;
+    n.linked = true;
+}
+
+void TimerWheel::unlink(uint32_t index) {
+    Node &n = nodes_[index];
+    if (n.prev != NIL) nodes_[n.prev].next = n.next;
+    else heads_[n.slot] = n.next;
+    if (n.next != NIL) nodes_[n.next].prev = n.prev;
+    n.prev = n.next = NIL;
+    n.linked = false;
+}
+
+TimerId TimerWheel::add(uint64_t tick, Callback cb) {
+    uint32_t index;
+    if (!free_.empty()) {
+        index = free_.back();
+        free_.pop_back();
+    } else {
+        index = (uint32_t)nodes_.size();
+        nodes_.emplace_back();
+    }
+    Node &n = nodes_[index];
+    n.expires = tick;
+    n.cb = std::move(cb);
+    link(index);
+    ++size_;
+    // generation in the high half; +1 keeps every id distinct from INVALID_TIMER
+    return ((TimerId)n.generation << 32 | index) + 1;
+}
+
+bool TimerWheel::cancel(TimerId id) {
+    if (id == INVALID_TIMER) return false;
+    --id;
+    uint32_t index = (uint32_t)id;
+    if (index >= nodes_.size()) return false;
+    Node &n = nodes_[index];
+    if (!n.linked || n.generation != (uint32_t)(id >> 32)) return false;
+    unlink(index);
+    n.cb = nullptr;
+    ++n.generation;
+    free_.push_back(index);
+    --size_;
+    return true;
+}
+
+// Move the timers of a higher-level slot down to the levels they now belong in
+void TimerWheel::cascade(int level, int index) {
+    int slot = level * SLOTS + index;
+    uint32_t i = heads_[slot];
+    heads_[slot] = NIL;
+    while (i != NIL) {
+        uint32_t next = nodes_[i].next;
+        link(i);
+        i = next;
+    }
+}
+
+void TimerWheel::advance(uint64_t tick, std::vector<Callback> &due) {
+    if (size_ == 0) {
+        if (tick >= current_) current_ = tick + 1;
+        return;
+    }
+    while (current_ <= tick) {
+        int index = (int)(current_ & (SLOTS - 1));
+        // at each wrap of a level, the next slot of the level above comes due
+        for (int level = 1; index == 0 && level < LEVELS; ++level) {
+            index = (int)((current_ >> (LEVEL_BITS * level)) & (SLOTS - 1));
+            cascade(level, index);
+        }
+        int slot = (int)(current_ & (SLOTS - 1));
+        while (heads_[slot] != NIL) {
+            uint32_t i = heads_[slot];
+            unlink(i);
+            Node &n = nodes_[i];
+            due.push_back(std::move(n.cb));
+            n.cb = nullptr;
+            ++n.generation;
+            free_.push_back(i);
+            --size_;
+        }
+        ++current_;
+        if (size_ == 0 && current_ <= tick) current_ = tick + 1;
+    }
+}
+
+// ---- service ----
+
+static TimerWheel wheel;
+static std::mutex wheel_mutex;
+static std::condition_variable service_cv;
+static std::thread service_thread;
+static std::atomic<bool> service_running(false);
+// steady-clock time of tick 0; set when the service starts
+static std::chrono::steady_clock::time_point epoch;
+
+// Tick that is current now. Caller holds wheel_mutex.
+static uint64_t now_tick_locked() {
+    if (!service_running.load()) return wheel.current_tick();
+    auto elapsed = std::chrono::steady_clock::now() - epoch;
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() / TIMER_TICK_MS;
+}
+
+static void service_loop() {
+    std::vector<TimerWheel::Callback> due;
+    std::unique_lock<std::mutex> lk(wheel_mutex);
+    while (service_running.load()) {
+        wheel.advance(now_tick_locked(), due);
+        if (!due.empty()) {
+            lk.unlock();
+            for (auto &cb : due) {
+                try {
+                    cb();
+                } catch (...) {}
+            }
+            due.clear();
+            lk.lock();
+            continue;
+        }
+        if (wheel.size() == 0) {
+            // nothing pending: sleep until a timer is added
+            service_cv.wait(lk, []{ return !service_running.load() || wheel.size() > 0; });
+        } else {
+            service_cv.wait_until(lk, epoch + std::chrono::milliseconds(wheel.current_tick() * TIMER_TICK_MS));
+        }
+    }
+}
+
+bool start_timer_service() {
+    std::lock_guard<std::mutex> lk(wheel_mutex);
+    if (service_running.load()) return true;
+    // continue from the wheel's current tick, so timers scheduled before now keep their delay
+    epoch = std::chrono::steady_clock::now() - std::chrono::milliseconds(wheel.current_tick() * TIMER_TICK_MS);
+    service_running.store(true);
+    service_thread = std::thread(service_loop);
+    return true;
+}
+
+void stop_timer_service() {
+    {
+        std::lock_guard<std::mutex> lk(wheel_mutex);
+        if (!service_running.load()) return;
+        service_running.store(false);
+    }
+    service_cv.notify_all();
+    if (service_thread.joinable()) service_thread.join();
+    std::lock_guard<std::mutex> lk(wheel_mutex);
+    wheel = TimerWheel(wheel.current_tick());
+}
+
+bool timer_service_running() {
+    return service_running.load();
+}
+
+TimerId schedule_timer(int64_t delay_ms, TimerWheel::Callback cb) {
+    if (delay_ms < 0) delay_ms = 0;
+    uint64_t ticks = (uint64_t)(delay_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    TimerId id;
+    bool was_empty;
+    {
+        std::lock_guard<std::mutex> lk(wheel_mutex);
+        was_empty = wheel.size() == 0;
+        id = wheel.add(now_tick_locked() + ticks, std::move(cb));
+    }
+    // the service sleeps without a deadline while the wheel is empty
+    if (was_empty) service_cv.notify_all();
+    return id;
+}
+
+bool cancel_timer(TimerId id) {
+    std::lock_guard<std::mutex> lk(wheel_mutex);
+    return wheel.cancel(id);
+}
+
+size_t pending_timers() {
+    std::lock_guard<std::mutex> lk(wheel_mutex);
+    return wheel.size();
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Timers: a hierarchical timer wheel driven by one service thread. Scheduling and
+// cancelling are O(1) whatever the number of pending timers, and the thread does a
+// constant amount of work per tick, so tens of thousands of timers (one per sensor,
+// room schedule or trigger retry) cost next to nothing while they wait.
+
+using TimerId = uint64_t;
+constexpr TimerId INVALID_TIMER = 0;
+
+// Resolution of the service: callbacks run up to one tick after they are due
+constexpr int TIMER_TICK_MS = 100;
+
+// The wheel itself, without a thread or a clock: time is a tick count advanced by the
+// owner. Four levels of 64 slots cover 64^4 ticks (19 days at 100 ms); timers further
+// out wait in the top level and are re-filed when it comes round. Not thread-safe.
+class TimerWheel {
+public:
+    using Callback = std::function<void()>;
+
+    explicit TimerWheel(uint64_t start_tick = 0);
+
+    // Add a timer expiring at `tick` (past ticks expire on the next advance)
+    TimerId add(uint64_t tick, Callback cb);
+    // Remove a pending timer; false if it already expired or was cancelled
+    bool cancel(TimerId id);
+    // Advance to `tick`, appending the callbacks of all timers expiring up to and
+    // including it to `due`, earliest first
+    void advance(uint64_t tick, std::vector<Callback> &due);
+
+    // Next tick that advance() will process
+    uint64_t current_tick() const { return current_; }
+    size_t size() const { return size_; }
+
+private:
+    static constexpr int LEVEL_BITS = 6;
+    static constexpr int SLOTS = 1 << LEVEL_BITS;
+    static constexpr int LEVELS = 4;
+    static constexpr uint32_t NIL = UINT32_MAX;
+
+    // Timers live in a slab and are linked into their slot by index. The id combines
+    // the slab index with a generation that changes when the node is reused, so stale
+    // ids never cancel somebody else's timer.
+    struct Node {
+        uint64_t expires = 0;
+        Callback cb;
+        uint32_t generation = 0;
+        uint32_t prev = NIL, next = NIL;
+        uint16_t slot = 0;  // level * SLOTS + index; only meaningful while linked
+        bool linked = false;
+    };
+
+    void link(uint32_t index);
+    void unlink(uint32_t index);
+    void cascade(int level, int index);
+
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> free_;
+    uint32_t heads_[LEVELS * SLOTS];
+    uint64_t current_;
+    size_t size_ = 0;
+};
+
+// Service thread driving one process-wide wheel. Callbacks run on that thread, one at
+// a time and without any lock held, so they may schedule or cancel timers themselves;
+// they should be short and hand long work to another thread.
+bool start_timer_service();
+// Stop the thread; pending timers are dropped without running.
+void stop_timer_service();
+bool timer_service_running();
+
+// Run `cb` after `delay_ms` milliseconds. Timers may be scheduled before the service
+// starts; they are then counted from the moment it does.
+TimerId schedule_timer(int64_t delay_ms, TimerWheel::Callback cb);
+// Cancel a pending timer. Returns false if it is unknown, already cancelled, or already
+// due (its callback may be about to run), so callbacks must tolerate a lost race.
+bool cancel_timer(TimerId id);
+// Number of pending timers
+size_t pending_timers();
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "trace.h"
+#include "json.h"
+#include <chrono>
+#include <vector>
+
+std::atomic<int> TRACE_SAMPLE_EVERY(0);
+thread_local uint64_t current_trace = 0;
+
+// A slot is published by storing its sequence number (index + 1) last; a reader that sees
+// the same number before and after copying the fields has a consistent span
+struct TraceSlot {
+    std::atomic<uint64_t> seq{0};
+    std::atomic<uint64_t> trace{0};
+    std::atomic<uint64_t> start{0};
+    std::atomic<uint64_t> end{0};
+    std::atomic<const char *> name{nullptr};
+    std::atomic<uint32_t> tid{0};
+};
+
+static TraceSlot ring[TRACE_RING_SPANS];
+static std::atomic<uint64_t> ring_head(0);
+static std::atomic<uint64_t> next_trace(1);
+static std::atomic<uint32_t> next_tid(1);
+
+uint64_t trace_now() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t trace_sample() {
+    int every = TRACE_SAMPLE_EVERY.load(std::memory_order_relaxed);
+    if (every <= 0) return 0;
+    thread_local uint64_t requests = 0;
+    if (++requests % (uint64_t)every != 0) return 0;
+    return next_trace.fetch_add(1, std::memory_order_relaxed);
+}
+
+void trace_record(uint64_t trace, const char *name, uint64_t start_ns, uint64_t end_ns) {
+    thread_local uint32_t tid = next_tid.fetch_add(1, std::memory_order_relaxed);
+    uint64_t index = ring_head.fetch_add(1, std::memory_order_relaxed);
+    TraceSlot &s = ring[index % TRACE_RING_SPANS];
+    s.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.trace.store(trace, std::memory_order_relaxed);
+    s.start.store(start_ns, std::memory_order_relaxed);
+    s.end.store(end_ns, std::memory_order_relaxed);
+    s.name.store(name, std::memory_order_relaxed);
+    s.tid.store(tid, std::memory_order_relaxed);
+    s.seq.store(index + 1, std::memory_order_release);
+}
+
+std::string traces_json() {
+    std::string out;
+    JsonWriter w(out);
+    w.begin_object();
+    w.key("traceEvents");
+    w.begin_array();
+    uint64_t head = ring_head.load(std::memory_order_acquire);
+    uint64_t first = head > TRACE_RING_SPANS ? head - TRACE_RING_SPANS : 0;
+    for (uint64_t index = first; index < head; ++index) {
+        const TraceSlot &s = ring[index % TRACE_RING_SPANS];
+        if (s.seq.load(std::memory_order_acquire) != index + 1) continue;  // being written or overwritten
+        uint64_t trace = s.trace.load(std::memory_order_relaxed);
+        uint64_t start = s.start.load(std::memory_order_relaxed);
+        uint64_t end = s.end.load(std::memory_order_relaxed);
+        const char *name = s.name.load(std::memory_order_relaxed);
+        uint32_t tid = s.tid.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s.seq.load(std::memory_order_relaxed) != index + 1) continue;
+        w.begin_object();
+        w.key("name");
+        w.value_string(name);
+        w.key("cat");
+        w.value_string("request");
+        w.key("ph");
+        w.value_string("X");
+        w.key("ts");
+        w.value_number((double)start / 1000.0);
+        w.key("dur");
+        w.value_number((double)(end - start) / 1000.0);
+        w.key("pid");
+        w.value_int(1);
+        w.key("tid");
+        w.value_int(tid);
+        w.key("args");
+        w.begin_object();
+        w.key("trace");
+        w.value_int((int64_t)trace);
+        w.end_object();
+        w.end_object();
+    }
+    w.end_array();
+    w.key("displayTimeUnit");
+    w.value_string("ns");
+    w.end_object();
+    return out;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Sampled request tracing. One request in TRACE_SAMPLE_EVERY gets a trace id; while it is
+// served, each phase (socket read, parse, handler steps, response write) is stored as a
+// span in a fixed ring that GET /debug/traces dumps in the Chrome trace-event format
+// (load it in chrome://tracing or Perfetto). Writers claim ring slots with one atomic
+// increment and never block; a reader skips slots that are being overwritten. A writer
+// stalled for a whole lap of the ring may overwrite a newer span; both are then lost.
+// With sampling off an untraced phase costs one thread-local load and branch.
+
+// Trace one request in this many (per thread); 0 = tracing off
+extern std::atomic<int> TRACE_SAMPLE_EVERY;
+// Spans kept; older ones are overwritten
+constexpr size_t TRACE_RING_SPANS = 4096;
+
+// Trace id of the request this thread is serving, 0 if it is not traced
+extern thread_local uint64_t current_trace;
+
+// Monotonic clock in nanoseconds
+uint64_t trace_now();
+// Whether sampling is on (the event loop only reads the clock then)
+inline bool trace_enabled() { return TRACE_SAMPLE_EVERY.load(std::memory_order_relaxed) > 0; }
+// Id for the next request if it is sampled, else 0
+uint64_t trace_sample();
+// Store a span of trace `trace`; `name` must be a string literal (or otherwise outlive the ring)
+void trace_record(uint64_t trace, const char *name, uint64_t start_ns, uint64_t end_ns);
+
+// Consecutive phases of the current trace: each next() ends the running span and starts
+// another; the last one ends with the object. Does nothing on untraced requests.
+class TracePhases {
+public:
+    explicit TracePhases(const char *name) : name_(name), start_(current_trace ? trace_now() : 0) {}
+    ~TracePhases() { next(nullptr); }
+    void next(const char *name) {
+        if (!current_trace) return;
+        uint64_t now = trace_now();
+        if (name_) trace_record(current_trace, name_, start_, now);
+        name_ = name;
+        start_ = now;
+    }
+    TracePhases(const TracePhases &) = delete;
+    TracePhases &operator=(const TracePhases &) = delete;
+
+private:
+    const char *name_;
+    uint64_t start_;
+};
+
+// {"traceEvents":[{"name":..,"cat":"request","ph":"X","ts":..,"dur":..,"pid":1,"tid":..,"args":{"trace":..}},..]}
+// with timestamps and durations in microseconds, oldest span first
+std::string traces_json();
+
+#endif // TRACE_H
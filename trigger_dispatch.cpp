@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "trigger_dispatch.h"
+#include "trigger_log.h"
+#include "timer_wheel.h"
+#include "metrics.h"
+#include <curl/curl.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+std::atomic<int> TRIGGER_QUEUE_CAPACITY(64);
+std::atomic<int> TRIGGER_HOST_CONCURRENCY(2);
+std::atomic<int> TRIGGER_RETRIES(2);
+std::atomic<int> TRIGGER_RETRY_DELAY_MS(2000);
+
+struct TriggerJob {
+    uint64_t seq = 0;
+    std::string url;
+    std::string host;
+    std::chrono::steady_clock::time_point queued;  // first submission; latency includes retries
+    int attempt = 0;
+    CURL *easy = nullptr;
+};
+
+struct RetryingJob {
+    TimerId timer = INVALID_TIMER;
+    std::unique_ptr<TriggerJob> job;
+};
+
+// Submission queue; guarded by queue_mutex. `in_flight` counts jobs handed to the
+// multi handle and `retrying` the failed ones waiting for their retry timer, so
+// waiting + in_flight + retrying never exceeds TRIGGER_QUEUE_CAPACITY.
+static std::deque<std::unique_ptr<TriggerJob>> waiting;
+static size_t in_flight = 0;
+static std::unordered_map<uint64_t, RetryingJob> retrying;
+static bool accepting = false;
+static std::mutex queue_mutex;
+
+// All transfers run on this handle. Its easy handles share one connection cache and
+// one DNS cache, so repeated triggers to the same relay reuse the open connection.
+static CURLM *multi = nullptr;
+static std::atomic<bool> dispatcher_running(false);
+static std::thread dispatcher_thread;
+
+static int64_t elapsed_ms(const TriggerJob &job) {
+    auto d = std::chrono::steady_clock::now() - job.queued;
+    return (int64_t)std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
+}
+
+std::string trigger_url_host(const std::string &url) {
+    size_t start = url.find("://");
+    start = (start == std::string::npos) ? 0 : start + 3;
+    size_t end = url.find_first_of("/?#", start);
+    std::string host = url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+    size_t at = host.rfind('@');
+    if (at != std::string::npos) host.erase(0, at + 1);
+    for (char &c : host) {
+        if (c >= 'A' && c <= 'Z') c = (char)(c - 'A' + 'a');
+    }
+    return host;
+}
+
+bool dispatch_trigger(uint64_t seq, const std::string &url) {
+    const char *reason;
+    {
+        std::lock_guard<std::mutex> lk(queue_mutex);
+        if (!accepting) {
+            reason = "dispatcher not running";
+        } else if (waiting.size() + in_flight + retrying.size() >= (size_t)std::max(1, TRIGGER_QUEUE_CAPACITY.load())) {
+            reason = "queue full";
+        } else {
+            auto job = std::make_unique<TriggerJob>();
+            job->seq = seq;
+            job->url = url;
+            job->host = trigger_url_host(url);
+            job->queued = std::chrono::steady_clock::now();
+            waiting.push_back(std::move(job));
+            curl_multi_wakeup(multi);
+            return true;
+        }
+    }
+    metrics_count(Counter::TriggersRejected);
+    record_trigger_result(seq, 0, 0, reason);
+    return false;
+}
+
+size_t trigger_queue_depth() {
+    std::lock_guard<std::mutex> lk(queue_mutex);
+    return waiting.size() + in_flight + retrying.size();
+}
+
+// Move waiting jobs to the multi handle, oldest first, skipping hosts already at their
+// limit. Returns the number started.
+static size_t start_ready_jobs(std::unordered_map<std::string, int> &host_active,
+                               std::vector<std::unique_ptr<TriggerJob>> &active) {
+    int limit = std::max(1, TRIGGER_HOST_CONCURRENCY.load());
+    std::vector<std::unique_ptr<TriggerJob>> ready;
+    {
+        std::lock_guard<std::mutex> lk(queue_mutex);
+        for (auto it = waiting.begin(); it != waiting.end();) {
+            int &n = host_active[(*it)->host];
+            if (n >= limit) {
+                ++it;
+                continue;
+            }
+            ++n;
+            ++in_flight;
+            ready.push_back(std::move(*it));
+            it = waiting.erase(it);
+        }
+    }
+    for (auto &job : ready) {
+        CURL *c = curl_easy_init();
+        if (!c) {
+            metrics_count(Counter::TriggersFailed);
+            record_trigger_result(job->seq, 0, elapsed_ms(*job), "out of memory");
+            --host_active[job->host];
+            std::lock_guard<std::mutex> lk(queue_mutex);
+            --in_flight;
+            continue;
+        }
+        curl_easy_setopt(c, CURLOPT_URL, job->url.c_str());
+        curl_easy_setopt(c, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(c, CURLOPT_TIMEOUT, (long)TRIGGER_TIMEOUT_SECONDS);
+        curl_easy_setopt(c, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(c, CURLOPT_TCP_KEEPALIVE, 1L);
+        // suppress output
+        curl_easy_setopt(c, CURLOPT_WRITEFUNCTION, +[](char*, size_t sz, size_t nmemb, void*){ return sz*nmemb; });
+        job->easy = c;
+        curl_multi_add_handle(multi, c);
+        active.push_back(std::move(job));
+    }
+    return ready.size();
+}
+
+// Retry timer callback: put the job back in the queue
+static void resubmit_job(uint64_t seq) {
+    std::lock_guard<std::mutex> lk(queue_mutex);
+    auto it = retrying.find(seq);
+    // stop_trigger_dispatcher() took it meanwhile
+    if (it == retrying.end()) return;
+    waiting.push_back(std::move(it->second.job));
+    retrying.erase(it);
+    curl_multi_wakeup(multi);
+}
+
+// Complete the transfer of active[index]: record its result, or park it for a retry.
+// `retry` is false when the transfer was cancelled.
+static void finish_job(std::unordered_map<std::string, int> &host_active,
+                       std::vector<std::unique_ptr<TriggerJob>> &active, size_t index, const char *error, bool retry) {
+    std::unique_ptr<TriggerJob> job = std::move(active[index]);
+    active[index] = std::move(active.back());
+    active.pop_back();
+    long status = 0;
+    curl_easy_getinfo(job->easy, CURLINFO_RESPONSE_CODE, &status);
+    curl_multi_remove_handle(multi, job->easy);
+    curl_easy_cleanup(job->easy);
+    job->easy = nullptr;
+    if (--host_active[job->host] <= 0) host_active.erase(job->host);
+
+    bool failed = error != nullptr || status >= 500;
+    if (retry && failed && job->attempt < TRIGGER_RETRIES.load() && timer_service_running()) {
+        int64_t delay = (int64_t)std::max(0, TRIGGER_RETRY_DELAY_MS.load()) << std::min(job->attempt, 20);
+        ++job->attempt;
+        uint64_t seq = job->seq;
+        std::lock_guard<std::mutex> lk(queue_mutex);
+        --in_flight;
+        RetryingJob &r = retrying[seq];
+        r.job = std::move(job);
+        r.timer = schedule_timer(delay, [seq]{ resubmit_job(seq); });
+        metrics_count(Counter::TriggersRetried);
+        return;
+    }
+    metrics_count(!retry ? Counter::TriggersCancelled : error ? Counter::TriggersFailed
+                  : status >= 500 ? Counter::TriggersHttpError : Counter::TriggersSucceeded);
+    record_trigger_result(job->seq, (int)status, elapsed_ms(*job), error ? error : "");
+    std::lock_guard<std::mutex> lk(queue_mutex);
+    --in_flight;
+}
+
+static void dispatcher_loop() {
+    std::unordered_map<std::string, int> host_active;
+    std::vector<std::unique_ptr<TriggerJob>> active;
+    while (dispatcher_running.load()) {
+        int running = 0;
+        curl_multi_perform(multi, &running);
+        CURLMsg *msg;
+        int left;
+        while ((msg = curl_multi_info_read(multi, &left))) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            for (size_t i = 0; i < active.size(); ++i) {
+                if (active[i]->easy != msg->easy_handle) continue;
+                CURLcode rc = msg->data.result;
+                finish_job(host_active, active, i, rc == CURLE_OK ? nullptr : curl_easy_strerror(rc), true);
+                break;
+            }
+        }
+        // start what fits (freed host slots included) and drive it right away
+        if (start_ready_jobs(host_active, active) > 0) continue;
+        curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+    }
+    while (!active.empty()) finish_job(host_active, active, active.size() - 1, "cancelled", false);
+}
+
+bool start_trigger_dispatcher() {
+    std::lock_guard<std::mutex> lk(queue_mutex);
+    if (accepting) return true;
+    multi = curl_multi_init();
+    if (!multi) return false;
+    // a backstop for the per-host limit applied by start_ready_jobs()
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)std::max(1, TRIGGER_HOST_CONCURRENCY.load()));
+    dispatcher_running.store(true);
+    dispatcher_thread = std::thread(dispatcher_loop);
+    accepting = true;
+    return true;
+}
+
+void stop_trigger_dispatcher() {
+    {
+        std::lock_guard<std::mutex> lk(queue_mutex);
+        if (!accepting) return;
+        accepting = false;
+        dispatcher_running.store(false);
+        curl_multi_wakeup(multi);
+    }
+    if (dispatcher_thread.joinable()) dispatcher_thread.join();
+    std::deque<std::unique_ptr<TriggerJob>> cancelled;
+    {
+        std::lock_guard<std::mutex> lk(queue_mutex);
+        cancelled.swap(waiting);
+        in_flight = 0;
+        for (auto &kv : retrying) {
+            cancel_timer(kv.second.timer);
+            cancelled.push_back(std::move(kv.second.job));
+        }
+        retrying.clear();
+    }
+    metrics_count(Counter::TriggersCancelled, cancelled.size());
+    for (auto &job : cancelled) record_trigger_result(job->seq, 0, elapsed_ms(*job), "cancelled");
+    curl_multi_cleanup(multi);
+    multi = nullptr;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef TRIGGER_DISPATCH_H
+#define TRIGGER_DISPATCH_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Outbound trigger requests. One dispatcher thread drives all of them through a single
+// curl multi handle, so connections and DNS lookups are cached and reused between
+// triggers. Submitting is a push onto a bounded queue; the result (HTTP status and
+// latency, or the error) is recorded on the trigger log event it belongs to.
+
+// Timeout of one trigger request, including connection setup
+constexpr int TRIGGER_TIMEOUT_SECONDS = 10;
+// Maximum number of triggers waiting or in flight; further submissions are rejected
+extern std::atomic<int> TRIGGER_QUEUE_CAPACITY;
+// Maximum concurrent requests to one host; further triggers for it wait in the queue
+extern std::atomic<int> TRIGGER_HOST_CONCURRENCY;
+// A request that fails (no response or a 5xx status) is retried up to TRIGGER_RETRIES
+// times, after TRIGGER_RETRY_DELAY_MS and twice as long before each further retry. The
+// retries wait on the timer service (timer_wheel.h) and count against the queue capacity;
+// without the timer service nothing is retried.
+extern std::atomic<int> TRIGGER_RETRIES;
+extern std::atomic<int> TRIGGER_RETRY_DELAY_MS;
+
+// Start the dispatcher thread. Until it is called, dispatch_trigger() rejects everything.
+bool start_trigger_dispatcher();
+// Stop the dispatcher; queued, in-flight and retrying triggers are recorded as cancelled.
+void stop_trigger_dispatcher();
+
+// Queue a GET of `url` for the trigger log event `seq`. Returns false (and records the
+// reason on the event) if the dispatcher is not running or the queue is full.
+bool dispatch_trigger(uint64_t seq, const std::string &url);
+
+// Triggers waiting, in flight or waiting for a retry
+size_t trigger_queue_depth();
+
+// Host part of a URL ("http://user@relay:80/x" -> "relay:80"); used to apply the per-host limit.
+std::string trigger_url_host(const std::string &url);
+
+#endif // TRIGGER_DISPATCH_H
@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "trigger_log.h"
+#include "storage.h"
+#include "json.h"
+#include "analytics.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+
+// Ring of the newest events: event `seq` lives in slot seq % ring.size(). Events
+// first_seq .. next_seq-1 are held (a slot whose seq differs is a gap and skipped).
+static std::vector<TriggerEvent> ring;
+static uint64_t next_seq = 1;
+static uint64_t first_seq = 1;
+// Last seq appended to a segment
+static uint64_t persisted_seq = 0;
+// Events at or below persisted_seq whose result arrived after they were written
+static std::vector<uint64_t> result_updates;
+static std::mutex ring_mutex;
+
+// Segment files; guarded by segment_mutex
+static uint64_t active_segment = 1;
+static uint64_t active_bytes = 0;
+static std::mutex segment_mutex;
+
+static std::string segment_path(uint64_t index) {
+    return TRIGGERS_LOG_FILE + "." + std::to_string(index);
+}
+
+// Indices of the existing segment files, oldest first
+static std::vector<uint64_t> list_segments() {
+    std::vector<uint64_t> out;
+    std::filesystem::path base(TRIGGERS_LOG_FILE);
+    std::filesystem::path dir = base.parent_path().empty() ? std::filesystem::path(".") : base.parent_path();
+    std::string prefix = base.filename().string() + ".";
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator(dir, ec)) {
+        std::string name = entry.path().filename().string();
+        if (name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix) != 0) continue;
+        std::string digits = name.substr(prefix.size());
+        if (digits.find_first_not_of("0123456789") != std::string::npos) continue;
+        out.push_back(std::stoull(digits));
+    }
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+// Resize the ring to MAX_TRIGGER_EVENTS, keeping the newest events. Caller holds ring_mutex.
+static void ensure_capacity_locked() {
+    size_t cap = (size_t)std::max(1, MAX_TRIGGER_EVENTS.load());
+    if (ring.size() == cap) return;
+    std::vector<TriggerEvent> resized(cap);
+    uint64_t keep_from = std::max(first_seq, next_seq > cap ? next_seq - cap : 1);
+    for (uint64_t s = keep_from; s < next_seq && !ring.empty(); ++s) {
+        TriggerEvent &ev = ring[s % ring.size()];
+        if (ev.seq == s) resized[s % cap] = std::move(ev);
+    }
+    ring.swap(resized);
+    first_seq = keep_from;
+}
+
+// Caller holds ring_mutex
+static void push_locked(TriggerEvent ev) {
+    size_t cap = ring.size();
+    if (first_seq >= next_seq) first_seq = ev.seq;  // was empty
+    next_seq = ev.seq + 1;
+    ring[ev.seq % cap] = std::move(ev);
+    if (next_seq - first_seq > cap) first_seq = next_seq - cap;
+}
+
+static void write_result_fields(JsonWriter &w, const TriggerEvent &ev) {
+    if (!ev.done) return;
+    w.key("status");
+    w.value_int(ev.status);
+    w.key("latency_ms");
+    w.value_int((long long)ev.latency_ms);
+    if (!ev.error.empty()) {
+        w.key("error");
+        w.value_string(ev.error);
+    }
+}
+
+static void write_event(JsonWriter &w, const TriggerEvent &ev) {
+    char ts[32];
+    size_t ts_len = format_local_timestamp(ev.timestamp, ts, sizeof(ts));
+    w.begin_object();
+    w.key("seq");
+    w.value_int((long long)ev.seq);
+    w.key("timestamp");
+    w.value_string(std::string_view(ts, ts_len));
+    w.key("sensor");
+    w.value_string(ev.sensor);
+    w.key("type");
+    w.value_string(ev.type);
+    w.key("url");
+    w.value_string(ev.url);
+    write_result_fields(w, ev);
+    w.end_object();
+}
+
+// Result line for an event that is already in a segment: {"seq":N,"status":...}
+static void write_result_update(JsonWriter &w, const TriggerEvent &ev) {
+    w.begin_object();
+    w.key("seq");
+    w.value_int((long long)ev.seq);
+    write_result_fields(w, ev);
+    w.end_object();
+}
+
+static bool is_result_update(const TriggerEvent &ev) {
+    return ev.done && ev.seq != 0 && ev.type.empty() && ev.url.empty();
+}
+
+static bool parse_event(std::string_view line, TriggerEvent &ev) {
+    JsonReader r(line);
+    if (!r.begin_object()) return false;
+    std::string key_scratch, scratch;
+    std::string_view key, value;
+    while (r.next_key(key, key_scratch)) {
+        bool ok;
+        if (key == "seq" && r.peek() != '"') {
+            double d;
+            ok = r.read_number(d);
+            if (ok && d >= 0) ev.seq = (uint64_t)d;
+        } else if ((key == "status" || key == "latency_ms") && r.peek() != '"') {
+            double d;
+            ok = r.read_number(d);
+            if (key == "status") ev.status = (int)d;
+            else ev.latency_ms = (int64_t)d;
+            ev.done = true;
+        } else if (key == "error") {
+            ok = r.read_string(value, scratch);
+            if (ok) ev.error.assign(value.data(), value.size());
+        } else if (key == "timestamp" || key == "sensor" || key == "type" || key == "url") {
+            ok = r.read_string(value, scratch);
+            if (!ok) break;
+            if (key == "timestamp") parse_local_timestamp(value, ev.timestamp);
+            else (key == "sensor" ? ev.sensor : key == "type" ? ev.type : ev.url).assign(value.data(), value.size());
+        } else {
+            ok = r.skip_value();
+        }
+        if (!ok) return false;
+    }
+    return r.ok() && r.peek() == 0;
+}
+
+uint64_t log_trigger_event(const std::string &sensor, const std::string &type, const std::string &url) {
+    int64_t timestamp = (int64_t)std::time(nullptr);
+    TriggerEvent ev;
+    ev.timestamp = timestamp;
+    ev.sensor = sensor;
+    ev.type = type;
+    ev.url = url;
+    uint64_t seq;
+    {
+        std::lock_guard<std::mutex> lk(ring_mutex);
+        ensure_capacity_locked();
+        seq = ev.seq = next_seq;
+        push_locked(std::move(ev));
+    }
+    // the flusher thread appends it to the active segment
+    mark_trigger_log_dirty();
+    // start measuring the room's response
+    analytics_trigger(sensor, type, timestamp);
+    return seq;
+}
+
+void record_trigger_result(uint64_t seq, int status, int64_t latency_ms, const std::string &error) {
+    {
+        std::lock_guard<std::mutex> lk(ring_mutex);
+        if (ring.empty()) return;
+        TriggerEvent &ev = ring[seq % ring.size()];
+        if (ev.seq != seq) return;  // already dropped from the ring
+        ev.done = true;
+        ev.status = status;
+        ev.latency_ms = latency_ms;
+        ev.error = error;
+        // events not yet written carry their result in their own line
+        if (seq > persisted_seq) return;
+        result_updates.push_back(seq);
+    }
+    mark_trigger_log_dirty();
+}
+
+std::string trigger_events_json(uint64_t since, size_t limit) {
+    std::string out;
+    JsonWriter w(out);
+    w.begin_array();
+    std::lock_guard<std::mutex> lk(ring_mutex);
+    if (!ring.empty()) {
+        uint64_t s = std::max(first_seq, since + 1);
+        for (size_t n = 0; s < next_seq && n < limit; ++s) {
+            const TriggerEvent &ev = ring[s % ring.size()];
+            if (ev.seq != s) continue;
+            write_event(w, ev);
+            ++n;
+        }
+    }
+    w.end_array();
+    return out;
+}
+
+std::string all_trigger_events_json() {
+    return trigger_events_json(0, SIZE_MAX);
+}
+
+bool flush_trigger_log() {
+    std::lock_guard<std::mutex> slk(segment_mutex);
+    std::string data;
+    uint64_t upto, previous;
+    std::vector<uint64_t> updates;
+    {
+        std::lock_guard<std::mutex> lk(ring_mutex);
+        upto = next_seq - 1;
+        previous = persisted_seq;
+        updates.swap(result_updates);
+        if (!ring.empty()) {
+            for (uint64_t s : updates) {
+                const TriggerEvent &ev = ring[s % ring.size()];
+                if (ev.seq != s) continue;
+                JsonWriter w(data);
+                write_result_update(w, ev);
+                data.push_back('\n');
+            }
+            // events that dropped out of the ring before a flush are lost
+            for (uint64_t s = std::max(persisted_seq + 1, first_seq); s <= upto; ++s) {
+                const TriggerEvent &ev = ring[s % ring.size()];
+                if (ev.seq != s) continue;
+                JsonWriter w(data);
+                write_event(w, ev);
+                data.push_back('\n');
+            }
+        }
+        persisted_seq = upto;
+    }
+    if (data.empty()) return true;
+
+    if (active_bytes >= TRIGGER_SEGMENT_BYTES) {
+        ++active_segment;
+        active_bytes = 0;
+        // retention: drop the oldest closed segments
+        std::vector<uint64_t> segments = list_segments();
+        size_t keep = TRIGGER_SEGMENTS_KEPT > 1 ? TRIGGER_SEGMENTS_KEPT - 1 : 0;
+        for (size_t i = 0; i + keep < segments.size(); ++i) unlink(segment_path(segments[i]).c_str());
+    }
+    std::string path = segment_path(active_segment);
+    std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    std::error_code ec;
+    if (!parent.empty()) std::filesystem::create_directories(parent, ec);
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    bool ok = fd >= 0;
+    size_t off = 0;
+    while (ok && off < data.size()) {
+        ssize_t n = write(fd, data.data() + off, data.size() - off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) ok = false;
+        else off += (size_t)n;
+    }
+    if (fd >= 0) close(fd);
+    active_bytes += off;
+    if (!ok) {
+        // retry on the next flush; lines that made it may then appear twice, a torn
+        // one is skipped when loading
+        std::lock_guard<std::mutex> lk(ring_mutex);
+        if (persisted_seq == upto) persisted_seq = previous;
+        result_updates.insert(result_updates.end(), updates.begin(), updates.end());
+    }
+    return ok;
+}
+
+bool clear_trigger_events_log() {
+    std::lock_guard<std::mutex> slk(segment_mutex);
+    {
+        std::lock_guard<std::mutex> lk(ring_mutex);
+        first_seq = next_seq;
+        persisted_seq = next_seq - 1;
+        result_updates.clear();
+    }
+    bool ok = true;
+    for (uint64_t index : list_segments()) {
+        if (unlink(segment_path(index).c_str()) != 0) ok = false;
+    }
+    ++active_segment;
+    active_bytes = 0;
+    return ok;
+}
+
+void load_triggers_from_disk() {
+    std::lock_guard<std::mutex> slk(segment_mutex);
+    // adopt the single-file log written by older versions as the first segment
+    std::vector<uint64_t> segments = list_segments();
+    std::error_code ec;
+    if (std::filesystem::exists(TRIGGERS_LOG_FILE, ec)) {
+        uint64_t index = segments.empty() ? 1 : segments.front() - 1;
+        if (index > 0 && std::rename(TRIGGERS_LOG_FILE.c_str(), segment_path(index).c_str()) == 0) {
+            segments.insert(segments.begin(), index);
+        }
+    }
+
+    std::lock_guard<std::mutex> lk(ring_mutex);
+    // stored events keep their sequence numbers; without any, numbering continues
+    uint64_t resume_seq = next_seq;
+    ring.clear();
+    first_seq = next_seq = 1;
+    ensure_capacity_locked();
+    size_t cap = ring.size();
+    // read the newest segments until they hold enough events to fill the ring
+    std::vector<std::vector<TriggerEvent>> loaded;
+    size_t total = 0;
+    for (auto it = segments.rbegin(); it != segments.rend() && total < cap; ++it) {
+        std::ifstream ifs(segment_path(*it));
+        std::vector<TriggerEvent> events;
+        std::string line;
+        while (std::getline(ifs, line)) {
+            TriggerEvent ev;
+            // skip blank and corrupt (e.g. torn) lines
+            if (parse_event(line, ev)) events.push_back(std::move(ev));
+        }
+        total += events.size();
+        loaded.push_back(std::move(events));
+    }
+    for (auto it = loaded.rbegin(); it != loaded.rend(); ++it) {
+        for (TriggerEvent &ev : *it) {
+            if (is_result_update(ev)) {
+                // merge into the event written earlier, if it is still held
+                TriggerEvent &target = ring[ev.seq % cap];
+                if (target.seq == ev.seq && ev.seq >= first_seq) {
+                    target.done = true;
+                    target.status = ev.status;
+                    target.latency_ms = ev.latency_ms;
+                    target.error = std::move(ev.error);
+                }
+                continue;
+            }
+            // lines from older versions carry no seq
+            if (ev.seq < next_seq) ev.seq = next_seq;
+            push_locked(std::move(ev));
+        }
+    }
+    if (first_seq >= next_seq) first_seq = next_seq = resume_seq;
+    persisted_seq = next_seq - 1;
+    result_updates.clear();
+    if (!segments.empty()) {
+        active_segment = segments.back();
+        active_bytes = (uint64_t)std::filesystem::file_size(segment_path(active_segment), ec);
+        if (ec) active_bytes = 0;
+    }
+}
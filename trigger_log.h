@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef TRIGGER_LOG_H
+#define TRIGGER_LOG_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Trigger event log. The newest MAX_TRIGGER_EVENTS events are held in a fixed-capacity
+// ring in memory and every read is served from it. Events are persisted by appending
+// them to numbered segment files (TRIGGERS_LOG_FILE.1, .2, ...); a full segment is
+// closed and never written again, and the oldest segments are deleted.
+
+// Rotate to a new segment once the active one exceeds this size
+constexpr size_t TRIGGER_SEGMENT_BYTES = 1 << 20;
+// Number of segments kept on disk
+constexpr size_t TRIGGER_SEGMENTS_KEPT = 4;
+
+struct TriggerEvent {
+    uint64_t seq = 0;       // increasing sequence number, never reused
+    int64_t timestamp = 0;  // seconds since the epoch
+    std::string sensor;
+    std::string type;       // "high" or "low"
+    std::string url;
+    // outcome of the request, once known
+    bool done = false;
+    int status = 0;         // HTTP status; 0 if no response was received
+    int64_t latency_ms = 0;
+    std::string error;      // empty on success
+};
+
+// Record that a trigger URL was executed for `sensor` with type `high` or `low` and the URL called.
+// Returns the event's sequence number.
+uint64_t log_trigger_event(const std::string &sensor, const std::string &type, const std::string &url);
+// Record the outcome of the request made for event `seq`. Events already written to a
+// segment get a short result line appended that is merged into them on load.
+void record_trigger_result(uint64_t seq, int status, int64_t latency_ms, const std::string &error);
+// Return up to `limit` events with seq > `since`, oldest first, as a JSON array
+// (each entry is an object with seq, timestamp, sensor, type, url and, once the
+// request finished, status, latency_ms and error).
+std::string trigger_events_json(uint64_t since, size_t limit);
+// All events held in memory
+std::string all_trigger_events_json();
+// Clear all trigger events (memory and segment files). Sequence numbers keep increasing.
+bool clear_trigger_events_log();
+
+// Fill the ring from the newest segments (keeps only latest `MAX_TRIGGER_EVENTS`).
+// A plain TRIGGERS_LOG_FILE from older versions is adopted as the first segment.
+void load_triggers_from_disk();
+// Append events logged since the last call to the active segment.
+bool flush_trigger_log();
+
+#endif // TRIGGER_LOG_H
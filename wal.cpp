@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "wal.h"
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+
+std::string WAL_FILE = "sensor_data.wal";
+std::atomic<int> WAL_SYNC_INTERVAL_MS(1000);
+
+static constexpr size_t RECORD_HEADER_BYTES = 4 + 2 + 2 + 8 + 4 * 3;
+
+// Records queued by wal_append(); guarded by pending_mutex.
+static std::string pending;
+static std::mutex pending_mutex;
+// Log file descriptor; file I/O (sync, rotation) is serialized by io_mutex.
+static int wal_fd = -1;
+static std::mutex io_mutex;
+
+static std::thread wal_thread;
+static std::atomic<bool> wal_running(false);
+static std::condition_variable wal_cv;
+static std::mutex wal_cv_mutex;
+
+// CRC-32 (IEEE); pass the previous result as `crc` to continue over another buffer
+static uint32_t crc32(uint32_t crc, const char *data, size_t len) {
+    static uint32_t table[256];
+    static std::once_flag table_once;
+    std::call_once(table_once, []{
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    });
+    uint32_t c = crc ^ 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; ++i) c = table[(c ^ (unsigned char)data[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+static bool write_all(int fd, const char *data, size_t len) {
+    size_t off = 0;
+    while (off < len) {
+        ssize_t n = write(fd, data + off, len - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        off += (size_t)n;
+    }
+    return true;
+}
+
+// Caller holds io_mutex
+static bool sync_locked() {
+    if (wal_fd < 0) return false;
+    // the two buffers trade places on every sync, so appends reuse capacity instead of
+    // growing a fresh buffer after each one
+    static std::string batch;
+    batch.clear();
+    {
+        std::lock_guard<std::mutex> lk(pending_mutex);
+        batch.swap(pending);
+    }
+    if (batch.empty()) return true;
+    if (write_all(wal_fd, batch.data(), batch.size()) && fdatasync(wal_fd) == 0) return true;
+    perror("wal write");
+    // keep the records for the next attempt; a partial write is dropped as a torn tail on replay
+    std::lock_guard<std::mutex> lk(pending_mutex);
+    pending.insert(0, batch);
+    return false;
+}
+
+bool wal_sync() {
+    std::lock_guard<std::mutex> lk(io_mutex);
+    return sync_locked();
+}
+
+void wal_append(std::string_view id, const SensorReading &reading) {
+    if (!wal_running.load()) return;
+    uint16_t id_len = (uint16_t)std::min<size_t>(id.size(), UINT16_MAX);
+    uint16_t reserved = 0;
+    char header[RECORD_HEADER_BYTES];
+    char *p = header + 4;
+    memcpy(p, &id_len, 2); p += 2;
+    memcpy(p, &reserved, 2); p += 2;
+    memcpy(p, &reading.timestamp, 8); p += 8;
+    memcpy(p, &reading.temp, 4); p += 4;
+    memcpy(p, &reading.hum, 4); p += 4;
+    memcpy(p, &reading.batt, 4);
+    // the crc covers everything after the crc field, including the id
+    uint32_t crc = crc32(crc32(0, header + 4, RECORD_HEADER_BYTES - 4), id.data(), id_len);
+    memcpy(header, &crc, 4);
+    {
+        std::lock_guard<std::mutex> lk(pending_mutex);
+        pending.append(header, RECORD_HEADER_BYTES);
+        pending.append(id.data(), id_len);
+    }
+    if (WAL_SYNC_INTERVAL_MS.load() == 0) wal_sync();
+}
+
+size_t wal_replay(const std::string &path, const std::function<void(std::string_view, const SensorReading &)> &fn,
+                  size_t *valid_bytes) {
+    if (valid_bytes) *valid_bytes = 0;
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) return 0;
+    std::string data;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) data.append(buf, n);
+    fclose(f);
+
+    size_t count = 0, off = 0;
+    while (data.size() - off >= RECORD_HEADER_BYTES) {
+        const char *rec = data.data() + off;
+        uint32_t crc;
+        uint16_t id_len;
+        memcpy(&crc, rec, 4);
+        memcpy(&id_len, rec + 4, 2);
+        size_t len = RECORD_HEADER_BYTES + id_len;
+        if (data.size() - off < len || crc32(0, rec + 4, len - 4) != crc) break;
+        SensorReading reading;
+        memcpy(&reading.timestamp, rec + 8, 8);
+        memcpy(&reading.temp, rec + 16, 4);
+        memcpy(&reading.hum, rec + 20, 4);
+        memcpy(&reading.batt, rec + 24, 4);
+        fn(std::string_view(rec + RECORD_HEADER_BYTES, id_len), reading);
+        ++count;
+        off += len;
+    }
+    if (valid_bytes) *valid_bytes = off;
+    return count;
+}
+
+// Caller holds io_mutex
+static bool open_log_locked() {
+    size_t valid = 0;
+    wal_replay(WAL_FILE, [](std::string_view, const SensorReading &){}, &valid);
+    wal_fd = open(WAL_FILE.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (wal_fd < 0) {
+        perror("open wal");
+        return false;
+    }
+    // drop a torn tail so new records are not appended after garbage
+    if (ftruncate(wal_fd, (off_t)valid) != 0 || lseek(wal_fd, 0, SEEK_END) < 0) {
+        perror("truncate wal");
+        close(wal_fd);
+        wal_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+static void wal_loop() {
+    std::unique_lock<std::mutex> lk(wal_cv_mutex);
+    while (wal_running.load()) {
+        int ms = WAL_SYNC_INTERVAL_MS.load();
+        wal_cv.wait_for(lk, std::chrono::milliseconds(ms > 0 ? ms : 1000), []{ return !wal_running.load(); });
+        lk.unlock();
+        wal_sync();
+        lk.lock();
+    }
+}
+
+bool start_wal() {
+    if (wal_running.load()) return true;
+    {
+        std::lock_guard<std::mutex> lk(io_mutex);
+        if (!open_log_locked()) return false;
+    }
+    wal_running.store(true);
+    wal_thread = std::thread(wal_loop);
+    return true;
+}
+
+void stop_wal() {
+    if (!wal_running.load()) return;
+    {
+        std::lock_guard<std::mutex> lk(wal_cv_mutex);
+        wal_running.store(false);
+    }
+    wal_cv.notify_all();
+    if (wal_thread.joinable()) wal_thread.join();
+    std::lock_guard<std::mutex> lk(io_mutex);
+    sync_locked();
+    if (wal_fd >= 0) close(wal_fd);
+    wal_fd = -1;
+}
+
+bool wal_rotate() {
+    std::lock_guard<std::mutex> lk(io_mutex);
+    if (wal_fd < 0) return false;
+    std::string prev = WAL_FILE + ".prev";
+    // an unfinished snapshot left its log behind: keep both until the next snapshot succeeds
+    if (access(prev.c_str(), F_OK) == 0) return false;
+    if (!sync_locked()) return false;
+    if (rename(WAL_FILE.c_str(), prev.c_str()) != 0) return false;
+    close(wal_fd);
+    wal_fd = open(WAL_FILE.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (wal_fd < 0) {
+        perror("open wal");
+        return false;
+    }
+    return true;
+}
+
+void wal_drop_rotated() {
+    std::string prev = WAL_FILE + ".prev";
+    unlink(prev.c_str());
+}
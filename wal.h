@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2026 github.com/jakubpolomsky
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: github.com/jakubpolomsky
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef WAL_H
+#define WAL_H
+
+#include "sensor_registry.h"
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+
+// Append-only write-ahead log of sensor readings. Every accepted reading is appended as a
+// small binary record; a background thread writes and fsyncs the pending records every
+// WAL_SYNC_INTERVAL_MS (group commit). A snapshot of all readings (sensor_data.json)
+// makes the log redundant, so the snapshot code rotates it away and deletes it.
+//
+// Record layout (host byte order):
+//   uint32 crc32 of the rest of the record | uint16 id length | uint16 reserved (0)
+//   int64 timestamp | float temp | float hum | float batt | id bytes
+
+// Path of the live log; the log being replaced by a snapshot is WAL_FILE + ".prev".
+extern std::string WAL_FILE;
+// Group commit interval; 0 writes and fsyncs every record before wal_append() returns.
+extern std::atomic<int> WAL_SYNC_INTERVAL_MS;
+
+// Open WAL_FILE for appending (dropping a torn tail left by a crash) and start the
+// group commit thread. Until it is called, wal_append() does nothing.
+bool start_wal();
+// Write and fsync pending records, then stop the group commit thread.
+void stop_wal();
+
+// Queue one reading for the log.
+void wal_append(std::string_view id, const SensorReading &reading);
+// Write and fsync all queued records now.
+bool wal_sync();
+
+// Snapshot support: make the log durable and move it aside to WAL_FILE.prev so new
+// records go to an empty log. Returns false (and keeps appending to the current log)
+// if an older .prev from an unfinished snapshot is still present.
+bool wal_rotate();
+// Delete WAL_FILE.prev once a snapshot containing its records is durable.
+void wal_drop_rotated();
+
+// Call fn for every intact record in the log at `path`, oldest first. Stops at the first
+// truncated or corrupt record. Returns the number of records; `valid_bytes` receives the
+// length of the intact prefix.
+size_t wal_replay(const std::string &path, const std::function<void(std::string_view, const SensorReading &)> &fn,
+                  size_t *valid_bytes = nullptr);
+
+#endif // WAL_H